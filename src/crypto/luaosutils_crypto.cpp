@@ -5,77 +5,337 @@
 //  Created by Robert Patterson on 10/31/23.
 //
 #include "luaosutils.hpp"
+#include "crypto/luaosutils_crypto_hash.h"
+#include "crypto/luaosutils_crypto_hash_batch.h"
+#include "crypto/luaosutils_crypto_key_cache.h"
 #include "crypto/luaosutils_crypto_os.h"
 #include "crypto/luaosutils_crypto_utils.h"
+#include "internet/luaosutils_callback_session.hpp"
+#include "internet/luaosutils_internet_utils.h"
 
-static int luaosutils_conv_bin_to_chars(lua_State* L)
+constexpr const char* const kHashMetatableKey = "luaosutils.hash";
+
+/** \brief The userdata that `crypto.new_hash` returns. Once it is finalized, the hasher is released and the digest kept. */
+struct hash_context
+{
+   std::unique_ptr<luaosutils::hasher> hasher;
+   std::string digest;
+};
+
+/** \brief Lets functions bound with lua_bind take hash contexts, checking that they are hash userdata. */
+template<>
+struct lua_metatable_key<hash_context*>
+{
+   static constexpr const char* value = kHashMetatableKey;
+};
+
+static std::string luaosutils_conv_bin_to_chars(luaosutils::bufferView bin)
+{
+   return luaosutils::buffer2HexString(bin);
+}
+
+static luaosutils::decode_mode get_decode_mode(std::optional<bool> strict)
+{
+   return strict.value_or(false) ? luaosutils::decode_mode::strict : luaosutils::decode_mode::lenient;
+}
+
+static std::optional<luaosutils::encryptBuffer> luaosutils_conv_chars_to_bin(std::string_view chars, std::optional<bool> strict)
+{
+   luaosutils::encryptBuffer result;
+   if (! luaosutils::hexString2Buffer(chars, result, get_decode_mode(strict)))
+      return std::nullopt;
+   return result;
+}
+
+static std::string luaosutils_conv_bin_to_base64(luaosutils::bufferView bin)
+{
+   return luaosutils::buffer2Base64String(bin);
+}
+
+static std::optional<luaosutils::encryptBuffer> luaosutils_conv_base64_to_bin(std::string_view text, std::optional<bool> strict)
 {
-   auto bin = get_lua_parameter<luaosutils::encryptBuffer>(L, 1, LUA_TSTRING);
-   push_lua_return_value(L, luaosutils::buffer2HexString(bin));
+   luaosutils::encryptBuffer result;
+   if (! luaosutils::base64String2Buffer(text, result, get_decode_mode(strict)))
+      return std::nullopt;
+   return result;
+}
+
+static luaosutils::encryptBuffer luaosutils_crypto_calc_randomized_data(std::optional<int> size)
+{
+   return luaosutils::calc_randomized_data(size.value_or(-1));
+}
+
+/** \brief Returns the hash algorithm named at a stack position, raising a Lua error if the name is unknown.
+ *
+ * \param L the Lua state
+ * \param index the stack position of the name
+ * \param defaultName the algorithm to use when the name is nil
+ */
+static luaosutils::hash_algorithm get_hash_algorithm(lua_State *L, int index, const char* defaultName)
+{
+   const std::string name = get_lua_parameter<std::string>(L, index, LUA_TSTRING, std::string(defaultName));
+   const auto algorithm = luaosutils::hash_algorithm_from_name(name);
+   if (! algorithm)
+   {
+      luaosutils::note_stats_error();
+      luaL_error(L, "param %d unknown hash algorithm %s", index, name.c_str());
+   }
+   return *algorithm;
+}
+
+/** \brief calculates the hash of a file
+ *
+ * Stack position 1: the utf-8 path of the file
+ * Stack position 2: (optional) "sha256", "sha512" or "blake3" (default "sha512")
+ * \return the hash as lowercase hex characters, or an empty string if the file could not be read
+ */
+static int luaosutils_crypto_calc_file_hash(lua_State *L)
+{
+   const std::string filePath = get_lua_parameter<std::string>(L, 1, LUA_TSTRING);
+   const luaosutils::hash_algorithm algorithm = get_hash_algorithm(L, 2, "sha512");
+   luaosutils::encryptBuffer digest;
+   if (! luaosutils::hash_file(filePath, algorithm, digest))
+      digest.clear();
+   push_lua_return_value(L, luaosutils::buffer2HexString(digest));
    return 1;
 }
 
-static int luaosutils_conv_chars_to_bin(lua_State* L)
+/** \brief Pushes a table of file paths to hex digests, leaving out the files that could not be read. */
+static void push_file_hashes(lua_State *L, const std::vector<std::string>& paths, const std::vector<luaosutils::file_hash_result>& results)
 {
-   auto chars = get_lua_parameter<std::string>(L, 1, LUA_TSTRING);
-   push_lua_return_value(L, luaosutils::hexString2Buffer(chars));
+   lua_createtable(L, 0, static_cast<int>(paths.size()));
+   for (size_t x = 0; x < paths.size(); x++)
+   {
+      if (! results[x].success)
+         continue;
+      push_lua_args(L, paths[x], luaosutils::buffer2HexString(results[x].digest));
+      lua_settable(L, -3);
+   }
+}
+
+/** \brief calculates the hashes of a list of files on a pool of worker threads
+ *
+ * Stack position 1: a table of utf-8 file paths
+ * Stack position 2: (optional) "sha256", "sha512" or "blake3" (default "sha512")
+ * Stack position 3: (optional) a function to call with the table of hashes when they are complete
+ * \return the table of paths to hashes, or the session if there is a callback
+ */
+static int luaosutils_crypto_calc_file_hashes(lua_State *L)
+{
+   check_lua_parameter_type(L, 1, LUA_TTABLE);
+   std::vector<std::string> paths;
+   const lua_Integer numPaths = luaL_len(L, 1);
+   paths.reserve(static_cast<size_t>((std::max)(lua_Integer(0), numPaths)));
+   for (lua_Integer x = 1; x <= numPaths; x++)
+   {
+      if (lua_rawgeti(L, 1, x) != LUA_TSTRING)
+      {
+         luaosutils::note_stats_error();
+         luaL_error(L, "path %d is not a string", static_cast<int>(x));
+      }
+      paths.push_back(LuaStack<std::string>(L).get(-1));
+      lua_pop(L, 1);
+   }
+   const luaosutils::hash_algorithm algorithm = get_hash_algorithm(L, 2, "sha512");
+   if (! lua_isnoneornil(L, 3) && ! luaosutils::prepare_completion_drain())
+   {
+      luaosutils::note_stats_error();
+      luaL_error(L, "unable to start the async completion handler");
+   }
+   auto batch = std::make_unique<luaosutils::file_hash_batch>(std::move(paths), algorithm);
+
+   if (lua_isnoneornil(L, 3))
+   {
+      const std::vector<luaosutils::file_hash_result> results = batch->run();
+      push_file_hashes(L, batch->paths(), results);
+      return 1;
+   }
+
+   const int callback = get_lua_parameter<int>(L, 3, LUA_TFUNCTION);
+   const luaosutils::callback_session::id_type sessionID = luaosutils::callback_session::get_new_session_id();
+   luaosutils::callback_session* session = luaosutils::push_callback_session(L, callback, sessionID);
+   batch->start([sessionID](const std::vector<std::string>& paths, const std::vector<luaosutils::file_hash_result>& results) -> void
+         {
+            luaosutils::complete_callback_session(sessionID, [&paths, &results](lua_State* L) -> void
+                  {
+                     push_file_hashes(L, paths, results);
+                  });
+         });
+   session->set_hash_batch(batch);
    return 1;
 }
 
-static int luaosutils_crypto_calc_randomized_data(lua_State* L)
+static void push_hash_context(lua_State *L, std::unique_ptr<luaosutils::hasher> hasher);
+
+/** \brief Returns the hash context at stack position 1, raising a Lua error if it has been finalized. */
+static hash_context* get_unfinalized_hash(lua_State *L)
+{
+   auto context = get_lua_parameter<hash_context*>(L, 1, LUA_TUSERDATA, std::nullopt, kHashMetatableKey);
+   if (! context->hasher)
+   {
+      luaosutils::note_stats_error();
+      luaL_error(L, "the hash has already been finalized");
+   }
+   return context;
+}
+
+/** \brief adds data to a hash
+ *
+ * Stack position 1: the hash
+ * Stack position 2: the data (string or buffer)
+ * \return the hash, so that calls can be chained
+ */
+static int hash_update(lua_State *L)
 {
-   auto size = get_lua_parameter<int>(L, 1, LUA_TNUMBER, -1);
-   luaosutils::encryptBuffer result = luaosutils::calc_randomized_data(size);
-   push_lua_return_value(L, result);
+   hash_context* context = get_unfinalized_hash(L);
+   context->hasher->update(get_lua_parameter<luaosutils::bufferView>(L, 2, LUA_TSTRING));
+   lua_settop(L, 1);
    return 1;
 }
 
-static int luaosutils_crypto_calc_file_hash(lua_State* L)
+/** \brief returns a new hash in the same state, which continues independently of the original
+ *
+ * Stack position 1: the hash
+ */
+static int hash_copy(lua_State *L)
 {
-   auto pathString = get_lua_parameter<std::string>(L, 1, LUA_TSTRING);
-   std::string retval = luaosutils::calc_file_hash(pathString);
-   LuaStack<std::string>(L).push(retval);
+   hash_context* context = get_unfinalized_hash(L);
+   std::unique_ptr<luaosutils::hasher> copy = context->hasher->clone();
+   if (! copy)
+   {
+      luaosutils::note_stats_error();
+      luaL_error(L, "the hash could not be copied");
+   }
+   push_hash_context(L, std::move(copy));
    return 1;
 }
 
-static int luaosutils_crypto_calc_crypto_key(lua_State* L)
+/** \brief returns the hash of all the data added to it as lowercase hex characters
+ *
+ * The hash can take no more data afterward, but finalizing it again returns the same value.
+ */
+static std::string hash_finalize(hash_context* context)
 {
-   auto seed = get_lua_parameter<luaosutils::encryptBuffer>(L, 1, LUA_TSTRING);
-   auto salt = get_lua_parameter<luaosutils::encryptBuffer>(L, 2, LUA_TSTRING);
-   luaosutils::encryptBuffer result = luaosutils::calc_crypto_key(seed, salt);
-   push_lua_return_value(L, result);
+   if (context->hasher)
+   {
+      context->digest = luaosutils::buffer2HexString(context->hasher->finish());
+      context->hasher.reset();
+   }
+   return context->digest;
+}
+
+static int hash_gc(lua_State *L)
+{
+   auto context = static_cast<hash_context*>(lua_touserdata(L, 1));
+   context->~hash_context();
+   return 0;
+}
+
+static const luaL_Reg hash_methods[] = {
+   {"update",              hash_update},
+   {"copy",                hash_copy},
+   {"finalize",            lua_bind<hash_finalize>},
+   {NULL, NULL} // sentinel
+};
+
+static void push_hash_context(lua_State *L, std::unique_ptr<luaosutils::hasher> hasher)
+{
+   new (lua_newuserdata(L, sizeof(hash_context))) hash_context{std::move(hasher), std::string()};
+   if (luaL_newmetatable(L, kHashMetatableKey))
+   {
+      lua_pushcfunction(L, hash_gc);
+      lua_setfield(L, -2, "__gc");
+      lua_newtable(L);
+      luaosutils::set_counted_funcs(L, hash_methods, "hash");
+      lua_setfield(L, -2, "__index");
+   }
+   lua_setmetatable(L, -2);
+}
+
+/** \brief creates a hash that takes its data in pieces
+ *
+ * Stack position 1: (optional) "sha256", "sha512" or "blake3" (default "sha512")
+ * \return the new hash
+ */
+static int luaosutils_crypto_new_hash(lua_State *L)
+{
+   push_hash_context(L, luaosutils::create_hasher(get_hash_algorithm(L, 1, "sha512")));
+   return 1;
+}
+
+/** \brief derives a key from a seed and salt, from the key cache if it holds the key
+ *
+ * Stack position 1: the seed (binary string)
+ * Stack position 2: the salt (binary string)
+ * Stack position 3: (optional) a function to call with the key when it has been derived on a worker thread
+ * \return the key, or the session if there is a callback
+ */
+static int luaosutils_crypto_calc_crypto_key(lua_State *L)
+{
+   const auto seedValue = get_lua_parameter<luaosutils::bufferView>(L, 1, LUA_TSTRING);
+   const auto salt = get_lua_parameter<luaosutils::bufferView>(L, 2, LUA_TSTRING);
+
+   if (lua_isnoneornil(L, 3))
+   {
+      luaosutils::encryptBuffer key = luaosutils::derive_crypto_key(seedValue, salt);
+      push_lua_return_value(L, key);
+      luaosutils::secure_zero(key.data(), key.size());
+      return 1;
+   }
+
+   const int callback = get_lua_parameter<int>(L, 3, LUA_TFUNCTION);
+   if (! luaosutils::prepare_completion_drain())
+   {
+      luaosutils::note_stats_error();
+      luaL_error(L, "unable to start the async completion handler");
+   }
+   auto task = std::make_unique<luaosutils::crypto_key_task>(seedValue, salt);
+   const luaosutils::callback_session::id_type sessionID = luaosutils::callback_session::get_new_session_id();
+   luaosutils::callback_session* session = luaosutils::push_callback_session(L, callback, sessionID);
+   task->start([sessionID](const luaosutils::encryptBuffer& key) -> void
+         {
+            luaosutils::complete_callback_session(sessionID, [&key](lua_State* L) -> void
+                  {
+                     push_lua_return_value(L, key);
+                  });
+         });
+   session->set_key_task(task);
    return 1;
 }
 
-static int luaosutils_crypto_encrypt(lua_State* L)
+static void luaosutils_crypto_set_key_cache_size(int maxKeys)
+{
+   luaosutils::set_crypto_key_cache_size(static_cast<size_t>((std::max)(0, maxKeys)));
+}
+
+// The ciphertext is a buffer if the plaintext is.
+static std::tuple<luaosutils::bytes_result, luaosutils::encryptBuffer> luaosutils_crypto_encrypt(luaosutils::bufferView key, luaosutils::bytes_argument plaintext)
 {
-   auto key = get_lua_parameter<luaosutils::encryptBuffer>(L, 1, LUA_TSTRING);
-   auto plaintext = get_lua_parameter<std::string>(L, 2, LUA_TSTRING);
    luaosutils::encryptBuffer iv;
-   luaosutils::encryptBuffer result = luaosutils::encrypt(key, plaintext, iv);
-   push_lua_return_value(L, result);
-   push_lua_return_value(L, iv);
-   return 2;
+   const std::string_view plaintextString(reinterpret_cast<const char*>(plaintext.bytes.data()), plaintext.bytes.size());
+   luaosutils::encryptBuffer result = luaosutils::encrypt(key, plaintextString, iv);
+   return {luaosutils::make_bytes_result(std::move(result), plaintext.isBuffer), std::move(iv)};
 }
 
-static int luaosutils_crypto_decrypt(lua_State* L)
+// The plaintext is a buffer if the ciphertext is.
+static luaosutils::bytes_result luaosutils_crypto_decrypt(luaosutils::bufferView key, luaosutils::bytes_argument cyphertext, luaosutils::bufferView iv)
 {
-   auto key = get_lua_parameter<luaosutils::encryptBuffer>(L, 1, LUA_TSTRING);
-   auto cyphertext = get_lua_parameter<luaosutils::encryptBuffer>(L, 2, LUA_TSTRING);
-   auto iv = get_lua_parameter<luaosutils::encryptBuffer>(L, 3, LUA_TSTRING);
-   std::string result = luaosutils::decrypt(key, cyphertext, iv);
-   push_lua_return_value(L, result);
-   return 1;
+   return luaosutils::make_bytes_result(luaosutils::decrypt(key, cyphertext.bytes, iv), cyphertext.isBuffer);
 }
 
 static const luaL_Reg crypyo_utils[] = {
-   {"conv_bin_to_chars",         luaosutils_conv_bin_to_chars},
-   {"conv_chars_to_bin",         luaosutils_conv_chars_to_bin},
-   {"calc_randomized_data",      luaosutils_crypto_calc_randomized_data},
+   {"conv_bin_to_chars",         lua_bind<luaosutils_conv_bin_to_chars>},
+   {"conv_chars_to_bin",         lua_bind<luaosutils_conv_chars_to_bin>},
+   {"conv_bin_to_base64",        lua_bind<luaosutils_conv_bin_to_base64>},
+   {"conv_base64_to_bin",        lua_bind<luaosutils_conv_base64_to_bin>},
+   {"calc_randomized_data",      lua_bind<luaosutils_crypto_calc_randomized_data>},
    {"calc_file_hash",            luaosutils_crypto_calc_file_hash},
+   {"calc_file_hashes",          luaosutils_crypto_calc_file_hashes},
+   {"new_hash",                  luaosutils_crypto_new_hash},
    {"calc_crypto_key",           luaosutils_crypto_calc_crypto_key},
-   {"encrypt",                   luaosutils_crypto_encrypt},
-   {"decrypt",                   luaosutils_crypto_decrypt},
+   {"set_key_cache_size",        lua_bind<luaosutils_crypto_set_key_cache_size>},
+   {"encrypt",                   lua_bind<luaosutils_crypto_encrypt>},
+   {"decrypt",                   lua_bind<luaosutils_crypto_decrypt>},
    {NULL, NULL} // sentinel
 };
 
@@ -84,7 +344,7 @@ void luaosutils_crypto_create(lua_State *L)
 {
    lua_newtable(L);  // create nested table
    
-   luaL_setfuncs(L, crypyo_utils, 0);   // add file methods to new metatable
+   luaosutils::set_counted_funcs(L, crypyo_utils, "crypto"); // add file methods to new metatable
    lua_setfield(L, -2, "crypto");       // add the nested table to the parent table with the name
 }
 
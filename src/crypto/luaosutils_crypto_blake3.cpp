@@ -0,0 +1,369 @@
+//
+//  luaosutils_crypto_blake3.cpp
+//  luaosutils
+//
+//  (Usage permitted by MIT License. See LICENSE file in this repository.)
+//
+//  Portable BLAKE3 (https://github.com/BLAKE3-team/BLAKE3-specs), unkeyed with a 32-byte digest. On x86
+//  processors, whole chunks are compressed four at a time with SSE2, which every x86-64 processor has.
+//  Define LUAOSUTILS_NO_SIMD to build the portable code alone.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#include "crypto/luaosutils_crypto_hash.h"
+
+#if ! defined(LUAOSUTILS_NO_SIMD) && (defined(__x86_64__) || defined(_M_X64))
+#define LUAOSUTILS_BLAKE3_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace luaosutils
+{
+
+constexpr size_t kBlake3BlockLength = 64;
+constexpr size_t kBlake3ChunkLength = 1024;
+constexpr size_t kBlake3MaxDepth = 54; // enough for 2^64 bytes
+
+constexpr uint32_t kChunkStart = 1 << 0;
+constexpr uint32_t kChunkEnd = 1 << 1;
+constexpr uint32_t kParent = 1 << 2;
+constexpr uint32_t kRoot = 1 << 3;
+
+static const uint32_t kBlake3IV[8] = {
+   0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+};
+
+// The message word order for each of the seven rounds (the permutation applied 0 to 6 times).
+static const uint8_t kBlake3Schedule[7][16] = {
+   {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+   {2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8},
+   {3, 4, 10, 12, 13, 2, 7, 14, 6, 5, 9, 0, 11, 15, 8, 1},
+   {10, 7, 12, 9, 14, 3, 13, 15, 4, 0, 11, 2, 5, 8, 1, 6},
+   {12, 13, 9, 11, 15, 10, 14, 8, 7, 2, 5, 3, 0, 1, 6, 4},
+   {9, 14, 11, 5, 8, 12, 15, 1, 13, 3, 0, 10, 2, 6, 4, 7},
+   {11, 15, 5, 0, 1, 9, 8, 6, 14, 10, 2, 12, 3, 4, 7, 13}
+};
+
+static inline uint32_t load_le32(const uint8_t* p)
+{
+   return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+}
+
+static inline void store_le32(uint8_t* p, uint32_t x)
+{
+   p[0] = uint8_t(x); p[1] = uint8_t(x >> 8); p[2] = uint8_t(x >> 16); p[3] = uint8_t(x >> 24);
+}
+
+static inline uint32_t rotr32(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+static inline void blake3_g(uint32_t* v, int a, int b, int c, int d, uint32_t mx, uint32_t my)
+{
+   v[a] = v[a] + v[b] + mx; v[d] = rotr32(v[d] ^ v[a], 16);
+   v[c] = v[c] + v[d];      v[b] = rotr32(v[b] ^ v[c], 12);
+   v[a] = v[a] + v[b] + my; v[d] = rotr32(v[d] ^ v[a], 8);
+   v[c] = v[c] + v[d];      v[b] = rotr32(v[b] ^ v[c], 7);
+}
+
+/** \brief The BLAKE3 compression function. \p out receives all 16 words, of which the first 8 are the new chaining value. */
+static void blake3_compress(const uint32_t cv[8], const uint8_t block[kBlake3BlockLength], uint64_t counter,
+                            uint32_t blockLength, uint32_t flags, uint32_t out[16])
+{
+   uint32_t m[16];
+   for (int x = 0; x < 16; x++)
+      m[x] = load_le32(block + 4 * x);
+   uint32_t v[16] = {
+      cv[0], cv[1], cv[2], cv[3], cv[4], cv[5], cv[6], cv[7],
+      kBlake3IV[0], kBlake3IV[1], kBlake3IV[2], kBlake3IV[3],
+      uint32_t(counter), uint32_t(counter >> 32), blockLength, flags
+   };
+   for (const auto& s : kBlake3Schedule)
+   {
+      blake3_g(v, 0, 4, 8, 12, m[s[0]], m[s[1]]);
+      blake3_g(v, 1, 5, 9, 13, m[s[2]], m[s[3]]);
+      blake3_g(v, 2, 6, 10, 14, m[s[4]], m[s[5]]);
+      blake3_g(v, 3, 7, 11, 15, m[s[6]], m[s[7]]);
+      blake3_g(v, 0, 5, 10, 15, m[s[8]], m[s[9]]);
+      blake3_g(v, 1, 6, 11, 12, m[s[10]], m[s[11]]);
+      blake3_g(v, 2, 7, 8, 13, m[s[12]], m[s[13]]);
+      blake3_g(v, 3, 4, 9, 14, m[s[14]], m[s[15]]);
+   }
+   for (int x = 0; x < 8; x++)
+   {
+      out[x] = v[x] ^ v[x + 8];
+      out[x + 8] = v[x + 8] ^ cv[x];
+   }
+}
+
+#ifdef LUAOSUTILS_BLAKE3_SSE2
+
+static inline __m128i rotr128(__m128i x, int n)
+{
+   return _mm_or_si128(_mm_srli_epi32(x, n), _mm_slli_epi32(x, 32 - n));
+}
+
+static inline __m128i rotr128_16(__m128i x)
+{
+   return _mm_shufflehi_epi16(_mm_shufflelo_epi16(x, 0xB1), 0xB1);
+}
+
+static inline void blake3_g4(__m128i* v, int a, int b, int c, int d, __m128i mx, __m128i my)
+{
+   v[a] = _mm_add_epi32(_mm_add_epi32(v[a], v[b]), mx); v[d] = rotr128_16(_mm_xor_si128(v[d], v[a]));
+   v[c] = _mm_add_epi32(v[c], v[d]);                    v[b] = rotr128(_mm_xor_si128(v[b], v[c]), 12);
+   v[a] = _mm_add_epi32(_mm_add_epi32(v[a], v[b]), my); v[d] = rotr128(_mm_xor_si128(v[d], v[a]), 8);
+   v[c] = _mm_add_epi32(v[c], v[d]);                    v[b] = rotr128(_mm_xor_si128(v[b], v[c]), 7);
+}
+
+static inline void transpose4(__m128i& a, __m128i& b, __m128i& c, __m128i& d)
+{
+   const __m128i ab01 = _mm_unpacklo_epi32(a, b);
+   const __m128i ab23 = _mm_unpackhi_epi32(a, b);
+   const __m128i cd01 = _mm_unpacklo_epi32(c, d);
+   const __m128i cd23 = _mm_unpackhi_epi32(c, d);
+   a = _mm_unpacklo_epi64(ab01, cd01);
+   b = _mm_unpackhi_epi64(ab01, cd01);
+   c = _mm_unpacklo_epi64(ab23, cd23);
+   d = _mm_unpackhi_epi64(ab23, cd23);
+}
+
+/** \brief Hashes four whole chunks at once, one per SSE2 lane, and writes their chaining values to \p cvs.
+ *
+ * The chunks are consecutive in \p input and the first has chunk number \p counter. None of them may be the
+ * root, which is why the hasher only takes this path when more input follows them.
+ */
+static void blake3_hash4_chunks(const uint8_t* input, const uint32_t key[8], uint64_t counter, uint32_t flags, uint32_t cvs[4][8])
+{
+   __m128i h[8];
+   for (int x = 0; x < 8; x++)
+      h[x] = _mm_set1_epi32(static_cast<int>(key[x]));
+   const __m128i counterLow = _mm_set_epi32(int(uint32_t(counter + 3)), int(uint32_t(counter + 2)),
+                                            int(uint32_t(counter + 1)), int(uint32_t(counter)));
+   const __m128i counterHigh = _mm_set_epi32(int(uint32_t((counter + 3) >> 32)), int(uint32_t((counter + 2) >> 32)),
+                                             int(uint32_t((counter + 1) >> 32)), int(uint32_t(counter >> 32)));
+   const __m128i blockLength = _mm_set1_epi32(int(kBlake3BlockLength));
+   for (size_t block = 0; block < kBlake3ChunkLength / kBlake3BlockLength; block++)
+   {
+      // Load word w of each chunk's block into lane n of m[w].
+      __m128i m[16];
+      for (int x = 0; x < 4; x++)
+      {
+         const size_t offset = block * kBlake3BlockLength + 16 * x;
+         m[4 * x + 0] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + offset));
+         m[4 * x + 1] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + kBlake3ChunkLength + offset));
+         m[4 * x + 2] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + 2 * kBlake3ChunkLength + offset));
+         m[4 * x + 3] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + 3 * kBlake3ChunkLength + offset));
+         transpose4(m[4 * x + 0], m[4 * x + 1], m[4 * x + 2], m[4 * x + 3]);
+      }
+      uint32_t blockFlags = flags;
+      if (block == 0)
+         blockFlags |= kChunkStart;
+      if (block == kBlake3ChunkLength / kBlake3BlockLength - 1)
+         blockFlags |= kChunkEnd;
+      __m128i v[16] = {
+         h[0], h[1], h[2], h[3], h[4], h[5], h[6], h[7],
+         _mm_set1_epi32(int(kBlake3IV[0])), _mm_set1_epi32(int(kBlake3IV[1])),
+         _mm_set1_epi32(int(kBlake3IV[2])), _mm_set1_epi32(int(kBlake3IV[3])),
+         counterLow, counterHigh, blockLength, _mm_set1_epi32(int(blockFlags))
+      };
+      for (const auto& s : kBlake3Schedule)
+      {
+         blake3_g4(v, 0, 4, 8, 12, m[s[0]], m[s[1]]);
+         blake3_g4(v, 1, 5, 9, 13, m[s[2]], m[s[3]]);
+         blake3_g4(v, 2, 6, 10, 14, m[s[4]], m[s[5]]);
+         blake3_g4(v, 3, 7, 11, 15, m[s[6]], m[s[7]]);
+         blake3_g4(v, 0, 5, 10, 15, m[s[8]], m[s[9]]);
+         blake3_g4(v, 1, 6, 11, 12, m[s[10]], m[s[11]]);
+         blake3_g4(v, 2, 7, 8, 13, m[s[12]], m[s[13]]);
+         blake3_g4(v, 3, 4, 9, 14, m[s[14]], m[s[15]]);
+      }
+      for (int x = 0; x < 8; x++)
+         h[x] = _mm_xor_si128(v[x], v[x + 8]);
+   }
+   transpose4(h[0], h[1], h[2], h[3]);
+   transpose4(h[4], h[5], h[6], h[7]);
+   for (int x = 0; x < 4; x++)
+   {
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(&cvs[x][0]), h[x]);
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(&cvs[x][4]), h[x + 4]);
+   }
+}
+
+#endif // LUAOSUTILS_BLAKE3_SSE2
+
+/** \brief The input to a compression that has not been run yet, because it may turn out to be the root. */
+struct blake3_output
+{
+   uint32_t cv[8];
+   uint8_t block[kBlake3BlockLength];
+   uint64_t counter;
+   uint32_t blockLength;
+   uint32_t flags;
+
+   void chaining_value(uint32_t result[8]) const
+   {
+      uint32_t out[16];
+      blake3_compress(cv, block, counter, blockLength, flags, out);
+      memcpy(result, out, 8 * sizeof(uint32_t));
+   }
+};
+
+class blake3_hasher : public hasher
+{
+   uint32_t m_key[8];
+   uint32_t m_flags{};
+
+   // the chunk being filled
+   uint32_t m_chunkCv[8];
+   uint64_t m_chunkCounter{};
+   uint8_t m_block[kBlake3BlockLength];
+   size_t m_blockLength{};
+   size_t m_blocksCompressed{};
+
+   // chaining values of completed subtrees, one per set bit of the number of completed chunks
+   uint32_t m_cvStack[kBlake3MaxDepth][8];
+   size_t m_cvStackLength{};
+
+   size_t chunk_length() const { return kBlake3BlockLength * m_blocksCompressed + m_blockLength; }
+
+   void start_chunk(uint64_t counter)
+   {
+      memcpy(m_chunkCv, m_key, sizeof(m_chunkCv));
+      m_chunkCounter = counter;
+      m_blockLength = 0;
+      m_blocksCompressed = 0;
+   }
+
+   uint32_t start_flag() const { return m_blocksCompressed == 0 ? kChunkStart : 0; }
+
+   blake3_output chunk_output() const
+   {
+      blake3_output output;
+      memcpy(output.cv, m_chunkCv, sizeof(output.cv));
+      memcpy(output.block, m_block, m_blockLength);
+      memset(output.block + m_blockLength, 0, kBlake3BlockLength - m_blockLength);
+      output.counter = m_chunkCounter;
+      output.blockLength = static_cast<uint32_t>(m_blockLength);
+      output.flags = m_flags | start_flag() | kChunkEnd;
+      return output;
+   }
+
+   blake3_output parent_output(const uint32_t left[8], const uint32_t right[8]) const
+   {
+      blake3_output output;
+      memcpy(output.cv, m_key, sizeof(output.cv));
+      for (int x = 0; x < 8; x++)
+      {
+         store_le32(output.block + 4 * x, left[x]);
+         store_le32(output.block + 32 + 4 * x, right[x]);
+      }
+      output.counter = 0;
+      output.blockLength = kBlake3BlockLength;
+      output.flags = m_flags | kParent;
+      return output;
+   }
+
+   // Merges completed subtrees while the chunk count is even, so that the stack holds one chaining value per set bit.
+   void add_chunk_cv(const uint32_t chunkCv[8], uint64_t totalChunks)
+   {
+      uint32_t cv[8];
+      memcpy(cv, chunkCv, sizeof(cv));
+      while ((totalChunks & 1) == 0)
+      {
+         m_cvStackLength--;
+         parent_output(m_cvStack[m_cvStackLength], cv).chaining_value(cv);
+         totalChunks >>= 1;
+      }
+      memcpy(m_cvStack[m_cvStackLength++], cv, sizeof(cv));
+   }
+
+   void update_chunk(const uint8_t* input, size_t size)
+   {
+      while (size)
+      {
+         if (m_blockLength == kBlake3BlockLength)
+         {
+            uint32_t out[16];
+            blake3_compress(m_chunkCv, m_block, m_chunkCounter, kBlake3BlockLength, m_flags | start_flag(), out);
+            memcpy(m_chunkCv, out, sizeof(m_chunkCv));
+            m_blocksCompressed++;
+            m_blockLength = 0;
+         }
+         const size_t take = (std::min)(size, kBlake3BlockLength - m_blockLength);
+         memcpy(m_block + m_blockLength, input, take);
+         m_blockLength += take;
+         input += take;
+         size -= take;
+      }
+   }
+
+public:
+   blake3_hasher()
+   {
+      memcpy(m_key, kBlake3IV, sizeof(m_key));
+      start_chunk(0);
+   }
+
+   void update(bufferView data) override
+   {
+      const uint8_t* input = data.data();
+      size_t size = data.size();
+      while (size)
+      {
+         // A full chunk is only finished once more input arrives, since the last chunk is compressed as the root.
+         if (chunk_length() == kBlake3ChunkLength)
+         {
+            uint32_t cv[8];
+            chunk_output().chaining_value(cv);
+            add_chunk_cv(cv, m_chunkCounter + 1);
+            start_chunk(m_chunkCounter + 1);
+         }
+#ifdef LUAOSUTILS_BLAKE3_SSE2
+         while (chunk_length() == 0 && size > 4 * kBlake3ChunkLength)
+         {
+            uint32_t cvs[4][8];
+            blake3_hash4_chunks(input, m_key, m_chunkCounter, m_flags, cvs);
+            for (int x = 0; x < 4; x++)
+               add_chunk_cv(cvs[x], m_chunkCounter + x + 1);
+            start_chunk(m_chunkCounter + 4);
+            input += 4 * kBlake3ChunkLength;
+            size -= 4 * kBlake3ChunkLength;
+         }
+#endif
+         const size_t take = (std::min)(size, kBlake3ChunkLength - chunk_length());
+         update_chunk(input, take);
+         input += take;
+         size -= take;
+      }
+   }
+
+   std::unique_ptr<hasher> clone() const override
+   {
+      return std::make_unique<blake3_hasher>(*this);
+   }
+
+   encryptBuffer finish() override
+   {
+      blake3_output output = chunk_output();
+      for (size_t x = m_cvStackLength; x > 0; x--)
+      {
+         uint32_t cv[8];
+         output.chaining_value(cv);
+         output = parent_output(m_cvStack[x - 1], cv);
+      }
+      uint32_t out[16];
+      blake3_compress(output.cv, output.block, 0, output.blockLength, output.flags | kRoot, out);
+      encryptBuffer digest(32);
+      for (int x = 0; x < 8; x++)
+         store_le32(digest.data() + 4 * x, out[x]);
+      return digest;
+   }
+};
+
+std::unique_ptr<hasher> create_blake3_hasher()
+{
+   return std::make_unique<blake3_hasher>();
+}
+
+}
@@ -0,0 +1,441 @@
+//
+//  luaosutils_crypto_codecs.cpp
+//  luaosutils
+//
+//  (Usage permitted by MIT License. See LICENSE file in this repository.)
+//
+//  Hex and base64 encoding and decoding. The scalar code is table driven. On x86 processors, long runs are
+//  converted 16 bytes at a time with SSE2, which every x86-64 processor has, and the scalar code finishes
+//  the tail. A block that the SSE2 code cannot decode, such as one with whitespace in it, falls back to the
+//  scalar code, so the two always give the same result. Define LUAOSUTILS_NO_SIMD to build the scalar code alone.
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+
+#include "crypto/luaosutils_crypto_utils.h"
+
+#if ! defined(LUAOSUTILS_NO_SIMD) && (defined(__x86_64__) || defined(_M_X64))
+#define LUAOSUTILS_CODECS_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace luaosutils
+{
+
+static const char kHexDigits[] = "0123456789abcdef";
+static const char kBase64Digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// Entries of kBase64Values that are not values 0-63.
+constexpr uint8_t kBase64UrlSafe = 0x80;   // '-' and '_', or'ed with the value they stand for
+constexpr uint8_t kBase64Space = 0xfd;
+constexpr uint8_t kBase64Pad = 0xfe;
+constexpr uint8_t kBase64Invalid = 0xff;
+
+static constexpr std::array<char, 512> make_hex_pairs()
+{
+   std::array<char, 512> result{};
+   for (int x = 0; x < 256; x++)
+   {
+      result[2 * x] = kHexDigits[x >> 4];
+      result[2 * x + 1] = kHexDigits[x & 0x0f];
+   }
+   return result;
+}
+
+static constexpr std::array<int8_t, 256> make_hex_values()
+{
+   std::array<int8_t, 256> result{};
+   for (int x = 0; x < 256; x++)
+   {
+      if (x >= '0' && x <= '9') result[x] = static_cast<int8_t>(x - '0');
+      else if (x >= 'a' && x <= 'f') result[x] = static_cast<int8_t>(x - 'a' + 10);
+      else if (x >= 'A' && x <= 'F') result[x] = static_cast<int8_t>(x - 'A' + 10);
+      else result[x] = -1;
+   }
+   return result;
+}
+
+static constexpr std::array<uint8_t, 256> make_base64_values()
+{
+   std::array<uint8_t, 256> result{};
+   for (int x = 0; x < 256; x++)
+      result[x] = kBase64Invalid;
+   for (int x = 0; x < 64; x++)
+      result[static_cast<uint8_t>(kBase64Digits[x])] = static_cast<uint8_t>(x);
+   result['-'] = kBase64UrlSafe | 62;
+   result['_'] = kBase64UrlSafe | 63;
+   result['='] = kBase64Pad;
+   for (char c : {' ', '\t', '\n', '\v', '\f', '\r'})
+      result[static_cast<uint8_t>(c)] = kBase64Space;
+   return result;
+}
+
+static constexpr std::array<char, 512> kHexPairs = make_hex_pairs();
+static constexpr std::array<int8_t, 256> kHexValues = make_hex_values();
+static constexpr std::array<uint8_t, 256> kBase64Values = make_base64_values();
+
+static int hex_digit_value(char c)
+{
+   return kHexValues[static_cast<uint8_t>(c)];
+}
+
+#ifdef LUAOSUTILS_CODECS_SSE2
+
+// Converts bytes holding 0-15 to lowercase hex digits.
+static __m128i sse2_hex_digits(__m128i nibbles)
+{
+   const __m128i letters = _mm_and_si128(_mm_cmpgt_epi8(nibbles, _mm_set1_epi8(9)), _mm_set1_epi8('a' - '0' - 10));
+   return _mm_add_epi8(_mm_add_epi8(nibbles, _mm_set1_epi8('0')), letters);
+}
+
+static void sse2_encode_hex16(const uint8_t* input, char* output)
+{
+   const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input));
+   const __m128i mask = _mm_set1_epi8(0x0f);
+   const __m128i high = _mm_and_si128(_mm_srli_epi16(bytes, 4), mask);
+   const __m128i low = _mm_and_si128(bytes, mask);
+   _mm_storeu_si128(reinterpret_cast<__m128i*>(output), sse2_hex_digits(_mm_unpacklo_epi8(high, low)));
+   _mm_storeu_si128(reinterpret_cast<__m128i*>(output + 16), sse2_hex_digits(_mm_unpackhi_epi8(high, low)));
+}
+
+// Returns a mask of the bytes of v that are between low and high inclusive. The comparisons are signed, so
+// bytes of 0x80 and above are never in range.
+static __m128i sse2_in_range(__m128i v, char low, char high)
+{
+   return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(static_cast<char>(low - 1))),
+                        _mm_cmpgt_epi8(_mm_set1_epi8(static_cast<char>(high + 1)), v));
+}
+
+// Converts 16 hex digits to their values, each in a 16-bit lane with the high digit in the low byte. Returns
+// false if any of them is not a hex digit.
+static bool sse2_hex_values(const char* input, __m128i& values)
+{
+   const __m128i chars = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input));
+   const __m128i isDigit = sse2_in_range(chars, '0', '9');
+   const __m128i lower = _mm_or_si128(chars, _mm_set1_epi8(0x20));
+   const __m128i isLetter = sse2_in_range(lower, 'a', 'f');
+   if (_mm_movemask_epi8(_mm_or_si128(isDigit, isLetter)) != 0xffff)
+      return false;
+   values = _mm_or_si128(_mm_and_si128(isDigit, _mm_sub_epi8(chars, _mm_set1_epi8('0'))),
+                         _mm_and_si128(isLetter, _mm_sub_epi8(lower, _mm_set1_epi8('a' - 10))));
+   return true;
+}
+
+// Decodes 32 hex digits to 16 bytes. Returns false without writing anything if any of them is not a hex digit.
+static bool sse2_decode_hex32(const char* input, uint8_t* output)
+{
+   __m128i first, second;
+   if (! sse2_hex_values(input, first) || ! sse2_hex_values(input + 16, second))
+      return false;
+   const __m128i lowByte = _mm_set1_epi16(0x00ff);
+   const __m128i bytes1 = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(first, lowByte), 4), _mm_srli_epi16(first, 8));
+   const __m128i bytes2 = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(second, lowByte), 4), _mm_srli_epi16(second, 8));
+   _mm_storeu_si128(reinterpret_cast<__m128i*>(output), _mm_packus_epi16(bytes1, bytes2));
+   return true;
+}
+
+// Encodes 12 bytes as 16 base64 digits.
+static void sse2_encode_base64_12(const uint8_t* input, char* output)
+{
+   const auto word = [input](int x) -> int
+         {
+            return (input[3 * x] << 16) | (input[3 * x + 1] << 8) | input[3 * x + 2];
+         };
+   const __m128i words = _mm_set_epi32(word(3), word(2), word(1), word(0));
+   const __m128i mask = _mm_set1_epi32(0x3f);
+   // each 32-bit lane becomes the four 6-bit values of its word, most significant first
+   const __m128i indexes = _mm_or_si128(
+         _mm_or_si128(_mm_and_si128(_mm_srli_epi32(words, 18), mask),
+                      _mm_slli_epi32(_mm_and_si128(_mm_srli_epi32(words, 12), mask), 8)),
+         _mm_or_si128(_mm_slli_epi32(_mm_and_si128(_mm_srli_epi32(words, 6), mask), 16),
+                      _mm_slli_epi32(_mm_and_si128(words, mask), 24)));
+   // 'A'-'Z', then 'a'-'z', then '0'-'9', then '+' and '/'
+   __m128i offsets = _mm_set1_epi8('A');
+   offsets = _mm_add_epi8(offsets, _mm_and_si128(_mm_cmpgt_epi8(indexes, _mm_set1_epi8(25)), _mm_set1_epi8('a' - 26 - 'A')));
+   offsets = _mm_add_epi8(offsets, _mm_and_si128(_mm_cmpgt_epi8(indexes, _mm_set1_epi8(51)), _mm_set1_epi8('0' - 52 - ('a' - 26))));
+   offsets = _mm_add_epi8(offsets, _mm_and_si128(_mm_cmpeq_epi8(indexes, _mm_set1_epi8(62)), _mm_set1_epi8('+' - 62 - ('0' - 52))));
+   offsets = _mm_add_epi8(offsets, _mm_and_si128(_mm_cmpeq_epi8(indexes, _mm_set1_epi8(63)), _mm_set1_epi8('/' - 63 - ('0' - 52))));
+   _mm_storeu_si128(reinterpret_cast<__m128i*>(output), _mm_add_epi8(indexes, offsets));
+}
+
+// Decodes 16 base64 digits of the standard alphabet to 12 bytes. Returns false without writing anything if
+// any of them is something else.
+static bool sse2_decode_base64_16(const char* input, uint8_t* output)
+{
+   const __m128i chars = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input));
+   const __m128i isUpper = sse2_in_range(chars, 'A', 'Z');
+   const __m128i isLower = sse2_in_range(chars, 'a', 'z');
+   const __m128i isDigit = sse2_in_range(chars, '0', '9');
+   const __m128i isPlus = _mm_cmpeq_epi8(chars, _mm_set1_epi8('+'));
+   const __m128i isSlash = _mm_cmpeq_epi8(chars, _mm_set1_epi8('/'));
+   const __m128i valid = _mm_or_si128(_mm_or_si128(isUpper, isLower), _mm_or_si128(_mm_or_si128(isDigit, isPlus), isSlash));
+   if (_mm_movemask_epi8(valid) != 0xffff)
+      return false;
+   __m128i offsets = _mm_and_si128(isUpper, _mm_set1_epi8(static_cast<char>(-'A')));
+   offsets = _mm_or_si128(offsets, _mm_and_si128(isLower, _mm_set1_epi8(static_cast<char>(26 - 'a'))));
+   offsets = _mm_or_si128(offsets, _mm_and_si128(isDigit, _mm_set1_epi8(52 - '0')));
+   offsets = _mm_or_si128(offsets, _mm_and_si128(isPlus, _mm_set1_epi8(62 - '+')));
+   offsets = _mm_or_si128(offsets, _mm_and_si128(isSlash, _mm_set1_epi8(63 - '/')));
+   const __m128i values = _mm_add_epi8(chars, offsets);
+   // each 32-bit lane holds four 6-bit values, the first in the low byte; join them into one 24-bit word
+   const __m128i mask = _mm_set1_epi32(0xff);
+   const __m128i words = _mm_or_si128(
+         _mm_or_si128(_mm_slli_epi32(_mm_and_si128(values, mask), 18),
+                      _mm_slli_epi32(_mm_and_si128(_mm_srli_epi32(values, 8), mask), 12)),
+         _mm_or_si128(_mm_slli_epi32(_mm_and_si128(_mm_srli_epi32(values, 16), mask), 6),
+                      _mm_srli_epi32(values, 24)));
+   alignas(16) uint32_t joined[4];
+   _mm_store_si128(reinterpret_cast<__m128i*>(joined), words);
+   for (uint32_t word : joined)
+   {
+      *output++ = static_cast<uint8_t>(word >> 16);
+      *output++ = static_cast<uint8_t>(word >> 8);
+      *output++ = static_cast<uint8_t>(word);
+   }
+   return true;
+}
+
+#endif // LUAOSUTILS_CODECS_SSE2
+
+std::string buffer2HexString(const uint8_t* buffer, const size_t size)
+{
+   std::string result(2 * size, '\0');
+   buffer2HexChars(bufferView(buffer, size), result.data());
+   return result;
+}
+
+std::string buffer2HexString(bufferView buffer)
+{
+   return buffer2HexString(buffer.data(), buffer.size());
+}
+
+void buffer2HexChars(bufferView buffer, char* output)
+{
+   const uint8_t* input = buffer.data();
+   size_t size = buffer.size();
+#ifdef LUAOSUTILS_CODECS_SSE2
+   for (; size >= 16; size -= 16, input += 16, output += 32)
+      sse2_encode_hex16(input, output);
+#endif
+   for (; size > 0; size--)
+   {
+      const char* pair = &kHexPairs[2 * *input++];
+      *output++ = pair[0];
+      *output++ = pair[1];
+   }
+}
+
+// Parses a pair of characters the way std::stoi(pair, nullptr, 16) does, which is what hexString2Buffer
+// originally used: leading whitespace and a sign are allowed, and parsing stops at the first non-hex digit.
+static bool parse_hex_pair(std::string_view pair, uint8_t& byte)
+{
+   size_t x = 0;
+   while (x < pair.size() && std::isspace(static_cast<unsigned char>(pair[x])))
+      x++;
+   bool negative = false;
+   if (x < pair.size() && (pair[x] == '+' || pair[x] == '-'))
+      negative = (pair[x++] == '-');
+   int value = 0;
+   bool hasDigits = false;
+   for (; x < pair.size(); x++)
+   {
+      const int digit = hex_digit_value(pair[x]);
+      if (digit < 0) break;
+      value = value * 16 + digit;
+      hasDigits = true;
+   }
+   if (! hasDigits)
+      return false;
+   byte = static_cast<uint8_t>(negative ? -value : value);
+   return true;
+}
+
+encryptBuffer hexString2Buffer(std::string_view hexString)
+{
+   encryptBuffer buffer((hexString.size() + 1) / 2);
+   buffer.resize(hexChars2Buffer(hexString, buffer.data()));
+   return buffer;
+}
+
+bool hexString2Buffer(std::string_view hexString, encryptBuffer& buffer, decode_mode mode)
+{
+   if (mode == decode_mode::lenient)
+   {
+      buffer = hexString2Buffer(hexString);
+      return true;
+   }
+   buffer.clear();
+   if (hexString.size() % 2 != 0)
+      return false;
+   buffer.resize(hexString.size() / 2);
+   const char* input = hexString.data();
+   uint8_t* output = buffer.data();
+   size_t size = hexString.size();
+#ifdef LUAOSUTILS_CODECS_SSE2
+   for (; size >= 32; size -= 32, input += 32, output += 16)
+   {
+      if (! sse2_decode_hex32(input, output))
+      {
+         buffer.clear();
+         return false;
+      }
+   }
+#endif
+   for (; size > 0; size -= 2, input += 2)
+   {
+      const int high = hex_digit_value(input[0]);
+      const int low = hex_digit_value(input[1]);
+      if ((high | low) < 0)
+      {
+         buffer.clear();
+         return false;
+      }
+      *output++ = static_cast<uint8_t>((high << 4) | low);
+   }
+   return true;
+}
+
+size_t hexChars2Buffer(std::string_view hexString, uint8_t* output)
+{
+   size_t numBytes = 0;
+   size_t i = 0;
+   while (i < hexString.size())
+   {
+#ifdef LUAOSUTILS_CODECS_SSE2
+      // A block with anything but hex digits in it goes through the scalar loop, which skips the bad pairs.
+      // Blocks start on even offsets, so no pair is split between the two.
+      if (i + 32 <= hexString.size() && sse2_decode_hex32(hexString.data() + i, output + numBytes))
+      {
+         i += 32;
+         numBytes += 16;
+         continue;
+      }
+      const size_t blockEnd = (std::min)(i + 32, hexString.size());
+#else
+      const size_t blockEnd = hexString.size();
+#endif
+      for (; i < blockEnd; i += 2)
+      {
+         const int high = hex_digit_value(hexString[i]);
+         const int low = (i + 1 < hexString.size()) ? hex_digit_value(hexString[i + 1]) : -1;
+         if (high >= 0 && low >= 0)
+         {
+            output[numBytes++] = static_cast<uint8_t>((high << 4) | low);
+            continue;
+         }
+         if (parse_hex_pair(hexString.substr(i, 2), output[numBytes]))
+            numBytes++; // invalid pairs are skipped
+      }
+   }
+   return numBytes;
+}
+
+std::string buffer2Base64String(bufferView buffer)
+{
+   std::string result(4 * ((buffer.size() + 2) / 3), '\0');
+   const uint8_t* input = buffer.data();
+   size_t size = buffer.size();
+   char* output = result.data();
+#ifdef LUAOSUTILS_CODECS_SSE2
+   for (; size >= 12; size -= 12, input += 12, output += 16)
+      sse2_encode_base64_12(input, output);
+#endif
+   for (; size >= 3; size -= 3, input += 3)
+   {
+      const uint32_t word = (input[0] << 16) | (input[1] << 8) | input[2];
+      *output++ = kBase64Digits[word >> 18];
+      *output++ = kBase64Digits[(word >> 12) & 0x3f];
+      *output++ = kBase64Digits[(word >> 6) & 0x3f];
+      *output++ = kBase64Digits[word & 0x3f];
+   }
+   if (size > 0)
+   {
+      const uint32_t word = (input[0] << 16) | (size > 1 ? input[1] << 8 : 0);
+      *output++ = kBase64Digits[word >> 18];
+      *output++ = kBase64Digits[(word >> 12) & 0x3f];
+      *output++ = size > 1 ? kBase64Digits[(word >> 6) & 0x3f] : '=';
+      *output++ = '=';
+   }
+   return result;
+}
+
+bool base64String2Buffer(std::string_view base64String, encryptBuffer& buffer, decode_mode mode)
+{
+   const bool strict = (mode == decode_mode::strict);
+   buffer.resize(base64String.size() / 4 * 3 + 3);
+   const char* input = base64String.data();
+   const size_t size = base64String.size();
+   uint8_t* output = buffer.data();
+   uint32_t word = 0;
+   int count = 0; // the number of values in word
+   size_t i = 0;
+   while (i < size)
+   {
+#ifdef LUAOSUTILS_CODECS_SSE2
+      if (count == 0 && size - i >= 16 && sse2_decode_base64_16(input + i, output))
+      {
+         i += 16;
+         output += 12;
+         continue;
+      }
+#endif
+      uint8_t value = kBase64Values[static_cast<uint8_t>(input[i])];
+      if (value == kBase64Pad)
+         break;
+      i++;
+      if (! strict && value == kBase64Space)
+         continue;
+      if (! strict && value != kBase64Invalid && (value & kBase64UrlSafe))
+         value &= 0x3f;
+      if (value >= 64)
+      {
+         buffer.clear();
+         return false;
+      }
+      word = (word << 6) | value;
+      if (++count == 4)
+      {
+         *output++ = static_cast<uint8_t>(word >> 16);
+         *output++ = static_cast<uint8_t>(word >> 8);
+         *output++ = static_cast<uint8_t>(word);
+         word = 0;
+         count = 0;
+      }
+   }
+   // only padding (and in lenient mode, whitespace) may follow the data
+   size_t numPads = 0;
+   for (; i < size; i++)
+   {
+      const uint8_t value = kBase64Values[static_cast<uint8_t>(input[i])];
+      if (value == kBase64Pad)
+         numPads++;
+      else if (strict || value != kBase64Space)
+      {
+         buffer.clear();
+         return false;
+      }
+   }
+   bool valid = count != 1 && count + numPads <= 4 && (count > 0 || numPads == 0);
+   if (strict && count > 0)
+      valid = valid && count + numPads == 4 && (word & ((1u << (2 * (4 - count))) - 1)) == 0;
+   if (! valid)
+   {
+      buffer.clear();
+      return false;
+   }
+   if (count == 2)
+      *output++ = static_cast<uint8_t>(word >> 4);
+   else if (count == 3)
+   {
+      *output++ = static_cast<uint8_t>(word >> 10);
+      *output++ = static_cast<uint8_t>(word >> 2);
+   }
+   buffer.resize(output - buffer.data());
+   return true;
+}
+
+}
@@ -0,0 +1,155 @@
+//
+//  luaosutils_crypto_hash.cpp
+//  luaosutils
+//
+//  (Usage permitted by MIT License. See LICENSE file in this repository.)
+//
+
+#include <algorithm>
+
+#include "luaosutils.hpp"
+#include "crypto/luaosutils_crypto_hash.h"
+#include "crypto/luaosutils_crypto_os.h"
+#include "luaosutils_trace.h"
+
+#if OPERATING_SYSTEM == WINDOWS
+#include <windows.h>
+#include "winutils/luaosutils_winutils.h"
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace luaosutils
+{
+
+/// Files are read and hashed this many bytes at a time.
+constexpr size_t kHashBlockSize = 1024 * 1024;
+
+std::optional<hash_algorithm> hash_algorithm_from_name(std::string_view name)
+{
+   if (name == "sha256") return hash_algorithm::sha256;
+   if (name == "sha512") return hash_algorithm::sha512;
+   if (name == "blake3") return hash_algorithm::blake3;
+   return std::nullopt;
+}
+
+std::unique_ptr<hasher> create_portable_hasher(hash_algorithm algorithm)
+{
+   switch (algorithm)
+   {
+      case hash_algorithm::sha256: return create_sha256_hasher();
+      case hash_algorithm::sha512: return create_sha512_hasher();
+      case hash_algorithm::blake3: return create_blake3_hasher();
+   }
+   return nullptr;
+}
+
+std::unique_ptr<hasher> create_hasher(hash_algorithm algorithm)
+{
+   if (auto result = create_os_hasher(algorithm))
+      return result;
+   return create_portable_hasher(algorithm);
+}
+
+static bool is_canceled(const std::atomic<bool>* canceled)
+{
+   return canceled && canceled->load(std::memory_order_relaxed);
+}
+
+#if OPERATING_SYSTEM == WINDOWS
+
+bool hash_file(const std::string& filePath, hash_algorithm algorithm, encryptBuffer& digest, const std::atomic<bool>* canceled)
+{
+   LUAOSUTILS_TRACE_SCOPE("crypto.hash");
+   HANDLE file = CreateFileW(utf8_to_WCHAR(filePath.c_str()).c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                             OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+   if (file == INVALID_HANDLE_VALUE)
+      return false;
+   auto hash = create_hasher(algorithm);
+   encryptBuffer block(kHashBlockSize);
+   bool success = true;
+   for (;;) // FILE_FLAG_SEQUENTIAL_SCAN has the cache manager read ahead of us
+   {
+      if (is_canceled(canceled))
+      {
+         success = false;
+         break;
+      }
+      DWORD bytesRead = 0;
+      if (! ReadFile(file, block.data(), static_cast<DWORD>(block.size()), &bytesRead, NULL))
+      {
+         success = false;
+         break;
+      }
+      if (bytesRead == 0)
+         break;
+      hash->update(bufferView(block.data(), bytesRead));
+   }
+   CloseHandle(file);
+   if (success)
+      digest = hash->finish();
+   return success;
+}
+
+#else
+
+bool hash_file(const std::string& filePath, hash_algorithm algorithm, encryptBuffer& digest, const std::atomic<bool>* canceled)
+{
+   LUAOSUTILS_TRACE_SCOPE("crypto.hash");
+   const int fd = open(filePath.c_str(), O_RDONLY);
+   if (fd < 0)
+      return false;
+   struct stat info;
+   if (fstat(fd, &info) != 0 || ! S_ISREG(info.st_mode))
+   {
+      close(fd);
+      return false;
+   }
+   // The file is read rather than memory mapped: a mapped file that another process truncates raises SIGBUS.
+#if defined(POSIX_FADV_SEQUENTIAL)
+   posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#elif defined(F_RDAHEAD)
+   fcntl(fd, F_RDAHEAD, 1);
+#endif
+   auto hash = create_hasher(algorithm);
+   encryptBuffer block(kHashBlockSize);
+   bool success = true;
+#if defined(POSIX_FADV_DONTNEED)
+   off_t hashedBytes = 0;
+#endif
+   for (;;)
+   {
+      if (is_canceled(canceled))
+      {
+         success = false;
+         break;
+      }
+      const ssize_t bytesRead = read(fd, block.data(), block.size());
+      if (bytesRead < 0)
+      {
+         if (errno == EINTR)
+            continue;
+         success = false;
+         break;
+      }
+      if (bytesRead == 0)
+         break;
+      hash->update(bufferView(block.data(), static_cast<size_t>(bytesRead)));
+#if defined(POSIX_FADV_DONTNEED)
+      // so that hashing a large file does not push everything else out of the page cache
+      posix_fadvise(fd, hashedBytes, bytesRead, POSIX_FADV_DONTNEED);
+      hashedBytes += bytesRead;
+#endif
+   }
+   close(fd);
+   if (success)
+      digest = hash->finish();
+   return success;
+}
+
+#endif
+
+}
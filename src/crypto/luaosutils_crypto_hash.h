@@ -0,0 +1,81 @@
+//
+//  luaosutils_crypto_hash.h
+//  luaosutils
+//
+//  (Usage permitted by MIT License. See LICENSE file in this repository.)
+//
+
+#ifndef luaosutils_crypto_hash_h
+#define luaosutils_crypto_hash_h
+
+#include <atomic>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "crypto/luaosutils_crypto_utils.h"
+
+namespace luaosutils
+{
+
+enum class hash_algorithm
+{
+   sha256,
+   sha512,
+   blake3
+};
+
+/** \brief Returns the algorithm with the name a script passes ("sha256", "sha512" or "blake3"), or nothing if there is none. */
+std::optional<hash_algorithm> hash_algorithm_from_name(std::string_view name);
+
+/** \brief Computes a hash incrementally. Data may be passed to #update in pieces of any size. */
+class hasher
+{
+public:
+   virtual ~hasher() {}
+
+   virtual void update(bufferView data) = 0;
+
+   /** \brief Returns a new hasher in the same state as this one, or nullptr if the state cannot be copied. Each continues
+    * independently of the other.
+    */
+   virtual std::unique_ptr<hasher> clone() const = 0;
+
+   /** \brief Returns the digest of all the data passed to #update. The hasher may not be used afterward. */
+   virtual encryptBuffer finish() = 0;
+};
+
+/** \brief Returns a hasher for \p algorithm: the operating system's implementation if it has one, or else the
+ * portable implementation.
+ */
+std::unique_ptr<hasher> create_hasher(hash_algorithm algorithm);
+
+/** \brief Returns the portable hasher for \p algorithm, which runs on every platform. SHA-256 uses the SHA
+ * instructions on x86 processors that have them, and BLAKE3 hashes four chunks at a time with SSE2.
+ */
+std::unique_ptr<hasher> create_portable_hasher(hash_algorithm algorithm);
+
+/** \brief Hashes a file in constant memory, reading it in large blocks.
+ *
+ * The file system is asked to read ahead of the block being hashed, so reading overlaps hashing.
+ *
+ * \param filePath the utf-8 path of the file
+ * \param algorithm the hash algorithm
+ * \param digest receives the digest
+ * \param canceled if not null, hashing stops between blocks once it becomes true
+ * \return false if the file could not be read or hashing was canceled
+ */
+bool hash_file(const std::string& filePath, hash_algorithm algorithm, encryptBuffer& digest,
+               const std::atomic<bool>* canceled = nullptr);
+
+/** \brief Derives a key with PBKDF2 using HMAC-SHA-256, for platforms without an OS implementation. */
+encryptBuffer pbkdf2_hmac_sha256(bufferView password, bufferView salt, long iterations, size_t keyLength);
+
+std::unique_ptr<hasher> create_sha256_hasher();
+std::unique_ptr<hasher> create_sha512_hasher();
+std::unique_ptr<hasher> create_blake3_hasher();
+
+}
+
+#endif /* luaosutils_crypto_hash_h */
@@ -0,0 +1,142 @@
+//
+//  luaosutils_crypto_hash_batch.cpp
+//  luaosutils
+//
+//  (Usage permitted by MIT License. See LICENSE file in this repository.)
+//
+
+#include <algorithm>
+#include <atomic>
+#include <system_error>
+
+#include "luaosutils.hpp"
+#include "crypto/luaosutils_crypto_hash_batch.h"
+#include "internet/luaosutils_internet_utils.h"
+#include "luaosutils_trace.h"
+
+namespace luaosutils
+{
+
+/// The workers and the completion share this, so it outlives a batch that is destroyed while they are running.
+struct file_hash_batch::shared_state
+{
+   std::vector<std::string> paths;
+   hash_algorithm algorithm;
+   std::vector<file_hash_result> results;
+   std::atomic<size_t> nextPath{0};
+   std::atomic<size_t> runningWorkers{0};
+   std::atomic<bool> canceled{false};
+   file_hash_callback callback;
+#ifdef LUAOSUTILS_TRACE
+   std::uint64_t traceId{};
+#endif
+
+   shared_state(std::vector<std::string>&& p, hash_algorithm a) :
+         paths(std::move(p)), algorithm(a), results(paths.size()) {}
+};
+
+/** \brief Returns the number of threads to hash \p numPaths files with: one per core, but no more than there are files. */
+static size_t worker_count(size_t numPaths)
+{
+   size_t numCores = std::thread::hardware_concurrency();
+   if (numCores == 0) numCores = 4; // the number of cores is unknown
+   return (std::max)(size_t(1), (std::min)(numCores, numPaths));
+}
+
+/** \brief Queues the callback of an async batch to run on the main thread, unless the batch has been canceled by then. */
+void file_hash_batch::queue_completion(const std::shared_ptr<shared_state>& state)
+{
+   completion_queue::instance().push([state]() -> void
+         {
+            if (state->canceled)
+               return;
+            LUAOSUTILS_TRACE_ASYNC_END("crypto.hash_batch", state->traceId);
+            file_hash_callback callback = state->callback; // the callback may destroy the batch
+            callback(state->paths, state->results);
+         });
+}
+
+file_hash_batch::file_hash_batch(std::vector<std::string> paths, hash_algorithm algorithm) :
+            m_state(std::make_shared<shared_state>(std::move(paths), algorithm))
+{
+}
+
+file_hash_batch::~file_hash_batch()
+{
+   m_state->canceled = true;
+   for (auto& worker : m_workers)
+      worker.join();
+}
+
+const std::vector<std::string>& file_hash_batch::paths() const
+{
+   return m_state->paths;
+}
+
+void file_hash_batch::run_worker(const std::shared_ptr<shared_state>& state)
+{
+   for (;;)
+   {
+      const size_t index = state->nextPath.fetch_add(1);
+      if (index >= state->paths.size() || state->canceled)
+         break;
+      file_hash_result& result = state->results[index];
+      result.success = hash_file(state->paths[index], state->algorithm, result.digest, &state->canceled);
+   }
+   if (state->callback && state->runningWorkers.fetch_sub(1) == 1) // the last worker to finish
+      queue_completion(state);
+}
+
+std::vector<file_hash_result> file_hash_batch::run()
+{
+   LUAOSUTILS_TRACE_SCOPE("crypto.hash_batch");
+   const size_t numWorkers = worker_count(m_state->paths.size());
+   m_workers.reserve(numWorkers); // so that only starting a thread can throw below
+   try
+   {
+      for (size_t x = 1; x < numWorkers; x++)
+         m_workers.emplace_back(run_worker, m_state);
+   }
+   catch (const std::system_error&)
+   {
+      // Fewer threads only make the batch slower: this thread hashes whatever the others do not.
+   }
+   run_worker(m_state);
+   for (auto& worker : m_workers)
+      worker.join();
+   m_workers.clear();
+   return std::move(m_state->results);
+}
+
+void file_hash_batch::start(file_hash_callback callback)
+{
+   m_state->callback = std::move(callback);
+#ifdef LUAOSUTILS_TRACE
+   m_state->traceId = trace_next_id();
+   LUAOSUTILS_TRACE_ASYNC_BEGIN("crypto.hash_batch", m_state->traceId);
+#endif
+   if (m_state->paths.empty())
+   {
+      queue_completion(m_state);
+      return;
+   }
+   const size_t numWorkers = worker_count(m_state->paths.size());
+   m_workers.reserve(numWorkers); // so that only starting a thread can throw below
+   m_state->runningWorkers = numWorkers;
+   size_t numStarted = 0;
+   try
+   {
+      for (; numStarted < numWorkers; numStarted++)
+         m_workers.emplace_back(run_worker, m_state);
+   }
+   catch (const std::system_error&)
+   {
+      // Count out the threads that never started. If the ones that did have already finished, or none started,
+      // nothing else will queue the completion. Files that no thread reached are reported as failed.
+      const size_t numUnstarted = numWorkers - numStarted;
+      if (m_state->runningWorkers.fetch_sub(numUnstarted) == numUnstarted)
+         queue_completion(m_state);
+   }
+}
+
+}
@@ -0,0 +1,68 @@
+//
+//  luaosutils_crypto_hash_batch.h
+//  luaosutils
+//
+//  (Usage permitted by MIT License. See LICENSE file in this repository.)
+//
+
+#ifndef luaosutils_crypto_hash_batch_h
+#define luaosutils_crypto_hash_batch_h
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "crypto/luaosutils_crypto_hash.h"
+
+namespace luaosutils
+{
+
+struct file_hash_result
+{
+   bool success{};
+   encryptBuffer digest;
+};
+
+using file_hash_callback = std::function<void (const std::vector<std::string>& paths, const std::vector<file_hash_result>& results)>;
+
+/** \brief Hashes a list of files on a pool of worker threads, one thread per processor core.
+ *
+ * Each worker takes the next file from the list as soon as it finishes one, so small and large files balance
+ * across the pool, and a worker waiting on the disk leaves its core to one that is hashing. The results are in
+ * the same order as the paths. Destroying the batch cancels it and waits for the workers to stop, which they do
+ * within one block of the file they are hashing.
+ */
+class file_hash_batch
+{
+   struct shared_state;
+
+   std::shared_ptr<shared_state> m_state;
+   std::vector<std::thread> m_workers;
+
+   static void run_worker(const std::shared_ptr<shared_state>& state);
+   static void queue_completion(const std::shared_ptr<shared_state>& state);
+
+public:
+   file_hash_batch(std::vector<std::string> paths, hash_algorithm algorithm);
+   ~file_hash_batch();
+
+   file_hash_batch(const file_hash_batch&) = delete;
+   file_hash_batch& operator=(const file_hash_batch&) = delete;
+
+   /** \brief Returns the paths of the files, in the order of the results. */
+   const std::vector<std::string>& paths() const;
+
+   /** \brief Hashes every file before returning. The calling thread works alongside the pool. */
+   std::vector<file_hash_result> run();
+
+   /** \brief Starts hashing in the background. The callback runs once, on the main thread, through the completion
+    * queue. It does not run if the batch is destroyed first.
+    */
+   void start(file_hash_callback callback);
+};
+
+}
+
+#endif /* luaosutils_crypto_hash_batch_h */
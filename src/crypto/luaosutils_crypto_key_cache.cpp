@@ -0,0 +1,210 @@
+//
+//  luaosutils_crypto_key_cache.cpp
+//  luaosutils
+//
+//  (Usage permitted by MIT License. See LICENSE file in this repository.)
+//
+
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+
+#include "luaosutils.hpp"
+#include "crypto/luaosutils_crypto_hash.h"
+#include "crypto/luaosutils_crypto_key_cache.h"
+#include "crypto/luaosutils_crypto_os.h"
+#include "internet/luaosutils_internet_utils.h"
+#include "luaosutils_trace.h"
+
+namespace luaosutils
+{
+
+constexpr size_t kKeyCacheSecretLength = 32;
+
+/// The derived keys, most recently used first, indexed by a keyed hash of their seeds and salts.
+class key_cache
+{
+   struct entry
+   {
+      std::string id;
+      encryptBuffer key;
+   };
+
+   std::mutex m_mutex;
+   size_t m_maxKeys{};
+   std::list<entry> m_entries;
+   std::unordered_map<std::string, std::list<entry>::iterator> m_index;
+   uint8_t m_secret[kKeyCacheSecretLength];
+
+   // Called with the mutex locked.
+   void evict_last()
+   {
+      entry& last = m_entries.back();
+      m_index.erase(last.id);
+      secure_zero(last.key.data(), last.key.size());
+      secure_zero(&last.id[0], last.id.size());
+      m_entries.pop_back();
+   }
+
+public:
+   key_cache()
+   {
+      fill_randomized_data(m_secret, sizeof(m_secret));
+   }
+
+   ~key_cache()
+   {
+      set_max_keys(0);
+      secure_zero(m_secret, sizeof(m_secret));
+   }
+
+   void set_max_keys(size_t maxKeys)
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_maxKeys = maxKeys;
+      while (m_entries.size() > m_maxKeys)
+         evict_last();
+   }
+
+   /** \brief Returns the id of a seed and salt. The seed's length goes first so that no two pairs run together the same way. */
+   std::string calc_id(bufferView seedValue, bufferView salt) const
+   {
+      auto hash = create_hasher(hash_algorithm::sha256);
+      hash->update(bufferView(m_secret, sizeof(m_secret)));
+      uint8_t seedLength[8];
+      for (size_t x = 0; x < sizeof(seedLength); x++)
+         seedLength[x] = static_cast<uint8_t>(static_cast<uint64_t>(seedValue.size()) >> (8 * x));
+      hash->update(bufferView(seedLength, sizeof(seedLength)));
+      hash->update(seedValue);
+      hash->update(salt);
+      encryptBuffer digest = hash->finish();
+      std::string result(digest.begin(), digest.end());
+      secure_zero(digest.data(), digest.size());
+      return result;
+   }
+
+   bool is_enabled()
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      return m_maxKeys > 0;
+   }
+
+   bool find(const std::string& id, encryptBuffer& key)
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      auto it = m_index.find(id);
+      if (it == m_index.end())
+         return false;
+      m_entries.splice(m_entries.begin(), m_entries, it->second);
+      key = it->second->key;
+      return true;
+   }
+
+   void insert(std::string id, const encryptBuffer& key)
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if (m_maxKeys == 0 || m_index.count(id)) // turned off, or another thread derived the same key meanwhile
+         return;
+      while (m_entries.size() >= m_maxKeys)
+         evict_last();
+      m_entries.push_front(entry{std::move(id), key});
+      m_index.emplace(m_entries.front().id, m_entries.begin());
+   }
+};
+
+static key_cache& get_key_cache()
+{
+   static key_cache g_keyCache;
+   return g_keyCache;
+}
+
+void set_crypto_key_cache_size(size_t maxKeys)
+{
+   get_key_cache().set_max_keys(maxKeys);
+}
+
+encryptBuffer derive_crypto_key(bufferView seedValue, bufferView salt)
+{
+   key_cache& cache = get_key_cache();
+   if (! cache.is_enabled())
+      return calc_crypto_key(seedValue, salt);
+   std::string id = cache.calc_id(seedValue, salt);
+   encryptBuffer key;
+   if (! cache.find(id, key))
+   {
+      key = calc_crypto_key(seedValue, salt);
+      cache.insert(id, key);
+   }
+   secure_zero(&id[0], id.size());
+   return key;
+}
+
+/// The worker and the completion share this, so it outlives a task that is destroyed while they are running.
+struct crypto_key_task::shared_state
+{
+   encryptBuffer seedValue;
+   encryptBuffer salt;
+   encryptBuffer key;
+   std::atomic<bool> canceled{false};
+   crypto_key_callback callback;
+#ifdef LUAOSUTILS_TRACE
+   std::uint64_t traceId{};
+#endif
+
+   shared_state(bufferView s, bufferView t) : seedValue(s.begin(), s.end()), salt(t.begin(), t.end()) {}
+
+   ~shared_state()
+   {
+      secure_zero(seedValue.data(), seedValue.size());
+      secure_zero(salt.data(), salt.size());
+      secure_zero(key.data(), key.size());
+   }
+};
+
+crypto_key_task::crypto_key_task(bufferView seedValue, bufferView salt) :
+            m_state(std::make_shared<shared_state>(seedValue, salt))
+{
+}
+
+crypto_key_task::~crypto_key_task()
+{
+   m_state->canceled = true;
+}
+
+void crypto_key_task::run_worker(const std::shared_ptr<shared_state>& state)
+{
+   if (state->canceled)
+      return;
+   state->key = derive_crypto_key(state->seedValue, state->salt);
+   completion_queue::instance().push([state]() -> void
+         {
+            if (state->canceled)
+               return;
+            LUAOSUTILS_TRACE_ASYNC_END("crypto.derive_key_async", state->traceId);
+            crypto_key_callback callback = state->callback; // the callback may destroy the task
+            callback(state->key);
+         });
+}
+
+void crypto_key_task::start(crypto_key_callback callback)
+{
+   m_state->callback = std::move(callback);
+#ifdef LUAOSUTILS_TRACE
+   m_state->traceId = trace_next_id();
+   LUAOSUTILS_TRACE_ASYNC_BEGIN("crypto.derive_key_async", m_state->traceId);
+#endif
+   try
+   {
+      std::thread(run_worker, m_state).detach();
+   }
+   catch (const std::system_error&)
+   {
+      run_worker(m_state); // no thread to spare, so derive the key here and still complete through the queue
+   }
+}
+
+}
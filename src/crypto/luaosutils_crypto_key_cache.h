@@ -0,0 +1,64 @@
+//
+//  luaosutils_crypto_key_cache.h
+//  luaosutils
+//
+//  (Usage permitted by MIT License. See LICENSE file in this repository.)
+//
+
+#ifndef luaosutils_crypto_key_cache_h
+#define luaosutils_crypto_key_cache_h
+
+#include <functional>
+#include <memory>
+
+#include "crypto/luaosutils_crypto_utils.h"
+
+namespace luaosutils
+{
+
+/** \brief Sets the number of derived keys that derive_crypto_key keeps in memory, least recently used first out.
+ *
+ * The cache is off (0) until this is called. Shrinking it, or turning it off, erases the keys it no longer has
+ * room for. Thread-safe.
+ */
+void set_crypto_key_cache_size(size_t maxKeys);
+
+/** \brief Returns the same key as calc_crypto_key, from the cache if it is on and holds the key. Thread-safe.
+ *
+ * The cache is indexed by a SHA-256 hash of the seed and salt, keyed with a random value chosen for the process,
+ * so it holds neither the seeds nor plain hashes of them. Keys are overwritten with zeros when they leave it.
+ */
+encryptBuffer derive_crypto_key(bufferView seedValue, bufferView salt);
+
+using crypto_key_callback = std::function<void (const encryptBuffer& key)>;
+
+/** \brief Derives a key with derive_crypto_key on a worker thread.
+ *
+ * The task keeps its own copies of the seed and salt, which are zeroed once both the task and the worker are
+ * done with them. Destroying the task cancels the callback without waiting: the worker is detached, finishes the
+ * key it is deriving and discards it.
+ */
+class crypto_key_task
+{
+   struct shared_state;
+
+   std::shared_ptr<shared_state> m_state;
+
+   static void run_worker(const std::shared_ptr<shared_state>& state);
+
+public:
+   crypto_key_task(bufferView seedValue, bufferView salt);
+   ~crypto_key_task();
+
+   crypto_key_task(const crypto_key_task&) = delete;
+   crypto_key_task& operator=(const crypto_key_task&) = delete;
+
+   /** \brief Starts deriving the key. The callback runs once, on the main thread, through the completion queue.
+    * It does not run if the task is destroyed first.
+    */
+   void start(crypto_key_callback callback);
+};
+
+}
+
+#endif /* luaosutils_crypto_key_cache_h */
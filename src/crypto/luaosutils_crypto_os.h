@@ -7,17 +7,20 @@
 #ifndef luaosutils_crypto_os_h
 #define luaosutils_crypto_os_h
 
+#include <memory>
 #include <string>
 
+#include "crypto/luaosutils_crypto_hash.h"
 #include "crypto/luaosutils_crypto_utils.h"
 
 namespace luaosutils
 {
 
-std::string calc_file_hash(const std::string& filePath);
-encryptBuffer calc_crypto_key(const encryptBuffer& seedValue, const encryptBuffer& salt);
-encryptBuffer encrypt(const encryptBuffer& key, const std::string& plaintext, encryptBuffer& iv);
-std::string decrypt(const encryptBuffer& key, const encryptBuffer& cyphertext, const encryptBuffer& iv);
+/** \brief Returns the operating system's hasher for \p algorithm, or nullptr if it has none. */
+std::unique_ptr<hasher> create_os_hasher(hash_algorithm algorithm);
+encryptBuffer calc_crypto_key(bufferView seedValue, bufferView salt);
+encryptBuffer encrypt(bufferView key, std::string_view plaintext, encryptBuffer& iv);
+std::string decrypt(bufferView key, bufferView cyphertext, bufferView iv);
 
 }
 
@@ -0,0 +1,94 @@
+//
+//  luaosutils_crypto_os_linux.cpp
+//  luaosutils
+//
+//  (Usage permitted by MIT License. See LICENSE file in this repository.)
+//
+//  Linux has no OS-level crypto API, so hashing and key derivation use the portable implementations.
+//  Encryption uses OpenSSL's libcrypto, with the same AES-CBC and PKCS#7 padding as the macOS and Windows versions.
+//
+#include <climits>
+#include <memory>
+#include <string>
+
+#include <openssl/evp.h>
+
+#include "crypto/luaosutils_crypto_hash.h"
+#include "crypto/luaosutils_crypto_os.h"
+#include "crypto/luaosutils_crypto_utils.h"
+#include "luaosutils_trace.h"
+
+namespace luaosutils
+{
+
+std::unique_ptr<hasher> create_os_hasher(hash_algorithm)
+{
+   return nullptr;
+}
+
+encryptBuffer calc_crypto_key(bufferView seedValue, bufferView salt)
+{
+   LUAOSUTILS_TRACE_SCOPE("crypto.derive_key");
+   return pbkdf2_hmac_sha256(seedValue, salt, cryptoKeyIterations, cryptoKeyLength);
+}
+
+constexpr size_t kAESBlockSize = 16;
+
+/** \brief Returns the AES-CBC cipher for the size of \p key, as CommonCrypto and BCrypt choose it, or nullptr. */
+static const EVP_CIPHER* aes_cbc_for_key(bufferView key)
+{
+   switch (key.size())
+   {
+      case 16: return EVP_aes_128_cbc();
+      case 24: return EVP_aes_192_cbc();
+      case 32: return EVP_aes_256_cbc();
+      default: return nullptr;
+   }
+}
+
+/** \brief Encrypts or decrypts \p input with AES-CBC and PKCS#7 padding. Returns false if the key, the IV or
+ * the input is invalid, such as a ciphertext that was not made with this key.
+ */
+static bool run_aes_cbc(bool encrypting, bufferView key, bufferView iv, bufferView input, encryptBuffer& output)
+{
+   const EVP_CIPHER* cipher = aes_cbc_for_key(key);
+   if (! cipher || iv.size() != kAESBlockSize || input.size() > static_cast<size_t>(INT_MAX) - kAESBlockSize)
+      return false;
+   std::unique_ptr<EVP_CIPHER_CTX, decltype(&EVP_CIPHER_CTX_free)> context(EVP_CIPHER_CTX_new(), &EVP_CIPHER_CTX_free);
+   if (! context || EVP_CipherInit_ex(context.get(), cipher, nullptr, key.data(), iv.data(), encrypting ? 1 : 0) != 1)
+      return false;
+   output.resize(input.size() + kAESBlockSize);
+   int length = 0;
+   int finalLength = 0;
+   if (EVP_CipherUpdate(context.get(), output.data(), &length, input.data(), static_cast<int>(input.size())) != 1
+         || EVP_CipherFinal_ex(context.get(), output.data() + length, &finalLength) != 1)
+   {
+      secure_zero(output.data(), output.size());
+      output.clear();
+      return false;
+   }
+   output.resize(static_cast<size_t>(length + finalLength));
+   return true;
+}
+
+encryptBuffer encrypt(bufferView key, std::string_view plaintext, encryptBuffer& iv)
+{
+   LUAOSUTILS_TRACE_SCOPE("crypto.encrypt");
+   iv = calc_randomized_data(kAESBlockSize);
+   encryptBuffer ciphertext;
+   run_aes_cbc(true, key, iv, bufferView(reinterpret_cast<const uint8_t*>(plaintext.data()), plaintext.size()), ciphertext);
+   return ciphertext;
+}
+
+std::string decrypt(bufferView key, bufferView cyphertext, bufferView iv)
+{
+   LUAOSUTILS_TRACE_SCOPE("crypto.decrypt");
+   encryptBuffer plaintext;
+   if (! run_aes_cbc(false, key, iv, cyphertext, plaintext))
+      return std::string();
+   std::string result(plaintext.begin(), plaintext.end());
+   secure_zero(plaintext.data(), plaintext.size());
+   return result;
+}
+
+} //namespace
@@ -4,41 +4,72 @@
 //
 //  Created by Robert Patterson on 10/31/23.
 //
+#include <algorithm>
 #include <string>
-#include <fstream>
 
 #include <CommonCrypto/CommonCrypto.h>
 
 #include "crypto/luaosutils_crypto_os.h"
 #include "crypto/luaosutils_crypto_utils.h"
+#include "luaosutils_trace.h"
 
 
 namespace luaosutils
 {
 
-std::string calc_file_hash(const std::string& filePath)
+/** \brief A hasher using CommonCrypto, which uses the SHA instructions on processors that have them. */
+template<typename Context, int (*Init)(Context*), int (*Update)(Context*, const void*, CC_LONG),
+         int (*Final)(unsigned char*, Context*), size_t DigestLength>
+class common_crypto_hasher : public hasher
 {
-   std::ifstream file(filePath, std::ios::binary);
-   if (!file) return ""; // throw std::runtime_error("Error opening file");
+   Context m_context;
 
-   // Compute the SHA-512 hash of the file
-   CC_SHA512_CTX context;
-   CC_SHA512_Init(&context);
-   const int bufsize = 4096;
-   char buf[bufsize];
-   while (file.read(buf, bufsize))
+public:
+   common_crypto_hasher() { Init(&m_context); }
+
+   void update(bufferView data) override
    {
-      CC_SHA512_Update(&context, buf, bufsize);
+      // CC_LONG is 32 bits, so large views are passed in pieces
+      const uint8_t* bytes = data.data();
+      size_t size = data.size();
+      while (size)
+      {
+         const CC_LONG chunk = static_cast<CC_LONG>((std::min)(size, size_t(1) << 30));
+         Update(&m_context, bytes, chunk);
+         bytes += chunk;
+         size -= chunk;
+      }
+   }
+
+   std::unique_ptr<hasher> clone() const override
+   {
+      return std::make_unique<common_crypto_hasher>(*this); // the contexts are plain structs
+   }
+
+   encryptBuffer finish() override
+   {
+      encryptBuffer digest(DigestLength);
+      Final(digest.data(), &m_context);
+      return digest;
+   }
+};
+
+std::unique_ptr<hasher> create_os_hasher(hash_algorithm algorithm)
+{
+   switch (algorithm)
+   {
+      case hash_algorithm::sha256:
+         return std::make_unique<common_crypto_hasher<CC_SHA256_CTX, CC_SHA256_Init, CC_SHA256_Update, CC_SHA256_Final, CC_SHA256_DIGEST_LENGTH>>();
+      case hash_algorithm::sha512:
+         return std::make_unique<common_crypto_hasher<CC_SHA512_CTX, CC_SHA512_Init, CC_SHA512_Update, CC_SHA512_Final, CC_SHA512_DIGEST_LENGTH>>();
+      default:
+         return nullptr;
    }
-   CC_SHA512_Update(&context, buf, static_cast<CC_LONG>(file.gcount()));
-   unsigned char hash[CC_SHA512_DIGEST_LENGTH];
-   CC_SHA512_Final(hash, &context);
-   
-   return buffer2HexString(hash, CC_SHA512_DIGEST_LENGTH);
 }
 
-encryptBuffer calc_crypto_key(const encryptBuffer& seedValue, const encryptBuffer& salt)
+encryptBuffer calc_crypto_key(bufferView seedValue, bufferView salt)
 {
+   LUAOSUTILS_TRACE_SCOPE("crypto.derive_key");
    // Allocate memory for the key using a unique_ptr
    encryptBuffer key(cryptoKeyLength);
    const uint8_t* pSalt = salt.size() ? salt.data() : nullptr;
@@ -59,10 +90,11 @@ encryptBuffer calc_crypto_key(const encryptBuffer& seedValue, const encryptBuffe
    return key;
 }
 
-encryptBuffer encrypt(const encryptBuffer& key, const std::string& plaintext, encryptBuffer& iv)
+encryptBuffer encrypt(bufferView key, std::string_view plaintext, encryptBuffer& iv)
 {
+   LUAOSUTILS_TRACE_SCOPE("crypto.encrypt");
    // Convert the plaintext from a string to a byte array
-   const char* plaintextBytes = plaintext.c_str();
+   const char* plaintextBytes = plaintext.data();
    const size_t plaintextLength = plaintext.length();
    
    // create the IV
@@ -91,8 +123,9 @@ encryptBuffer encrypt(const encryptBuffer& key, const std::string& plaintext, en
    return encryptedString;
 }
 
-std::string decrypt(const encryptBuffer& key, const encryptBuffer& cyphertext, const encryptBuffer& iv)
+std::string decrypt(bufferView key, bufferView cyphertext, bufferView iv)
 {
+   LUAOSUTILS_TRACE_SCOPE("crypto.decrypt");
    const char* encryptedBytes = reinterpret_cast<const char*>(cyphertext.data());
    const size_t encryptedLength = cyphertext.size();
    
@@ -4,74 +4,116 @@
 //
 //  Created by Robert Patterson on 10/31/23.
 //
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
 #include <string>
-#include <fstream>
 
 #include <bcrypt.h>
 
 #include "crypto/luaosutils_crypto_os.h"
 #include "crypto/luaosutils_crypto_utils.h"
+#include "luaosutils_trace.h"
 
 namespace luaosutils
 {
 
-std::string calc_file_hash(const std::string& filePath)
+/** \brief A hasher using CNG, which uses the SHA instructions on processors that have them. */
+class cng_hasher : public hasher
 {
-   std::ifstream file(filePath, std::ios::binary);
-   if (!file) return ""; // throw std::runtime_error("Error opening file");
+   std::shared_ptr<void> m_hAlg; // shared with clones, whose hash objects are duplicated from this provider's
+   BCRYPT_HASH_HANDLE m_hHash = NULL;
+   DWORD m_hashSize = 0;
 
-   // Read the entire file into a buffer
-   std::string buffer(std::istreambuf_iterator<char>(file), {});
-   std::string retval;
-
-   // Initialize variables
-   BCRYPT_ALG_HANDLE hAlg = NULL;
-   BCRYPT_HASH_HANDLE hHash = NULL;
-   DWORD hashSize = 0;
-   DWORD resultSize = 0;
-   NTSTATUS status = 0;
+   cng_hasher(const cng_hasher& other) : m_hAlg(other.m_hAlg), m_hashSize(other.m_hashSize)
+   {
+      if (!BCRYPT_SUCCESS(BCryptDuplicateHash(other.m_hHash, &m_hHash, NULL, 0, 0)))
+         throw std::runtime_error("Failed to duplicate hash object.");
+   }
 
-   try
+public:
+   cng_hasher(LPCWSTR algorithmId)
    {
-      // Open an algorithm handle
-      if (!BCRYPT_SUCCESS(status = BCryptOpenAlgorithmProvider(&hAlg, BCRYPT_SHA512_ALGORITHM, NULL, 0)))
+      BCRYPT_ALG_HANDLE hAlg = NULL;
+      if (!BCRYPT_SUCCESS(BCryptOpenAlgorithmProvider(&hAlg, algorithmId, NULL, 0)))
          throw std::runtime_error("Failed to open algorithm handle.");
-      // Determine the hash size
-      if (!BCRYPT_SUCCESS(status = BCryptGetProperty(hAlg, BCRYPT_HASH_LENGTH, reinterpret_cast<PUCHAR>(&hashSize), sizeof(hashSize), &resultSize, 0)))
-         throw std::runtime_error("Failed to retrieve hash size.");
-      encryptBuffer hashResult(hashSize);
-      // Create a hash object
-      if (!BCRYPT_SUCCESS(status = BCryptCreateHash(hAlg, &hHash, NULL, 0, NULL, 0, 0)))
+      m_hAlg = std::shared_ptr<void>(hAlg, [](void* h) { BCryptCloseAlgorithmProvider(h, 0); });
+      DWORD resultSize = 0;
+      if (!BCRYPT_SUCCESS(BCryptGetProperty(m_hAlg.get(), BCRYPT_HASH_LENGTH, reinterpret_cast<PUCHAR>(&m_hashSize), sizeof(m_hashSize), &resultSize, 0))
+          || !BCRYPT_SUCCESS(BCryptCreateHash(m_hAlg.get(), &m_hHash, NULL, 0, NULL, 0, 0)))
          throw std::runtime_error("Failed to create hash object.");
-      // Hash the input data
-      if (!BCRYPT_SUCCESS(status = BCryptHashData(hHash, reinterpret_cast<PUCHAR>(const_cast<char*>(buffer.data())), static_cast<ULONG>(buffer.size()), 0)))
-         throw std::runtime_error("Failed to hash the data.");
-      // Finalize the hash
-      if (!BCRYPT_SUCCESS(status = BCryptFinishHash(hHash, hashResult.data(), static_cast<ULONG>(hashResult.size()), 0)))
-         throw std::runtime_error("Failed to finalize the hash.");
-      retval = buffer2HexString(hashResult);
+   }
+
+   ~cng_hasher()
+   {
+      if (m_hHash) BCryptDestroyHash(m_hHash);
+   }
+
+   void update(bufferView data) override
+   {
+      // BCryptHashData takes a 32-bit length, so large views are passed in pieces
+      const uint8_t* bytes = data.data();
+      size_t size = data.size();
+      while (size)
+      {
+         const ULONG chunk = static_cast<ULONG>((std::min)(size, size_t(1) << 30));
+         BCryptHashData(m_hHash, const_cast<PUCHAR>(bytes), chunk, 0);
+         bytes += chunk;
+         size -= chunk;
+      }
+   }
+
+   std::unique_ptr<hasher> clone() const override
+   {
+      try
+      {
+         return std::unique_ptr<hasher>(new cng_hasher(*this));
+      }
+      catch (std::exception&)
+      {
+         return nullptr;
+      }
+   }
+
+   encryptBuffer finish() override
+   {
+      encryptBuffer digest(m_hashSize);
+      if (!BCRYPT_SUCCESS(BCryptFinishHash(m_hHash, digest.data(), static_cast<ULONG>(digest.size()), 0)))
+         return encryptBuffer();
+      return digest;
+   }
+};
+
+std::unique_ptr<hasher> create_os_hasher(hash_algorithm algorithm)
+{
+   try
+   {
+      switch (algorithm)
+      {
+         case hash_algorithm::sha256:
+            return std::make_unique<cng_hasher>(BCRYPT_SHA256_ALGORITHM);
+         case hash_algorithm::sha512:
+            return std::make_unique<cng_hasher>(BCRYPT_SHA512_ALGORITHM);
+         default:
+            break;
+      }
    }
    catch (std::exception&)
    {
-      retval = std::string();
-      // fall-thru to catchall return
+      // fall-thru to the portable hasher
    }
-   // Clean up resources
-   if (hHash) BCryptDestroyHash(hHash);
-   if (hAlg) BCryptCloseAlgorithmProvider(hAlg, 0);
-   return retval;
+   return nullptr;
 }
 
-encryptBuffer calc_crypto_key(const encryptBuffer& seedValue, const encryptBuffer& salt)
+encryptBuffer calc_crypto_key(bufferView seedValue, bufferView salt)
 {
+   LUAOSUTILS_TRACE_SCOPE("crypto.derive_key");
    // Allocate memory for the key using a unique_ptr
    encryptBuffer key(cryptoKeyLength);
-   const uint8_t* pSalt = salt.size() ? salt.data() : nullptr;
    
-   // stoopid WinAPI can't take const salt or seed, so effing copy them
-   encryptBuffer salty = salt;
-   uint8_t* pSalty = salty.size() ? salty.data() : nullptr;
-   encryptBuffer seedy = seedValue;
+   // stoopid WinAPI can't take const salt or seed, but it only reads them
+   PUCHAR pSalt = salt.size() ? const_cast<PUCHAR>(salt.data()) : nullptr;
+   PUCHAR pSeed = const_cast<PUCHAR>(seedValue.data());
    
    // Open a handle to the RNG algorithm
    BCRYPT_ALG_HANDLE rgnHandle = NULL;
@@ -79,8 +121,8 @@ encryptBuffer calc_crypto_key(const encryptBuffer& seedValue, const encryptBuffe
    if (BCRYPT_SUCCESS(BCryptOpenAlgorithmProvider(&rgnHandle, BCRYPT_SHA256_ALGORITHM, NULL, BCRYPT_ALG_HANDLE_HMAC_FLAG)))
    {
       // Generate the key using PBKDF2 with SHA-256
-      NTSTATUS status =  BCryptDeriveKeyPBKDF2(rgnHandle, reinterpret_cast<PUCHAR>(seedy.data()), static_cast<ULONG>(seedy.size()),
-                            reinterpret_cast<const PUCHAR>(pSalty), static_cast<ULONG>(salty.size()), cryptoKeyIterations, key.data(), cryptoKeyLength, 0);
+      NTSTATUS status =  BCryptDeriveKeyPBKDF2(rgnHandle, pSeed, static_cast<ULONG>(seedValue.size()),
+                            pSalt, static_cast<ULONG>(salt.size()), cryptoKeyIterations, key.data(), cryptoKeyLength, 0);
       if (!BCRYPT_SUCCESS(status))
       {
 #ifdef _DEBUG
@@ -113,8 +155,9 @@ encryptBuffer calc_crypto_key(const encryptBuffer& seedValue, const encryptBuffe
    return key;
 }
 
-encryptBuffer encrypt(const encryptBuffer& key, const std::string& plaintext, encryptBuffer& iv)
+encryptBuffer encrypt(bufferView key, std::string_view plaintext, encryptBuffer& iv)
 {
+   LUAOSUTILS_TRACE_SCOPE("crypto.encrypt");
    encryptBuffer encryptedData;
 
    BCRYPT_ALG_HANDLE hAlgorithm = NULL;
@@ -170,8 +213,9 @@ encryptBuffer encrypt(const encryptBuffer& key, const std::string& plaintext, en
    return encryptedData;
 }
 
-std::string decrypt(const encryptBuffer& key, const encryptBuffer& cyphertext, const encryptBuffer& iv)
+std::string decrypt(bufferView key, bufferView cyphertext, bufferView iv)
 {
+   LUAOSUTILS_TRACE_SCOPE("crypto.decrypt");
    std::string decryptedData;
    BCRYPT_ALG_HANDLE hAlgorithm = NULL;
    BCRYPT_KEY_HANDLE hKey = NULL;
@@ -191,7 +235,7 @@ std::string decrypt(const encryptBuffer& key, const encryptBuffer& cyphertext, c
       if (!BCRYPT_SUCCESS(BCryptSetProperty(hAlgorithm, BCRYPT_CHAINING_MODE, ptr, size, 0)))
          throw std::runtime_error("Failed to set chain mode property");
       /* BCryptEncrypt modifies iv parameter, so we need to make copy */
-      encryptBuffer iv_copy = iv;
+      encryptBuffer iv_copy(iv.begin(), iv.end());
       // Determine the size of the decrypted data
       ULONG dwDataLen = static_cast<ULONG>(cyphertext.size());
       ULONG dwResultLen = 0;
@@ -0,0 +1,391 @@
+//
+//  luaosutils_crypto_sha2.cpp
+//  luaosutils
+//
+//  (Usage permitted by MIT License. See LICENSE file in this repository.)
+//
+//  Portable SHA-256 and SHA-512 (FIPS 180-4), with a SHA-256 kernel for the x86 SHA extensions.
+//  Define LUAOSUTILS_NO_SIMD to build the portable kernel alone.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#include "crypto/luaosutils_crypto_hash.h"
+
+#if ! defined(LUAOSUTILS_NO_SIMD) && (defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86))
+#define LUAOSUTILS_SHA_NI 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define LUAOSUTILS_TARGET_SHA
+#else
+#include <cpuid.h>
+#define LUAOSUTILS_TARGET_SHA __attribute__((target("sha,sse4.1")))
+#endif
+#endif
+
+namespace luaosutils
+{
+
+static inline uint32_t rotr32(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+static inline uint64_t rotr64(uint64_t x, int n) { return (x >> n) | (x << (64 - n)); }
+
+static inline uint32_t load_be32(const uint8_t* p)
+{
+   return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+}
+
+static inline uint64_t load_be64(const uint8_t* p)
+{
+   return (uint64_t(load_be32(p)) << 32) | load_be32(p + 4);
+}
+
+static inline void store_be32(uint8_t* p, uint32_t x)
+{
+   p[0] = uint8_t(x >> 24); p[1] = uint8_t(x >> 16); p[2] = uint8_t(x >> 8); p[3] = uint8_t(x);
+}
+
+static inline void store_be64(uint8_t* p, uint64_t x)
+{
+   store_be32(p, uint32_t(x >> 32));
+   store_be32(p + 4, uint32_t(x));
+}
+
+alignas(16) static const uint32_t kSha256K[64] = {
+   0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+   0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+   0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+   0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+   0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+   0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+   0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+   0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static const uint64_t kSha512K[80] = {
+   0x428a2f98d728ae22, 0x7137449123ef65cd, 0xb5c0fbcfec4d3b2f, 0xe9b5dba58189dbbc, 0x3956c25bf348b538,
+   0x59f111f1b605d019, 0x923f82a4af194f9b, 0xab1c5ed5da6d8118, 0xd807aa98a3030242, 0x12835b0145706fbe,
+   0x243185be4ee4b28c, 0x550c7dc3d5ffb4e2, 0x72be5d74f27b896f, 0x80deb1fe3b1696b1, 0x9bdc06a725c71235,
+   0xc19bf174cf692694, 0xe49b69c19ef14ad2, 0xefbe4786384f25e3, 0x0fc19dc68b8cd5b5, 0x240ca1cc77ac9c65,
+   0x2de92c6f592b0275, 0x4a7484aa6ea6e483, 0x5cb0a9dcbd41fbd4, 0x76f988da831153b5, 0x983e5152ee66dfab,
+   0xa831c66d2db43210, 0xb00327c898fb213f, 0xbf597fc7beef0ee4, 0xc6e00bf33da88fc2, 0xd5a79147930aa725,
+   0x06ca6351e003826f, 0x142929670a0e6e70, 0x27b70a8546d22ffc, 0x2e1b21385c26c926, 0x4d2c6dfc5ac42aed,
+   0x53380d139d95b3df, 0x650a73548baf63de, 0x766a0abb3c77b2a8, 0x81c2c92e47edaee6, 0x92722c851482353b,
+   0xa2bfe8a14cf10364, 0xa81a664bbc423001, 0xc24b8b70d0f89791, 0xc76c51a30654be30, 0xd192e819d6ef5218,
+   0xd69906245565a910, 0xf40e35855771202a, 0x106aa07032bbd1b8, 0x19a4c116b8d2d0c8, 0x1e376c085141ab53,
+   0x2748774cdf8eeb99, 0x34b0bcb5e19b48a8, 0x391c0cb3c5c95a63, 0x4ed8aa4ae3418acb, 0x5b9cca4f7763e373,
+   0x682e6ff3d6b2b8a3, 0x748f82ee5defb2fc, 0x78a5636f43172f60, 0x84c87814a1f0ab72, 0x8cc702081a6439ec,
+   0x90befffa23631e28, 0xa4506cebde82bde9, 0xbef9a3f7b2c67915, 0xc67178f2e372532b, 0xca273eceea26619c,
+   0xd186b8c721c0c207, 0xeada7dd6cde0eb1e, 0xf57d4f7fee6ed178, 0x06f067aa72176fba, 0x0a637dc5a2c898a6,
+   0x113f9804bef90dae, 0x1b710b35131c471b, 0x28db77f523047d84, 0x32caab7b40c72493, 0x3c9ebe0a15c9bebc,
+   0x431d67c49c100d4c, 0x4cc5d4becb3e42b6, 0x597f299cfc657e2a, 0x5fcb6fab3ad6faec, 0x6c44198c4a475817
+};
+
+static void sha256_blocks_portable(uint32_t state[8], const uint8_t* data, size_t numBlocks)
+{
+   for (; numBlocks; numBlocks--, data += 64)
+   {
+      uint32_t w[64];
+      for (int x = 0; x < 16; x++)
+         w[x] = load_be32(data + 4 * x);
+      for (int x = 16; x < 64; x++)
+      {
+         const uint32_t s0 = rotr32(w[x - 15], 7) ^ rotr32(w[x - 15], 18) ^ (w[x - 15] >> 3);
+         const uint32_t s1 = rotr32(w[x - 2], 17) ^ rotr32(w[x - 2], 19) ^ (w[x - 2] >> 10);
+         w[x] = w[x - 16] + s0 + w[x - 7] + s1;
+      }
+      uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+      uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+      for (int x = 0; x < 64; x++)
+      {
+         const uint32_t t1 = h + (rotr32(e, 6) ^ rotr32(e, 11) ^ rotr32(e, 25)) + ((e & f) ^ (~e & g)) + kSha256K[x] + w[x];
+         const uint32_t t2 = (rotr32(a, 2) ^ rotr32(a, 13) ^ rotr32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+         h = g; g = f; f = e; e = d + t1;
+         d = c; c = b; b = a; a = t1 + t2;
+      }
+      state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+      state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+   }
+}
+
+#ifdef LUAOSUTILS_SHA_NI
+
+static bool cpu_has_sha_extensions()
+{
+   unsigned int leaf1[4] = {}, leaf7[4] = {};
+#if defined(_MSC_VER)
+   int info[4];
+   __cpuid(info, 0);
+   if (info[0] < 7) return false;
+   __cpuid(info, 1);
+   leaf1[2] = static_cast<unsigned int>(info[2]);
+   __cpuidex(info, 7, 0);
+   leaf7[1] = static_cast<unsigned int>(info[1]);
+#else
+   if (__get_cpuid_max(0, nullptr) < 7) return false;
+   __cpuid(1, leaf1[0], leaf1[1], leaf1[2], leaf1[3]);
+   __cpuid_count(7, 0, leaf7[0], leaf7[1], leaf7[2], leaf7[3]);
+#endif
+   const bool ssse3 = (leaf1[2] & (1u << 9)) != 0;
+   const bool sse41 = (leaf1[2] & (1u << 19)) != 0;
+   const bool sha = (leaf7[1] & (1u << 29)) != 0;
+   return ssse3 && sse41 && sha;
+}
+
+// The state is kept in the ABEF/CDGH order that the sha256rnds2 instruction uses, and each loop iteration
+// runs four rounds while the message schedule for four rounds later is computed.
+LUAOSUTILS_TARGET_SHA
+static void sha256_blocks_sha_ni(uint32_t state[8], const uint8_t* data, size_t numBlocks)
+{
+   const __m128i byteSwap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+   __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&state[0])), 0xB1); // CDAB
+   __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&state[4])), 0x1B); // EFGH
+   __m128i state0 = _mm_alignr_epi8(tmp, state1, 8); // ABEF
+   state1 = _mm_blend_epi16(state1, tmp, 0xF0); // CDGH
+
+   for (; numBlocks; numBlocks--, data += 64)
+   {
+      const __m128i abefSave = state0;
+      const __m128i cdghSave = state1;
+      __m128i msgs[4];
+      for (int x = 0; x < 4; x++)
+         msgs[x] = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16 * x)), byteSwap);
+      for (int x = 0; x < 16; x++)
+      {
+         __m128i msg = _mm_add_epi32(msgs[x & 3], _mm_load_si128(reinterpret_cast<const __m128i*>(&kSha256K[4 * x])));
+         state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+         if (x < 12)
+         {
+            const __m128i w7 = _mm_alignr_epi8(msgs[(x + 3) & 3], msgs[(x + 2) & 3], 4);
+            const __m128i next = _mm_add_epi32(_mm_sha256msg1_epu32(msgs[x & 3], msgs[(x + 1) & 3]), w7);
+            msgs[x & 3] = _mm_sha256msg2_epu32(next, msgs[(x + 3) & 3]);
+         }
+         msg = _mm_shuffle_epi32(msg, 0x0E);
+         state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+      }
+      state0 = _mm_add_epi32(state0, abefSave);
+      state1 = _mm_add_epi32(state1, cdghSave);
+   }
+
+   tmp = _mm_shuffle_epi32(state0, 0x1B); // FEBA
+   state1 = _mm_shuffle_epi32(state1, 0xB1); // DCHG
+   _mm_storeu_si128(reinterpret_cast<__m128i*>(&state[0]), _mm_blend_epi16(tmp, state1, 0xF0)); // DCBA
+   _mm_storeu_si128(reinterpret_cast<__m128i*>(&state[4]), _mm_alignr_epi8(state1, tmp, 8)); // HGFE
+}
+
+#endif // LUAOSUTILS_SHA_NI
+
+using sha256_blocks_function = void (*)(uint32_t state[8], const uint8_t* data, size_t numBlocks);
+
+static sha256_blocks_function select_sha256_blocks()
+{
+#ifdef LUAOSUTILS_SHA_NI
+   if (cpu_has_sha_extensions())
+      return sha256_blocks_sha_ni;
+#endif
+   return sha256_blocks_portable;
+}
+
+static const sha256_blocks_function sha256_blocks = select_sha256_blocks();
+
+static void sha512_blocks(uint64_t state[8], const uint8_t* data, size_t numBlocks)
+{
+   for (; numBlocks; numBlocks--, data += 128)
+   {
+      uint64_t w[80];
+      for (int x = 0; x < 16; x++)
+         w[x] = load_be64(data + 8 * x);
+      for (int x = 16; x < 80; x++)
+      {
+         const uint64_t s0 = rotr64(w[x - 15], 1) ^ rotr64(w[x - 15], 8) ^ (w[x - 15] >> 7);
+         const uint64_t s1 = rotr64(w[x - 2], 19) ^ rotr64(w[x - 2], 61) ^ (w[x - 2] >> 6);
+         w[x] = w[x - 16] + s0 + w[x - 7] + s1;
+      }
+      uint64_t a = state[0], b = state[1], c = state[2], d = state[3];
+      uint64_t e = state[4], f = state[5], g = state[6], h = state[7];
+      for (int x = 0; x < 80; x++)
+      {
+         const uint64_t t1 = h + (rotr64(e, 14) ^ rotr64(e, 18) ^ rotr64(e, 41)) + ((e & f) ^ (~e & g)) + kSha512K[x] + w[x];
+         const uint64_t t2 = (rotr64(a, 28) ^ rotr64(a, 34) ^ rotr64(a, 39)) + ((a & b) ^ (a & c) ^ (b & c));
+         h = g; g = f; f = e; e = d + t1;
+         d = c; c = b; b = a; a = t1 + t2;
+      }
+      state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+      state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+   }
+}
+
+/** \brief The buffering and padding that SHA-256 and SHA-512 share. Traits supply the word type, block size and compression. */
+template<typename Traits>
+class sha2_hasher : public hasher
+{
+   using word = typename Traits::word;
+   static constexpr size_t kBlockSize = 16 * sizeof(word);
+
+   word m_state[8];
+   uint8_t m_block[kBlockSize];
+   size_t m_blockLength{};
+   uint64_t m_totalLength{};
+
+public:
+   sha2_hasher() { memcpy(m_state, Traits::initialState, sizeof(m_state)); }
+
+   void update(bufferView data) override
+   {
+      const uint8_t* input = data.data();
+      size_t size = data.size();
+      if (size == 0)
+         return;
+      m_totalLength += size;
+      if (m_blockLength)
+      {
+         const size_t take = (std::min)(size, kBlockSize - m_blockLength);
+         memcpy(m_block + m_blockLength, input, take);
+         m_blockLength += take;
+         input += take;
+         size -= take;
+         if (m_blockLength < kBlockSize)
+            return;
+         Traits::blocks(m_state, m_block, 1);
+         m_blockLength = 0;
+      }
+      if (size >= kBlockSize)
+      {
+         Traits::blocks(m_state, input, size / kBlockSize);
+         input += size - size % kBlockSize;
+         size %= kBlockSize;
+      }
+      if (size)
+      {
+         memcpy(m_block, input, size);
+         m_blockLength = size;
+      }
+   }
+
+   std::unique_ptr<hasher> clone() const override
+   {
+      return std::make_unique<sha2_hasher>(*this);
+   }
+
+   encryptBuffer finish() override
+   {
+      // Append 0x80, pad with zeros, and end the last block with the message length in bits (big-endian).
+      constexpr size_t lengthSize = 2 * sizeof(word);
+      const uint64_t bitLength = m_totalLength * 8;
+      m_block[m_blockLength++] = 0x80;
+      if (m_blockLength > kBlockSize - lengthSize)
+      {
+         memset(m_block + m_blockLength, 0, kBlockSize - m_blockLength);
+         Traits::blocks(m_state, m_block, 1);
+         m_blockLength = 0;
+      }
+      memset(m_block + m_blockLength, 0, kBlockSize - m_blockLength);
+      store_be64(m_block + kBlockSize - 8, bitLength);
+      Traits::blocks(m_state, m_block, 1);
+
+      encryptBuffer digest(sizeof(m_state));
+      for (size_t x = 0; x < 8; x++)
+         Traits::store(digest.data() + x * sizeof(word), m_state[x]);
+      return digest;
+   }
+};
+
+struct sha256_traits
+{
+   using word = uint32_t;
+   static constexpr uint32_t initialState[8] = {
+      0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+   };
+   static void blocks(uint32_t state[8], const uint8_t* data, size_t numBlocks) { sha256_blocks(state, data, numBlocks); }
+   static void store(uint8_t* p, uint32_t x) { store_be32(p, x); }
+};
+
+struct sha512_traits
+{
+   using word = uint64_t;
+   static constexpr uint64_t initialState[8] = {
+      0x6a09e667f3bcc908, 0xbb67ae8584caa73b, 0x3c6ef372fe94f82b, 0xa54ff53a5f1d36f1,
+      0x510e527fade682d1, 0x9b05688c2b3e6c1f, 0x1f83d9abfb41bd6b, 0x5be0cd19137e2179
+   };
+   static void blocks(uint64_t state[8], const uint8_t* data, size_t numBlocks) { sha512_blocks(state, data, numBlocks); }
+   static void store(uint8_t* p, uint64_t x) { store_be64(p, x); }
+};
+
+using sha256_hasher = sha2_hasher<sha256_traits>;
+using sha512_hasher = sha2_hasher<sha512_traits>;
+
+std::unique_ptr<hasher> create_sha256_hasher()
+{
+   return std::make_unique<sha256_hasher>();
+}
+
+std::unique_ptr<hasher> create_sha512_hasher()
+{
+   return std::make_unique<sha512_hasher>();
+}
+
+/** \brief HMAC-SHA-256 with the inner and outer key blocks already hashed, so that each message costs two compressions fewer. */
+class hmac_sha256
+{
+   sha256_hasher m_inner;
+   sha256_hasher m_outer;
+
+public:
+   explicit hmac_sha256(bufferView key)
+   {
+      uint8_t block[64] = {};
+      if (key.size() > sizeof(block))
+      {
+         sha256_hasher keyHasher;
+         keyHasher.update(key);
+         const encryptBuffer keyDigest = keyHasher.finish();
+         memcpy(block, keyDigest.data(), keyDigest.size());
+      }
+      else if (key.size())
+         memcpy(block, key.data(), key.size());
+      uint8_t pad[64];
+      for (size_t x = 0; x < sizeof(pad); x++)
+         pad[x] = block[x] ^ 0x36;
+      m_inner.update(bufferView(pad, sizeof(pad)));
+      for (size_t x = 0; x < sizeof(pad); x++)
+         pad[x] = block[x] ^ 0x5c;
+      m_outer.update(bufferView(pad, sizeof(pad)));
+   }
+
+   encryptBuffer calc(bufferView message1, bufferView message2 = bufferView()) const
+   {
+      sha256_hasher inner(m_inner);
+      inner.update(message1);
+      inner.update(message2);
+      const encryptBuffer innerDigest = inner.finish();
+      sha256_hasher outer(m_outer);
+      outer.update(innerDigest);
+      return outer.finish();
+   }
+};
+
+encryptBuffer pbkdf2_hmac_sha256(bufferView password, bufferView salt, long iterations, size_t keyLength)
+{
+   const hmac_sha256 hmac(password);
+   encryptBuffer key;
+   key.reserve(keyLength);
+   for (uint32_t blockIndex = 1; key.size() < keyLength; blockIndex++)
+   {
+      uint8_t indexBytes[4];
+      store_be32(indexBytes, blockIndex);
+      encryptBuffer u = hmac.calc(salt, bufferView(indexBytes, sizeof(indexBytes)));
+      encryptBuffer t = u;
+      for (long x = 1; x < iterations; x++)
+      {
+         u = hmac.calc(u);
+         for (size_t y = 0; y < t.size(); y++)
+            t[y] ^= u[y];
+      }
+      const size_t take = (std::min)(t.size(), keyLength - key.size());
+      key.insert(key.end(), t.begin(), t.begin() + take);
+   }
+   return key;
+}
+
+}
@@ -8,6 +8,7 @@
 #define luaosutils_crypto_utils_h
 
 #include <string>
+#include <string_view>
 #include <vector>
 
 constexpr int cryptoKeyLength = 32;
@@ -17,11 +18,75 @@ namespace luaosutils
 {
 
 using encryptBuffer = std::vector<uint8_t>;
+
+/** \brief A read-only view of bytes that belong to someone else, such as a Lua string argument.
+ *
+ * This stands in for `std::span<const uint8_t>`, which needs C++20. The bytes must outlive the view.
+ */
+class bufferView
+{
+   const uint8_t* m_data{};
+   size_t m_size{};
+
+public:
+   bufferView() {}
+   bufferView(const uint8_t* data, size_t size) : m_data(data), m_size(size) {}
+   bufferView(const encryptBuffer& buffer) : m_data(buffer.data()), m_size(buffer.size()) {}
+
+   const uint8_t* data() const { return m_data; }
+   size_t size() const { return m_size; }
+   bool empty() const { return m_size == 0; }
+   const uint8_t* begin() const { return m_data; }
+   const uint8_t* end() const { return m_data + m_size; }
+};
+
+/** \brief How the decoders treat input that is not well formed. */
+enum class decode_mode
+{
+   lenient,    ///< skip what cannot be decoded (hex pairs that are not hex, whitespace in base64)
+   strict      ///< fail on anything that is not exactly what the encoder produces
+};
+
 std::string buffer2HexString(const uint8_t* buffer, const size_t size);
-std::string buffer2HexString(const luaosutils::encryptBuffer& buffer);
-encryptBuffer hexString2Buffer(const std::string& hexString);
+std::string buffer2HexString(bufferView buffer);
+encryptBuffer hexString2Buffer(std::string_view hexString);
+
+/** \brief Decodes hex digits in either mode. In strict mode the string must be an even number of hex digits.
+ *
+ * \return false if the string is not valid in the mode (lenient decoding always succeeds)
+ */
+bool hexString2Buffer(std::string_view hexString, encryptBuffer& buffer, decode_mode mode);
+
+/** \brief Writes two lowercase hex digits for each byte of \p buffer to \p output, which must hold 2 * buffer.size() characters. */
+void buffer2HexChars(bufferView buffer, char* output);
+
+/** \brief Decodes \p hexString two characters at a time into \p output, which must hold (hexString.size() + 1) / 2 bytes.
+ *
+ * Pairs that are not hex are skipped, as in hexString2Buffer.
+ * \return the number of bytes written
+ */
+size_t hexChars2Buffer(std::string_view hexString, uint8_t* output);
+
+/** \brief Encodes bytes as standard base64 (RFC 4648) with padding. */
+std::string buffer2Base64String(bufferView buffer);
+
+/** \brief Decodes base64.
+ *
+ * In lenient mode, whitespace is skipped, padding is optional, and the URL-safe characters `-` and `_` are
+ * accepted for `+` and `/`. In strict mode, the text must be standard base64 with padding and no unused bits set.
+ * Other characters, and data after padding, are errors in both modes.
+ *
+ * \return false if the text is not valid in the mode
+ */
+bool base64String2Buffer(std::string_view base64String, encryptBuffer& buffer, decode_mode mode);
 
 encryptBuffer calc_randomized_data(int size = -1);
 
+/** \brief Fills \p output with \p size bytes from the operating system's random number generator. */
+void fill_randomized_data(uint8_t* output, size_t size);
+
+/** \brief Overwrites \p size bytes with zeros in a way that the compiler cannot optimize away. */
+void secure_zero(void* data, size_t size);
+
 }
 #endif /* luaosutils_crypto_utils_h */
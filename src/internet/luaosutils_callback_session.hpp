@@ -10,16 +10,18 @@
 #ifndef luaosutils_callback_session_hpp
 #define luaosutils_callback_session_hpp
 
-#include <map>
-#include <mutex>
-
 #include "luaosutils.hpp"
 #include "internet/luaosutils_internet_os.h"
+#include "internet/luaosutils_session_registry.h"
+#include "internet/luaosutils_internet_batch.h"
+#include "internet/luaosutils_internet_segmented.h"
+#include "crypto/luaosutils_crypto_hash_batch.h"
+#include "crypto/luaosutils_crypto_key_cache.h"
 
 namespace luaosutils
 {
 
-constexpr const char (&kSessionMetatableKey)[] = "luaosutils_callback_session";
+constexpr const char* const kSessionMetatableKey = "luaosutils_callback_session";
 
 /** \brief This class is used to guarantee that a Lua state is still active when a callback occurs.
  * A userdata of it is returned to Lua and the session stays active as long as
@@ -29,26 +31,26 @@ constexpr const char (&kSessionMetatableKey)[] = "luaosutils_callback_session";
 class callback_session
 {
 public:
-   using id_type = unsigned long;
+   using id_type = slot_registry<callback_session>::handle_type;
 private:
-   using active_sessions_type = std::map<id_type, luaosutils::callback_session*>;
-   
    id_type m_ID;
    lua_State* m_L;
    int m_function;
+   int m_chunkFunction{LUA_NOREF};
    OSSESSION_ptr m_osSession;
+   std::unique_ptr<request_batch> m_batch;
+   std::unique_ptr<segmented_download> m_segmented;
+   std::unique_ptr<file_hash_batch> m_hashBatch;
+   std::unique_ptr<crypto_key_task> m_keyTask;
+   lua_State* m_coroutine{};
+   int m_coroutineRef{LUA_NOREF};
    bool m_reportErrors;
    
-   static active_sessions_type& _get_active_sessions()
-   {
-      static active_sessions_type g_activeSessions;
-      return g_activeSessions;
-   }
-   
-   static std::mutex& get_active_sessions_mutex()
+   // Completion paths on I/O threads look sessions up, so the registry is never destroyed.
+   static slot_registry<callback_session>& get_active_sessions()
    {
-      static std::mutex activeSessionsMutex;
-      return activeSessionsMutex;
+      static slot_registry<callback_session>* g_activeSessions = new slot_registry<callback_session>;
+      return *g_activeSessions;
    }
    
 public:
@@ -63,27 +65,28 @@ public:
     */
    callback_session(lua_State* L, int func, id_type id) : m_L(L), m_function(func), m_ID(id), m_reportErrors(true)
    {
-      get_active_sessions_mutex().lock();
-      _get_active_sessions().emplace(id, this);
-      get_active_sessions_mutex().unlock();
+      get_active_sessions().bind(id, this);
    }
    
    /** \brief Destructor. Attempts to cancel session if there is one. */
    ~callback_session()
    {
-      get_active_sessions_mutex().lock();
+      get_active_sessions().release(m_ID);
       luaL_unref(m_L, LUA_REGISTRYINDEX, m_function);
-      _get_active_sessions().erase(m_ID);
-      get_active_sessions_mutex().unlock();
+      luaL_unref(m_L, LUA_REGISTRYINDEX, m_chunkFunction);
+      luaL_unref(m_L, LUA_REGISTRYINDEX, m_coroutineRef);
    }
    
    /** \brief Class-level function that generates a new value for use as a unique instance identifier. */
    static id_type get_new_session_id() // this should always be used to calculate the id
    {
-      static std::mutex mtx;
-      static id_type sessionID = 0;
-      std::lock_guard<std::mutex> lock(mtx);
-      return ++sessionID;
+      return get_active_sessions().reserve();
+   }
+   
+   /** \brief Class-level function that frees an identifier from #get_new_session_id that was never used to construct a session. */
+   static void release_session_id(id_type id)
+   {
+      get_active_sessions().release(id);
    }
    
    /** \brief Returns the Lua state for this instance. */
@@ -92,6 +95,12 @@ public:
    /** \brief Returns the Lua function for this instance. */
    int function() { return m_function; }
    
+   /** \brief Returns the Lua function that receives body chunks, or LUA_NOREF if there is none. */
+   int chunk_function() { return m_chunkFunction; }
+   
+   /** \brief Sets the Lua function that receives body chunks. The session takes ownership of the reference. */
+   void set_chunk_function(int func) { m_chunkFunction = func; }
+   
    ///** \brief Returns the OS session pointer for this instance. */
    //OSSESSION* os_session() const { return m_osSession.get(); }
    
@@ -102,8 +111,56 @@ public:
          m_osSession = std::move(session);
    }
    
-   /** \brief Cancels any running request. */
-   void cancel() { m_osSession = nullptr; }
+   /** \brief Sets the batch of requests for this instance. */
+   void set_batch(std::unique_ptr<request_batch>& batch) { m_batch = std::move(batch); }
+   
+   /** \brief Sets the segmented download for this instance. */
+   void set_segmented_download(std::unique_ptr<segmented_download>& download) { m_segmented = std::move(download); }
+   
+   /** \brief Sets the batch of file hashes for this instance. */
+   void set_hash_batch(std::unique_ptr<file_hash_batch>& batch) { m_hashBatch = std::move(batch); }
+   
+   /** \brief Sets the key derivation for this instance. */
+   void set_key_task(std::unique_ptr<crypto_key_task>& task) { m_keyTask = std::move(task); }
+   
+   /** \brief Returns the coroutine that is waiting for this session to complete, or nullptr if none is waiting. */
+   lua_State* coroutine() const { return m_coroutine; }
+   
+   /** \brief Sets the coroutine that is waiting for this session to complete. The session keeps a registry
+    * reference to it, so that it is not collected while it waits even if the script kept no reference.
+    */
+   void set_coroutine(lua_State* co)
+   {
+      luaL_unref(m_L, LUA_REGISTRYINDEX, release_coroutine());
+      m_coroutine = co;
+      if (co)
+      {
+         lua_pushthread(co);
+         m_coroutineRef = luaL_ref(co, LUA_REGISTRYINDEX);
+      }
+   }
+   
+   /** \brief Stops waiting for the coroutine and returns the registry reference that keeps it from being collected.
+    * The caller must release the reference.
+    */
+   int release_coroutine()
+   {
+      const int ref = m_coroutineRef;
+      m_coroutine = nullptr;
+      m_coroutineRef = LUA_NOREF;
+      return ref;
+   }
+   
+   /** \brief Cancels any running request. A coroutine that was waiting for it is no longer kept alive. */
+   void cancel()
+   {
+      luaL_unref(m_L, LUA_REGISTRYINDEX, release_coroutine());
+      m_osSession = nullptr;
+      m_batch = nullptr;
+      m_segmented = nullptr;
+      m_hashBatch = nullptr;
+      m_keyTask = nullptr;
+   }
    
    /** \brief Returns whether to report errors in a dialog box. */
    bool report_errors() const { return m_reportErrors; }
@@ -117,10 +174,7 @@ public:
     */
    static luaosutils::callback_session* get_session_for_id(id_type id)
    {
-      auto it = _get_active_sessions().find(id);
-      if (it == _get_active_sessions().end())
-         return nullptr;
-      return it->second;
+      return get_active_sessions().find(id);
    }
    
    /** \brief Class-level function that returns true if the input session is currently still valid.
@@ -134,10 +188,33 @@ public:
     */
    static bool is_valid_session(luaosutils::callback_session *session)
    {
-      return get_session_for_id(session->m_ID) != nullptr;
+      return get_session_for_id(session->m_ID) == session;
    }
 };
 
+/** \brief Pushes one value onto a Lua stack. */
+using lua_value_pusher = std::function<void (lua_State*)>;
+
+/** \brief Creates a session for an async function outside the `internet` namespace and pushes its userdata.
+ *
+ * \param L the Lua state
+ * \param callback the registry reference to the Lua callback function, which the session takes ownership of
+ * \param sessionID the id of the session, from callback_session::get_new_session_id
+ */
+callback_session* push_callback_session(lua_State* L, int callback, callback_session::id_type sessionID);
+
+/** \brief Calls the Lua callback of a session with one argument and then closes the session, the way async
+ * `internet` requests complete. Does nothing if the session has been collected. Call only from the main thread.
+ */
+void complete_callback_session(callback_session::id_type sessionID, const lua_value_pusher& argument);
+
 }
 
+/** \brief Lets functions bound with lua_bind take sessions, checking that they are session userdata. */
+template<>
+struct lua_metatable_key<luaosutils::callback_session*>
+{
+   static constexpr const char* value = luaosutils::kSessionMetatableKey;
+};
+
 #endif /* luaosutils_callback_session_hpp */
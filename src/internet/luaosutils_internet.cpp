@@ -9,11 +9,16 @@
 
 #include <string>
 #include <exception>
+#include <functional>
 
 #include "luaosutils.hpp"
 #include "internet/luaosutils_callback_session.hpp"
 #include "internet/luaosutils_internet_lua.h"
+#include "internet/luaosutils_internet_cache.h"
 #include "process/luaosutils_process_os.h"
+#include "luaosutils_trace.h"
+
+constexpr const char (&kResponseHeadersMetatableKey)[] = "luaosutils_response_headers";
 
 template <>
 struct LuaStack<luaosutils::HeadersMap> {
@@ -48,6 +53,128 @@ private:
    lua_State* L;
 };
 
+template <>
+struct LuaStack<std::vector<luaosutils::batch_result>> {
+public:
+   LuaStack(lua_State* L) : L(L) {}
+   
+   void push_impl(const std::vector<luaosutils::batch_result>& value)
+   {
+      lua_createtable(L, static_cast<int>(value.size()), 0);
+      for (size_t x = 0; x < value.size(); x++) {
+         lua_createtable(L, 0, 2);
+         LuaStack<bool>(L).push(value[x].success);
+         lua_setfield(L, -2, "success");
+         LuaStack<std::string>(L).push(value[x].data);
+         lua_setfield(L, -2, "data");
+         lua_rawseti(L, -2, static_cast<lua_Integer>(x + 1));
+      }
+   }
+   
+private:
+   lua_State* L;
+};
+
+template <>
+struct LuaStack<luaosutils::lua_value_pusher> {
+public:
+   LuaStack(lua_State* L) : L(L) {}
+   
+   void push_impl(const luaosutils::lua_value_pusher& value)
+   {
+      value(L);
+   }
+   
+private:
+   lua_State* L;
+};
+
+/** \brief Pushes the headers of a response as a userdata that reads them on demand, or nil if there was no response.
+ *
+ * Indexing the userdata with a header name in any case returns its value or nil, and `pairs` visits every
+ * header with lowercase names. The raw headers are not parsed until a script first reads one.
+ */
+template <>
+struct LuaStack<std::shared_ptr<luaosutils::response_info>> {
+public:
+   LuaStack(lua_State* L) : L(L) {}
+   
+   void push_impl(const std::shared_ptr<luaosutils::response_info>& value)
+   {
+      if (! value || ! value->statusCode)
+      {
+         lua_pushnil(L);
+         return;
+      }
+      new (lua_newuserdata(L, sizeof(std::shared_ptr<luaosutils::response_info>))) std::shared_ptr<luaosutils::response_info>(value);
+      if (luaL_newmetatable(L, kResponseHeadersMetatableKey))
+      {
+         lua_pushcfunction(L, headers_gc);
+         lua_setfield(L, -2, "__gc");
+         lua_pushcfunction(L, headers_index);
+         lua_setfield(L, -2, "__index");
+         lua_pushcfunction(L, headers_pairs);
+         lua_setfield(L, -2, "__pairs");
+      }
+      lua_setmetatable(L, -2);
+   }
+   
+private:
+   lua_State* L;
+   
+   static std::shared_ptr<luaosutils::response_info>* get_response(lua_State* L)
+   {
+      return static_cast<std::shared_ptr<luaosutils::response_info>*>(luaL_checkudata(L, 1, kResponseHeadersMetatableKey));
+   }
+   
+   static int headers_gc(lua_State* L)
+   {
+      using response_ptr = std::shared_ptr<luaosutils::response_info>;
+      get_response(L)->~response_ptr();
+      return 0;
+   }
+   
+   static int headers_index(lua_State* L)
+   {
+      const luaosutils::HeadersMap& headers = (*get_response(L))->headers();
+      if (lua_type(L, 2) != LUA_TSTRING)
+         return 0;
+      auto it = headers.find(luaosutils::lowercase_header_name(LuaStack<std::string>(L).get(2)));
+      if (it == headers.end())
+         return 0;
+      LuaStack<std::string>(L).push(it->second);
+      return 1;
+   }
+   
+   static int headers_next(lua_State* L)
+   {
+      const luaosutils::HeadersMap& headers = (*get_response(L))->headers();
+      auto it = lua_isnoneornil(L, 2) ? headers.begin() : headers.upper_bound(LuaStack<std::string>(L).get(2));
+      if (it == headers.end())
+         return 0;
+      LuaStack<std::string>(L).push(it->first);
+      LuaStack<std::string>(L).push(it->second);
+      return 2;
+   }
+   
+   static int headers_pairs(lua_State* L)
+   {
+      get_response(L);
+      lua_pushcfunction(L, headers_next);
+      lua_pushvalue(L, 1);
+      lua_pushnil(L);
+      return 3;
+   }
+};
+
+/** \brief Returns the status code of a response, or no value if the request failed before the server replied. */
+static std::optional<long long> response_status(const std::shared_ptr<luaosutils::response_info>& response)
+{
+   if (! response || ! response->statusCode)
+      return std::nullopt;
+   return response->statusCode;
+}
+
 static void LuaRun_AppendLineToOutput(lua_State * L, const char * str)
 {
    // I'm just guessing what this function should do, but this seems to make sense.
@@ -62,23 +189,48 @@ static void LuaRun_AppendLineToOutput(lua_State * L, const char * str)
    lua_pop(L, 1); // pop the function from the stack
 }
 
-/** \brief Calls a callback function in Lua.
+/** \brief Reports the error message on top of the Lua stack and pops it.
+ *
+ * \param L the Lua state
+ * \param reportErrors whether to show the error in a dialog box as well as printing it
+ */
+static void report_lua_error(lua_State* L, bool reportErrors)
+{
+   const char* errorMessage = lua_tostring(L, -1);
+   LuaRun_AppendLineToOutput(L, errorMessage);
+#if defined(LUAOSUTILS_RGPLUA_AWARE)
+   lua_getglobal(L, "finenv");
+   lua_getfield(L, -1, "RetainLuaState");
+   if (lua_isboolean(L, -1))
+   {
+      lua_pushboolean(L, 0);
+      lua_setfield(L, -3, "RetainLuaState");
+   }
+#endif // defined(LUAOSUTILS_RGPLUA_AWARE)
+   if (reportErrors)
+      luaosutils::error_message_box(errorMessage);
+   lua_pop(L, 1); // pop the error message from the stack
+}
+
+/** \brief Calls one of a session's callback functions in Lua.
  *
  * \param session the callback session
+ * \param function the registry reference of the Lua function to call
  * \param args the arguments to the Lua function to be called
  */
 template<typename... Args>
-static void call_lua_function(luaosutils::callback_session &session, Args... args)
+static void call_lua_function_ref(luaosutils::callback_session &session, int function, Args... args)
 {
    if (! luaosutils::callback_session::is_valid_session(&session)) // session has gone out of scope in Lua
       return;
+   LUAOSUTILS_TRACE_SCOPE("lua.callback");
    int customErrfuncIndex = 0;
    if (luaosutils_errfunc_callback)
    {
       lua_pushcfunction(session.state(), luaosutils_errfunc_callback);
       customErrfuncIndex = lua_gettop(session.state());
    }
-   lua_rawgeti(session.state(), LUA_REGISTRYINDEX, session.function());
+   lua_rawgeti(session.state(), LUA_REGISTRYINDEX, function);
    int nArgs = push_lua_args(session.state(), args...);
    int result = lua_pcall(session.state(), nArgs, 0, customErrfuncIndex);
    if (customErrfuncIndex)
@@ -87,30 +239,40 @@ static void call_lua_function(luaosutils::callback_session &session, Args... arg
       customErrfuncIndex = 0;
    }
    if (result != LUA_OK)
-   {
-      const char* errorMessage = lua_tostring(session.state(), -1);
-      LuaRun_AppendLineToOutput(session.state(), errorMessage);
-#if defined(LUAOSUTILS_RGPLUA_AWARE)
-      lua_getglobal(session.state(), "finenv");
-      lua_getfield(session.state(), -1, "RetainLuaState");
-      if (lua_isboolean(session.state(), -1))
-      {
-         lua_pushboolean(session.state(), 0);
-         lua_setfield(session.state(), -3, "RetainLuaState");
-      }
-#endif // defined(LUAOSUTILS_RGPLUA_AWARE)
-      if (session.report_errors())
-         luaosutils::error_message_box(errorMessage);
-      lua_pop(session.state(), 1); // pop the error message from the stack
-   }
+      report_lua_error(session.state(), session.report_errors());
 }
 
-static void create_luaosutils_callback_session(lua_State *L, luaosutils::OSSESSION_ptr& os_session,
-           int callback, luaosutils::callback_session::id_type sessionID)
+/** \brief Calls a session's callback function in Lua.
+ *
+ * \param session the callback session
+ * \param args the arguments to the Lua function to be called
+ */
+template<typename... Args>
+static void call_lua_function(luaosutils::callback_session &session, Args... args)
+{
+   call_lua_function_ref(session, session.function(), args...);
+}
+
+/** \brief Returns the main thread of a Lua state.
+ *
+ * Sessions call back into Lua on the main thread, because the thread that started a request may be a
+ * coroutine that has finished or is suspended by the time the request completes.
+ */
+static lua_State* main_lua_thread(lua_State* L)
+{
+   lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_MAINTHREAD);
+   lua_State* mainThread = lua_tothread(L, -1);
+   lua_pop(L, 1);
+   return mainThread;
+}
+
+static luaosutils::callback_session* create_luaosutils_callback_session(lua_State *L, luaosutils::OSSESSION_ptr& os_session,
+           int callback, luaosutils::callback_session::id_type sessionID, int chunkFunction = LUA_NOREF)
 {
    luaosutils::callback_session* session = new (lua_newuserdata(L, sizeof(luaosutils::callback_session)))
-                                 luaosutils::callback_session(L, callback, sessionID);
+                                 luaosutils::callback_session(main_lua_thread(L), callback, sessionID);
    session->set_os_session(os_session);
+   session->set_chunk_function(chunkFunction);
 
    // Create a metatable for the userdata through that object can be accessed with "gc". That means we get called when Lua state closes.
    if (luaL_newmetatable(L, luaosutils::kSessionMetatableKey))
@@ -125,117 +287,545 @@ static void create_luaosutils_callback_session(lua_State *L, luaosutils::OSSESSI
       lua_settable(L, -3);
    }
    lua_setmetatable(L, -2);
+   return session;
+}
+
+namespace luaosutils
+{
+
+callback_session* push_callback_session(lua_State* L, int callback, callback_session::id_type sessionID)
+{
+   OSSESSION_ptr os_session;
+   return create_luaosutils_callback_session(L, os_session, callback, sessionID);
+}
+
+void complete_callback_session(callback_session::id_type sessionID, const lua_value_pusher& argument)
+{
+   callback_session* session = callback_session::get_session_for_id(sessionID);
+   if (! session)
+      return;
+   call_lua_function(*session, argument);
+   session = callback_session::get_session_for_id(sessionID); // the callback may have let it be collected
+   if (session) session->cancel();
+}
+
+}
+
+/** \brief Returns the data a completion passes to Lua: a buffer if the request asked for one and succeeded, or otherwise a string. */
+static luaosutils::bytes_result response_data(bool success, std::string&& data, bool asBuffer)
+{
+   return luaosutils::make_bytes_result(std::move(data), success && asBuffer);
+}
+
+/** \brief Returns the completion function for an async request that calls the Lua callback and then closes the session.
+ *
+ * \param L the Lua state
+ * \param callback the registry reference to the Lua callback function
+ * \param sessionID the id of the callback session that owns the request
+ * \param response the response the request fills in, whose status and headers are passed after the data (may be null)
+ * \param asBuffer if true, the data is passed as a buffer instead of a string
+ */
+static luaosutils::lua_callback session_completion(lua_State *L, int callback, luaosutils::callback_session::id_type sessionID,
+                                                   const std::shared_ptr<luaosutils::response_info>& response = nullptr,
+                                                   bool asBuffer = false)
+{
+   lua_State* mainThread = main_lua_thread(L);
+   return [sessionID, mainThread, callback, response, asBuffer](bool success, std::string&& urlResult) -> void
+         {
+            luaosutils::callback_session* session = luaosutils::callback_session::get_session_for_id(sessionID);
+            if (session)
+            {
+               call_lua_function(*session, success, response_data(success, std::move(urlResult), asBuffer), response_status(response), response);
+               session = luaosutils::callback_session::get_session_for_id(sessionID); // the callback may have let it be collected
+               if (session) session->cancel();
+            }
+            else
+            {
+               luaosutils::callback_session temp(mainThread, callback, luaosutils::callback_session::get_new_session_id());
+               call_lua_function(temp, success, response_data(success, std::move(urlResult), asBuffer), response_status(response), response);
+            }
+         };
+}
+
+/** \brief Pushes the results of a completed request onto a Lua stack and returns how many it pushed. */
+using results_pusher = std::function<int(lua_State*)>;
+
+/** \brief Resumes the coroutine that is waiting for a session with the results of its request.
+ *
+ * The coroutine runs until it yields again or finishes. Since the request resumed it rather than a
+ * caller in Lua, anything it yields or returns is discarded, and an error is reported as a callback
+ * error would be. The session may be collected by the time this returns.
+ */
+static void resume_coroutine(luaosutils::callback_session& session, const results_pusher& results)
+{
+   lua_State* co = session.coroutine();
+   const bool reportErrors = session.report_errors();
+   const int coRef = session.release_coroutine(); // tells the continuation that these are the results
+   session.cancel();
+   if (lua_status(co) != LUA_YIELD)
+   {
+      luaL_unref(co, LUA_REGISTRYINDEX, coRef);
+      return;
+   }
+   LUAOSUTILS_TRACE_SCOPE("lua.resume");
+   const int nArgs = results(co);
+#if LUA_VERSION_NUM >= 504
+   int nResults = 0;
+   const int status = lua_resume(co, nullptr, nArgs, &nResults);
+#else
+   const int status = lua_resume(co, nullptr, nArgs);
+   const int nResults = (status == LUA_OK || status == LUA_YIELD) ? lua_gettop(co) : 0;
+#endif
+   if (status == LUA_OK || status == LUA_YIELD)
+      lua_pop(co, nResults);
+   else
+      report_lua_error(co, reportErrors);
+   luaL_unref(co, LUA_REGISTRYINDEX, coRef); // only now, since nothing else may reference the coroutine while it runs
+}
+
+/** \brief Connects a request made from a coroutine to the session whose userdata anchors the coroutine. */
+struct coroutine_request
+{
+   luaosutils::callback_session::id_type sessionID;
+   results_pusher earlyResults; // results that arrived before the coroutine yielded
+
+   coroutine_request(luaosutils::callback_session::id_type id) : sessionID(id) {}
+
+   void complete(results_pusher results)
+   {
+      luaosutils::callback_session* session = luaosutils::callback_session::get_session_for_id(sessionID);
+      if (session && session->coroutine())
+         resume_coroutine(*session, results);
+      else
+         earlyResults = std::move(results);
+   }
+};
+
+/** \brief Returns the completion function for an async request that resumes the coroutine that made it.
+ *
+ * \param request connects the request to its session
+ * \param response the response the request fills in, whose status and headers are passed after the data (may be null)
+ * \param asBuffer if true, the data is returned as a buffer instead of a string
+ */
+static luaosutils::lua_callback coroutine_completion(const std::shared_ptr<coroutine_request>& request,
+                                                     const std::shared_ptr<luaosutils::response_info>& response = nullptr,
+                                                     bool asBuffer = false)
+{
+   return [request, response, asBuffer](bool success, std::string&& urlResult) -> void
+         {
+            request->complete([success, data = response_data(success, std::move(urlResult), asBuffer), response](lua_State* L) -> int
+                  {
+                     return push_lua_args(L, success, data, response_status(response), response);
+                  });
+         };
+}
+
+/** \brief Continues an internet function after its coroutine resumes, returning the results of the request. */
+static int coroutine_continuation(lua_State* L, int /*status*/, lua_KContext ctx)
+{
+   const int sessionIndex = static_cast<int>(ctx);
+   auto session = static_cast<luaosutils::callback_session*>(lua_touserdata(L, sessionIndex));
+   if (session->coroutine()) // resumed by something other than the request: keep waiting
+   {
+      lua_settop(L, sessionIndex);
+      return lua_yieldk(L, 0, ctx, coroutine_continuation);
+   }
+   return lua_gettop(L) - sessionIndex;
+}
+
+/** \brief Yields the running coroutine until the request of the session on top of the stack completes.
+ *
+ * The session userdata stays on the coroutine's stack, and the session holds a registry reference to the
+ * coroutine until the request completes, so a script need not keep a reference to either while it waits.
+ *
+ * \param L the coroutine
+ * \param request the request of the session
+ * \return the results of the request, if it completed before the coroutine could yield
+ */
+static int yield_for_results(lua_State* L, const std::shared_ptr<coroutine_request>& request)
+{
+   const int sessionIndex = lua_gettop(L);
+   auto session = static_cast<luaosutils::callback_session*>(lua_touserdata(L, sessionIndex));
+   if (request->earlyResults)
+   {
+      session->cancel();
+      return request->earlyResults(L);
+   }
+   session->set_coroutine(L);
+   return lua_yieldk(L, 0, static_cast<lua_KContext>(sessionIndex), coroutine_continuation);
+}
+
+/** \brief Returns the registry reference of the completion callback, or LUA_NOREF if the calling coroutine
+ * should instead yield until the request completes.
+ *
+ * \param L the Lua state
+ * \param index the stack position of the callback
+ */
+static int get_completion_callback(lua_State *L, int index)
+{
+   if (lua_isnoneornil(L, index) && lua_isyieldable(L))
+      return LUA_NOREF;
+   return get_lua_parameter<int>(L, index, LUA_TFUNCTION);
+}
+
+/** \brief Reads the `connect` and `first_byte` fields of a timeouts table into the request options.
+ *
+ * \param L the Lua state
+ * \param index the stack position of the timeouts table
+ * \param options receives the timeouts that are present
+ */
+static void get_request_timeouts(lua_State *L, int index, luaosutils::request_options& options)
+{
+   if (lua_getfield(L, index, "connect") == LUA_TNUMBER)
+      options.connectTimeout = (std::max)(0.0, lua_tonumber(L, -1));
+   lua_pop(L, 1);
+   if (lua_getfield(L, index, "first_byte") == LUA_TNUMBER)
+      options.firstByteTimeout = (std::max)(0.0, lua_tonumber(L, -1));
+   lua_pop(L, 1);
+}
+
+/** \brief Returns the total timeout for a sync request, which is either a number or a table of timeouts.
+ *
+ * \param L the Lua state
+ * \param index the stack position of the timeout
+ * \param options receives the connect and first-byte timeouts when the timeout is a table
+ */
+static double get_sync_timeout(lua_State *L, int index, luaosutils::request_options& options)
+{
+   if (lua_type(L, index) != LUA_TTABLE)
+      return (std::max)(0.0, get_lua_parameter<double>(L, index, LUA_TNUMBER));
+   get_request_timeouts(L, index, options);
+   if (lua_getfield(L, index, "total") != LUA_TNUMBER)
+   {
+      luaosutils::note_stats_error();
+      luaL_error(L, "param %d timeouts table requires a total", index);
+   }
+   const double total = (std::max)(0.0, lua_tonumber(L, -1));
+   lua_pop(L, 1);
+   return total;
+}
+
+/** \brief Returns the options for an async request, including a chunk callback that calls the session's `on_chunk` function.
+ *
+ * The options always include a response_info, so that the completion callback can report the status and headers.
+ *
+ * \param L the Lua state
+ * \param index the stack position of the optional options table
+ * \param sessionID the id of the callback session that owns the request
+ * \param chunkFunction receives the registry reference to the `on_chunk` function or LUA_NOREF
+ */
+static luaosutils::request_options get_request_options(lua_State *L, int index, luaosutils::callback_session::id_type sessionID, int& chunkFunction)
+{
+   luaosutils::request_options options;
+   options.response = std::make_shared<luaosutils::response_info>();
+   chunkFunction = LUA_NOREF;
+   if (lua_isnoneornil(L, index))
+      return options;
+   check_lua_parameter_type(L, index, LUA_TTABLE);
+   if (lua_getfield(L, index, "cache") == LUA_TBOOLEAN)
+      options.useCache = lua_toboolean(L, -1);
+   lua_pop(L, 1);
+   if (lua_getfield(L, index, "timeouts") == LUA_TTABLE)
+      get_request_timeouts(L, lua_gettop(L), options);
+   lua_pop(L, 1);
+   if (lua_getfield(L, index, "on_chunk") == LUA_TFUNCTION)
+   {
+      chunkFunction = luaL_ref(L, LUA_REGISTRYINDEX); // pops the function
+      options.chunkCallback = [sessionID](const std::string& chunk, size_t bytesSoFar, long long contentLength) -> void
+            {
+               luaosutils::callback_session* session = luaosutils::callback_session::get_session_for_id(sessionID);
+               if (session)
+                  call_lua_function_ref(*session, session->chunk_function(), chunk, static_cast<long long>(bytesSoFar),
+                                        contentLength >= 0 ? std::optional<long long>(contentLength) : std::nullopt);
+            };
+   }
+   else
+      lua_pop(L, 1);
+   return options;
+}
+
+/** \brief Returns true if the optional request options table at \p index has `buffer = true`.
+ *
+ * \param L the Lua state
+ * \param index the stack position of the optional options table, which get_request_options has already checked
+ */
+static bool get_buffer_option(lua_State *L, int index)
+{
+   if (lua_type(L, index) != LUA_TTABLE)
+      return false;
+   const bool asBuffer = (lua_getfield(L, index, "buffer") == LUA_TBOOLEAN) && lua_toboolean(L, -1);
+   lua_pop(L, 1);
+   return asBuffer;
 }
 
 /** \brief downloads the contents of a url into a string
  *
  * stack position 1: the url to download
- * stack position 2: a reference to a lua function to call on completion
+ * stack position 2: a reference to a lua function to call on completion (optional in a coroutine, which then yields)
  * stack position 3: optional HTTP headers
- * \return download session or nil
+ * stack position 4: optional table of request options (`buffer`, `cache`, `on_chunk`, `timeouts`)
+ * \return download session or nil, or the results of the request when the calling coroutine yields
  */
 static int luaosutils_internet_get(lua_State *L)
 {
    auto urlString = get_lua_parameter<std::string>(L, 1, LUA_TSTRING);
-   auto callback = get_lua_parameter<int>(L, 2, LUA_TFUNCTION);
+   auto callback = get_completion_callback(L, 2);
    auto headers = get_lua_parameter<luaosutils::HeadersMap>(L, 3, LUA_TTABLE, luaosutils::HeadersMap());
    
    luaosutils::callback_session::id_type sessionID = luaosutils::callback_session::get_new_session_id();
+   int chunkFunction;
+   auto options = get_request_options(L, 4, sessionID, chunkFunction);
+   const bool asBuffer = get_buffer_option(L, 4);
+   auto request = (callback == LUA_NOREF) ? std::make_shared<coroutine_request>(sessionID) : nullptr;
       
-   luaosutils::OSSESSION_ptr os_session = luaosutils::https_request("get", urlString, "", headers, -1,
-         [sessionID, L, callback](bool success, const std::string &urlResult) -> void
-         {
-            luaosutils::callback_session* session = luaosutils::callback_session::get_session_for_id(sessionID);
-            if (session)
-            {
-               call_lua_function(*session, success, urlResult);
-               session->cancel();
-            }
-            else
-            {
-               luaosutils::callback_session temp(L, callback, luaosutils::callback_session::get_new_session_id());
-               call_lua_function(temp, success, urlResult);
-            }
-         });
+   luaosutils::OSSESSION_ptr os_session = luaosutils::cached_https_request("get", urlString, "", headers, -1,
+         request ? coroutine_completion(request, options.response, asBuffer)
+                 : session_completion(L, callback, sessionID, options.response, asBuffer), options);
 
+   if (request)
+   {
+      create_luaosutils_callback_session(L, os_session, callback, sessionID, chunkFunction);
+      return yield_for_results(L, request);
+   }
    if (os_session)
    {
-      create_luaosutils_callback_session(L, os_session, callback, sessionID);
+      create_luaosutils_callback_session(L, os_session, callback, sessionID, chunkFunction);
       return 1;
    }
    
+   luaosutils::callback_session::release_session_id(sessionID);
+   luaL_unref(L, LUA_REGISTRYINDEX, chunkFunction);
    return 0;
 }
 
 /** \brief downloads the contents of a url into a string synchronously (blocks the UI)
  *
  * stack position 1: the url to download
- * stack position 2: a timeout value
+ * stack position 2: a timeout value, or a table of timeouts (`total`, `connect`, `first_byte`)
  * stack position 3: optional HTTP headers
  * \return success
  * \return data or error message
+ * \return status code or nil
+ * \return headers or nil
  */
 static int luaosutils_internet_get_sync(lua_State *L)
 {
+   luaosutils::request_options options;
+   options.response = std::make_shared<luaosutils::response_info>();
    auto urlString = get_lua_parameter<std::string>(L, 1, LUA_TSTRING);
-   auto timeout = (std::max)(0.0, get_lua_parameter<double>(L, 2, LUA_TNUMBER));
+   auto timeout = get_sync_timeout(L, 2, options);
    auto headers = get_lua_parameter<luaosutils::HeadersMap>(L, 3, LUA_TTABLE, luaosutils::HeadersMap());
    
    bool success = false;
    std::string result;
    
-   luaosutils::https_request("get", urlString, "", headers, timeout,
-            [&success, &result](bool cbsuccess, const std::string &data) -> void
+   luaosutils::cached_https_request("get", urlString, "", headers, timeout,
+            [&success, &result](bool cbsuccess, std::string&& data) -> void
                   {
                      success = cbsuccess;
-                     result = data;
-                  });
+                     result = std::move(data);
+                  }, options);
    
    LuaStack<bool>(L).push(success);
    LuaStack<std::string>(L).push(result);
-   return 2;
+   push_lua_args(L, response_status(options.response), options.response);
+   return 4;
 }
 
 
-/** \brief post data to a url and returns the reply in a string
+/** \brief downloads the contents of a url directly into a file
  *
- * stack position 1: the url to post to
- * stack position 2: the post data (string)
- * stack position 3: a reference to a lua function to call on completion
+ * stack position 1: the url to download
+ * stack position 2: the path of the file to create or replace
+ * stack position 3: a reference to a lua function to call on completion (optional in a coroutine, which then yields)
  * stack position 4: optional HTTP headers
- * \return download session or nil
+ * stack position 5: optional table of download options (`segments`, `resume`)
+ * \return download session or nil, or the results of the download when the calling coroutine yields
  */
-int luaosutils_internet_post(lua_State *L)
+static int luaosutils_internet_download_to_file(lua_State *L)
 {
    auto urlString = get_lua_parameter<std::string>(L, 1, LUA_TSTRING);
-   auto postData = get_lua_parameter<std::string>(L, 2, LUA_TSTRING);
-   auto callback = get_lua_parameter<int>(L, 3, LUA_TFUNCTION);
+   auto filePath = get_lua_parameter<std::string>(L, 2, LUA_TSTRING);
+   auto callback = get_completion_callback(L, 3);
    auto headers = get_lua_parameter<luaosutils::HeadersMap>(L, 4, LUA_TTABLE, luaosutils::HeadersMap());
-   
+
+   luaosutils::segmented_download_options options;
+   options.segments = 1;
+   options.resume = false;
+   if (! lua_isnoneornil(L, 5))
+   {
+      check_lua_parameter_type(L, 5, LUA_TTABLE);
+      if (lua_getfield(L, 5, "segments") == LUA_TNUMBER)
+         options.segments = static_cast<size_t>((std::max)(lua_Integer(1), lua_tointeger(L, -1)));
+      lua_pop(L, 1);
+      if (lua_getfield(L, 5, "resume") == LUA_TBOOLEAN)
+         options.resume = lua_toboolean(L, -1);
+      lua_pop(L, 1);
+   }
+
    luaosutils::callback_session::id_type sessionID = luaosutils::callback_session::get_new_session_id();
-   
-   luaosutils::OSSESSION_ptr os_session = luaosutils::https_request("post", urlString, postData, headers, -1,
-         [sessionID, L, callback](bool success, const std::string &urlResult) -> void
+   auto request = (callback == LUA_NOREF) ? std::make_shared<coroutine_request>(sessionID) : nullptr;
+   auto completion = request ? coroutine_completion(request) : session_completion(L, callback, sessionID);
+
+   if (options.segments > 1 || options.resume)
+   {
+      auto download = std::make_unique<luaosutils::segmented_download>(urlString, filePath, headers, options, completion);
+      // The session must exist before the download starts, so that immediate failures find it.
+      luaosutils::segmented_download* pDownload = download.get();
+      luaosutils::OSSESSION_ptr os_session;
+      luaosutils::callback_session* session = create_luaosutils_callback_session(L, os_session, callback, sessionID);
+      session->set_segmented_download(download);
+      pDownload->start();
+      return request ? yield_for_results(L, request) : 1;
+   }
+
+   luaosutils::OSSESSION_ptr os_session = luaosutils::https_download_to_file(urlString, filePath, headers, completion);
+
+   if (request)
+   {
+      create_luaosutils_callback_session(L, os_session, callback, sessionID);
+      return yield_for_results(L, request);
+   }
+   if (os_session)
+   {
+      create_luaosutils_callback_session(L, os_session, callback, sessionID);
+      return 1;
+   }
+
+   luaosutils::callback_session::release_session_id(sessionID);
+   return 0;
+}
+
+/** \brief downloads a list of urls with a limited number of requests in flight and returns all the results at once
+ *
+ * stack position 1: array of urls, each either a string or a table with `url` and optional `headers` fields
+ * stack position 2: optional table of options (`max_concurrent`, `share_connections`)
+ * stack position 3: a reference to a lua function to call when every request has completed (optional in a coroutine, which then yields)
+ * \return download session, or the results when the calling coroutine yields
+ */
+static int luaosutils_internet_get_many(lua_State *L)
+{
+   check_lua_parameter_type(L, 1, LUA_TTABLE);
+   std::vector<luaosutils::batch_request> requests;
+   const lua_Integer numRequests = luaL_len(L, 1);
+   requests.reserve(static_cast<size_t>((std::max)(lua_Integer(0), numRequests)));
+   for (lua_Integer x = 1; x <= numRequests; x++)
+   {
+      luaosutils::batch_request request;
+      const int type = lua_rawgeti(L, 1, x);
+      if (type == LUA_TSTRING)
+         request.url = LuaStack<std::string>(L).get(-1);
+      else if (type == LUA_TTABLE)
+      {
+         if (lua_getfield(L, -1, "url") == LUA_TSTRING)
+            request.url = LuaStack<std::string>(L).get(-1);
+         lua_pop(L, 1);
+         if (lua_getfield(L, -1, "headers") == LUA_TTABLE)
+            request.headers = LuaStack<luaosutils::HeadersMap>(L).get(lua_gettop(L));
+         lua_pop(L, 1);
+      }
+      lua_pop(L, 1);
+      if (request.url.empty())
+      {
+         luaosutils::note_stats_error();
+         luaL_error(L, "request %d has no url", static_cast<int>(x));
+      }
+      requests.push_back(std::move(request));
+   }
+
+   lua_Integer maxConcurrent = 6;
+   bool shareConnections = true;
+   if (! lua_isnoneornil(L, 2))
+   {
+      check_lua_parameter_type(L, 2, LUA_TTABLE);
+      if (lua_getfield(L, 2, "max_concurrent") == LUA_TNUMBER)
+         maxConcurrent = (std::max)(lua_Integer(1), lua_tointeger(L, -1));
+      lua_pop(L, 1);
+      if (lua_getfield(L, 2, "share_connections") == LUA_TBOOLEAN)
+         shareConnections = lua_toboolean(L, -1);
+      lua_pop(L, 1);
+   }
+   if (! shareConnections)
+   {
+      for (auto& request : requests)
+         request.headers["Connection"] = "close";
+   }
+
+   auto callback = get_completion_callback(L, 3);
+
+   luaosutils::callback_session::id_type sessionID = luaosutils::callback_session::get_new_session_id();
+   auto request = (callback == LUA_NOREF) ? std::make_shared<coroutine_request>(sessionID) : nullptr;
+   lua_State* mainThread = main_lua_thread(L);
+   auto batch = std::make_unique<luaosutils::request_batch>(std::move(requests), static_cast<size_t>(maxConcurrent),
+         [sessionID, mainThread, callback, request](const std::vector<luaosutils::batch_result>& results) -> void
          {
+            if (request)
+            {
+               request->complete([results](lua_State* L) -> int { return push_lua_args(L, results); });
+               return;
+            }
             luaosutils::callback_session* session = luaosutils::callback_session::get_session_for_id(sessionID);
             if (session)
             {
-               call_lua_function(*session, success, urlResult);
-               session->cancel();
+               call_lua_function(*session, results);
+               session = luaosutils::callback_session::get_session_for_id(sessionID); // the callback may have let it be collected
+               if (session) session->cancel();
             }
             else
             {
-               luaosutils::callback_session temp(L, callback, luaosutils::callback_session::get_new_session_id());
-               call_lua_function(temp, success, urlResult);
+               luaosutils::callback_session temp(mainThread, callback, luaosutils::callback_session::get_new_session_id());
+               call_lua_function(temp, results);
             }
-      });
+         });
+
+   // The session must exist before the batch starts, so that immediate failures find it.
+   luaosutils::request_batch* pBatch = batch.get();
+   luaosutils::OSSESSION_ptr os_session;
+   luaosutils::callback_session* session = create_luaosutils_callback_session(L, os_session, callback, sessionID);
+   session->set_batch(batch);
+   pBatch->start();
+   return request ? yield_for_results(L, request) : 1;
+}
 
+/** \brief post data to a url and returns the reply in a string
+ *
+ * stack position 1: the url to post to
+ * stack position 2: the post data (string or buffer)
+ * stack position 3: a reference to a lua function to call on completion (optional in a coroutine, which then yields)
+ * stack position 4: optional HTTP headers
+ * stack position 5: optional table of request options (`buffer`, `cache`, `on_chunk`, `timeouts`)
+ * \return download session or nil, or the results of the request when the calling coroutine yields
+ */
+int luaosutils_internet_post(lua_State *L)
+{
+   auto urlString = get_lua_parameter<std::string>(L, 1, LUA_TSTRING);
+   auto postData = get_lua_parameter<std::string_view>(L, 2, LUA_TSTRING);
+   auto callback = get_completion_callback(L, 3);
+   auto headers = get_lua_parameter<luaosutils::HeadersMap>(L, 4, LUA_TTABLE, luaosutils::HeadersMap());
+   
+   luaosutils::callback_session::id_type sessionID = luaosutils::callback_session::get_new_session_id();
+   int chunkFunction;
+   auto options = get_request_options(L, 5, sessionID, chunkFunction);
+   const bool asBuffer = get_buffer_option(L, 5);
+   auto request = (callback == LUA_NOREF) ? std::make_shared<coroutine_request>(sessionID) : nullptr;
+   
+   luaosutils::OSSESSION_ptr os_session = luaosutils::https_request("post", urlString, postData, headers, -1,
+         request ? coroutine_completion(request, options.response, asBuffer)
+                 : session_completion(L, callback, sessionID, options.response, asBuffer), options);
+
+   if (request)
+   {
+      create_luaosutils_callback_session(L, os_session, callback, sessionID, chunkFunction);
+      return yield_for_results(L, request);
+   }
    if (os_session)
    {
-      create_luaosutils_callback_session(L, os_session, callback, sessionID);
+      create_luaosutils_callback_session(L, os_session, callback, sessionID, chunkFunction);
       return 1;
    }
    
+   luaosutils::callback_session::release_session_id(sessionID);
+   luaL_unref(L, LUA_REGISTRYINDEX, chunkFunction);
    return 0;
 }
 
@@ -243,11 +833,13 @@ int luaosutils_internet_post(lua_State *L)
 /** \brief downloads the contents of a url into a string synchronously (blocks the UI)
  *
  * stack position 1: the url to post to
- * stack position 2: the post data (string)
- * stack position 3: a timeout value
+ * stack position 2: the post data (string or buffer)
+ * stack position 3: a timeout value, or a table of timeouts (`total`, `connect`, `first_byte`)
  * stack position 4: optional HTTP headers
  * \return success
  * \return data or error message
+ * \return status code or nil
+ * \return headers or nil
  */
 
 /** \brief launch the url in the user's default browsert
@@ -257,97 +849,147 @@ int luaosutils_internet_post(lua_State *L)
 int luaosutils_internet_post_sync(lua_State *L)
 {
    auto urlString = get_lua_parameter<std::string>(L, 1, LUA_TSTRING);
-   auto postData = get_lua_parameter<std::string>(L, 2, LUA_TSTRING);
-   auto timeout = (std::max)(0.0, get_lua_parameter<double>(L, 3, LUA_TNUMBER));
+   auto postData = get_lua_parameter<std::string_view>(L, 2, LUA_TSTRING);
+   luaosutils::request_options options;
+   options.response = std::make_shared<luaosutils::response_info>();
+   auto timeout = get_sync_timeout(L, 3, options);
    auto headers = get_lua_parameter<luaosutils::HeadersMap>(L, 4, LUA_TTABLE, luaosutils::HeadersMap());
    
    bool success = false;
    std::string result;
    
    luaosutils::https_request("post", urlString, postData, headers, timeout,
-                  [&success, &result](bool cbsuccess, const std::string &data) -> void
+                  [&success, &result](bool cbsuccess, std::string&& data) -> void
                               {
                                  success = cbsuccess;
-                                 result = data;
-                              });
+                                 result = std::move(data);
+                              }, options);
    
    LuaStack<bool>(L).push(success);
    LuaStack<std::string>(L).push(result);
-   return 2;
+   push_lua_args(L, response_status(options.response), options.response);
+   return 4;
 }
 
-static int luaosutils_internet_url_escape(lua_State* L)
+static std::nullptr_t luaosutils_internet_cancel_session(std::optional<luaosutils::callback_session*> session)
 {
-   auto input = get_lua_parameter<std::string>(L, 1, LUA_TSTRING);
-   std::string result = luaosutils::url_escape(input);
-   LuaStack<std::string>(L).push(result);
-   return 1;
+   if (session.has_value()) session.value()->cancel();
+   return nullptr; // returns nil so that scripts can clear their reference in the same statement
 }
 
-static int luaosutils_internet_cancel_session(lua_State* L)
+static void luaosutils_internet_report_errors(std::optional<luaosutils::callback_session*> session, bool state)
 {
-   auto session = get_lua_parameter<luaosutils::callback_session*>(L, 1, LUA_TUSERDATA, nullptr, luaosutils::kSessionMetatableKey);
-   if (session) session->cancel();
-   lua_pushnil(L);
-   return 1;
+   if (session.has_value()) session.value()->set_report_errors(state);
 }
 
-static int luaosutils_internet_report_errors(lua_State* L)
+/** \brief configures the process-wide connection pool
+ *
+ * stack position 1: table of options (`max_per_host`, `idle_timeout`). Missing fields keep their current values.
+ * \return nil
+ */
+static int luaosutils_internet_set_connection_pool(lua_State *L)
 {
-   auto session = get_lua_parameter<luaosutils::callback_session*>(L, 1, LUA_TUSERDATA, nullptr, luaosutils::kSessionMetatableKey);
-   auto state = get_lua_parameter<luaosutils::callback_session*>(L, 2, LUA_TBOOLEAN);
-   if (session) session->set_report_errors(state);
+   check_lua_parameter_type(L, 1, LUA_TTABLE);
+   luaosutils::connection_pool_options options = luaosutils::get_connection_pool_options();
+   if (lua_getfield(L, 1, "max_per_host") == LUA_TNUMBER)
+      options.maxConnectionsPerHost = (std::max)(1, static_cast<int>(lua_tointeger(L, -1)));
+   lua_pop(L, 1);
+   if (lua_getfield(L, 1, "idle_timeout") == LUA_TNUMBER)
+      options.idleTimeoutSeconds = (std::max)(0.0, lua_tonumber(L, -1));
+   lua_pop(L, 1);
+   luaosutils::set_connection_pool_options(options);
    return 0;
 }
 
-static int luaosutils_internet_server_name(lua_State *L)
+/** \brief returns the connection pool counters
+ *
+ * stack position 1: (optional) if true, the counters are reset after they are read
+ * \return table with `hits` and `misses`
+ */
+static int luaosutils_internet_connection_pool_stats(lua_State *L)
 {
-   auto urlString = get_lua_parameter<std::string>(L, 1, LUA_TSTRING);
-   std::string result = luaosutils::server_name(urlString);
-   LuaStack<std::string>(L).push(result);
+   auto reset = get_lua_parameter<bool>(L, 1, LUA_TBOOLEAN, false);
+   const luaosutils::connection_pool_stats stats = luaosutils::get_connection_pool_stats(reset);
+   lua_newtable(L);
+   lua_pushinteger(L, static_cast<lua_Integer>(stats.hits));
+   lua_setfield(L, -2, "hits");
+   lua_pushinteger(L, static_cast<lua_Integer>(stats.misses));
+   lua_setfield(L, -2, "misses");
    return 1;
 }
 
-static int luaosutils_internet_launch_website(lua_State *L)
+/** \brief configures the on-disk response cache
+ *
+ * stack position 1: table of options (`directory`, `max_size`, `stale_while_revalidate`) or nil to disable the cache
+ * \return nil
+ */
+static int luaosutils_internet_set_response_cache(lua_State *L)
 {
-   auto urlString = get_lua_parameter<std::string>(L, 1, LUA_TSTRING);
+   luaosutils::response_cache_options options;
+   if (! lua_isnoneornil(L, 1))
+   {
+      check_lua_parameter_type(L, 1, LUA_TTABLE);
+      options = luaosutils::get_response_cache_options();
+      if (lua_getfield(L, 1, "directory") == LUA_TSTRING)
+         options.directory = LuaStack<std::string>(L).get(-1);
+      lua_pop(L, 1);
+      if (lua_getfield(L, 1, "max_size") == LUA_TNUMBER)
+         options.maxBytes = static_cast<unsigned long long>((std::max)(lua_Integer(0), lua_tointeger(L, -1)));
+      lua_pop(L, 1);
+      if (lua_getfield(L, 1, "stale_while_revalidate") == LUA_TBOOLEAN)
+         options.staleWhileRevalidate = lua_toboolean(L, -1);
+      lua_pop(L, 1);
+   }
+   luaosutils::set_response_cache_options(options);
+   return 0;
+}
 
+static void luaosutils_internet_launch_website(std::string urlString)
+{
    if (urlString.size() > 0 && urlString[0] != '\"')
       urlString = '\"' + urlString + '\"';
 
-   urlString = WINCODE("cmd /c start \"\" ") MACCODE("open ") + urlString;
+   urlString = WINCODE("cmd /c start \"\" ") MACCODE("open ") LINUXCODE("xdg-open ") + urlString;
    luaosutils::process_launch(urlString, "");
-   
-   return 0;
 }
 
 static const luaL_Reg internet_utils[] = {
    {"download_url",        luaosutils_internet_get},        // alias for backwards compatibility
    {"download_url_sync",   luaosutils_internet_get_sync},   // alias for backwards compatibility
+   {"download_to_file",    luaosutils_internet_download_to_file},
    {"get",                 luaosutils_internet_get},
    {"get_sync",            luaosutils_internet_get_sync},
+   {"get_many",            luaosutils_internet_get_many},
    {"post",                luaosutils_internet_post},
    {"post_sync",           luaosutils_internet_post_sync},
-   {"cancel_session",      luaosutils_internet_cancel_session},
-   {"report_errors",       luaosutils_internet_report_errors},
-   {"launch_website",      luaosutils_internet_launch_website},
-   {"server_name",         luaosutils_internet_server_name},
-   {"url_escape",          luaosutils_internet_url_escape},
+   {"cancel_session",      lua_bind<luaosutils_internet_cancel_session>},
+   {"report_errors",       lua_bind<luaosutils_internet_report_errors>},
+   {"set_connection_pool", luaosutils_internet_set_connection_pool},
+   {"connection_pool_stats", luaosutils_internet_connection_pool_stats},
+   {"set_response_cache",  luaosutils_internet_set_response_cache},
+   {"launch_website",      lua_bind<luaosutils_internet_launch_website>},
+   {"server_name",         lua_bind<luaosutils::server_name>},
+   {"url_escape",          lua_bind<luaosutils::url_escape>},
    {NULL, NULL} // sentinel
 };
 
 static const luaL_Reg internet_utils_restricted[] = {
    {"download_url",        restricted_function},         // alias for backwards compatibility
    {"download_url_sync",   restricted_function},         // alias for backwards compatibility
+   {"download_to_file",    restricted_function},
    {"get",                 restricted_function},
    {"get_sync",            restricted_function},
+   {"get_many",            restricted_function},
    {"post",                restricted_function},
    {"post_sync",           restricted_function},
    {"cancel_session",      restricted_function},
    {"report_errors",       restricted_function},
-   {"launch_website",      luaosutils_internet_launch_website},
-   {"server_name",         luaosutils_internet_server_name},
-   {"url_escape",          luaosutils_internet_url_escape},
+   {"set_connection_pool", restricted_function},
+   {"connection_pool_stats", restricted_function},
+   {"set_response_cache",  restricted_function},
+   {"launch_website",      lua_bind<luaosutils_internet_launch_website>},
+   {"server_name",         lua_bind<luaosutils::server_name>},
+   {"url_escape",          lua_bind<luaosutils::url_escape>},
    {NULL, NULL} // sentinel
 };
 
@@ -356,6 +998,6 @@ void luaosutils_internet_create(lua_State *L, bool restricted)
    lua_newtable(L);  // create nested table
    
    const luaL_Reg* funcs = restricted ? internet_utils_restricted : internet_utils;
-   luaL_setfuncs(L, funcs, 0);            // add file methods to new metatable
+   luaosutils::set_counted_funcs(L, funcs, "internet"); // add file methods to new metatable
    lua_setfield(L, -2, "internet");       // add the nested table to the parent table with the name
 }
@@ -0,0 +1,75 @@
+//
+//  luaosutils_internet_batch.cpp
+//  luaosutils
+//
+//  (Usage permitted by MIT License. See LICENSE file in this repository.)
+//
+
+#include <algorithm>
+
+#include "luaosutils.hpp"
+#include "internet/luaosutils_internet_batch.h"
+#include "internet/luaosutils_internet_cache.h"
+
+namespace luaosutils
+{
+
+request_batch::request_batch(std::vector<batch_request> requests, size_t maxConcurrent, batch_callback callback) :
+            m_requests(std::move(requests)),
+            m_results(m_requests.size()),
+            m_maxConcurrent((std::max)(size_t(1), maxConcurrent)),
+            m_callback(callback)
+{
+}
+
+request_batch::~request_batch()
+{
+   m_running.clear(); // cancels the requests that are still running, so their callbacks never reach this batch
+}
+
+void request_batch::finish()
+{
+   batch_callback callback = m_callback; // the callback may destroy this batch
+   const std::vector<batch_result> results = std::move(m_results);
+   callback(results);
+}
+
+void request_batch::start()
+{
+   start_requests();
+   if (m_numCompleted == m_requests.size())
+      finish();
+}
+
+void request_batch::start_requests()
+{
+   m_starting = true;
+   while (m_running.size() < m_maxConcurrent && m_nextRequest < m_requests.size())
+   {
+      const size_t index = m_nextRequest++;
+      OSSESSION_ptr session = cached_https_request("get", m_requests[index].url, "", m_requests[index].headers, -1,
+            [this, index](bool success, std::string&& data) -> void
+            {
+               complete_request(index, success, std::move(data));
+            });
+      if (session && ! m_results[index].finished) // an immediate failure has already called back
+         m_running.emplace(index, std::move(session));
+   }
+   m_starting = false;
+}
+
+void request_batch::complete_request(size_t index, bool success, std::string&& data)
+{
+   m_results[index].finished = true;
+   m_results[index].success = success;
+   m_results[index].data = std::move(data);
+   m_numCompleted++;
+   m_running.erase(index); // OS sessions allow themselves to be destroyed from inside their callbacks
+   if (m_starting) // an immediate failure from https_request; the loop in start_requests continues
+      return;
+   start_requests();
+   if (m_numCompleted == m_requests.size())
+      finish();
+}
+
+}
@@ -0,0 +1,67 @@
+//
+//  luaosutils_internet_batch.h
+//  luaosutils
+//
+//  (Usage permitted by MIT License. See LICENSE file in this repository.)
+//
+
+#ifndef luaosutils_internet_batch_h
+#define luaosutils_internet_batch_h
+
+#include <vector>
+#include <map>
+
+#include "internet/luaosutils_internet_os.h"
+
+namespace luaosutils
+{
+
+struct batch_request
+{
+   std::string url;
+   HeadersMap headers;
+};
+
+struct batch_result
+{
+   bool finished{};
+   bool success{};
+   std::string data;
+};
+
+using batch_callback = std::function<void (const std::vector<batch_result>& results)>;
+
+/** \brief Runs a list of async `GET` requests with at most a fixed number in flight at once.
+ *
+ * Each request starts as soon as an earlier one finishes, and the callback runs once, on the main thread,
+ * with the results in the same order as the requests. Destroying the batch cancels any requests still running.
+ */
+class request_batch
+{
+   std::vector<batch_request> m_requests;
+   std::vector<batch_result> m_results;
+   std::map<size_t, OSSESSION_ptr> m_running;
+   size_t m_nextRequest{};
+   size_t m_numCompleted{};
+   size_t m_maxConcurrent;
+   bool m_starting{};
+   batch_callback m_callback;
+
+   void start_requests();
+   void complete_request(size_t index, bool success, std::string&& data);
+   void finish();
+
+public:
+   request_batch(std::vector<batch_request> requests, size_t maxConcurrent, batch_callback callback);
+   ~request_batch();
+
+   request_batch(const request_batch&) = delete;
+   request_batch& operator=(const request_batch&) = delete;
+
+   /** \brief Starts the first requests. The callback may run before this returns if every request fails immediately. */
+   void start();
+};
+
+}
+
+#endif /* luaosutils_internet_batch_h */
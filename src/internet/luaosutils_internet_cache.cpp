@@ -0,0 +1,399 @@
+//
+//  luaosutils_internet_cache.cpp
+//  luaosutils
+//
+//  (Usage permitted by MIT License. See LICENSE file in this repository.)
+//
+//  The cache directory holds one "<key>.body" file per response and an "index.txt" file that
+//  lists the entries from least to most recently used. The index is rewritten atomically
+//  whenever it changes, so a crash leaves either the old index or the new one.
+//
+
+#include <list>
+#include <vector>
+#include <map>
+#include <set>
+#include <mutex>
+#include <cstdio>
+#include <cstdlib>
+#include <cinttypes>
+
+#include "luaosutils.hpp"
+#include "internet/luaosutils_internet_cache.h"
+#include "internet/luaosutils_internet_utils.h"
+
+namespace luaosutils
+{
+
+static const char* kIndexFileName = "index.txt";
+static const char* kIndexSignature = "luaosutils-cache 2";
+static const int kHTTPStatusOK = 200;
+static const int kHTTPStatusNotModified = 304;
+
+struct cache_entry
+{
+   std::string key;
+   std::string url;
+   std::string etag;
+   std::string lastModified;
+   std::string vary;    // the request headers named by the response's Vary header, lowercase and comma-separated
+   unsigned long long size{};
+};
+
+/** \brief Returns the value of a request header, matching its name without regard to case. */
+static const std::string* find_request_header(const HeadersMap& headers, const std::string& lowercaseName)
+{
+   for (const auto& header : headers)
+   {
+      if (lowercase_header_name(header.first) == lowercaseName)
+         return &header.second;
+   }
+   return nullptr;
+}
+
+/** \brief Returns true if a request carries credentials, whose responses must not be served to other requests. */
+static bool has_credentials(const HeadersMap& headers)
+{
+   return find_request_header(headers, "authorization") || find_request_header(headers, "proxy-authorization")
+            || find_request_header(headers, "cookie");
+}
+
+/** \brief Returns the header names in a Vary header, lowercase and comma-separated. Returns "*" if it contains "*". */
+static std::string parse_vary(const std::string& vary)
+{
+   std::string result;
+   size_t start = 0;
+   while (start <= vary.size())
+   {
+      size_t comma = vary.find(',', start);
+      if (comma == std::string::npos) comma = vary.size();
+      std::string name = vary.substr(start, comma - start);
+      name.erase(0, name.find_first_not_of(" \t"));
+      name.erase(name.find_last_not_of(" \t") + 1);
+      if (name == "*")
+         return name;
+      if (name.size())
+         result += (result.size() ? "," : "") + lowercase_header_name(name);
+      start = comma + 1;
+   }
+   return result;
+}
+
+class response_cache
+{
+   std::mutex m_mutex;
+   response_cache_options m_options;
+   bool m_loaded{};
+   std::list<cache_entry> m_entries; // least recently used first
+   std::map<std::string, std::list<cache_entry>::iterator> m_urls;
+   unsigned long long m_totalBytes{};
+
+   std::map<size_t, OSSESSION_ptr> m_refreshes; // background revalidations, only touched on the main thread
+   std::set<std::string> m_refreshingUrls;
+   size_t m_nextRefreshId{};
+
+   /** \brief Returns the file key for a url and the values of the request headers that the response varies on. */
+   static std::string key_for_request(const std::string& url, const std::string& vary, const HeadersMap& headers)
+   {
+      std::string identity = url;
+      size_t start = 0;
+      while (start < vary.size())
+      {
+         size_t comma = vary.find(',', start);
+         if (comma == std::string::npos) comma = vary.size();
+         const std::string name = vary.substr(start, comma - start);
+         identity += "\n" + name;
+         if (const std::string* value = find_request_header(headers, name))
+            identity += ":" + *value; // so that a missing header differs from an empty one
+         start = comma + 1;
+      }
+      uint64_t hash = 14695981039346656037ull; // FNV-1a
+      for (unsigned char c : identity)
+      {
+         hash ^= c;
+         hash *= 1099511628211ull;
+      }
+      char buffer[17];
+      snprintf(buffer, sizeof(buffer), "%016" PRIx64, hash);
+      return buffer;
+   }
+
+   std::string path_for(const std::string& fileName) const
+   {
+      const char last = m_options.directory.back();
+      return (last == '/' || last == '\\') ? m_options.directory + fileName : m_options.directory + "/" + fileName;
+   }
+
+   std::string body_path(const cache_entry& entry) const { return path_for(entry.key + ".body"); }
+
+   static std::vector<std::string> split_fields(const std::string& line)
+   {
+      std::vector<std::string> fields;
+      size_t start = 0;
+      while (true)
+      {
+         const size_t tab = line.find('\t', start);
+         fields.push_back(line.substr(start, tab == std::string::npos ? std::string::npos : tab - start));
+         if (tab == std::string::npos) break;
+         start = tab + 1;
+      }
+      return fields;
+   }
+
+   // must be called with m_mutex held
+   void load_index()
+   {
+      if (m_loaded) return;
+      m_loaded = true;
+      std::string contents;
+      if (! read_file_contents(path_for(kIndexFileName), contents))
+         return;
+      size_t lineStart = 0;
+      bool first = true;
+      while (lineStart < contents.size())
+      {
+         size_t lineEnd = contents.find('\n', lineStart);
+         if (lineEnd == std::string::npos) lineEnd = contents.size();
+         const std::string line = contents.substr(lineStart, lineEnd - lineStart);
+         lineStart = lineEnd + 1;
+         if (first)
+         {
+            if (line != kIndexSignature) return; // unknown format: start empty
+            first = false;
+            continue;
+         }
+         const std::vector<std::string> fields = split_fields(line);
+         if (fields.size() != 6 || m_urls.find(fields[5]) != m_urls.end()) continue;
+         cache_entry entry{fields[0], fields[5], fields[2], fields[3], fields[4], std::strtoull(fields[1].c_str(), nullptr, 10)};
+         m_totalBytes += entry.size;
+         m_urls[entry.url] = m_entries.insert(m_entries.end(), entry);
+      }
+   }
+
+   // must be called with m_mutex held
+   void save_index()
+   {
+      download_file file(path_for(kIndexFileName));
+      std::string contents = std::string(kIndexSignature) + "\n";
+      for (const auto& entry : m_entries)
+         contents += entry.key + "\t" + std::to_string(entry.size) + "\t" + entry.etag + "\t" + entry.lastModified + "\t" + entry.vary + "\t" + entry.url + "\n";
+      if (file.write(contents.data(), contents.size()))
+         file.commit();
+   }
+
+   // must be called with m_mutex held
+   void remove_entry(std::list<cache_entry>::iterator it)
+   {
+      delete_file(body_path(*it));
+      m_totalBytes -= it->size;
+      m_urls.erase(it->url);
+      m_entries.erase(it);
+   }
+
+   response_cache() {}
+
+public:
+   // Like the connection pools, this is never destroyed, so background refreshes never outlive it.
+   static response_cache& instance()
+   {
+      static response_cache* cache = new response_cache;
+      return *cache;
+   }
+
+   bool enabled()
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      return ! m_options.directory.empty();
+   }
+
+   bool stale_while_revalidate()
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      return m_options.staleWhileRevalidate;
+   }
+
+   void set_options(const response_cache_options& options)
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if (options.directory != m_options.directory)
+      {
+         m_entries.clear();
+         m_urls.clear();
+         m_totalBytes = 0;
+         m_loaded = false;
+      }
+      m_options = options;
+   }
+
+   response_cache_options get_options()
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      return m_options;
+   }
+
+   /** \brief Finds the cached response for \p url, reads its body and marks it most recently used. The response is
+    * not found if the request headers it varies on differ from \p headers, or if its body cannot be read.
+    */
+   bool lookup(const std::string& url, const HeadersMap& headers, cache_entry& entry, std::string& body)
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if (m_options.directory.empty()) return false;
+      load_index();
+      auto it = m_urls.find(url);
+      if (it == m_urls.end() || it->second->key != key_for_request(url, it->second->vary, headers)) return false;
+      if (! read_file_contents(body_path(*it->second), body))
+      {
+         remove_entry(it->second);
+         save_index();
+         return false;
+      }
+      m_entries.splice(m_entries.end(), m_entries, it->second);
+      entry = *it->second;
+      return true;
+   }
+
+   void store(const std::string& url, const HeadersMap& headers, const std::string& vary, const std::string& etag,
+              const std::string& lastModified, const std::string& body)
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if (m_options.directory.empty() || body.size() > m_options.maxBytes) return;
+      load_index();
+      auto existing = m_urls.find(url);
+      if (existing != m_urls.end())
+         remove_entry(existing->second);
+      cache_entry entry{key_for_request(url, vary, headers), url, etag, lastModified, vary, body.size()};
+      for (auto it = m_entries.begin(); it != m_entries.end(); ++it)
+      {
+         if (it->key == entry.key) // hash collision: the newer url wins
+         {
+            remove_entry(it);
+            break;
+         }
+      }
+      download_file file(body_path(entry));
+      if (! file.write(body.data(), body.size()) || ! file.commit())
+         return;
+      m_totalBytes += entry.size;
+      m_urls[url] = m_entries.insert(m_entries.end(), entry);
+      while (m_totalBytes > m_options.maxBytes && m_entries.size() > 1)
+         remove_entry(m_entries.begin());
+      save_index();
+   }
+
+   /** \brief Removes the cached response for \p url, if there is one. */
+   void forget(const std::string& url)
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if (m_options.directory.empty()) return;
+      load_index();
+      auto it = m_urls.find(url);
+      if (it == m_urls.end()) return;
+      remove_entry(it->second);
+      save_index();
+   }
+
+   /** \brief Handles the reply to a request that went through the cache, then calls the caller's callback.
+    *
+    * \p cachedBody is the body that was read from the cache when the request was sent with conditional headers,
+    * or null if it was sent without them. A 304 reply is answered with it, even if the entry has been evicted since.
+    */
+   void complete(const std::string& url, const HeadersMap& requestHeaders, const std::shared_ptr<const std::string>& cachedBody,
+                 const std::shared_ptr<response_info>& response, bool success, std::string&& data, const lua_callback& callback)
+   {
+      if (cachedBody && response->statusCode == kHTTPStatusNotModified)
+      {
+         response->statusCode = kHTTPStatusOK; // the headers are still those of the 304 reply
+         callback(true, std::string(*cachedBody));
+         return;
+      }
+      if (success)
+      {
+         const auto& headers = response->headers();
+         auto cacheControl = headers.find("cache-control");
+         const bool noStore = cacheControl != headers.end() && cacheControl->second.find("no-store") != std::string::npos;
+         auto etag = headers.find("etag");
+         auto lastModified = headers.find("last-modified");
+         auto varyHeader = headers.find("vary");
+         const std::string vary = varyHeader != headers.end() ? parse_vary(varyHeader->second) : "";
+         if (! noStore && vary != "*" && (etag != headers.end() || lastModified != headers.end()))
+            store(url, requestHeaders, vary, etag != headers.end() ? etag->second : "",
+                  lastModified != headers.end() ? lastModified->second : "", data);
+         else if (response->statusCode == kHTTPStatusOK)
+            forget(url); // otherwise the outdated response would be served, or revalidated, from then on
+      }
+      callback(success, std::move(data));
+   }
+
+   /** \brief Revalidates a cached response in the background. Call only from the main thread. */
+   void refresh(const std::string& url, const HeadersMap& headers, const std::shared_ptr<const std::string>& cachedBody,
+                const request_options& options)
+   {
+      if (! m_refreshingUrls.insert(url).second)
+         return; // already refreshing
+      const size_t refreshId = ++m_nextRefreshId;
+      auto response = options.response;
+      OSSESSION_ptr session = https_request("get", url, "", headers, -1,
+            [this, refreshId, url, headers, cachedBody, response](bool success, std::string&& data) -> void
+            {
+               m_refreshingUrls.erase(url);
+               complete(url, headers, cachedBody, response, success, std::move(data), [](bool, std::string&&) {});
+               m_refreshes.erase(refreshId);
+            }, options);
+      if (session && m_refreshingUrls.count(url))
+         m_refreshes.emplace(refreshId, std::move(session));
+   }
+};
+
+void set_response_cache_options(const response_cache_options& options)
+{
+   response_cache::instance().set_options(options);
+}
+
+response_cache_options get_response_cache_options()
+{
+   return response_cache::instance().get_options();
+}
+
+OSSESSION_ptr cached_https_request(const std::string& requestType, const std::string& urlString, std::string_view postData,
+                                   const HeadersMap& headers, double timeout, lua_callback callback,
+                                   const request_options& options)
+{
+   response_cache& cache = response_cache::instance();
+   if (requestType != "get" || ! options.useCache || options.sink || options.chunkCallback || has_credentials(headers) || ! cache.enabled())
+      return https_request(requestType, urlString, postData, headers, timeout, callback, options);
+
+   request_options cacheOptions = options;
+   if (! cacheOptions.response)
+      cacheOptions.response = std::make_shared<response_info>();
+   HeadersMap cacheHeaders = headers;
+   cache_entry entry;
+   std::string body;
+   std::shared_ptr<const std::string> cachedBody;
+   // The body is read now, so that a 304 reply can be answered even if the entry is evicted in the meantime.
+   // If it cannot be read, the entry is dropped and the request is sent without conditional headers.
+   if (cache.lookup(urlString, headers, entry, body))
+   {
+      if (entry.etag.size())
+         cacheHeaders["If-None-Match"] = entry.etag;
+      if (entry.lastModified.size())
+         cacheHeaders["If-Modified-Since"] = entry.lastModified;
+      if (cache.stale_while_revalidate())
+      {
+         cacheOptions.response->statusCode = kHTTPStatusOK;
+         callback(true, std::move(body));
+         cacheOptions.response = std::make_shared<response_info>(); // the caller's copy is final
+         // The refresh only updates the cache, so a 304 reply to it needs no body.
+         cache.refresh(urlString, cacheHeaders, std::make_shared<const std::string>(), cacheOptions);
+         return nullptr;
+      }
+      cachedBody = std::make_shared<const std::string>(std::move(body));
+   }
+   auto response = cacheOptions.response;
+   return https_request(requestType, urlString, postData, cacheHeaders, timeout,
+         [&cache, urlString, headers, cachedBody, response, callback](bool success, std::string&& data) -> void
+         {
+            cache.complete(urlString, headers, cachedBody, response, success, std::move(data), callback);
+         }, cacheOptions);
+}
+
+}
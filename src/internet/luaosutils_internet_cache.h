@@ -0,0 +1,40 @@
+//
+//  luaosutils_internet_cache.h
+//  luaosutils
+//
+//  (Usage permitted by MIT License. See LICENSE file in this repository.)
+//
+
+#ifndef luaosutils_internet_cache_h
+#define luaosutils_internet_cache_h
+
+#include "internet/luaosutils_internet_os.h"
+
+namespace luaosutils
+{
+
+/** \brief Settings for the on-disk response cache. The cache is disabled while the directory is empty. */
+struct response_cache_options
+{
+   std::string directory;
+   unsigned long long maxBytes{50ull * 1024 * 1024};  // least recently used responses are evicted beyond this size
+   bool staleWhileRevalidate{};                       // serve cached responses at once and refresh them in the background
+};
+
+void set_response_cache_options(const response_cache_options& options);
+response_cache_options get_response_cache_options();
+
+/** \brief Sends a request through the response cache when the cache is enabled and the request can use it.
+ *
+ * Only buffered `GET` requests without credentials use the cache. Responses with an `ETag` or `Last-Modified`
+ * header are stored, and later requests for the same url and the same values of the headers named by `Vary` are
+ * sent with `If-None-Match` or `If-Modified-Since`. A 304 reply is answered from the cache. Everything else is
+ * passed straight to https_request.
+ */
+OSSESSION_ptr cached_https_request(const std::string& requestType, const std::string& urlString, std::string_view postData,
+                                   const HeadersMap& headers, double timeout, lua_callback callback,
+                                   const request_options& options = request_options());
+
+}
+
+#endif /* luaosutils_internet_cache_h */
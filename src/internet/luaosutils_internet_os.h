@@ -13,16 +13,94 @@
 #include <memory>
 #include <map>
 #include <mutex>
+#include <string_view>
+
+#include "internet/luaosutils_internet_utils.h"
 
 namespace luaosutils
 {
 
-using lua_callback = std::function<void (bool, const std::string&)>;
+// The callback owns the data it is given, so it can move a response body on instead of copying it.
+using lua_callback = std::function<void (bool, std::string&&)>;
 using HeadersMap = std::map<std::string, std::string>;
 
+/** \brief Receives the response body chunk by chunk as it arrives, instead of accumulating it in the session buffer.
+ *
+ * It may be called on a background thread. Returning false aborts the request.
+ */
+using data_sink = std::function<bool (const char* data, size_t size)>;
+
+/** \brief Examines the status code and headers (with lowercase names) of the final response before any of its body
+ * reaches the data sink.
+ *
+ * It may be called on a background thread. Returning false aborts the request.
+ */
+using response_check = std::function<bool (int statusCode, const HeadersMap& headers)>;
+
+/** \brief The status code and headers of a response.
+ *
+ * Backends store the header lines as received. They are parsed the first time headers() is called, so
+ * requests whose headers are never examined do not pay for building the map.
+ */
+struct response_info
+{
+   int statusCode{};
+   std::string rawHeaders;          // "Name: value" lines separated by CRLF or LF
+
+   /** \brief Returns the headers of the final response, with lowercase names. Call only after the request completes. */
+   const HeadersMap& headers()
+   {
+      if (! m_headersParsed)
+      {
+         parse_response_headers(rawHeaders, m_headers);
+         m_headersParsed = true;
+      }
+      return m_headers;
+   }
+
+private:
+   HeadersMap m_headers;
+   bool m_headersParsed{};
+};
+
+/** \brief Optional behavior for https_request. The defaults accumulate the whole body in the session buffer. */
+struct request_options
+{
+   data_sink sink{};                // receives the body on a background thread
+   response_check responseCheck{};  // with a sink, called once before the body is sent to it
+   chunk_callback chunkCallback{};  // receives the body on the main thread as it arrives (async requests only)
+   std::shared_ptr<response_info> response{}; // if set, filled in before the callback is called
+   bool useCache{true};             // false bypasses the response cache
+   double connectTimeout{-1};       // seconds allowed to connect to the server, or negative for the system default
+   double firstByteTimeout{-1};     // seconds from the start of the request until the response begins, or negative for no limit
+};
+
+/** \brief Settings for the process-wide pool of warm connections, keyed by scheme, host and port. */
+struct connection_pool_options
+{
+   int maxConnectionsPerHost{6};
+   double idleTimeoutSeconds{30.0};   // idle connections older than this are closed rather than reused
+};
+
+/** \brief Counts requests that reused a pooled connection (hits) versus ones that opened a new one (misses).
+ *
+ * On Windows, a connection is an `InternetConnect` handle rather than a socket.
+ */
+struct connection_pool_stats
+{
+   unsigned long long hits{};
+   unsigned long long misses{};
+};
+
+void set_connection_pool_options(const connection_pool_options& options);
+connection_pool_options get_connection_pool_options();
+connection_pool_stats get_connection_pool_stats(bool reset = false);
+
 #if OPERATING_SYSTEM == WINDOWS
 #include <wininet.h>
 
+void release_pooled_connection(HINTERNET hConnect);
+
 enum class win_request_state
 {
    SEND,
@@ -37,75 +115,75 @@ struct win_request_context
 {
    win_request_state state;
    lua_callback callbackFunction;
-   HINTERNET hInternet{};
-   HINTERNET hConnect{};
+   HINTERNET hConnect{};         // borrowed from the connection pool
    HINTERNET hRequest{};
    HANDLE hEvent{};
    DWORD statusCode{};
    DWORD readErrorCode{};
    LONG bufferReserve{};
+   LONGLONG contentLength{-1};
    std::string buffer{};
    std::string postData{};
+   data_sink dataSink{};
+   response_check responseCheck{};
+   std::shared_ptr<response_info> response{};
+   chunk_callback chunkFunction{};
+   std::shared_ptr<chunk_queue> chunks{};
    std::vector<CHAR> readBuf{};
    DWORD numBytesRead{};
+   bool async{};                 // completes through the completion queue rather than on a waiting thread
    
    win_request_context(lua_callback callback) :
                state(win_request_state::SEND),
                callbackFunction(callback)
    {
       hEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+      _id = get_new_id();
+      get_id_mutex().lock();
+      get_id_map().emplace(_id, this);
+      get_id_mutex().unlock();
    }
    
    ~win_request_context()
    {
-      this->set_timer_id(0);
+      get_id_mutex().lock();
+      get_id_map().erase(_id);
+      get_id_mutex().unlock();
       if (hEvent) CloseHandle(hEvent);
       if (hRequest) InternetCloseHandle(hRequest);
-      if (hConnect) InternetCloseHandle(hConnect);
-      if (hInternet) InternetCloseHandle(hInternet);
+      if (hConnect) release_pooled_connection(hConnect);
    }
 
-   static win_request_context* get_context_from_timer(UINT_PTR timerID)
+   void deliver_chunks()
    {
-      auto it = get_timer_map().find(timerID);
-      if (it == get_timer_map().end()) return nullptr;
-      return it->second;
+      if (!chunks) return;
+      auto queue = chunks;
+      chunk_callback callback = chunkFunction; // the callback may destroy this context
+      queue->deliver(callback);
    }
 
-   UINT_PTR get_timer_id() const { return timerID; }
-
-   bool set_timer_id(UINT_PTR id)
+   static win_request_context* get_context_from_id(size_t val)
    {
-      if (timerID)
-      {
-         ::KillTimer(NULL, timerID);
-         get_timer_mutex().lock();
-         get_timer_map().erase(timerID);
-         get_timer_mutex().unlock();
-      }
-      if (id)
-      {
-         get_timer_mutex().lock();
-         get_timer_map().emplace(id, this);
-         get_timer_mutex().unlock();
-      }
-      this->timerID = id;
-      return (id != 0);
+      std::lock_guard<std::mutex> lock(get_id_mutex());
+      auto it = get_id_map().find(val);
+      if (it == get_id_map().end()) return nullptr;
+      return it->second;
    }
 
+   size_t get_id() const { return _id; }
+
 private:
-   UINT_PTR timerID{};
-   
-   static std::mutex& get_timer_mutex()
-   {
-      static std::mutex timerMapMutex;
-      return timerMapMutex;
-   }
+   size_t _id{};
    
-   static std::map<UINT_PTR, win_request_context*>& get_timer_map()
+   static std::mutex& get_id_mutex();
+   static std::map<size_t, win_request_context*>& get_id_map();
+
+   static size_t get_new_id() // this should always be used to calculate the id
    {
-      static std::map<UINT_PTR, win_request_context*> timerMap;
-      return timerMap;
+      static std::mutex mtx;
+      static size_t _highestId = 0;
+      std::lock_guard<std::mutex> lock(mtx);
+      return ++_highestId;
    }
 };
 using OSSESSION = win_request_context;
@@ -121,6 +199,9 @@ struct mac_request_context
    int statusCode{};
    std::string buffer{};
    bool success{};
+   std::shared_ptr<response_info> response{};
+   chunk_callback chunkFunction{};
+   std::shared_ptr<chunk_queue> chunks{};
    
    mac_request_context(lua_callback callback) : callbackFunction(callback)
    {
@@ -141,9 +222,21 @@ struct mac_request_context
    
    void complete_request()
    {
-      callbackFunction(success, buffer);
-      cancel_session(sessionTask);
+      void* task = sessionTask;
       sessionTask = nullptr;
+      cancel_session(task);
+      lua_callback callback = callbackFunction; // the callback may destroy this context
+      const bool result = success;
+      std::string data = std::move(buffer);
+      callback(result, std::move(data));
+   }
+
+   void deliver_chunks()
+   {
+      if (!chunks) return;
+      auto queue = chunks;
+      chunk_callback callback = chunkFunction; // the callback may destroy this context
+      queue->deliver(callback);
    }
 
    static mac_request_context* get_context_from_id(size_t val)
@@ -174,10 +267,120 @@ using OSSESSION = mac_request_context;
 
 #endif //OPERATING_SYSTEM == MAC_OS
 
+#if OPERATING_SYSTEM == LINUX_OS
+void cancel_transfer(size_t contextId);
+
+/** \brief Linux session context.
+ *
+ * All transfers run on a single libcurl multi-handle thread that is shared by every session. The
+ * context only holds the id the event loop uses to find it again, so it is safe for the event loop
+ * to finish a transfer after the context has been destroyed.
+ */
+struct linux_request_context
+{
+   lua_callback callbackFunction;
+   int statusCode{};
+   std::string buffer{};
+   bool success{};
+   bool transferActive{};
+   chunk_callback chunkFunction{};
+   std::shared_ptr<chunk_queue> chunks{};
+
+   linux_request_context(lua_callback callback) : callbackFunction(callback)
+   {
+      _id = get_new_id();
+      get_id_mutex().lock();
+      get_id_map().emplace(_id, this);
+      get_id_mutex().unlock();
+   }
+
+   ~linux_request_context()
+   {
+      if (transferActive)
+         cancel_transfer(_id);
+      get_id_mutex().lock();
+      get_id_map().erase(_id);
+      get_id_mutex().unlock();
+   }
+
+   void complete_request()
+   {
+      transferActive = false;
+      lua_callback callback = callbackFunction; // the callback may destroy this context
+      const bool result = success;
+      std::string data = std::move(buffer);
+      callback(result, std::move(data));
+   }
+
+   void deliver_chunks()
+   {
+      if (!chunks) return;
+      auto queue = chunks;
+      chunk_callback callback = chunkFunction; // the callback may destroy this context
+      queue->deliver(callback);
+   }
+
+   static linux_request_context* get_context_from_id(size_t val)
+   {
+      std::lock_guard<std::mutex> lock(get_id_mutex());
+      auto it = get_id_map().find(val);
+      if (it == get_id_map().end()) return nullptr;
+      return it->second;
+   }
+
+   size_t get_id() const { return _id; }
+
+private:
+   size_t _id{};
+
+   static std::mutex& get_id_mutex();
+   static std::map<size_t, linux_request_context*>& get_id_map();
+
+   static size_t get_new_id() // this should always be used to calculate the id
+   {
+      static std::mutex mtx;
+      static size_t _highestId = 0;
+      std::lock_guard<std::mutex> lock(mtx);
+      return ++_highestId;
+   }
+};
+using OSSESSION = linux_request_context;
+
+/** \brief Runs completed async requests on the calling (Lua) thread until the timeout expires.
+ *
+ * Linux has no application run loop, so hosts must pump completions, normally through `process.run_event_loop`.
+ */
+void dispatch_completions(double timeoutSeconds);
+
+#endif //OPERATING_SYSTEM == LINUX_OS
+
 using OSSESSION_ptr = std::unique_ptr<OSSESSION>;
 
-OSSESSION_ptr https_request(const std::string& requestType, const std::string &urlString, const std::string& postData,
-                            const HeadersMap& headers, double timeout, lua_callback callback);
+/** \brief Sends an https request.
+ *
+ * A \p timeout of zero or more makes the request synchronous: it blocks until the request completes or the
+ * timeout expires, calls the callback and returns null. A negative timeout makes it asynchronous: it returns
+ * the session and the callback is called later on the main thread. The post data is copied, so it only needs to
+ * remain valid for the duration of the call.
+ */
+OSSESSION_ptr https_request(const std::string& requestType, const std::string &urlString, std::string_view postData,
+                            const HeadersMap& headers, double timeout, lua_callback callback,
+                            const request_options& options = request_options());
+
+/** \brief Counts a request in the `backend.https_request` stats counter.
+ *
+ * Each backend's https_request calls this first. It wraps \p callback, and the sink and chunk callback of the
+ * returned copy of \p options, so that completions, failures, latency and bytes received are counted too.
+ */
+request_options count_https_request(std::string_view postData, lua_callback& callback, const request_options& options);
+
+/** \brief Downloads a url asynchronously into a file, writing each chunk as it arrives.
+ *
+ * The data is written to a temporary file in the same folder, which is renamed to \p filePath only when the
+ * download succeeds. The callback receives the path on success or an error message on failure.
+ */
+OSSESSION_ptr https_download_to_file(const std::string& urlString, const std::string& filePath, const HeadersMap& headers,
+                                     lua_callback callback);
 
 void error_message_box(const std::string &msg);
 
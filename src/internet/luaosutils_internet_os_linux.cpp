@@ -0,0 +1,536 @@
+//
+//  luaosutils_internet_os_linux.cpp
+//  luaosutils
+//
+//  (Usage permitted by MIT License. See LICENSE file in this repository.)
+//
+//  Linux has no OS-level https API, so this backend uses libcurl. Every request shares one
+//  multi handle that is serviced by a single I/O thread. The multi handle's connection cache
+//  is the connection pool. Completions go through the completion queue to the Lua thread, which
+//  runs them from dispatch_completions.
+//
+#include <cstdio>
+#include <cassert>
+#include <cmath>
+#include <algorithm>
+#include <string>
+#include <map>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <chrono>
+
+#include <curl/curl.h>
+
+#include "luaosutils.hpp"
+#include "internet/luaosutils_internet_os.h"
+
+namespace luaosutils
+{
+
+static const long kHTTPStatusCodeOK = 200;
+static const long kHTTPStatusCodePartialContent = 206; // only sent in reply to a Range header
+
+std::mutex& linux_request_context::get_id_mutex()
+{
+   static std::mutex idMutex;
+   return idMutex;
+}
+
+std::map<size_t, linux_request_context*>& linux_request_context::get_id_map()
+{
+   static std::map<size_t, linux_request_context*> idMap;
+   return idMap;
+}
+
+/** \brief The state of one request while it is owned by the event loop. */
+struct linux_transfer
+{
+   size_t contextId{};
+   bool sync{};
+   CURL* easy{};
+   curl_slist* headerList{};
+   std::string postData{};
+   std::string buffer{};
+   data_sink sink{};             // if set, the body goes here instead of into buffer
+   response_check responseCheck{}; // if set, approves the response before the sink receives its body
+   std::shared_ptr<chunk_queue> chunks{}; // if set, the body is queued for the session's chunk callback
+   std::shared_ptr<response_info> response{}; // if set, receives the status code and headers
+   std::string rawHeaders{};
+   bool encodedBody{};           // the body has a Content-Encoding, so Content-Length does not match what the caller sees
+   long statusCode{};
+   bool success{};
+   char errorBuffer[CURL_ERROR_SIZE]{};
+   bool receivedResponse{};      // set when the first header line arrives
+   std::chrono::steady_clock::time_point firstByteDeadline{std::chrono::steady_clock::time_point::max()};
+
+   completion_signal syncSignal; // sync requests are waited on by the Lua thread rather than queued for dispatch
+
+   ~linux_transfer()
+   {
+      if (easy) curl_easy_cleanup(easy);
+      if (headerList) curl_slist_free_all(headerList);
+   }
+};
+using linux_transfer_ptr = std::shared_ptr<linux_transfer>;
+
+class curl_event_loop
+{
+   CURLM* m_multi{};
+   std::thread m_thread;
+
+   std::mutex m_commandMutex;
+   std::vector<linux_transfer_ptr> m_pendingAdds;
+   std::vector<size_t> m_pendingCancels;
+   bool m_quit{};
+
+   std::map<size_t, linux_transfer_ptr> m_running; // only touched by the event loop thread
+
+   std::mutex m_poolMutex;
+   connection_pool_options m_poolOptions;
+   connection_pool_stats m_poolStats;
+   bool m_poolOptionsChanged{true};
+
+
+   curl_event_loop()
+   {
+      curl_global_init(CURL_GLOBAL_DEFAULT);
+      m_multi = curl_multi_init();
+      m_thread = std::thread([this]() { run(); });
+   }
+
+   ~curl_event_loop()
+   {
+      {
+         std::lock_guard<std::mutex> lock(m_commandMutex);
+         m_quit = true;
+      }
+      curl_multi_wakeup(m_multi);
+      if (m_thread.joinable())
+         m_thread.join();
+      m_running.clear();
+      curl_multi_cleanup(m_multi);
+      curl_global_cleanup();
+   }
+
+   void process_commands()
+   {
+      std::vector<linux_transfer_ptr> adds;
+      std::vector<size_t> cancels;
+      {
+         std::lock_guard<std::mutex> lock(m_commandMutex);
+         adds.swap(m_pendingAdds);
+         cancels.swap(m_pendingCancels);
+      }
+      long maxAgeSeconds;
+      {
+         // curl_multi_setopt may only be called from the thread that drives the multi handle
+         std::lock_guard<std::mutex> lock(m_poolMutex);
+         if (m_poolOptionsChanged)
+         {
+            curl_multi_setopt(m_multi, CURLMOPT_MAX_HOST_CONNECTIONS, static_cast<long>((std::max)(1, m_poolOptions.maxConnectionsPerHost)));
+            m_poolOptionsChanged = false;
+         }
+         maxAgeSeconds = static_cast<long>((std::max)(1.0, m_poolOptions.idleTimeoutSeconds));
+      }
+      for (auto& transfer : adds)
+      {
+         curl_easy_setopt(transfer->easy, CURLOPT_MAXAGE_CONN, maxAgeSeconds);
+         curl_multi_add_handle(m_multi, transfer->easy);
+         m_running.emplace(transfer->contextId, transfer);
+      }
+      for (size_t contextId : cancels)
+      {
+         auto it = m_running.find(contextId);
+         if (it == m_running.end()) continue;
+         curl_multi_remove_handle(m_multi, it->second->easy);
+         m_running.erase(it);
+      }
+   }
+
+   void finish_transfer(CURL* easy, CURLcode result)
+   {
+      linux_transfer* pTransfer = nullptr;
+      curl_easy_getinfo(easy, CURLINFO_PRIVATE, &pTransfer);
+      curl_multi_remove_handle(m_multi, easy);
+      if (!pTransfer) return;
+      auto it = m_running.find(pTransfer->contextId);
+      if (it == m_running.end()) return;
+      linux_transfer_ptr transfer = it->second;
+      m_running.erase(it);
+
+      // Failed transfers count too. One that never got a connection reports no new connections and no
+      // address, and counts as a miss: it needed a new connection.
+      long numConnects = 0;
+      const char* primaryAddress = nullptr;
+      curl_easy_getinfo(easy, CURLINFO_NUM_CONNECTS, &numConnects);
+      curl_easy_getinfo(easy, CURLINFO_PRIMARY_IP, &primaryAddress);
+      {
+         std::lock_guard<std::mutex> lock(m_poolMutex);
+         if (numConnects || ! primaryAddress || ! *primaryAddress) m_poolStats.misses++;
+         else m_poolStats.hits++;
+      }
+
+      if (result != CURLE_OK)
+      {
+         transfer->success = false;
+         transfer->buffer = transfer->errorBuffer[0] ? transfer->errorBuffer : curl_easy_strerror(result);
+         curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &transfer->statusCode); // 0 unless the server had replied
+      }
+      else
+      {
+         curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &transfer->statusCode);
+         transfer->success = (transfer->statusCode == kHTTPStatusCodeOK || transfer->statusCode == kHTTPStatusCodePartialContent);
+         if (! transfer->success)
+            transfer->buffer = "Request returned status " + std::to_string(transfer->statusCode) + ".";
+      }
+
+      // The response is shared with the caller, so a sync request fills it in only if the caller is still waiting.
+      auto storeResponse = [&transfer]()
+            {
+               if (transfer->response && transfer->statusCode)
+               {
+                  transfer->response->statusCode = static_cast<int>(transfer->statusCode);
+                  transfer->response->rawHeaders = std::move(transfer->rawHeaders);
+               }
+            };
+      if (transfer->sync)
+      {
+         transfer->syncSignal.complete(storeResponse);
+         return;
+      }
+      storeResponse();
+      completion_queue::instance().push([transfer]()
+                      {
+                         linux_request_context* pSession = linux_request_context::get_context_from_id(transfer->contextId);
+                         if (!pSession) return; // session was canceled or garbage-collected
+                         pSession->statusCode = static_cast<int>(transfer->statusCode);
+                         pSession->success = transfer->success;
+                         pSession->buffer = std::move(transfer->buffer);
+                         pSession->complete_request();
+                      });
+   }
+
+   /** \brief Fails the transfers whose server has not started to respond by their first-byte deadline. */
+   void expire_first_byte_deadlines()
+   {
+      const auto now = std::chrono::steady_clock::now();
+      std::vector<CURL*> expired;
+      for (const auto& running : m_running)
+      {
+         if (! running.second->receivedResponse && running.second->firstByteDeadline <= now)
+            expired.push_back(running.second->easy);
+      }
+      for (CURL* easy : expired)
+      {
+         linux_transfer* pTransfer = nullptr;
+         curl_easy_getinfo(easy, CURLINFO_PRIVATE, &pTransfer);
+         std::snprintf(pTransfer->errorBuffer, sizeof(pTransfer->errorBuffer), "Timed out waiting for the server to respond.");
+         finish_transfer(easy, CURLE_OPERATION_TIMEDOUT);
+      }
+   }
+
+   /** \brief Returns how long the event loop may sleep before the next first-byte deadline, capped at one second. */
+   int poll_timeout_ms() const
+   {
+      auto next = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+      for (const auto& running : m_running)
+      {
+         if (! running.second->receivedResponse)
+            next = (std::min)(next, running.second->firstByteDeadline);
+      }
+      const auto wait = std::chrono::ceil<std::chrono::milliseconds>(next - std::chrono::steady_clock::now()).count();
+      return static_cast<int>(std::max<long long>(0, wait));
+   }
+
+   void run()
+   {
+      while (true)
+      {
+         {
+            std::lock_guard<std::mutex> lock(m_commandMutex);
+            if (m_quit) break;
+         }
+         process_commands();
+         int stillRunning = 0;
+         curl_multi_perform(m_multi, &stillRunning);
+         int msgsLeft = 0;
+         while (CURLMsg* msg = curl_multi_info_read(m_multi, &msgsLeft))
+         {
+            if (msg->msg == CURLMSG_DONE)
+               finish_transfer(msg->easy_handle, msg->data.result);
+         }
+         expire_first_byte_deadlines();
+         curl_multi_poll(m_multi, nullptr, 0, poll_timeout_ms(), nullptr); // curl_multi_wakeup interrupts this
+      }
+   }
+
+public:
+   static curl_event_loop& instance()
+   {
+      static curl_event_loop eventLoop;
+      return eventLoop;
+   }
+
+   void add(const linux_transfer_ptr& transfer)
+   {
+      {
+         std::lock_guard<std::mutex> lock(m_commandMutex);
+         m_pendingAdds.push_back(transfer);
+      }
+      curl_multi_wakeup(m_multi);
+   }
+
+   void cancel(size_t contextId)
+   {
+      {
+         std::lock_guard<std::mutex> lock(m_commandMutex);
+         m_pendingCancels.push_back(contextId);
+      }
+      curl_multi_wakeup(m_multi);
+   }
+
+   void set_pool_options(const connection_pool_options& options)
+   {
+      {
+         std::lock_guard<std::mutex> lock(m_poolMutex);
+         m_poolOptions = options;
+         m_poolOptionsChanged = true;
+      }
+      curl_multi_wakeup(m_multi);
+   }
+
+   connection_pool_options get_pool_options()
+   {
+      std::lock_guard<std::mutex> lock(m_poolMutex);
+      return m_poolOptions;
+   }
+
+   connection_pool_stats get_pool_stats(bool reset)
+   {
+      std::lock_guard<std::mutex> lock(m_poolMutex);
+      connection_pool_stats retval = m_poolStats;
+      if (reset) m_poolStats = connection_pool_stats();
+      return retval;
+   }
+
+};
+
+static void DeliverChunks(size_t contextId)
+{
+   linux_request_context* pSession = linux_request_context::get_context_from_id(contextId);
+   if (pSession) pSession->deliver_chunks();
+}
+
+static size_t WriteCallback(char* ptr, size_t size, size_t nmemb, void* userdata)
+{
+   auto transfer = static_cast<linux_transfer*>(userdata);
+   if (transfer->sink)
+   {
+      if (transfer->responseCheck)
+      {
+         const response_check check = std::move(transfer->responseCheck); // called once, before the first bytes
+         transfer->responseCheck = nullptr;
+         long statusCode = 0;
+         curl_easy_getinfo(transfer->easy, CURLINFO_RESPONSE_CODE, &statusCode);
+         HeadersMap headers;
+         parse_response_headers(transfer->rawHeaders, headers);
+         if (! check(static_cast<int>(statusCode), headers))
+            return 0;
+      }
+      return transfer->sink(ptr, size * nmemb) ? size * nmemb : 0; // returning a short count aborts the transfer
+   }
+   if (transfer->chunks)
+   {
+      curl_off_t contentLength = -1;
+      if (! transfer->encodedBody)
+         curl_easy_getinfo(transfer->easy, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &contentLength);
+      const size_t contextId = transfer->contextId;
+      if (transfer->chunks->push(ptr, size * nmemb, static_cast<long long>(contentLength)))
+         completion_queue::instance().push([contextId]() { DeliverChunks(contextId); });
+      return size * nmemb;
+   }
+   transfer->buffer.append(ptr, size * nmemb);
+   return size * nmemb;
+}
+
+static size_t HeaderCallback(char* buffer, size_t size, size_t nitems, void* userdata)
+{
+   auto transfer = static_cast<linux_transfer*>(userdata);
+   transfer->receivedResponse = true;
+   const std::string line(buffer, size * nitems);
+   if (line.compare(0, 5, "HTTP/") == 0)
+      transfer->encodedBody = false; // each redirect starts with a new status line
+   else
+   {
+      const std::string lowercaseLine = lowercase_header_name(line);
+      if (lowercaseLine.compare(0, 17, "content-encoding:") == 0 && lowercaseLine.find("identity") == std::string::npos)
+         transfer->encodedBody = true;
+   }
+   if (transfer->response || transfer->responseCheck)
+      transfer->rawHeaders += line;
+   return size * nitems;
+}
+
+void cancel_transfer(size_t contextId)
+{
+   curl_event_loop::instance().cancel(contextId);
+}
+
+void dispatch_completions(double timeoutSeconds)
+{
+   const auto deadline = completion_signal::deadline_after(timeoutSeconds);
+   completion_queue& queue = completion_queue::instance();
+   while (queue.wait_until(deadline))
+   {
+      queue.drain();
+      if (completion_signal::clock::now() >= deadline)
+         break;
+   }
+}
+
+void request_completion_drain()
+{
+   // Linux has no run loop to wake. The Lua thread drains the queue from dispatch_completions.
+}
+
+bool prepare_completion_drain()
+{
+   return true;
+}
+
+void set_connection_pool_options(const connection_pool_options& options)
+{
+   curl_event_loop::instance().set_pool_options(options);
+}
+
+connection_pool_options get_connection_pool_options()
+{
+   return curl_event_loop::instance().get_pool_options();
+}
+
+connection_pool_stats get_connection_pool_stats(bool reset)
+{
+   return curl_event_loop::instance().get_pool_stats(reset);
+}
+
+OSSESSION_ptr https_request(const std::string& requestType, const std::string& urlString, std::string_view postData,
+                            const HeadersMap& headers, double timeout, lua_callback callback, const request_options& requestOptions)
+{
+   const request_options options = count_https_request(postData, callback, requestOptions);
+   OSSESSION_ptr session = OSSESSION_ptr(new linux_request_context(callback));
+
+   auto transfer = std::make_shared<linux_transfer>();
+   transfer->contextId = session->get_id();
+   transfer->sync = (timeout >= 0);
+   transfer->sink = options.sink;
+   if (options.sink)
+      transfer->responseCheck = options.responseCheck;
+   if (options.chunkCallback && timeout < 0)
+   {
+      session->chunkFunction = options.chunkCallback;
+      session->chunks = std::make_shared<chunk_queue>();
+      transfer->chunks = session->chunks;
+   }
+   transfer->easy = curl_easy_init();
+   if (!transfer->easy)
+   {
+      callback(false, "Failed to create session for " + urlString + ".");
+      return nullptr;
+   }
+
+   CURL* easy = transfer->easy;
+   curl_easy_setopt(easy, CURLOPT_URL, urlString.c_str());
+   curl_easy_setopt(easy, CURLOPT_PROTOCOLS_STR, "https");
+   curl_easy_setopt(easy, CURLOPT_REDIR_PROTOCOLS_STR, "https");
+   curl_easy_setopt(easy, CURLOPT_FOLLOWLOCATION, 1L);
+   curl_easy_setopt(easy, CURLOPT_NOSIGNAL, 1L);
+   curl_easy_setopt(easy, CURLOPT_ERRORBUFFER, transfer->errorBuffer);
+   curl_easy_setopt(easy, CURLOPT_WRITEFUNCTION, WriteCallback);
+   curl_easy_setopt(easy, CURLOPT_WRITEDATA, transfer.get());
+   curl_easy_setopt(easy, CURLOPT_PRIVATE, transfer.get());
+   curl_easy_setopt(easy, CURLOPT_HEADERFUNCTION, HeaderCallback);
+   curl_easy_setopt(easy, CURLOPT_HEADERDATA, transfer.get());
+   transfer->response = options.response;
+   // An empty string advertises every encoding this libcurl build can decode (gzip, deflate, and br or zstd
+   // when available). The body is decoded as it streams in on the event loop thread.
+   curl_easy_setopt(easy, CURLOPT_ACCEPT_ENCODING, "");
+   if (options.connectTimeout >= 0)
+      curl_easy_setopt(easy, CURLOPT_CONNECTTIMEOUT_MS, (std::max)(1L, std::lround(options.connectTimeout * 1000.0)));
+   if (options.firstByteTimeout >= 0)
+      transfer->firstByteDeadline = completion_signal::deadline_after(options.firstByteTimeout);
+
+   if (requestType == "post")
+   {
+      transfer->postData = postData;
+      curl_easy_setopt(easy, CURLOPT_POST, 1L);
+      curl_easy_setopt(easy, CURLOPT_POSTFIELDS, transfer->postData.data());
+      curl_easy_setopt(easy, CURLOPT_POSTFIELDSIZE_LARGE, static_cast<curl_off_t>(transfer->postData.size()));
+   }
+   else if (requestType != "get")
+   {
+      assert(false); // offensive programming, since this should never happen
+      return nullptr;
+   }
+
+   for (const auto& header : headers)
+      transfer->headerList = curl_slist_append(transfer->headerList, (header.first + ": " + header.second).c_str());
+   if (transfer->headerList)
+      curl_easy_setopt(easy, CURLOPT_HTTPHEADER, transfer->headerList);
+
+   session->transferActive = true;
+   curl_event_loop::instance().add(transfer);
+
+   if (timeout >= 0)
+   {
+      if (transfer->syncSignal.wait_until(completion_signal::deadline_after(timeout)))
+      {
+         session->statusCode = static_cast<int>(transfer->statusCode);
+         session->success = transfer->success;
+         session->buffer = std::move(transfer->buffer);
+      }
+      else
+      {
+         session->success = false;
+         session->buffer = "Request timed out.";
+         cancel_transfer(session->get_id());
+      }
+      session->complete_request();
+      return nullptr;
+   }
+
+   return session;
+}
+
+void error_message_box(const std::string& msg)
+{
+   // Linux hosts are headless, so there is no dialog box to show.
+   std::fprintf(stderr, "Error: %s\n", msg.c_str());
+}
+
+std::string server_name(const std::string& url)
+{
+   std::string retval;
+   CURLU* handle = curl_url();
+   if (!handle) return retval;
+   char* host = nullptr;
+   if (curl_url_set(handle, CURLUPART_URL, url.c_str(), 0) == CURLUE_OK
+       && curl_url_get(handle, CURLUPART_HOST, &host, 0) == CURLUE_OK)
+   {
+      retval = host;
+      curl_free(host);
+   }
+   curl_url_cleanup(handle);
+   return retval;
+}
+
+std::string url_escape(const std::string& input)
+{
+   char* escaped = curl_easy_escape(nullptr, input.c_str(), static_cast<int>(input.size()));
+   if (!escaped) return "";
+   std::string retval = escaped;
+   curl_free(escaped);
+   return retval;
+}
+
+} // namespace luaosutils
@@ -12,10 +12,110 @@
 #include "luaosutils.hpp"
 #include "internet/luaosutils_internet_os.h"
 
+namespace luaosutils
+{
+static void record_pool_result(bool reusedConnection);
+static bool send_to_sink(NSURLSessionTask* task, NSData* data);
+static bool complete_streaming_task(NSURLSessionTask* task, NSError* error);
+}
+
+/** \brief Session delegate that counts pool hits and misses from the task metrics and feeds streaming tasks to their sinks. */
+@interface LuaosutilsSessionDelegate : NSObject <NSURLSessionDataDelegate>
+@end
+
+@implementation LuaosutilsSessionDelegate
+- (void)URLSession:(NSURLSession *)session dataTask:(NSURLSessionDataTask *)dataTask didReceiveData:(NSData *)data
+{
+   if (! luaosutils::send_to_sink(dataTask, data))
+      [dataTask cancel];
+}
+
+- (void)URLSession:(NSURLSession *)session task:(NSURLSessionTask *)task didCompleteWithError:(NSError *)error
+{
+   luaosutils::complete_streaming_task(task, error);
+}
+
+- (void)URLSession:(NSURLSession *)session task:(NSURLSessionTask *)task didFinishCollectingMetrics:(NSURLSessionTaskMetrics *)metrics
+{
+   NSURLSessionTaskTransactionMetrics* transaction = metrics.transactionMetrics.lastObject;
+   if (! transaction || transaction.resourceFetchType != NSURLSessionTaskMetricsResourceFetchTypeNetworkLoad)
+      return;
+   luaosutils::record_pool_result(transaction.isReusedConnection);
+}
+@end
+
 namespace luaosutils
 {
 
 static const int kHTTPStatusCodeOK = 200;
+static const int kHTTPStatusCodePartialContent = 206; // only sent in reply to a Range header
+
+// NSURLSession keeps its own per-host pool of keep-alive connections, so the pool is a single
+// process-wide session configured from connection_pool_options. macOS manages the idle timeout itself.
+static std::mutex& get_pool_mutex()
+{
+   static std::mutex poolMutex;
+   return poolMutex;
+}
+
+static connection_pool_options g_poolOptions;
+static connection_pool_stats g_poolStats;
+static NSURLSession* g_pooledSession = nil;
+
+static void record_pool_result(bool reusedConnection)
+{
+   std::lock_guard<std::mutex> lock(get_pool_mutex());
+   if (reusedConnection) g_poolStats.hits++;
+   else g_poolStats.misses++;
+}
+
+static NSURLSession* GetPooledSession()
+{
+   std::lock_guard<std::mutex> lock(get_pool_mutex());
+   if (! g_pooledSession)
+   {
+      NSURLSessionConfiguration* config = [NSURLSessionConfiguration defaultSessionConfiguration];
+      config.HTTPMaximumConnectionsPerHost = (std::max)(1, g_poolOptions.maxConnectionsPerHost);
+      LuaosutilsSessionDelegate* delegate = [[LuaosutilsSessionDelegate alloc] init];
+      NSURLSession* session = [NSURLSession sessionWithConfiguration:config delegate:delegate delegateQueue:nil];
+#if __has_feature(objc_arc)
+      g_pooledSession = session;
+#else
+      g_pooledSession = [session retain];
+      [delegate release];
+#endif
+   }
+   return g_pooledSession;
+}
+
+void set_connection_pool_options(const connection_pool_options& options)
+{
+   std::lock_guard<std::mutex> lock(get_pool_mutex());
+   g_poolOptions = options;
+   if (g_pooledSession)
+   {
+      // running tasks finish on the old session; the next request creates a new one
+      [g_pooledSession finishTasksAndInvalidate];
+#if ! __has_feature(objc_arc)
+      [g_pooledSession release];
+#endif
+      g_pooledSession = nil;
+   }
+}
+
+connection_pool_options get_connection_pool_options()
+{
+   std::lock_guard<std::mutex> lock(get_pool_mutex());
+   return g_poolOptions;
+}
+
+connection_pool_stats get_connection_pool_stats(bool reset)
+{
+   std::lock_guard<std::mutex> lock(get_pool_mutex());
+   connection_pool_stats retval = g_poolStats;
+   if (reset) g_poolStats = connection_pool_stats();
+   return retval;
+}
 
 // WARNING:  get_id_mutex() and get_id_map() must be defined here
 //             and not in the header, because when RGPLua includes
@@ -34,9 +134,211 @@ std::map<size_t, mac_request_context*>& mac_request_context::get_id_map()
    return idMap;
 }
 
-OSSESSION_ptr https_request(const std::string& requestType, const std::string &urlString, const std::string& postData,
-                            const HeadersMap& headers, double timeout, lua_callback callback)
+static std::string RawHeadersFor(NSHTTPURLResponse *httpResponse)
+{
+   std::string rawHeaders;
+   for (id key in [httpResponse allHeaderFields])
+   {
+      NSString* value = [[httpResponse allHeaderFields] objectForKey:key];
+      rawHeaders += std::string([[key description] UTF8String]) + ": " + [[value description] UTF8String] + "\r\n";
+   }
+   return rawHeaders;
+}
+
+static bool StoreResults(size_t sessionId, NSData *data, NSURLResponse *response, NSError *error)
+{
+   NSHTTPURLResponse *httpResponse = (NSHTTPURLResponse *) response;
+   NSLog(@"NSURLSessionDataTask response status code: %ld", (long)[httpResponse statusCode]);
+   mac_request_context* pSession = luaosutils::mac_request_context::get_context_from_id(sessionId);
+   if (!pSession)
+   {
+      NSLog(@"Completion handler called but session was gone. (User likely canceled it.)");
+      return false;
+   }
+   if (! error && pSession->response)
+   {
+      pSession->response->statusCode = static_cast<int>([httpResponse statusCode]);
+      pSession->response->rawHeaders = RawHeadersFor(httpResponse);
+   }
+   if (error)
+   {
+      NSLog(@"Https request completed with error: %@", [error localizedDescription]);
+      pSession->success = false;
+      pSession->buffer = [[error localizedDescription] UTF8String];
+   }
+   else
+   {
+      if ([httpResponse statusCode] == kHTTPStatusCodeOK || [httpResponse statusCode] == kHTTPStatusCodePartialContent)
+      {
+         pSession->success = true;
+         if (data)
+            pSession->buffer = std::string(static_cast<const char *>([data bytes]), [data length]);
+      }
+      else
+      {
+         pSession->success = false;
+         pSession->buffer = [[NSHTTPURLResponse localizedStringForStatusCode:[httpResponse statusCode]] UTF8String];
+      }
+   }
+   return true;
+}
+
+/** \brief Stores the results of a finished task in its session and arranges for the callback to be called.
+ *
+ * A sync request's session belongs to the thread waiting on \p syncSignal, which calls the callback itself.
+ * Async requests call back on the main thread, through the completion queue, because Lua is not thread-safe.
+ */
+static void CompleteRequest(size_t sessionId, const std::shared_ptr<completion_signal>& syncSignal,
+                            NSData *data, NSURLResponse *response, NSError *error)
 {
+   if (syncSignal)
+   {
+      syncSignal->complete([&]() { StoreResults(sessionId, data, response, error); });
+      return;
+   }
+   if (! StoreResults(sessionId, data, response, error))
+      return;
+   completion_queue::instance().push([sessionId]()
+         {
+            mac_request_context* pSession = luaosutils::mac_request_context::get_context_from_id(sessionId);
+            if (!pSession)
+            {
+               NSLog(@"Async completion handler called but session was gone. (User likely canceled it.)");
+               return;
+            }
+            pSession->sessionTask = nil; // no need to try to cancel it here, because it's finished.
+            pSession->complete_request();
+         });
+}
+
+void request_completion_drain()
+{
+   dispatch_async(dispatch_get_main_queue(), ^{
+      completion_queue::instance().drain();
+   });
+}
+
+bool prepare_completion_drain()
+{
+   return true; // the main dispatch queue is always there
+}
+
+// Tasks created with a completion handler never see the delegate's data callbacks, so tasks that
+// stream their body are created without one and are tracked here until the delegate reports that they completed.
+struct streaming_task
+{
+   data_sink sink;
+   response_check responseCheck;    // cleared once it has been called
+   std::shared_ptr<chunk_queue> chunks;
+   size_t sessionId{};
+   std::shared_ptr<completion_signal> syncSignal;
+   bool sinkFailed{};
+};
+
+static std::mutex& get_streaming_mutex()
+{
+   static std::mutex streamingMutex;
+   return streamingMutex;
+}
+
+static std::map<void*, streaming_task>& get_streaming_tasks()
+{
+   static std::map<void*, streaming_task> streamingTasks;
+   return streamingTasks;
+}
+
+static bool send_to_sink(NSURLSessionTask* task, NSData* data)
+{
+   data_sink sink;
+   response_check responseCheck;
+   std::shared_ptr<chunk_queue> chunks;
+   size_t sessionId{};
+   {
+      std::lock_guard<std::mutex> lock(get_streaming_mutex());
+      auto it = get_streaming_tasks().find((__bridge void*)task);
+      if (it == get_streaming_tasks().end()) return true;
+      sink = it->second.sink;
+      responseCheck = std::move(it->second.responseCheck);
+      it->second.responseCheck = nullptr;
+      chunks = it->second.chunks;
+      sessionId = it->second.sessionId;
+   }
+   if (chunks)
+   {
+      // NSURLSession decodes compressed bodies itself, and then Content-Length no longer matches the decoded size.
+      long long contentLength = [[task response] expectedContentLength]; // NSURLResponseUnknownLength is -1
+      if ([[task response] isKindOfClass:[NSHTTPURLResponse class]])
+      {
+         NSString* encoding = [[(NSHTTPURLResponse*)[task response] allHeaderFields] objectForKey:@"Content-Encoding"];
+         if (encoding && [encoding caseInsensitiveCompare:@"identity"] != NSOrderedSame)
+            contentLength = -1;
+      }
+      __block bool wasEmpty = false;
+      [data enumerateByteRangesUsingBlock:^(const void *bytes, NSRange byteRange, BOOL *stop)
+         {
+            if (chunks->push(static_cast<const char*>(bytes), byteRange.length, contentLength))
+               wasEmpty = true;
+         }];
+      if (wasEmpty)
+      {
+         completion_queue::instance().push([sessionId]()
+               {
+                  mac_request_context* pSession = luaosutils::mac_request_context::get_context_from_id(sessionId);
+                  if (pSession) pSession->deliver_chunks();
+               });
+      }
+      return true;
+   }
+   __block bool result = true;
+   if (responseCheck)
+   {
+      NSHTTPURLResponse* httpResponse = [[task response] isKindOfClass:[NSHTTPURLResponse class]] ? (NSHTTPURLResponse*)[task response] : nil;
+      HeadersMap headers;
+      if (httpResponse)
+         parse_response_headers(RawHeadersFor(httpResponse), headers);
+      result = responseCheck(httpResponse ? static_cast<int>([httpResponse statusCode]) : 0, headers);
+   }
+   if (result)
+   {
+      [data enumerateByteRangesUsingBlock:^(const void *bytes, NSRange byteRange, BOOL *stop)
+         {
+            if (! sink(static_cast<const char*>(bytes), byteRange.length))
+            {
+               result = false;
+               *stop = YES;
+            }
+         }];
+   }
+   if (! result)
+   {
+      std::lock_guard<std::mutex> lock(get_streaming_mutex());
+      auto it = get_streaming_tasks().find((__bridge void*)task);
+      if (it != get_streaming_tasks().end())
+         it->second.sinkFailed = true;
+   }
+   return result;
+}
+
+static bool complete_streaming_task(NSURLSessionTask* task, NSError* error)
+{
+   streaming_task streamingTask;
+   {
+      std::lock_guard<std::mutex> lock(get_streaming_mutex());
+      auto it = get_streaming_tasks().find((__bridge void*)task);
+      if (it == get_streaming_tasks().end()) return false;
+      streamingTask = it->second;
+      get_streaming_tasks().erase(it);
+   }
+   if (streamingTask.sinkFailed)
+      error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileWriteUnknownError userInfo:nil];
+   CompleteRequest(streamingTask.sessionId, streamingTask.syncSignal, nil, [task response], error);
+   return true;
+}
+
+OSSESSION_ptr https_request(const std::string& requestType, const std::string &urlString, std::string_view postData,
+                            const HeadersMap& headers, double timeout, lua_callback callback, const request_options& requestOptions)
+{
+   const request_options options = count_https_request(postData, callback, requestOptions);
    NSURL* url = [NSURL URLWithString:[NSString stringWithUTF8String:urlString.c_str()]];
    NSMutableURLRequest *request = [NSMutableURLRequest requestWithURL:url];
    NSString *method = [NSString stringWithUTF8String:requestType.c_str()];
@@ -49,7 +351,7 @@ OSSESSION_ptr https_request(const std::string& requestType, const std::string &u
    else if ([method isEqualToString:@"post"])
    {
       request.HTTPMethod = @"POST";
-      NSData *postDataBytes = [[NSString stringWithUTF8String:postData.c_str()] dataUsingEncoding:NSUTF8StringEncoding];
+      NSData *postDataBytes = [NSData dataWithBytes:postData.data() length:postData.size()];
       [request setHTTPBody:postDataBytes];
    }
    else
@@ -66,54 +368,39 @@ OSSESSION_ptr https_request(const std::string& requestType, const std::string &u
       NSString *value = [NSString stringWithUTF8String:header.second.c_str()];
       [request addValue:value forHTTPHeaderField:key];
    }
+   // Conditional requests come from the luaosutils response cache, which must see the 304 replies.
+   if (headers.find("If-None-Match") != headers.end() || headers.find("If-Modified-Since") != headers.end())
+      request.cachePolicy = NSURLRequestReloadIgnoringLocalCacheData;
+   // NSURLSession has no separate connect or first-byte timeout. Its per-request timeout limits how long the
+   // task may go without receiving data, which before the response begins covers both.
+   if (options.firstByteTimeout >= 0)
+      request.timeoutInterval = (std::max)(0.001, options.firstByteTimeout);
+   else if (options.connectTimeout >= 0)
+      request.timeoutInterval = (std::max)(0.001, options.connectTimeout);
    
    OSSESSION_ptr session = OSSESSION_ptr(new mac_request_context(callback));
    size_t sessionId = session->get_id();
+   session->response = options.response;
+   if (options.chunkCallback && timeout < 0)
+   {
+      session->chunkFunction = options.chunkCallback;
+      session->chunks = std::make_shared<chunk_queue>();
+   }
+   const bool streaming = options.sink || session->chunks;
+   std::shared_ptr<completion_signal> syncSignal = (timeout >= 0) ? std::make_shared<completion_signal>() : nullptr;
    
 
-   NSURLSessionDataTask* sessionTask = [[NSURLSession sharedSession] dataTaskWithRequest:request
-               completionHandler:^(NSData *data, NSURLResponse *response, NSError *error)
-                  {
-                     NSHTTPURLResponse *httpResponse = (NSHTTPURLResponse *) response;
-                     NSLog(@"NSURLSessionDataTask response status code: %ld", (long)[httpResponse statusCode]);
-                     mac_request_context* pSession = luaosutils::mac_request_context::get_context_from_id(sessionId);
-                     if (!pSession)
-                     {
-                        NSLog(@"Completion handler called but session was gone. (User likely canceled it.)");
-                        return;
-                     }
-                     if (error)
-                     {
-                        NSLog(@"Https request completed with error: %@", [error localizedDescription]);
-                        pSession->success = false;
-                        pSession->buffer = [[error localizedDescription] UTF8String];
-                     }
-                     else
+   NSURLSessionDataTask* sessionTask = nil;
+   if (streaming)
+      sessionTask = [GetPooledSession() dataTaskWithRequest:request];
+   else
+   {
+      sessionTask = [GetPooledSession() dataTaskWithRequest:request
+                  completionHandler:^(NSData *data, NSURLResponse *response, NSError *error)
                      {
-                        if ([httpResponse statusCode] == kHTTPStatusCodeOK)
-                        {
-                           pSession->success = true;
-                           pSession->buffer = std::string(static_cast<const char *>([data bytes]), [data length]);
-                        }
-                        else
-                        {
-                           pSession->success = false;
-                           pSession->buffer = [[NSHTTPURLResponse localizedStringForStatusCode:[httpResponse statusCode]] UTF8String];
-                        }
-                     }
-                     auto codeBlock = ^{
-                        mac_request_context* pSessionBlock = luaosutils::mac_request_context::get_context_from_id(sessionId);
-                        if (!pSessionBlock)
-                        {
-                           NSLog(@"Async completion handler called but session was gone. (User likely canceled it.)");
-                           return;
-                        }
-                        pSessionBlock->sessionTask = nil; // no need to try to cancel it here, because it's finished.
-                        pSessionBlock->complete_request();
-                     };
-                     if (timeout < 0)
-                        dispatch_async(dispatch_get_main_queue(), codeBlock); // async calls must call back on the main thread because Lua is not thread-safe
-                  }];
+                        CompleteRequest(sessionId, syncSignal, data, response, error);
+                     }];
+   }
    if (! sessionTask)
    {
       callback(false, [[NSString stringWithFormat:@"Failed to create session for %@.", [url absoluteString]] UTF8String]);
@@ -125,27 +412,21 @@ OSSESSION_ptr https_request(const std::string& requestType, const std::string &u
                         [url absoluteString], [[sessionTask error] localizedDescription]] UTF8String]);
       return nil;
    }
+   if (streaming)
+   {
+      std::lock_guard<std::mutex> lock(get_streaming_mutex());
+      get_streaming_tasks()[(__bridge void*)sessionTask] = streaming_task{options.sink, options.responseCheck, session->chunks, sessionId, syncSignal};
+   }
    session->sessionTask = (__bridge void *)(sessionTask);
    [sessionTask resume];
-   if (timeout >= 0)
+   if (syncSignal)
    {
-      NSTimeInterval startTime = [NSDate timeIntervalSinceReferenceDate];
-      while (! [[sessionTask progress] isFinished])
+      if (! syncSignal->wait_until(completion_signal::deadline_after(timeout)))
       {
-         if ([NSDate timeIntervalSinceReferenceDate] >= (startTime + timeout))
-         {
-            if (! [[sessionTask progress] isFinished])
-            {
-               [sessionTask cancel];
-               session->sessionTask = nil;
-               session->success = false;
-               session->buffer = "Request timed out.";
-               break;
-            }
-         }
-         [NSThread sleepForTimeInterval:0.05]; // minimum timeout value
+         session->success = false;
+         session->buffer = "Request timed out.";
       }
-      session->complete_request();
+      session->complete_request(); // cancels the task if it is still running
       return nil;
    }
    return session;
@@ -8,6 +8,8 @@
 //
 #include <algorithm>
 #include <cassert>
+#include <map>
+#include <mutex>
 
 #include <windows.h>
 #include <wininet.h>
@@ -66,6 +68,26 @@ inline std::string GetStringFromLastError(DWORD errorCode, bool forWinInet = fal
    return "No error message.";
 }
 
+std::mutex& win_request_context::get_id_mutex()
+{
+   static std::mutex idMutex;
+   return idMutex;
+}
+
+std::map<size_t, win_request_context*>& win_request_context::get_id_map()
+{
+   static std::map<size_t, win_request_context*> idMap;
+   return idMap;
+}
+
+// A 206 is only sent in reply to a Range header, so it is as successful as a 200 for the caller that asked.
+static bool IsSuccessStatus(DWORD statusCode)
+{
+   return statusCode == HTTP_STATUS_OK || statusCode == HTTP_STATUS_PARTIAL_CONTENT;
+}
+
+static void CompleteAsyncRequest(size_t sessionId);
+
 static DWORD OnSendRequest(win_request_context* session)
 {
    assert(session->state == win_request_state::SEND);
@@ -79,22 +101,54 @@ static DWORD OnSendRequest(win_request_context* session)
    return ERROR_SUCCESS;
 }
 
+static std::string QueryRawHeaders(HINTERNET hRequest)
+{
+   DWORD headersSize = 0;
+   if (!HttpQueryInfoA(hRequest, HTTP_QUERY_RAW_HEADERS_CRLF, NULL, &headersSize, NULL) && GetLastError() == ERROR_INSUFFICIENT_BUFFER)
+   {
+      std::string rawHeaders(headersSize, '\0');
+      if (HttpQueryInfoA(hRequest, HTTP_QUERY_RAW_HEADERS_CRLF, rawHeaders.data(), &headersSize, NULL))
+      {
+         rawHeaders.resize(headersSize);
+         return rawHeaders;
+      }
+   }
+   return "";
+}
+
 static DWORD OnAllocateBuffer(win_request_context* session)
 {
    assert(session->state == win_request_state::ALLOCATE);
    session->state = win_request_state::READ_CHUNK;
 
+   if (session->dataSink && session->responseCheck)
+   {
+      DWORD statusCode = 0;
+      DWORD statusCodeSize = sizeof(statusCode);
+      if (!HttpQueryInfoA(session->hRequest, HTTP_QUERY_STATUS_CODE | HTTP_QUERY_FLAG_NUMBER, &statusCode, &statusCodeSize, NULL))
+         return GetLastError();
+      HeadersMap headers;
+      parse_response_headers(QueryRawHeaders(session->hRequest), headers);
+      if (!session->responseCheck(static_cast<int>(statusCode), headers))
+         return ERROR_WRITE_FAULT;
+   }
+
    CHAR lengthAsText[256];
    DWORD sizeLength = sizeof(lengthAsText);
    if (HttpQueryInfoA(session->hRequest, HTTP_QUERY_CONTENT_LENGTH, lengthAsText, &sizeLength, 0))
    {
       lengthAsText[(std::min)((size_t)sizeLength, sizeof(lengthAsText) - 1)] = 0;
-      DWORD length = atoi(lengthAsText);
-      if (length)
+      session->contentLength = _atoi64(lengthAsText);
+      DWORD length = static_cast<DWORD>(session->contentLength); // a compressed length is still a useful minimum reserve
+      if (length && !session->dataSink && !session->chunks) // streamed bodies are not kept in memory
       {
          session->buffer.reserve(length);
          session->bufferReserve = length;
       }
+      CHAR encoding[64];
+      DWORD sizeEncoding = sizeof(encoding);
+      if (HttpQueryInfoA(session->hRequest, HTTP_QUERY_CONTENT_ENCODING, encoding, &sizeEncoding, 0) && _stricmp(encoding, "identity") != 0)
+         session->contentLength = -1; // Content-Length counts the encoded bytes, not the decoded ones the caller sees
    }
 
    return ERROR_SUCCESS;
@@ -123,7 +177,25 @@ static DWORD OnChunkComplete(win_request_context* session)
       session->state = win_request_state::TERMINATE;
    else
    {
-      session->buffer.append(session->readBuf.data(), session->numBytesRead);
+      if (session->dataSink)
+      {
+         if (!session->dataSink(session->readBuf.data(), session->numBytesRead))
+            return ERROR_WRITE_FAULT;
+      }
+      else if (session->chunks)
+      {
+         if (session->chunks->push(session->readBuf.data(), session->numBytesRead, session->contentLength))
+         {
+            const size_t sessionId = session->get_id();
+            completion_queue::instance().push([sessionId]()
+                  {
+                     win_request_context* pSession = win_request_context::get_context_from_id(sessionId);
+                     if (pSession) pSession->deliver_chunks();
+                  });
+         }
+      }
+      else
+         session->buffer.append(session->readBuf.data(), session->numBytesRead);
       session->state = win_request_state::READ_CHUNK;
    }
    session->readBuf.clear();
@@ -144,7 +216,13 @@ static DWORD OnTerminate(win_request_context* session)
       session->readErrorCode = GetLastError();
    }
 
-   if (!session->readErrorCode && session->statusCode != HTTP_STATUS_OK)
+   if (!session->readErrorCode && session->response)
+   {
+      session->response->statusCode = static_cast<int>(session->statusCode);
+      session->response->rawHeaders = QueryRawHeaders(session->hRequest);
+   }
+
+   if (!session->readErrorCode && !IsSuccessStatus(session->statusCode))
    {
       DWORD msgSize;
       session->buffer = "";
@@ -161,10 +239,8 @@ static DWORD OnTerminate(win_request_context* session)
 
    InternetCloseHandle(session->hRequest);
    session->hRequest = NULL;
-   InternetCloseHandle(session->hConnect);
+   release_pooled_connection(session->hConnect);
    session->hConnect = NULL;
-   InternetCloseHandle(session->hInternet);
-   session->hInternet = NULL;
 
    return ERROR_SUCCESS;
 }
@@ -208,65 +284,124 @@ static void ProcessRequest(win_request_context* session, DWORD errorCode)
    if (errorCode != ERROR_SUCCESS)
       session->readErrorCode = errorCode;
 
+   // Read these first: once the event is set, a sync request's thread may destroy the session.
+   const bool async = session->async;
+   const size_t sessionId = session->get_id();
    SetEvent(session->hEvent);
+   if (async)
+      completion_queue::instance().push([sessionId]() { CompleteAsyncRequest(sessionId); });
 }
 
 static void HandleRequestResult(win_request_context* session, DWORD result, bool errorOnTimeout)
 {
-   if (errorOnTimeout || result != WAIT_TIMEOUT)
-      session->set_timer_id(0); // kill timer if there is one
-
+   bool success = false;
+   std::string data;
    switch (result)
    {
       case WAIT_OBJECT_0:
       {
          if (session->readErrorCode)
-            session->callbackFunction(false, GetStringFromLastError(session->readErrorCode, true));
+            data = GetStringFromLastError(session->readErrorCode, true);
          else
-            session->callbackFunction(session->statusCode == HTTP_STATUS_OK, session->buffer);
+         {
+            success = IsSuccessStatus(session->statusCode);
+            data = std::move(session->buffer);
+         }
          break;
       }
 
       case WAIT_TIMEOUT:
-         if (errorOnTimeout)
-            session->callbackFunction(false, "Request timed out.");
+         if (!errorOnTimeout)
+            return;
+         data = "Request timed out.";
          break;
 
       case WAIT_FAILED:
          if (session->readErrorCode)
-            session->callbackFunction(false, GetStringFromLastError(session->readErrorCode, true));
+            data = GetStringFromLastError(session->readErrorCode, true);
          else
-            session->callbackFunction(false, GetStringFromLastError(GetLastError(), false));
+            data = GetStringFromLastError(GetLastError(), false);
          break;
 
       default:
-         session->callbackFunction(false, GetStringFromLastError(GetLastError()));
+         data = GetStringFromLastError(GetLastError());
          break;
    }
 
-   // if we called the callbackFunction, it may have destroyed our session, so do not reference it again.
+   lua_callback callback = session->callbackFunction; // the callback may destroy the session
+   callback(success, std::move(data));
+   // the session may be gone, so do not reference it again.
 }
 
-static void CALLBACK __TimerProc(HWND, UINT, UINT_PTR idEvent, DWORD)
+static void CompleteAsyncRequest(size_t sessionId)
 {
-   win_request_context* session = win_request_context::get_context_from_timer(idEvent);
-   assert(session->hEvent);
-   DWORD result = WaitForSingleObject(session->hEvent, 0);
-   HandleRequestResult(session, result, false);
+   win_request_context* session = win_request_context::get_context_from_id(sessionId);
+   if (!session) return; // session was canceled or garbage-collected
+   if (session->chunks)
+   {
+      // The request has finished, so every chunk is queued and goes before the final callback.
+      session->deliver_chunks();
+      session = win_request_context::get_context_from_id(sessionId);
+      if (!session) return; // the chunk callback canceled the session
+   }
+   HandleRequestResult(session, WAIT_OBJECT_0, false);
    // HandleRequestResult may have destroyed our session, so do not reference it again.
 }
 
-void SplitUrl(const std::string& url, std::string& host, std::string& path)
+// Lua is not thread-safe, so completions from every background thread (WinINet callbacks, file hashing,
+// key derivation) are queued and drained on the main thread. A message-only window created on the main thread
+// receives a posted message whenever the queue needs draining, which any thread may post.
+static const UINT WM_LUAOSUTILS_DRAIN = WM_APP + 1;
+static HWND g_completionWindow = NULL;
+
+static LRESULT CALLBACK __CompletionWindowProc(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam)
+{
+   if (message == WM_LUAOSUTILS_DRAIN)
+   {
+      completion_queue::instance().drain();
+      return 0;
+   }
+   return ::DefWindowProcW(hwnd, message, wParam, lParam);
+}
+
+bool prepare_completion_drain()
+{
+   if (g_completionWindow)
+      return true;
+   HMODULE hModule = NULL;
+   ::GetModuleHandleExW(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+                        reinterpret_cast<LPCWSTR>(&__CompletionWindowProc), &hModule);
+   WNDCLASSW windowClass{};
+   windowClass.lpfnWndProc = &__CompletionWindowProc;
+   windowClass.hInstance = hModule;
+   windowClass.lpszClassName = L"luaosutils_completion_window";
+   if (!::RegisterClassW(&windowClass) && ::GetLastError() != ERROR_CLASS_ALREADY_EXISTS)
+      return false;
+   g_completionWindow = ::CreateWindowExW(0, windowClass.lpszClassName, L"", 0, 0, 0, 0, 0, HWND_MESSAGE, NULL, hModule, NULL);
+   return g_completionWindow != NULL;
+}
+
+void request_completion_drain()
+{
+   // Called on any thread. The window belongs to the main thread, so its message loop runs the drain.
+   if (g_completionWindow)
+      ::PostMessageW(g_completionWindow, WM_LUAOSUTILS_DRAIN, 0, 0);
+}
+
+void SplitUrl(const std::string& url, std::string& host, std::string& path, INTERNET_PORT& port)
 {
    URL_COMPONENTSA urlComponents{};
    urlComponents.dwStructSize = sizeof(urlComponents);
    urlComponents.dwHostNameLength = 1;
    urlComponents.dwUrlPathLength = 1;
 
+   port = INTERNET_DEFAULT_HTTPS_PORT;
    if (InternetCrackUrlA(url.c_str(), static_cast<DWORD>(url.length()), 0, &urlComponents))
    {
       host.assign(urlComponents.lpszHostName, urlComponents.dwHostNameLength);
       path.assign(urlComponents.lpszUrlPath, urlComponents.dwUrlPathLength);
+      if (urlComponents.nPort)
+         port = urlComponents.nPort;
    }
    else
    {
@@ -278,6 +413,7 @@ void SplitUrl(const std::string& url, std::string& host, std::string& path)
 void CALLBACK WinINetCallback(HINTERNET hInternet, DWORD_PTR dwContext, DWORD dwInternetStatus, LPVOID lpvStatusInformation, DWORD dwStatusInformationLength)
 {
    auto session = reinterpret_cast<win_request_context*>(dwContext);
+   if (!session) return; // pooled connection handles have no context
 
    switch (dwInternetStatus)
    {
@@ -290,31 +426,182 @@ void CALLBACK WinINetCallback(HINTERNET hInternet, DWORD_PTR dwContext, DWORD dw
    }
 }
 
-OSSESSION_ptr https_request(const std::string& requestType, const std::string& urlString, const std::string& postData,
-                              const HeadersMap& headers, double timeout, lua_callback callback)
+/** \brief Process-wide pool of WinINet connection handles.
+ *
+ * All requests share one `InternetOpen` session, so WinINet can keep sockets alive between requests,
+ * and connection handles are cached per scheme, host and port. Only https is supported, so the scheme
+ * is always the same, but it is kept in the key to match the other platforms.
+ */
+class win_connection_pool
 {
-   OSSESSION_ptr session = OSSESSION_ptr(new win_request_context(callback));
+   struct pooled_connection
+   {
+      HINTERNET hConnect{};
+      int useCount{};
+      ULONGLONG lastUsedTicks{};
+   };
+
+   std::mutex m_mutex;
+   HINTERNET m_hInternet{};
+   connection_pool_options m_options;
+   connection_pool_stats m_stats;
+   std::map<std::string, pooled_connection> m_connections;
+   std::map<HINTERNET, std::string> m_keys;
+
+   void apply_options()
+   {
+      DWORD maxConns = static_cast<DWORD>((std::max)(1, m_options.maxConnectionsPerHost));
+      InternetSetOption(NULL, INTERNET_OPTION_MAX_CONNS_PER_SERVER, &maxConns, sizeof(maxConns));
+      InternetSetOption(NULL, INTERNET_OPTION_MAX_CONNS_PER_1_0_SERVER, &maxConns, sizeof(maxConns));
+   }
 
-   session->hInternet = InternetOpen(TEXT("Luaosutils WinInet Downloader"), INTERNET_OPEN_TYPE_PRECONFIG, NULL, NULL, INTERNET_FLAG_ASYNC);
-   if (!session->hInternet)
+   void evict_idle_connections()
    {
-      callback(false, GetStringFromLastError(GetLastError(), true));
-      return nullptr;
+      const ULONGLONG now = GetTickCount64();
+      const ULONGLONG idleTicks = static_cast<ULONGLONG>((std::max)(0.0, m_options.idleTimeoutSeconds) * 1000.0);
+      for (auto it = m_connections.begin(); it != m_connections.end(); )
+      {
+         if (!it->second.useCount && now - it->second.lastUsedTicks > idleTicks)
+         {
+            m_keys.erase(it->second.hConnect);
+            InternetCloseHandle(it->second.hConnect);
+            it = m_connections.erase(it);
+         }
+         else
+            ++it;
+      }
    }
 
-   if (InternetSetStatusCallback(session->hInternet, WinINetCallback) == INTERNET_INVALID_STATUS_CALLBACK)
+public:
+   // The handles are deliberately never closed at static destruction time, because
+   // WinINet may already have been unloaded by then.
+   static win_connection_pool& instance()
    {
-      callback(false, "InternetSetStatusCallback failed with INTERNET_INVALID_STATUS_CALLBACK");
-      return nullptr;
+      static win_connection_pool* pool = new win_connection_pool;
+      return *pool;
+   }
+
+   DWORD acquire(const std::string& host, INTERNET_PORT port, HINTERNET& hConnect)
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      hConnect = NULL;
+      if (!m_hInternet)
+      {
+         m_hInternet = InternetOpen(TEXT("Luaosutils WinInet Downloader"), INTERNET_OPEN_TYPE_PRECONFIG, NULL, NULL, INTERNET_FLAG_ASYNC);
+         if (!m_hInternet)
+            return GetLastError();
+         if (InternetSetStatusCallback(m_hInternet, WinINetCallback) == INTERNET_INVALID_STATUS_CALLBACK)
+         {
+            InternetCloseHandle(m_hInternet);
+            m_hInternet = NULL;
+            return ERROR_INVALID_FUNCTION;
+         }
+         apply_options();
+      }
+      evict_idle_connections();
+      const std::string key = "https://" + host + ":" + std::to_string(port);
+      // The stats count reuse of the connection handle. WinINet does not report whether the request then
+      // reuses a socket, so a hit here may still open one.
+      auto it = m_connections.find(key);
+      if (it != m_connections.end())
+      {
+         m_stats.hits++;
+         it->second.useCount++;
+         hConnect = it->second.hConnect;
+         return ERROR_SUCCESS;
+      }
+      m_stats.misses++;
+      hConnect = InternetConnectA(m_hInternet, host.c_str(), port, NULL, NULL, INTERNET_SERVICE_HTTP, 0, 0);
+      if (!hConnect)
+         return GetLastError();
+      m_connections.emplace(key, pooled_connection{ hConnect, 1, GetTickCount64() });
+      m_keys.emplace(hConnect, key);
+      return ERROR_SUCCESS;
+   }
+
+   void release(HINTERNET hConnect)
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      auto keyIt = m_keys.find(hConnect);
+      if (keyIt == m_keys.end()) return;
+      auto it = m_connections.find(keyIt->second);
+      if (it == m_connections.end()) return;
+      if (it->second.useCount > 0)
+         it->second.useCount--;
+      it->second.lastUsedTicks = GetTickCount64();
+   }
+
+   void set_options(const connection_pool_options& options)
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_options = options;
+      apply_options();
+      evict_idle_connections();
+   }
+
+   connection_pool_options get_options()
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      return m_options;
+   }
+
+   connection_pool_stats get_stats(bool reset)
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      connection_pool_stats retval = m_stats;
+      if (reset) m_stats = connection_pool_stats();
+      return retval;
+   }
+};
+
+void release_pooled_connection(HINTERNET hConnect)
+{
+   win_connection_pool::instance().release(hConnect);
+}
+
+void set_connection_pool_options(const connection_pool_options& options)
+{
+   win_connection_pool::instance().set_options(options);
+}
+
+connection_pool_options get_connection_pool_options()
+{
+   return win_connection_pool::instance().get_options();
+}
+
+connection_pool_stats get_connection_pool_stats(bool reset)
+{
+   return win_connection_pool::instance().get_stats(reset);
+}
+
+OSSESSION_ptr https_request(const std::string& requestType, const std::string& urlString, std::string_view postData,
+                              const HeadersMap& headers, double timeout, lua_callback callback, const request_options& requestOptions)
+{
+   const request_options options = count_https_request(postData, callback, requestOptions);
+   OSSESSION_ptr session = OSSESSION_ptr(new win_request_context(callback));
+   session->dataSink = options.sink;
+   session->responseCheck = options.responseCheck;
+   session->response = options.response;
+   if (options.chunkCallback && timeout < 0)
+   {
+      session->chunkFunction = options.chunkCallback;
+      session->chunks = std::make_shared<chunk_queue>();
    }
 
    std::string host;
    std::string path;
-   SplitUrl(urlString, host, path);
+   INTERNET_PORT port;
+   SplitUrl(urlString, host, path, port);
 
-   session->hConnect = InternetConnectA(session->hInternet, host.c_str(), INTERNET_DEFAULT_HTTPS_PORT, NULL, NULL, INTERNET_SERVICE_HTTP, 0, (DWORD_PTR)session.get());
-   if (!session->hConnect) {
-      callback(false, GetStringFromLastError(GetLastError(), true));
+   const DWORD connectError = win_connection_pool::instance().acquire(host, port, session->hConnect);
+   if (connectError == ERROR_INVALID_FUNCTION)
+   {
+      callback(false, "InternetSetStatusCallback failed with INTERNET_INVALID_STATUS_CALLBACK");
+      return nullptr;
+   }
+   if (connectError != ERROR_SUCCESS)
+   {
+      callback(false, GetStringFromLastError(connectError, true));
       return nullptr;
    }
 
@@ -328,9 +615,20 @@ OSSESSION_ptr https_request(const std::string& requestType, const std::string& u
       return nullptr;
    }
 
-   DWORD timeoutValue = 0; // 0 means no timeout or set to a large value
-   InternetSetOption(session->hRequest, INTERNET_OPTION_RECEIVE_TIMEOUT, &timeoutValue, sizeof(DWORD));
-   InternetSetOption(session->hRequest, INTERNET_OPTION_CONNECT_TIMEOUT, &timeoutValue, sizeof(DWORD));
+   // WinINet decodes gzip and deflate responses on its own worker threads as they are read.
+   BOOL decodeContent = TRUE;
+   InternetSetOption(session->hRequest, INTERNET_OPTION_HTTP_DECODING, &decodeContent, sizeof(decodeContent));
+   if (headers.find("Accept-Encoding") == headers.end())
+   {
+      const std::string acceptEncoding = "Accept-Encoding: gzip, deflate";
+      HttpAddRequestHeadersA(session->hRequest, acceptEncoding.c_str(), static_cast<DWORD>(acceptEncoding.size()), HTTP_ADDREQ_FLAG_ADD | HTTP_ADDREQ_FLAG_REPLACE);
+   }
+
+   // 0 means no timeout. WinINet's receive timeout limits each wait for data, which covers the wait for the first byte.
+   DWORD receiveTimeout = (options.firstByteTimeout >= 0) ? (std::max)(1L, std::lround(options.firstByteTimeout * 1000.0)) : 0;
+   DWORD connectTimeout = (options.connectTimeout >= 0) ? (std::max)(1L, std::lround(options.connectTimeout * 1000.0)) : 0;
+   InternetSetOption(session->hRequest, INTERNET_OPTION_RECEIVE_TIMEOUT, &receiveTimeout, sizeof(DWORD));
+   InternetSetOption(session->hRequest, INTERNET_OPTION_CONNECT_TIMEOUT, &connectTimeout, sizeof(DWORD));
 
    for (auto& header : headers)
    {
@@ -353,26 +651,26 @@ OSSESSION_ptr https_request(const std::string& requestType, const std::string& u
       session->postData = postData;
    }
 
+   if (timeout < 0)
+   {
+      if (!prepare_completion_drain())
+      {
+         callback(false, GetStringFromLastError(GetLastError()));
+         return nullptr;
+      }
+      session->async = true;
+   }
+
    ProcessRequest(session.get(), ERROR_SUCCESS);
 
    if (timeout >= 0)
    {
       DWORD result = WaitForSingleObject(session->hEvent, std::lround(timeout*1000.0));
       HandleRequestResult(session.get(), result, true);
-   }
-   else
-   {
-      // Lua is not thread-safe, so we use a timer to check the status of the request,
-      // then call the callback from the main thread (where the timer runs).
-      UINT_PTR timerID = ::SetTimer(NULL, 0, USER_TIMER_MINIMUM, &__TimerProc);
-      if (!timerID)
-         callback(false, GetStringFromLastError(GetLastError()));
-      session->set_timer_id(timerID);
-      assert(session->get_timer_id());
-      return session;
+      return nullptr;
    }
 
-   return nullptr;
+   return session;
 }
 
 #include <utility>
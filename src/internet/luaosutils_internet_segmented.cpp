@@ -0,0 +1,512 @@
+//
+//  luaosutils_internet_segmented.cpp
+//  luaosutils
+//
+//  (Usage permitted by MIT License. See LICENSE file in this repository.)
+//
+//  The state file lists the url, the file size and validator, and one "start end done" line per segment.
+//  It is rewritten atomically when a segment starts, finishes or fails, and after every kStateSaveBytes a
+//  segment receives. The done counts it records never exceed what has been flushed to the temporary file,
+//  so a crash at worst downloads the last few megabytes of each range again.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <cstdio>
+#include <cstdlib>
+
+#include "luaosutils.hpp"
+#include "internet/luaosutils_internet_segmented.h"
+#include "internet/luaosutils_internet_utils.h"
+
+#if OPERATING_SYSTEM == WINDOWS
+#include <io.h>
+#else
+#include <unistd.h>
+#include <sys/types.h>
+#endif
+
+namespace luaosutils
+{
+
+static const int kHTTPStatusOK = 200;
+static const int kHTTPStatusPartialContent = 206;
+static const int kHTTPStatusRangeNotSatisfiable = 416; // the reply to a range request for an empty file
+static const char* kStateSignature = "luaosutils-segments 1";
+static const unsigned long long kStateSaveBytes = 4 * 1024 * 1024;
+
+static bool SeekFile(FILE* file, unsigned long long offset)
+{
+#if OPERATING_SYSTEM == WINDOWS
+   return _fseeki64(file, static_cast<__int64>(offset), SEEK_SET) == 0;
+#else
+   return fseeko(file, static_cast<off_t>(offset), SEEK_SET) == 0;
+#endif
+}
+
+static bool ResizeFile(FILE* file, unsigned long long size)
+{
+#if OPERATING_SYSTEM == WINDOWS
+   return _chsize_s(_fileno(file), static_cast<__int64>(size)) == 0;
+#else
+   return ftruncate(fileno(file), static_cast<off_t>(size)) == 0;
+#endif
+}
+
+static bool GetFileSize(const std::string& path, unsigned long long& size)
+{
+   FILE* file = open_file(path, "rb");
+   if (!file) return false;
+#if OPERATING_SYSTEM == WINDOWS
+   const bool success = _fseeki64(file, 0, SEEK_END) == 0;
+   const long long position = success ? _ftelli64(file) : -1;
+#else
+   const bool success = fseeko(file, 0, SEEK_END) == 0;
+   const long long position = success ? static_cast<long long>(ftello(file)) : -1;
+#endif
+   fclose(file);
+   if (position < 0) return false;
+   size = static_cast<unsigned long long>(position);
+   return true;
+}
+
+static std::vector<std::string> SplitString(const std::string& text, char separator)
+{
+   std::vector<std::string> fields;
+   size_t start = 0;
+   while (true)
+   {
+      const size_t next = text.find(separator, start);
+      fields.push_back(text.substr(start, next == std::string::npos ? std::string::npos : next - start));
+      if (next == std::string::npos) break;
+      start = next + 1;
+   }
+   return fields;
+}
+
+/** \brief Reads the size of the whole file from a reply's "Content-Range: bytes 0-0/<size>" header. */
+static bool GetContentRangeSize(const HeadersMap& headers, unsigned long long& size)
+{
+   auto it = headers.find("content-range");
+   if (it == headers.end()) return false;
+   const size_t slash = it->second.rfind('/');
+   if (slash == std::string::npos) return false;
+   const std::string value = it->second.substr(slash + 1);
+   if (value.empty() || value[0] < '0' || value[0] > '9') return false; // "*" means the size is unknown
+   size = std::strtoull(value.c_str(), nullptr, 10);
+   return size > 0;
+}
+
+/** \brief Reads the first byte offset from a reply's "Content-Range: bytes <first>-<last>/<size>" header. */
+static bool GetContentRangeStart(const HeadersMap& headers, unsigned long long& first)
+{
+   auto it = headers.find("content-range");
+   if (it == headers.end() || it->second.compare(0, 6, "bytes ") != 0) return false;
+   const char* digits = it->second.c_str() + 6;
+   if (*digits < '0' || *digits > '9') return false;
+   char* end = nullptr;
+   first = std::strtoull(digits, &end, 10);
+   return *end == '-';
+}
+
+struct segmented_download::segment
+{
+   unsigned long long start{};
+   unsigned long long end{};        // inclusive
+   unsigned long long done{};       // bytes of the range already written
+   unsigned long long saved{};      // the value of done when the state file was last due to be saved
+   bool accepted{};                 // the reply is a 206 that continues the range, so write takes its bytes
+   bool rejected{};                 // the reply is anything else
+   FILE* file{};
+   std::mutex mutex;                // the sink writes on a background thread
+
+   segment(unsigned long long start, unsigned long long end, unsigned long long done) :
+         start(start), end(end), done(done), saved(done) {}
+   ~segment() { close(); }
+
+   unsigned long long length() const { return end - start + 1; }
+
+   /** \brief Opens the temporary file and positions it where the range continues. */
+   bool open(const std::string& path)
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      file = open_file(path, "r+b");
+      return file && SeekFile(file, start + done);
+   }
+
+   /** \brief Accepts a reply only if it is a 206 whose Content-Range starts where the range continues. A server that
+    * ignored the range, or an If-Range that failed, sends a 200 with the whole file instead.
+    */
+   bool accept(int statusCode, const HeadersMap& headers)
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      unsigned long long first = 0;
+      accepted = statusCode == kHTTPStatusPartialContent && GetContentRangeStart(headers, first) && first == start + done;
+      rejected = ! accepted;
+      return accepted;
+   }
+
+   bool was_rejected()
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      return rejected;
+   }
+
+   /** \brief Appends the next bytes of an accepted reply. Rejects more bytes than the range holds. */
+   bool write(const char* data, size_t size)
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!file || !accepted || done + size > length()) return false;
+      if (fwrite(data, 1, size, file) != size) return false;
+      done += size;
+      return true;
+   }
+
+   /** \brief Returns true once for every kStateSaveBytes written since the last time it did. */
+   bool save_due()
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (done - saved < kStateSaveBytes) return false;
+      saved = done;
+      return true;
+   }
+
+   /** \brief Flushes the file and returns the number of bytes of the range that are safely in it. */
+   unsigned long long flush()
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (file) fflush(file);
+      return done;
+   }
+
+   void close()
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (file) fclose(file);
+      file = nullptr;
+   }
+};
+
+segmented_download::segmented_download(const std::string& url, const std::string& path, const HeadersMap& headers,
+                                       const segmented_download_options& options, lua_callback callback) :
+            m_url(url),
+            m_path(path),
+            m_headers(headers),
+            m_options(options),
+            m_callback(callback)
+{
+   m_options.segments = (std::max)(size_t(1), m_options.segments);
+   m_options.minSegmentBytes = (std::max)(1ull, m_options.minSegmentBytes);
+}
+
+segmented_download::~segmented_download()
+{
+   // Cancel the requests first, so that nothing is written after the files close.
+   m_probe.reset();
+   m_fallback.reset();
+   m_running.clear();
+   if (m_finished || m_segments.empty())
+      return;
+   for (const auto& seg : m_segments)
+      seg->close();
+   if (m_options.resume)
+      save_state();
+   else
+   {
+      delete_file(temp_path());
+      delete_file(state_path());
+   }
+}
+
+std::string segmented_download::temp_path() const
+{
+   return download_file::temp_path_for(m_path);
+}
+
+std::string segmented_download::state_path() const
+{
+   return temp_path() + ".parts";
+}
+
+void segmented_download::start()
+{
+   // A one-byte range shows whether the server supports ranges, and its Content-Range gives the file size.
+   HeadersMap headers = m_headers;
+   headers["Range"] = "bytes=0-0";
+   headers["Accept-Encoding"] = "identity"; // ranges of a compressed reply would be ranges of the compressed bytes
+   auto response = std::make_shared<response_info>();
+   auto bytesReceived = std::make_shared<std::atomic<unsigned long long>>(0);
+   request_options options;
+   options.response = response;
+   options.sink = [bytesReceived](const char*, size_t size) -> bool
+         {
+            return (*bytesReceived += size) <= 1; // a server that ignores the range sends the whole file, so stop it
+         };
+   m_starting = true;
+   OSSESSION_ptr probe = https_request("get", m_url, "", headers, -1,
+         [this, response](bool success, const std::string& data) -> void
+         {
+            complete_probe(success, data, response);
+         }, options);
+   m_starting = false;
+   if (m_startError.size())
+      finish(false, m_startError);
+   else
+      m_probe = std::move(probe);
+}
+
+void segmented_download::complete_probe(bool success, const std::string& data, const std::shared_ptr<response_info>& response)
+{
+   if (m_starting) // an immediate failure from https_request; start reports it
+   {
+      m_startError = data;
+      return;
+   }
+   m_probe.reset(); // OS sessions allow themselves to be destroyed from inside their callbacks
+   unsigned long long totalSize = 0;
+   if (success && response->statusCode == kHTTPStatusPartialContent && GetContentRangeSize(response->headers(), totalSize))
+   {
+      m_totalSize = totalSize;
+      const HeadersMap& headers = response->headers();
+      auto etag = headers.find("etag");
+      auto lastModified = headers.find("last-modified");
+      if (etag != headers.end() && etag->second.compare(0, 2, "W/") != 0) // If-Range needs a strong validator
+         m_validator = etag->second;
+      else if (lastModified != headers.end())
+         m_validator = lastModified->second;
+      if (! prepare_segments())
+      {
+         m_segments.clear();
+         finish(false, "Unable to create " + temp_path() + ".");
+         return;
+      }
+      start_segments();
+      return;
+   }
+   if (response->statusCode == kHTTPStatusOK || response->statusCode == kHTTPStatusRangeNotSatisfiable) // no usable range
+   {
+      start_fallback();
+      return;
+   }
+   if (response->statusCode != 0 && response->statusCode != kHTTPStatusPartialContent)
+   {
+      finish(false, "Request returned status " + std::to_string(response->statusCode) + "."); // data may only say the probe stopped early
+      return;
+   }
+   finish(false, data);
+}
+
+void segmented_download::start_fallback()
+{
+   m_starting = true;
+   OSSESSION_ptr fallback = https_download_to_file(m_url, m_path, m_headers,
+         [this](bool success, const std::string& data) -> void
+         {
+            if (m_starting)
+            {
+               m_startError = data;
+               return;
+            }
+            finish(success, data);
+         });
+   m_starting = false;
+   if (m_startError.size())
+      finish(false, m_startError);
+   else
+      m_fallback = std::move(fallback);
+}
+
+bool segmented_download::prepare_segments()
+{
+   if (m_options.resume && load_state())
+      return true;
+   m_segments.clear();
+   FILE* file = open_file(temp_path(), "wb");
+   if (!file) return false;
+   const bool allocated = ResizeFile(file, m_totalSize);
+   fclose(file);
+   if (!allocated) return false;
+   const unsigned long long maxSegments = (m_totalSize + m_options.minSegmentBytes - 1) / m_options.minSegmentBytes;
+   const unsigned long long numSegments = (std::max)(1ull, (std::min)(static_cast<unsigned long long>(m_options.segments), maxSegments));
+   const unsigned long long segmentSize = m_totalSize / numSegments;
+   for (unsigned long long x = 0; x < numSegments; x++)
+   {
+      const unsigned long long start = x * segmentSize;
+      const unsigned long long end = (x == numSegments - 1) ? m_totalSize - 1 : start + segmentSize - 1;
+      m_segments.push_back(std::make_shared<segment>(start, end, 0));
+   }
+   for (const auto& seg : m_segments)
+   {
+      if (! seg->open(temp_path()))
+         return false;
+   }
+   return true;
+}
+
+bool segmented_download::load_state()
+{
+   if (m_validator.empty())
+   {
+      // Without a validator there is no If-Range, so nothing would stop bytes of a changed file from being
+      // spliced into the old ones.
+      delete_file(state_path());
+      return false;
+   }
+   std::string contents;
+   if (! read_file_contents(state_path(), contents))
+      return false;
+   const std::vector<std::string> lines = SplitString(contents, '\n');
+   if (lines.size() < 4 || lines[0] != kStateSignature || lines[1] != m_url)
+      return false;
+   const std::vector<std::string> fileFields = SplitString(lines[2], '\t');
+   if (fileFields.size() != 2 || std::strtoull(fileFields[0].c_str(), nullptr, 10) != m_totalSize || fileFields[1] != m_validator)
+      return false; // the file on the server has changed
+   unsigned long long tempSize = 0;
+   if (! GetFileSize(temp_path(), tempSize) || tempSize != m_totalSize)
+      return false;
+   std::vector<std::shared_ptr<segment>> segments;
+   for (size_t x = 3; x < lines.size(); x++)
+   {
+      if (lines[x].empty()) continue;
+      const std::vector<std::string> fields = SplitString(lines[x], '\t');
+      if (fields.size() != 3) return false;
+      auto seg = std::make_shared<segment>(std::strtoull(fields[0].c_str(), nullptr, 10), std::strtoull(fields[1].c_str(), nullptr, 10),
+                                           std::strtoull(fields[2].c_str(), nullptr, 10));
+      if (seg->start > seg->end || seg->end >= m_totalSize || seg->done > seg->length())
+         return false;
+      segments.push_back(seg);
+   }
+   if (segments.empty())
+      return false;
+   for (const auto& seg : segments)
+   {
+      if (seg->done < seg->length() && ! seg->open(temp_path()))
+         return false;
+   }
+   m_segments = std::move(segments);
+   return true;
+}
+
+void segmented_download::save_state()
+{
+   std::lock_guard<std::mutex> lock(m_stateMutex);
+   std::string contents = std::string(kStateSignature) + "\n" + m_url + "\n" + std::to_string(m_totalSize) + "\t" + m_validator + "\n";
+   for (const auto& seg : m_segments)
+      contents += std::to_string(seg->start) + "\t" + std::to_string(seg->end) + "\t" + std::to_string(seg->flush()) + "\n";
+   download_file file(state_path());
+   if (file.write(contents.data(), contents.size()))
+      file.commit();
+}
+
+void segmented_download::start_segments()
+{
+   if (m_options.resume)
+      save_state(); // so that an interruption from here on can be resumed
+   m_starting = true;
+   for (size_t index = 0; index < m_segments.size() && m_startError.empty(); index++)
+   {
+      std::shared_ptr<segment> seg = m_segments[index];
+      const unsigned long long done = seg->flush();
+      if (done == seg->length())
+         continue;
+      HeadersMap headers = m_headers;
+      headers["Range"] = "bytes=" + std::to_string(seg->start + done) + "-" + std::to_string(seg->end);
+      headers["Accept-Encoding"] = "identity";
+      if (m_validator.size())
+         headers["If-Range"] = m_validator; // a changed file comes back whole, which the segment rejects
+      request_options options;
+      options.responseCheck = [seg](int statusCode, const HeadersMap& headers) -> bool
+            {
+               return seg->accept(statusCode, headers);
+            };
+      const bool saveProgress = m_options.resume;
+      options.sink = [this, seg, saveProgress](const char* data, size_t size) -> bool
+            {
+               if (! seg->write(data, size))
+                  return false;
+               if (saveProgress && seg->save_due())
+                  save_state(); // the requests are canceled before this download is destroyed
+               return true;
+            };
+      OSSESSION_ptr session = https_request("get", m_url, "", headers, -1,
+            [this, index](bool success, const std::string& data) -> void
+            {
+               complete_segment(index, success, data);
+            }, options);
+      if (session && m_startError.empty())
+         m_running.emplace(index, std::move(session));
+   }
+   m_starting = false;
+   if (m_startError.size())
+      finish(false, m_startError);
+   else if (m_running.empty()) // every segment was already complete
+      finish(true, m_path);
+}
+
+void segmented_download::complete_segment(size_t index, bool success, const std::string& data)
+{
+   if (m_starting) // an immediate failure from https_request; start_segments reports it
+   {
+      m_startError = data;
+      return;
+   }
+   m_running.erase(index); // OS sessions allow themselves to be destroyed from inside their callbacks
+   std::shared_ptr<segment> seg = m_segments[index];
+   if (seg->was_rejected())
+   {
+      finish(false, "The server did not return the requested range.");
+      return;
+   }
+   if (success && seg->flush() != seg->length())
+   {
+      finish(false, "The server ended a range before it was complete.");
+      return;
+   }
+   if (! success)
+   {
+      finish(false, data);
+      return;
+   }
+   seg->close();
+   if (m_running.empty())
+      finish(true, m_path);
+   else if (m_options.resume)
+      save_state();
+}
+
+void segmented_download::finish(bool success, const std::string& data)
+{
+   m_finished = true;
+   m_running.clear(); // cancels the remaining segments after a failure
+   lua_callback callback = m_callback; // the callback may destroy this download
+   if (m_segments.empty()) // the probe failed or the download fell back to a single stream
+   {
+      callback(success, std::string(data));
+      return;
+   }
+   for (const auto& seg : m_segments)
+      seg->close();
+   if (success)
+   {
+      delete_file(state_path());
+      if (! rename_file(temp_path(), m_path))
+      {
+         delete_file(temp_path());
+         callback(false, "Unable to move the download to " + m_path + ".");
+         return;
+      }
+      callback(true, std::string(m_path));
+      return;
+   }
+   if (m_options.resume)
+      save_state();
+   else
+   {
+      delete_file(temp_path());
+      delete_file(state_path());
+   }
+   callback(false, std::string(data));
+}
+
+}
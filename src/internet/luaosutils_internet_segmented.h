@@ -0,0 +1,89 @@
+//
+//  luaosutils_internet_segmented.h
+//  luaosutils
+//
+//  (Usage permitted by MIT License. See LICENSE file in this repository.)
+//
+
+#ifndef luaosutils_internet_segmented_h
+#define luaosutils_internet_segmented_h
+
+#include <vector>
+#include <map>
+#include <mutex>
+
+#include "internet/luaosutils_internet_os.h"
+
+namespace luaosutils
+{
+
+/** \brief Settings for a segmented download. */
+struct segmented_download_options
+{
+   size_t segments{4};                                  // byte ranges downloaded in parallel
+   unsigned long long minSegmentBytes{1024 * 1024};     // smaller files are split into fewer segments
+   bool resume{true};                                   // keep partial downloads and continue them on the next attempt
+};
+
+/** \brief Downloads a url into a file as several byte ranges in parallel, and can resume an interrupted download.
+ *
+ * A one-byte range request first finds out whether the server supports ranges and how large the file is. The
+ * temporary file is then allocated at full size and each segment writes its range into it through its own
+ * file handle. The progress of every segment is kept in a state file next to the temporary file, so that a
+ * later download of the same url to the same path continues where this one stopped, as long as the server
+ * reports the same size and validator (`ETag` or `Last-Modified`). Without a validator, a download always starts over.
+ *
+ * Servers that do not support ranges are downloaded as a single stream, as by https_download_to_file. The
+ * callback runs once, on the main thread, with the path on success or an error message on failure.
+ * Destroying the download cancels it and, if resume is enabled, leaves the partial state for next time.
+ */
+class segmented_download
+{
+public:
+   struct segment;
+
+private:
+   std::string m_url;
+   std::string m_path;
+   HeadersMap m_headers;
+   segmented_download_options m_options;
+   lua_callback m_callback;
+
+   OSSESSION_ptr m_probe;
+   OSSESSION_ptr m_fallback;
+   std::map<size_t, OSSESSION_ptr> m_running;
+   std::vector<std::shared_ptr<segment>> m_segments;
+   unsigned long long m_totalSize{};
+   std::string m_validator;
+   std::mutex m_stateMutex;         // the state file is saved from the sinks as well as the main thread
+   std::string m_startError;
+   bool m_starting{};
+   bool m_finished{};
+
+   std::string temp_path() const;
+   std::string state_path() const;
+
+   void complete_probe(bool success, const std::string& data, const std::shared_ptr<response_info>& response);
+   void start_fallback();
+   bool prepare_segments();
+   bool load_state();
+   void save_state();
+   void start_segments();
+   void complete_segment(size_t index, bool success, const std::string& data);
+   void finish(bool success, const std::string& data);
+
+public:
+   segmented_download(const std::string& url, const std::string& path, const HeadersMap& headers,
+                      const segmented_download_options& options, lua_callback callback);
+   ~segmented_download();
+
+   segmented_download(const segmented_download&) = delete;
+   segmented_download& operator=(const segmented_download&) = delete;
+
+   /** \brief Sends the probe request. The callback may run before this returns if the request fails immediately. */
+   void start();
+};
+
+}
+
+#endif /* luaosutils_internet_segmented_h */
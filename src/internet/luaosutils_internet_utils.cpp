@@ -0,0 +1,359 @@
+//
+//  luaosutils_internet_utils.cpp
+//  luaosutils
+//
+//  (Usage permitted by MIT License. See LICENSE file in this repository.)
+//
+
+#include "luaosutils.hpp"
+#include "internet/luaosutils_internet_os.h"
+#include "internet/luaosutils_internet_utils.h"
+#include "luaosutils_trace.h"
+
+#if OPERATING_SYSTEM == WINDOWS
+#include <windows.h>
+#include "winutils/luaosutils_winutils.h"
+#endif
+
+namespace luaosutils
+{
+
+FILE* open_file(const std::string& path, const char* mode)
+{
+#if OPERATING_SYSTEM == WINDOWS
+   const std::string modeString(mode);
+   return _wfopen(utf8_to_WCHAR(path.c_str()).c_str(), std::wstring(modeString.begin(), modeString.end()).c_str());
+#else
+   return fopen(path.c_str(), mode);
+#endif
+}
+
+void delete_file(const std::string& path)
+{
+#if OPERATING_SYSTEM == WINDOWS
+   DeleteFileW(utf8_to_WCHAR(path.c_str()).c_str());
+#else
+   remove(path.c_str());
+#endif
+}
+
+bool read_file_contents(const std::string& path, std::string& contents)
+{
+   FILE* file = open_file(path, "rb");
+   if (!file) return false;
+   contents.clear();
+   char buffer[16384];
+   size_t numRead;
+   while ((numRead = fread(buffer, 1, sizeof(buffer), file)) > 0)
+      contents.append(buffer, numRead);
+   const bool success = ! ferror(file);
+   fclose(file);
+   return success;
+}
+
+std::string lowercase_header_name(const std::string& name)
+{
+   std::string retval = name;
+   for (char& c : retval)
+   {
+      if (c >= 'A' && c <= 'Z')
+         c = static_cast<char>(c - 'A' + 'a');
+   }
+   return retval;
+}
+
+void parse_response_headers(const std::string& raw, std::map<std::string, std::string>& headers)
+{
+   size_t lineStart = 0;
+   while (lineStart < raw.size())
+   {
+      size_t lineEnd = raw.find('\n', lineStart);
+      if (lineEnd == std::string::npos) lineEnd = raw.size();
+      std::string line = raw.substr(lineStart, lineEnd - lineStart);
+      lineStart = lineEnd + 1;
+      if (line.size() && line.back() == '\r')
+         line.pop_back();
+      if (line.compare(0, 5, "HTTP/") == 0)
+      {
+         headers.clear();
+         continue;
+      }
+      const size_t colon = line.find(':');
+      if (colon == std::string::npos || colon == 0)
+         continue;
+      const std::string name = lowercase_header_name(line.substr(0, colon));
+      const size_t valueStart = line.find_first_not_of(" \t", colon + 1);
+      const std::string value = (valueStart == std::string::npos) ? "" : line.substr(valueStart);
+      auto it = headers.find(name);
+      if (it == headers.end())
+         headers.emplace(name, value);
+      else
+         it->second += ", " + value;
+   }
+}
+
+bool rename_file(const std::string& fromPath, const std::string& toPath)
+{
+#if OPERATING_SYSTEM == WINDOWS
+   return MoveFileExW(utf8_to_WCHAR(fromPath.c_str()).c_str(), utf8_to_WCHAR(toPath.c_str()).c_str(),
+                      MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+   return rename(fromPath.c_str(), toPath.c_str()) == 0;
+#endif
+}
+
+bool chunk_queue::push(const char* data, size_t size, long long contentLength)
+{
+   std::lock_guard<std::mutex> lock(m_mutex);
+   const bool wasEmpty = m_chunks.empty();
+   m_bytesSoFar += size;
+   m_chunks.push_back(chunk{std::string(data, size), m_bytesSoFar, contentLength});
+   return wasEmpty;
+}
+
+void chunk_queue::deliver(const chunk_callback& callback)
+{
+   while (true)
+   {
+      chunk next;
+      {
+         std::lock_guard<std::mutex> lock(m_mutex);
+         if (m_chunks.empty()) return;
+         next = std::move(m_chunks.front());
+         m_chunks.pop_front();
+      }
+      callback(next.data, next.bytesSoFar, next.contentLength); // runs Lua, so it must be outside the lock
+   }
+}
+
+completion_signal::clock::time_point completion_signal::deadline_after(double seconds)
+{
+   return clock::now() + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>((std::max)(0.0, seconds)));
+}
+
+void completion_signal::complete(const std::function<void()>& storeResults)
+{
+   std::lock_guard<std::mutex> lock(m_mutex);
+   if (m_abandoned) return;
+   storeResults();
+   m_done = true;
+   m_signal.notify_all();
+}
+
+bool completion_signal::wait_until(clock::time_point deadline)
+{
+   std::unique_lock<std::mutex> lock(m_mutex);
+   if (m_signal.wait_until(lock, deadline, [this]() { return m_done; }))
+      return true;
+   m_abandoned = true;
+   return false;
+}
+
+static const double kDefaultCompletionBudget = 0.008; // about half a frame at 60 Hz
+
+completion_queue::completion_queue() : m_budgetSeconds(kDefaultCompletionBudget) {}
+
+// Completions may be pushed from I/O threads during static destruction, so the queue is never destroyed.
+completion_queue& completion_queue::instance()
+{
+   static completion_queue* queue = new completion_queue;
+   return *queue;
+}
+
+void completion_queue::push(std::function<void()> completion)
+{
+#ifdef LUAOSUTILS_TRACE
+   // The span from here to the start of the completion is the queueing delay.
+   const std::uint64_t traceId = trace_next_id();
+   LUAOSUTILS_TRACE_ASYNC_BEGIN("completion.queued", traceId);
+   completion = [traceId, completion = std::move(completion)]()
+         {
+            LUAOSUTILS_TRACE_ASYNC_END("completion.queued", traceId);
+            completion();
+         };
+#endif
+   bool requestDrain = false;
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_completions.push_back(std::move(completion));
+      requestDrain = ! m_drainRequested;
+      m_drainRequested = true;
+   }
+   m_signal.notify_one();
+   if (requestDrain)
+      request_completion_drain();
+}
+
+size_t completion_queue::drain(double budgetSeconds)
+{
+   LUAOSUTILS_TRACE_SCOPE("completion.drain");
+   std::deque<std::function<void()>> batch;
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      batch.swap(m_completions);
+      m_drainRequested = false;
+   }
+   const auto deadline = completion_signal::deadline_after(budgetSeconds);
+   while (batch.size())
+   {
+      std::function<void()> completion = std::move(batch.front());
+      batch.pop_front();
+      completion(); // Lua callbacks run here, outside the lock
+      if (budgetSeconds > 0 && completion_signal::clock::now() >= deadline)
+         break;
+   }
+   bool requestDrain = false;
+   size_t remaining;
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if (batch.size())
+      {
+         // Whatever was pushed while the batch ran goes after what is left of the batch.
+         for (auto& completion : m_completions)
+            batch.push_back(std::move(completion));
+         m_completions.swap(batch);
+      }
+      remaining = m_completions.size();
+      if (remaining && ! m_drainRequested)
+      {
+         m_drainRequested = true;
+         requestDrain = true;
+      }
+   }
+   if (requestDrain)
+      request_completion_drain();
+   return remaining;
+}
+
+bool completion_queue::wait_until(completion_signal::clock::time_point deadline)
+{
+   std::unique_lock<std::mutex> lock(m_mutex);
+   return m_signal.wait_until(lock, deadline, [this]() { return ! m_completions.empty(); });
+}
+
+void completion_queue::set_budget(double seconds)
+{
+   std::lock_guard<std::mutex> lock(m_mutex);
+   m_budgetSeconds = seconds;
+}
+
+double completion_queue::budget()
+{
+   std::lock_guard<std::mutex> lock(m_mutex);
+   return m_budgetSeconds;
+}
+
+bool download_file::open()
+{
+   if (m_file) fclose(m_file);
+   m_file = open_file(m_tempPath, "wb");
+   return m_file != nullptr;
+}
+
+bool download_file::write(const char* data, size_t size)
+{
+   if (!m_file && !open())
+      return false;
+   return fwrite(data, 1, size, m_file) == size;
+}
+
+bool download_file::commit()
+{
+   if (!m_file && !open()) // an empty response still produces an (empty) file
+      return false;
+   const bool closed = (fclose(m_file) == 0);
+   m_file = nullptr;
+   if (!closed || !rename_file(m_tempPath, m_path))
+   {
+      delete_file(m_tempPath);
+      return false;
+   }
+   return true;
+}
+
+void download_file::discard()
+{
+   if (m_file)
+   {
+      fclose(m_file);
+      m_file = nullptr;
+      delete_file(m_tempPath);
+   }
+}
+
+request_options count_https_request(std::string_view postData, lua_callback& callback, const request_options& options)
+{
+   static stats_counter& counter = get_stats_counter("backend.https_request");
+   counter.add(counter.calls);
+   counter.add(counter.bytesOut, postData.size());
+#ifdef LUAOSUTILS_TRACE
+   const std::uint64_t traceId = trace_next_id();
+   LUAOSUTILS_TRACE_ASYNC_BEGIN("internet.request", traceId);
+   callback = [traceId, callback = std::move(callback)](bool success, std::string&& data)
+         {
+            LUAOSUTILS_TRACE_ASYNC_END("internet.request", traceId);
+            callback(success, std::move(data));
+         };
+#endif
+   request_options result = options;
+   if (options.sink)
+   {
+      result.sink = [sink = options.sink](const char* data, size_t size) -> bool
+            {
+               counter.add(counter.bytesIn, size);
+               return sink(data, size);
+            };
+   }
+   if (options.chunkCallback)
+   {
+      result.chunkCallback = [chunkCallback = options.chunkCallback](const std::string& chunk, size_t bytesSoFar, long long contentLength)
+            {
+               counter.add(counter.bytesIn, chunk.size());
+               chunkCallback(chunk, bytesSoFar, contentLength);
+            };
+   }
+   // Streamed bodies are counted as they arrive and reach the callback empty.
+   callback = [callback = std::move(callback), start = stats_counter::clock::now()](bool success, std::string&& data)
+         {
+            counter.add_latency(stats_counter::clock::now() - start);
+            if (! success)
+               counter.add(counter.errors);
+            else
+               counter.add(counter.bytesIn, data.size());
+            callback(success, std::move(data));
+         };
+   return result;
+}
+
+OSSESSION_ptr https_download_to_file(const std::string& urlString, const std::string& filePath, const HeadersMap& headers,
+                                     lua_callback callback)
+{
+   // The file is shared by the sink, which may run on a background thread, and the completion callback,
+   // which runs on the main thread after the last chunk has been written.
+   auto file = std::make_shared<download_file>(filePath);
+   if (! file->open())
+   {
+      callback(false, "Unable to create " + file->temp_path() + ".");
+      return nullptr;
+   }
+   request_options options;
+   options.sink = [file](const char* data, size_t size) -> bool
+         {
+            return file->write(data, size);
+         };
+   return https_request("get", urlString, "", headers, -1,
+         [file, callback](bool success, std::string&& data) -> void
+         {
+            if (! success)
+            {
+               file->discard();
+               callback(false, std::move(data));
+            }
+            else if (! file->commit())
+               callback(false, "Unable to move the download to " + file->path() + ".");
+            else
+               callback(true, std::string(file->path()));
+         }, options);
+}
+
+}
@@ -0,0 +1,193 @@
+//
+//  luaosutils_internet_utils.h
+//  luaosutils
+//
+//  (Usage permitted by MIT License. See LICENSE file in this repository.)
+//
+//  Platform-independent helpers shared by the internet backends.
+
+#ifndef luaosutils_internet_utils_h
+#define luaosutils_internet_utils_h
+
+#include <string>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <functional>
+#include <map>
+
+namespace luaosutils
+{
+
+/** \brief Receives one chunk of the response body on the main thread.
+ *
+ * \param chunk the bytes that just arrived
+ * \param bytesSoFar the total number of bytes received, including this chunk
+ * \param contentLength the value of the Content-Length header, or -1 if the server did not send one
+ */
+using chunk_callback = std::function<void (const std::string& chunk, size_t bytesSoFar, long long contentLength)>;
+
+/** \brief Hands body chunks from the thread that receives them to the main thread, where Lua callbacks run. */
+class chunk_queue
+{
+   struct chunk
+   {
+      std::string data;
+      size_t bytesSoFar{};
+      long long contentLength{-1};
+   };
+
+   std::mutex m_mutex;
+   std::deque<chunk> m_chunks;
+   size_t m_bytesSoFar{};
+
+public:
+   /** \brief Adds a chunk. Thread-safe.
+    *
+    * \return true if the queue was empty, in which case the caller must arrange for #deliver to run on the main thread.
+    */
+   bool push(const char* data, size_t size, long long contentLength);
+
+   /** \brief Passes every queued chunk to the callback in order. Call only from the main thread. */
+   void deliver(const chunk_callback& callback);
+};
+
+/** \brief Lets a synchronous request block until its backend completes it on another thread, or a deadline passes.
+ *
+ * The backend stores its results inside #complete, and the waiting thread reads them only after #wait_until
+ * returns true. Once the deadline has passed, later completions are ignored, so the waiter can report a
+ * timeout and discard the request without racing the backend.
+ */
+class completion_signal
+{
+   std::mutex m_mutex;
+   std::condition_variable m_signal;
+   bool m_done{};
+   bool m_abandoned{};
+
+public:
+   using clock = std::chrono::steady_clock;
+
+   /** \brief Returns the deadline that is \p seconds from now. */
+   static clock::time_point deadline_after(double seconds);
+
+   /** \brief Calls \p storeResults and wakes the waiter, unless the waiter has already timed out. Thread-safe. */
+   void complete(const std::function<void()>& storeResults);
+
+   /** \brief Waits for #complete until \p deadline. Returns false if the deadline passed first. */
+   bool wait_until(clock::time_point deadline);
+};
+
+/** \brief Asks the main thread to call completion_queue::drain soon. Each backend defines it for its platform. */
+void request_completion_drain();
+
+/** \brief Readies the backend to drain completions. Called on the main thread before any async work starts that
+ * pushes to the completion queue. Returns false if the main thread cannot be woken to drain.
+ */
+bool prepare_completion_drain();
+
+/** \brief Hands completions from background threads to the main thread, which runs them in batches.
+ *
+ * Any thread may push. The main thread drains the queue from the platform's event loop, or the embedding
+ * host drains it with `luaosutils_pump_completions`. Each drain takes every waiting completion under one lock
+ * and runs them until the time budget is spent, so a burst of completions is spread over several turns of
+ * the event loop instead of blocking the UI. Completions left over are kept in order for the next drain.
+ */
+class completion_queue
+{
+   std::mutex m_mutex;
+   std::condition_variable m_signal;
+   std::deque<std::function<void()>> m_completions;
+   bool m_drainRequested{};
+   double m_budgetSeconds;
+
+   completion_queue();
+
+public:
+   static completion_queue& instance();
+
+   /** \brief Adds a completion to run on the main thread. Thread-safe. */
+   void push(std::function<void()> completion);
+
+   /** \brief Runs waiting completions until the queue is empty or \p budgetSeconds have passed. At least one
+    * completion runs if any is waiting. A budget of zero or less means no limit. Call only from the main thread.
+    *
+    * \return the number of completions still waiting.
+    */
+   size_t drain(double budgetSeconds);
+
+   /** \brief Drains with the configured budget. */
+   size_t drain() { return drain(budget()); }
+
+   /** \brief Waits until a completion is waiting or \p deadline passes. Returns true if one is waiting. */
+   bool wait_until(completion_signal::clock::time_point deadline);
+
+   /** \brief Sets the time budget of each drain that the event loop runs, in seconds. */
+   void set_budget(double seconds);
+   double budget();
+};
+
+/** \brief Parses a raw response header block ("Name: value" lines) into \p headers with lowercase names.
+ *
+ * A status line ("HTTP/...") clears the headers collected so far, so that only the final response of a
+ * redirect chain is kept. Repeated headers are joined with ", ".
+ */
+void parse_response_headers(const std::string& raw, std::map<std::string, std::string>& headers);
+
+/** \brief Returns a lowercase copy of a header name. */
+std::string lowercase_header_name(const std::string& name);
+
+/** \brief Opens a file with an fopen \p mode. The path is utf-8. */
+FILE* open_file(const std::string& path, const char* mode);
+
+/** \brief Renames a file, replacing any file already at \p toPath. The paths are utf-8. */
+bool rename_file(const std::string& fromPath, const std::string& toPath);
+
+/** \brief Reads a whole file into \p contents. The path is utf-8. */
+bool read_file_contents(const std::string& path, std::string& contents);
+
+/** \brief Deletes a file if it exists. The path is utf-8. */
+void delete_file(const std::string& path);
+
+/** \brief Writes a download to a temporary file next to its destination and renames it into place when complete.
+ *
+ * Because the temporary file is in the same folder as the destination, the final rename is atomic. Readers of
+ * the destination either see the previous file or the complete new one, never a partial download.
+ */
+class download_file
+{
+   std::string m_path;
+   std::string m_tempPath;
+   FILE* m_file{};
+
+public:
+   download_file(const std::string& path) : m_path(path), m_tempPath(temp_path_for(path)) {}
+   ~download_file() { discard(); }
+
+   download_file(const download_file&) = delete;
+   download_file& operator=(const download_file&) = delete;
+
+   /** \brief Returns the temporary path used while downloading to \p path. */
+   static std::string temp_path_for(const std::string& path) { return path + ".download"; }
+
+   const std::string& path() const { return m_path; }
+   const std::string& temp_path() const { return m_tempPath; }
+
+   /** \brief Creates (or truncates) the temporary file. */
+   bool open();
+
+   /** \brief Appends a chunk to the temporary file. Opens it first if necessary. */
+   bool write(const char* data, size_t size);
+
+   /** \brief Closes the temporary file and atomically renames it to the destination path. */
+   bool commit();
+
+   /** \brief Closes and deletes the temporary file, leaving any existing destination file untouched. */
+   void discard();
+};
+
+}
+
+#endif /* luaosutils_internet_utils_h */
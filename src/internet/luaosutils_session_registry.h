@@ -0,0 +1,136 @@
+//
+//  luaosutils_session_registry.h
+//  luaosutils
+//
+//  (Usage permitted by MIT License. See LICENSE file in this repository.)
+//
+
+#ifndef luaosutils_session_registry_h
+#define luaosutils_session_registry_h
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace luaosutils
+{
+
+/** \brief A table of live objects addressed by generation-counted handles.
+ *
+ * A handle packs a slot index (low 32 bits, offset by one so that 0 is never valid) with the generation
+ * of the slot when the handle was issued (high 32 bits). Releasing a handle bumps the slot's generation,
+ * so stale handles stop matching even after the slot is reused. Slots live in fixed-size pages that are
+ * never moved or freed, which lets #find run without a lock on any thread. Reserving and releasing
+ * handles take a mutex, but only to maintain the free list.
+ *
+ * The pointer that #find returns is only safe to use on the thread that owns the objects. Other threads
+ * may use it to test whether a handle is still live.
+ */
+template<typename T>
+class slot_registry
+{
+public:
+   using handle_type = std::uint64_t;
+
+private:
+   static constexpr size_t kPageBits = 10;
+   static constexpr size_t kPageSize = size_t(1) << kPageBits;
+   static constexpr size_t kMaxPages = 4096; // about 4 million slots
+
+   struct slot
+   {
+      std::atomic<std::uint32_t> generation{0};
+      std::atomic<T*> object{nullptr};
+   };
+
+   std::atomic<slot*> m_pages[kMaxPages] = {};
+   std::atomic<std::uint32_t> m_numSlots{0};
+   std::vector<std::uint32_t> m_freeSlots;
+   std::mutex m_mutex; // guards m_freeSlots and the allocation of slots and pages
+
+   static std::uint32_t index_of(handle_type handle) { return static_cast<std::uint32_t>(handle) - 1; }
+   static std::uint32_t generation_of(handle_type handle) { return static_cast<std::uint32_t>(handle >> 32); }
+
+   slot* slot_for(handle_type handle) const
+   {
+      if (static_cast<std::uint32_t>(handle) == 0) return nullptr;
+      const std::uint32_t index = index_of(handle);
+      if (index >= m_numSlots.load(std::memory_order_acquire)) return nullptr;
+      slot* page = m_pages[index >> kPageBits].load(std::memory_order_acquire);
+      return page ? &page[index & (kPageSize - 1)] : nullptr;
+   }
+
+public:
+   slot_registry() {}
+   ~slot_registry()
+   {
+      for (auto& page : m_pages)
+         delete[] page.load();
+   }
+
+   slot_registry(const slot_registry&) = delete;
+   slot_registry& operator=(const slot_registry&) = delete;
+
+   /** \brief Issues a new handle with no object bound to it yet.
+    *
+    * \return the handle, or 0 if every slot is in use.
+    */
+   handle_type reserve()
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      std::uint32_t index;
+      if (m_freeSlots.size())
+      {
+         index = m_freeSlots.back();
+         m_freeSlots.pop_back();
+      }
+      else
+      {
+         index = m_numSlots.load(std::memory_order_relaxed);
+         if (index >= kMaxPages * kPageSize) return 0;
+         auto& page = m_pages[index >> kPageBits];
+         if (! page.load(std::memory_order_relaxed))
+            page.store(new slot[kPageSize], std::memory_order_release);
+         m_numSlots.store(index + 1, std::memory_order_release);
+      }
+      slot* s = &m_pages[index >> kPageBits].load(std::memory_order_relaxed)[index & (kPageSize - 1)];
+      return (handle_type(s->generation.load(std::memory_order_relaxed)) << 32) | (handle_type(index) + 1);
+   }
+
+   /** \brief Binds an object to a handle from #reserve. Does nothing if the handle is no longer live. */
+   void bind(handle_type handle, T* object)
+   {
+      slot* s = slot_for(handle);
+      if (s && s->generation.load(std::memory_order_acquire) == generation_of(handle))
+         s->object.store(object, std::memory_order_release);
+   }
+
+   /** \brief Invalidates a handle and makes its slot available for reuse. Does nothing if the handle is no longer live. */
+   void release(handle_type handle)
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      slot* s = slot_for(handle);
+      if (!s || s->generation.load(std::memory_order_relaxed) != generation_of(handle)) return;
+      s->generation.fetch_add(1, std::memory_order_release);
+      s->object.store(nullptr, std::memory_order_release);
+      m_freeSlots.push_back(index_of(handle));
+   }
+
+   /** \brief Returns the object bound to a handle, or nullptr if the handle has been released or has no object yet. */
+   T* find(handle_type handle) const
+   {
+      const slot* s = slot_for(handle);
+      if (!s) return nullptr;
+      const std::uint32_t generation = generation_of(handle);
+      if (s->generation.load(std::memory_order_acquire) != generation) return nullptr;
+      T* object = s->object.load(std::memory_order_acquire);
+      // The slot may have been released and reused between the two loads.
+      if (s->generation.load(std::memory_order_acquire) != generation) return nullptr;
+      return object;
+   }
+};
+
+}
+
+#endif /* luaosutils_session_registry_h */
@@ -7,7 +7,13 @@
 //  (Usage permitted by MIT License. See LICENSE file in this repository.)
 //
 
+#include <algorithm>
+#include <climits>
+#include <cstring>
+
 #include "luaosutils.hpp"
+#include "internet/luaosutils_internet_utils.h"
+#include "luaosutils_trace.h"
 
 lua_CFunction luaosutils_errfunc_callback = nullptr;
 
@@ -17,11 +23,107 @@ constexpr static uint32_t kRestrictMenus = 0x0002;
 constexpr static uint32_t kRestrictExternal = 0x0004;
 static uint32_t g_restrictedOptions = 0; //this is always reset to zero after initialization
 
+/** \brief returns the performance counters of every function and backend operation that has been called
+ *
+ * stack position 1: (optional) if true, the counters are reset to zero as they are read
+ * \return table keyed by name (e.g., "internet.get") of tables with `calls`, `errors`, `bytes_in`, `bytes_out`,
+ *          `total_time` in seconds and `latency`, an array of call counts by latency bucket
+ */
+static int luaosutils_stats(lua_State *L)
+{
+   auto reset = get_lua_parameter<bool>(L, 1, LUA_TBOOLEAN, false);
+   lua_newtable(L);
+   luaosutils::for_each_stats_counter(reset, [L](const std::string& name, const luaosutils::stats_snapshot& stats)
+         {
+            lua_createtable(L, 0, 6);
+            lua_pushinteger(L, static_cast<lua_Integer>(stats.calls));
+            lua_setfield(L, -2, "calls");
+            lua_pushinteger(L, static_cast<lua_Integer>(stats.errors));
+            lua_setfield(L, -2, "errors");
+            lua_pushinteger(L, static_cast<lua_Integer>(stats.bytesIn));
+            lua_setfield(L, -2, "bytes_in");
+            lua_pushinteger(L, static_cast<lua_Integer>(stats.bytesOut));
+            lua_setfield(L, -2, "bytes_out");
+            lua_pushnumber(L, static_cast<lua_Number>(stats.totalNanoseconds) / 1e9);
+            lua_setfield(L, -2, "total_time");
+            lua_createtable(L, static_cast<int>(luaosutils::kStatsLatencyBuckets), 0);
+            for (size_t x = 0; x < luaosutils::kStatsLatencyBuckets; x++)
+            {
+               lua_pushinteger(L, static_cast<lua_Integer>(stats.latency[x]));
+               lua_rawseti(L, -2, static_cast<lua_Integer>(x + 1));
+            }
+            lua_setfield(L, -2, "latency");
+            lua_setfield(L, -2, name.c_str());
+         });
+   return 1;
+}
+
+#ifdef LUAOSUTILS_TRACE
+/** \brief returns the recorded trace spans as Chrome trace-event JSON
+ *
+ * stack position 1: (optional) if true, the recorded spans are cleared after they are read
+ * \return string containing the JSON
+ */
+static std::string luaosutils_trace_dump(std::optional<bool> clear)
+{
+   return luaosutils::trace_to_json(clear.value_or(false));
+}
+#endif
+
 static const luaL_Reg funcs[] = {
-   // currently no top-level functions
+   {"stats",               luaosutils_stats},
+#ifdef LUAOSUTILS_TRACE
+   {"trace_dump",          lua_bind<luaosutils_trace_dump>},
+#endif
    {NULL, NULL} // sentinel
 };
 
+/** \brief a nested namespace table and the function that builds it */
+struct lazy_namespace
+{
+   const char* name;
+   void (*create)(lua_State *L, uint32_t restrictedOptions);
+};
+
+static const lazy_namespace namespaces[] = {
+   {"buffer",     [](lua_State *L, uint32_t) { luaosutils_buffer_create(L); }},
+   {"crypto",     [](lua_State *L, uint32_t) { luaosutils_crypto_create(L); }},
+   {"internet",   [](lua_State *L, uint32_t restrictedOptions) { luaosutils_internet_create(L, (restrictedOptions & kRestrictHttps) != 0); }},
+#if OPERATING_SYSTEM != LINUX_OS // Linux hosts are headless, so there are no menus
+   {"menu",       [](lua_State *L, uint32_t restrictedOptions) { luaosutils_menu_create(L, (restrictedOptions & kRestrictMenus) != 0); }},
+#endif
+   {"process",    [](lua_State *L, uint32_t restrictedOptions) { luaosutils_process_create(L, (restrictedOptions & kRestrictExternal) != 0); }},
+   {"text",       [](lua_State *L, uint32_t) { luaosutils_text_create(L); }}
+};
+
+/** \brief builds a nested namespace table the first time a script reads it
+ *
+ * upvalue 1: the restricted options in effect when the library was opened
+ * stack position 1: the luaosutils table
+ * stack position 2: the key being read
+ * \return the namespace table, or nil if the key is not a namespace
+ */
+static int luaosutils_index(lua_State *L)
+{
+   const char* key = (lua_type(L, 2) == LUA_TSTRING) ? lua_tostring(L, 2) : nullptr;
+   if (key)
+   {
+      for (const auto& space : namespaces)
+      {
+         if (strcmp(key, space.name) != 0)
+            continue;
+         const uint32_t restrictedOptions = static_cast<uint32_t>(lua_tointeger(L, lua_upvalueindex(1)));
+         lua_settop(L, 2);
+         lua_pushvalue(L, 1);
+         space.create(L, restrictedOptions); // stores the table in the luaosutils table, so this runs once per state
+         lua_getfield(L, -1, space.name);
+         return 1;
+      }
+   }
+   lua_pushnil(L);
+   return 1;
+}
+
 static int luaopen_luaosutils(lua_State *L, bool restricted, bool restrictMenus)
 {
    /* export functions (and leave namespace table on top of stack) */
@@ -30,12 +132,12 @@ static int luaopen_luaosutils(lua_State *L, bool restricted, bool restrictMenus)
 #else
    luaL_newlib(L, funcs);
 #endif
-   /* add nested tables */
-   luaosutils_crypto_create(L);
-   luaosutils_internet_create(L, (g_restrictedOptions & kRestrictHttps) != 0);
-   luaosutils_menu_create(L, (g_restrictedOptions & kRestrictMenus) != 0);
-   luaosutils_process_create(L, (g_restrictedOptions & kRestrictExternal) != 0);
-   luaosutils_text_create(L);
+   /* add nested tables when they are first used */
+   lua_createtable(L, 0, 1);
+   lua_pushinteger(L, static_cast<lua_Integer>(g_restrictedOptions));
+   lua_pushcclosure(L, luaosutils_index, 1);
+   lua_setfield(L, -2, "__index");
+   lua_setmetatable(L, -2);
    /* make version string available to scripts */
    lua_pushstring(L, "_VERSION");
    lua_pushstring(L, LUAOSUTILS_VERSION);
@@ -65,3 +167,14 @@ int luaopen_luaosutils_restricted(lua_State *L)
    luaosutils_set_permissions(false, true, true);
    return luaopen_luaosutils(L, true, true);
 }
+
+int luaosutils_pump_completions(double budgetSeconds)
+{
+   const size_t remaining = luaosutils::completion_queue::instance().drain(budgetSeconds);
+   return static_cast<int>((std::min)(remaining, static_cast<size_t>(INT_MAX)));
+}
+
+void luaosutils_set_completion_budget(double budgetSeconds)
+{
+   luaosutils::completion_queue::instance().set_budget(budgetSeconds);
+}
@@ -10,14 +10,17 @@
 #ifndef luaosutils_hpp
 #define luaosutils_hpp
 
-#define LUAOSUTILS_VERSION "Luaosutils 2.5.0"
+#define LUAOSUTILS_VERSION "Luaosutils 2.6.0"
 
 #define MAC_OS       1         /* Macintosh operating system */
 #define WINDOWS      2         /* Microsoft Windows (MS-DOS) */
+#define LINUX_OS     3         /* Linux (headless hosts only) */
 #define UNKNOWN_OS   -1
 
 #if defined(_WIN32)
 #define OPERATING_SYSTEM WINDOWS
+#elif defined(__linux__)
+#define OPERATING_SYSTEM LINUX_OS
 #elif defined(__GNUC__)
 #define OPERATING_SYSTEM MAC_OS
 #else
@@ -40,6 +43,14 @@
 #define MAC_PARM(X)
 #endif
 
+#if OPERATING_SYSTEM == LINUX_OS
+#define LINUXCODE(X) X
+#define LINUX_PARM(X) , X
+#else
+#define LINUXCODE(X)
+#define LINUX_PARM(X)
+#endif
+
 #include <string>
 #include <functional>
 #include <optional>
@@ -47,6 +58,7 @@
 #include "lua.hpp"
 #include "luaosutils_export.h"
 #include "luaosutils_luastack.h"
+#include "luaosutils_stats.h"
 
 #define TRUSTED_ERROR_MESSAGE "trusted code is required to run this function"
 
@@ -63,10 +75,12 @@ inline void add_constant(lua_State *L, const char* const_name, int value, int ta
 
 inline int restricted_function(lua_State *L)
 {
+   luaosutils::note_stats_error();
    luaL_error(L, "the current permissions environment does not allow this function to run");
    return 0;
 }
 
+void luaosutils_buffer_create(lua_State *L);
 void luaosutils_crypto_create(lua_State *L);
 void luaosutils_internet_create(lua_State *L, bool restricted);
 void luaosutils_menu_create(lua_State *L, bool restricted);
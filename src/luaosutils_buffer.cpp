@@ -0,0 +1,174 @@
+//
+//  luaosutils_buffer.cpp
+//  luaosutils
+//
+//  (Usage permitted by MIT License. See LICENSE file in this repository.)
+//
+
+#include <algorithm>
+#include <cstdio>
+
+#include "luaosutils.hpp"
+#include "luaosutils_buffer.h"
+#include "internet/luaosutils_internet_utils.h"
+
+/** \brief Lets functions bound with lua_bind take buffers, checking that they are buffer userdata. */
+template<>
+struct lua_metatable_key<luaosutils::shared_buffer*>
+{
+   static constexpr const char* value = luaosutils::kBufferMetatableKey;
+};
+
+namespace luaosutils
+{
+
+shared_buffer::shared_buffer(encryptBuffer&& bytes)
+{
+   auto owner = std::make_shared<const encryptBuffer>(std::move(bytes));
+   m_data = owner->data();
+   m_size = owner->size();
+   m_owner = std::move(owner);
+}
+
+shared_buffer::shared_buffer(std::string&& bytes)
+{
+   auto owner = std::make_shared<const std::string>(std::move(bytes));
+   m_data = reinterpret_cast<const uint8_t*>(owner->data());
+   m_size = owner->size();
+   m_owner = std::move(owner);
+}
+
+shared_buffer shared_buffer::slice(size_t offset, size_t size) const
+{
+   shared_buffer result(*this);
+   offset = (std::min)(offset, m_size);
+   result.m_data = m_data + offset;
+   result.m_size = (std::min)(size, m_size - offset);
+   return result;
+}
+
+static int buffer_gc(lua_State* L)
+{
+   auto buffer = static_cast<shared_buffer*>(lua_touserdata(L, 1));
+   buffer->~shared_buffer();
+   return 0;
+}
+
+static lua_Integer buffer_len(shared_buffer* buffer)
+{
+   return static_cast<lua_Integer>(buffer->size());
+}
+
+static std::string_view buffer_tostring(shared_buffer* buffer)
+{
+   return buffer->string_view();
+}
+
+/** \brief returns part of a buffer without copying it, taking the same positions as `string.sub`
+ *
+ * \param first the position of the first byte, counting from the end if negative
+ * \param last the position of the last byte, counting from the end if negative (default -1)
+ */
+static shared_buffer buffer_sub(shared_buffer* buffer, lua_Integer first, std::optional<lua_Integer> last)
+{
+   const lua_Integer size = static_cast<lua_Integer>(buffer->size());
+   lua_Integer start = first;
+   if (start < 0)
+      start = (std::max)(size + start + 1, lua_Integer(1));
+   else if (start == 0)
+      start = 1;
+   lua_Integer end = last.value_or(-1);
+   if (end < 0)
+      end = size + end + 1;
+   else if (end > size)
+      end = size;
+   if (start > end)
+      return buffer->slice(0, 0);
+   return buffer->slice(static_cast<size_t>(start - 1), static_cast<size_t>(end - start + 1));
+}
+
+/** \brief writes a buffer to a file, replacing the file if it exists
+ *
+ * \param path the utf-8 path of the file
+ * \return true if the whole buffer was written
+ */
+static bool buffer_write_file(shared_buffer* buffer, const std::string& path)
+{
+   FILE* file = open_file(path, "wb");
+   if (! file)
+      return false;
+   const bool success = fwrite(buffer->data(), 1, buffer->size(), file) == buffer->size();
+   return (fclose(file) == 0) && success;
+}
+
+static const luaL_Reg buffer_methods[] = {
+   {"len",                 lua_bind<buffer_len>},
+   {"sub",                 lua_bind<buffer_sub>},
+   {"tostring",            lua_bind<buffer_tostring>},
+   {"write_file",          lua_bind<buffer_write_file>},
+   {NULL, NULL} // sentinel
+};
+
+void push_buffer(lua_State* L, shared_buffer buffer)
+{
+   new (lua_newuserdata(L, sizeof(shared_buffer))) shared_buffer(std::move(buffer));
+   if (luaL_newmetatable(L, kBufferMetatableKey))
+   {
+      lua_pushcfunction(L, buffer_gc);
+      lua_setfield(L, -2, "__gc");
+      lua_pushcfunction(L, lua_bind<buffer_len>);
+      lua_setfield(L, -2, "__len");
+      lua_pushcfunction(L, lua_bind<buffer_tostring>);
+      lua_setfield(L, -2, "__tostring");
+      lua_newtable(L);
+      set_counted_funcs(L, buffer_methods, "buffer");
+      lua_setfield(L, -2, "__index");
+   }
+   lua_setmetatable(L, -2);
+}
+
+}
+
+/** \brief returns a new buffer holding a copy of a string
+ *
+ * \param data the string (or buffer) to copy
+ */
+static luaosutils::shared_buffer luaosutils_buffer_new(std::string data)
+{
+   return luaosutils::shared_buffer(std::move(data));
+}
+
+/** \brief reads a whole file into a buffer
+ *
+ * \param path the utf-8 path of the file
+ * \return the buffer, or nil if the file could not be read
+ */
+static std::optional<luaosutils::shared_buffer> luaosutils_buffer_read_file(const std::string& path)
+{
+   std::string contents;
+   if (! luaosutils::read_file_contents(path, contents))
+      return std::nullopt;
+   return luaosutils::shared_buffer(std::move(contents));
+}
+
+/** \brief returns true if the value at stack position 1 is a buffer */
+static int luaosutils_buffer_is_buffer(lua_State *L)
+{
+   lua_pushboolean(L, luaosutils::to_buffer(L, 1) != nullptr);
+   return 1;
+}
+
+static const luaL_Reg buffer_utils[] = {
+   {"new",                 lua_bind<luaosutils_buffer_new>},
+   {"read_file",           lua_bind<luaosutils_buffer_read_file>},
+   {"is_buffer",           luaosutils_buffer_is_buffer},
+   {NULL, NULL} // sentinel
+};
+
+void luaosutils_buffer_create(lua_State *L)
+{
+   lua_newtable(L);  // create nested table
+
+   luaosutils::set_counted_funcs(L, buffer_utils, "buffer"); // add file methods to new metatable
+   lua_setfield(L, -2, "buffer");       // add the nested table to the parent table with the name
+}
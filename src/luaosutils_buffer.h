@@ -0,0 +1,87 @@
+//
+//  luaosutils_buffer.h
+//  luaosutils
+//
+//  (Usage permitted by MIT License. See LICENSE file in this repository.)
+//
+
+#ifndef luaosutils_buffer_h
+#define luaosutils_buffer_h
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <variant>
+
+#include "lua.hpp"
+#include "crypto/luaosutils_crypto_utils.h"
+
+namespace luaosutils
+{
+
+constexpr const char* const kBufferMetatableKey = "luaosutils.buffer";
+
+/** \brief Immutable bytes that a `luaosutils.buffer` userdata holds instead of a Lua string.
+ *
+ * The bytes are shared rather than copied: slices and copies of a shared_buffer refer to the same storage,
+ * which is freed when the last of them is destroyed. A shared_buffer takes over the string or vector it is
+ * built from, so wrapping a result that is already in memory does not copy it.
+ */
+class shared_buffer
+{
+   std::shared_ptr<const void> m_owner;
+   const uint8_t* m_data{};
+   size_t m_size{};
+
+public:
+   shared_buffer() {}
+   explicit shared_buffer(encryptBuffer&& bytes);
+   explicit shared_buffer(std::string&& bytes);
+
+   const uint8_t* data() const { return m_data; }
+   size_t size() const { return m_size; }
+   bufferView view() const { return bufferView(m_data, m_size); }
+   std::string_view string_view() const { return std::string_view(reinterpret_cast<const char*>(m_data), m_size); }
+
+   /** \brief Returns the bytes from \p offset for \p size bytes, sharing this buffer's storage. Both are clamped to the buffer. */
+   shared_buffer slice(size_t offset, size_t size) const;
+};
+
+/** \brief The value of a function that returns either a Lua string or a buffer, depending on what the caller asked for. */
+using bytes_result = std::variant<std::string, encryptBuffer, shared_buffer>;
+
+/** \brief A string or buffer argument, for functions that return a buffer when they are passed one. */
+struct bytes_argument
+{
+   bufferView bytes;
+   bool isBuffer{};
+};
+
+/** \brief Returns \p bytes as a buffer if \p asBuffer is true or as a Lua string otherwise. Either way, \p bytes are moved, not copied. */
+inline bytes_result make_bytes_result(std::string&& bytes, bool asBuffer)
+{
+   if (asBuffer)
+      return shared_buffer(std::move(bytes));
+   return std::move(bytes);
+}
+
+inline bytes_result make_bytes_result(encryptBuffer&& bytes, bool asBuffer)
+{
+   if (asBuffer)
+      return shared_buffer(std::move(bytes));
+   return std::move(bytes);
+}
+
+/** \brief Pushes a new buffer userdata that holds \p buffer. */
+void push_buffer(lua_State* L, shared_buffer buffer);
+
+/** \brief Returns the buffer at \p index, or nullptr if the value there is not a buffer userdata. */
+inline const shared_buffer* to_buffer(lua_State* L, int index)
+{
+   return static_cast<const shared_buffer*>(luaL_testudata(L, index, kBufferMetatableKey));
+}
+
+}
+
+#endif /* luaosutils_buffer_h */
@@ -10,6 +10,8 @@
 #ifndef luaosutils_export_h
 #define luaosutils_export_h
 
+#include <stddef.h>
+
 #include "lua.hpp"
 
 #ifdef _WIN32 // can't use #if OPERATING_SYSTEM == WINDOWS here because external code may have conflicting definitions
@@ -26,6 +28,31 @@ extern "C" {
 LUAOSUTILS_EXPORT int luaopen_luaosutils(lua_State* L);
 LUAOSUTILS_EXPORT int luaopen_luaosutils_restricted(lua_State* L);
 
+/* luaosutils_pump_completions runs pending async completions (Lua callbacks) on the calling thread, which must be
+   the thread that runs Lua. It returns after budgetSeconds (zero or less means no limit) or when none are left,
+   and returns the number still waiting. Hosts whose main loop is not the platform run loop call it from that loop. */
+LUAOSUTILS_EXPORT int luaosutils_pump_completions(double budgetSeconds);
+
+/* luaosutils_set_completion_budget limits how long each automatic pump from the platform run loop may run. */
+LUAOSUTILS_EXPORT void luaosutils_set_completion_budget(double budgetSeconds);
+
+/* The luaosutils_ffi_ functions are a plain C path to the pure utility functions for LuaJIT FFI callers, which
+   skips the Lua stack. Each writes its result to the caller's output buffer and returns the number of bytes the
+   result needs. If that is more than outputSize, nothing is written and the caller retries with a larger buffer.
+   Results are not null-terminated. The functions never throw, and they return LUAOSUTILS_FFI_ERROR on failure.
+   luaosutils_ffi.lua has the matching cdef and Lua wrappers. */
+#define LUAOSUTILS_FFI_ERROR ((size_t)-1)
+
+LUAOSUTILS_EXPORT size_t luaosutils_ffi_url_escape(const char* input, size_t inputSize, char* output, size_t outputSize);
+LUAOSUTILS_EXPORT size_t luaosutils_ffi_conv_bin_to_chars(const unsigned char* input, size_t inputSize, char* output, size_t outputSize);
+/* Needs (inputSize + 1) / 2 bytes of output, and returns the number of bytes decoded, which is less if some pairs are not hex. */
+LUAOSUTILS_EXPORT size_t luaosutils_ffi_conv_chars_to_bin(const char* input, size_t inputSize, unsigned char* output, size_t outputSize);
+/* Fills all outputSize bytes. */
+LUAOSUTILS_EXPORT size_t luaosutils_ffi_calc_randomized_data(unsigned char* output, size_t outputSize);
+/* Returns 0 for empty input, whatever the codepages, as text.convert_encoding returns "". */
+LUAOSUTILS_EXPORT size_t luaosutils_ffi_text_convert_encoding(const char* input, size_t inputSize, unsigned int fromCodepage,
+                                                              unsigned int toCodepage, char* output, size_t outputSize);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,86 @@
+//
+//  luaosutils_ffi.cpp
+//  luaosutils
+//
+//  (Usage permitted by MIT License. See LICENSE file in this repository.)
+//
+//  The plain C entry points declared in luaosutils_export.h for LuaJIT FFI callers. None of them may let
+//  an exception escape.
+
+#include <cstring>
+#include <string>
+#include <string_view>
+
+#include "luaosutils.hpp"
+#include "crypto/luaosutils_crypto_utils.h"
+#include "internet/luaosutils_internet_os.h"
+#include "text/luaosutils_text_os.h"
+
+// Copies a result into the caller's buffer if it fits and returns the size the result needs.
+static size_t copy_ffi_result(const std::string& result, char* output, size_t outputSize)
+{
+   if (result.size() <= outputSize && result.size())
+      memcpy(output, result.data(), result.size());
+   return result.size();
+}
+
+size_t luaosutils_ffi_url_escape(const char* input, size_t inputSize, char* output, size_t outputSize)
+{
+   try
+   {
+      return copy_ffi_result(luaosutils::url_escape(std::string(input, inputSize)), output, outputSize);
+   }
+   catch (...)
+   {
+      return LUAOSUTILS_FFI_ERROR;
+   }
+}
+
+size_t luaosutils_ffi_conv_bin_to_chars(const unsigned char* input, size_t inputSize, char* output, size_t outputSize)
+{
+   const size_t needed = 2 * inputSize;
+   if (needed <= outputSize)
+      luaosutils::buffer2HexChars(luaosutils::bufferView(input, inputSize), output);
+   return needed;
+}
+
+size_t luaosutils_ffi_conv_chars_to_bin(const char* input, size_t inputSize, unsigned char* output, size_t outputSize)
+{
+   const size_t needed = (inputSize + 1) / 2;
+   if (needed > outputSize)
+      return needed;
+   return luaosutils::hexChars2Buffer(std::string_view(input, inputSize), output);
+}
+
+size_t luaosutils_ffi_calc_randomized_data(unsigned char* output, size_t outputSize)
+{
+   try
+   {
+      luaosutils::fill_randomized_data(output, outputSize);
+      return outputSize;
+   }
+   catch (...) // std::random_device throws if the operating system's generator is unavailable
+   {
+      return LUAOSUTILS_FFI_ERROR;
+   }
+}
+
+size_t luaosutils_ffi_text_convert_encoding(const char* input, size_t inputSize, unsigned int fromCodepage,
+                                            unsigned int toCodepage, char* output, size_t outputSize)
+{
+   if (inputSize == 0)
+      return 0; // text.convert_encoding returns "" for empty text without checking the codepages
+   if (! fromCodepage || ! toCodepage)
+      return LUAOSUTILS_FFI_ERROR;
+   try
+   {
+      std::string result;
+      if (! luaosutils::text_convert_encoding(std::string_view(input, inputSize), fromCodepage, result, toCodepage))
+         return LUAOSUTILS_FFI_ERROR;
+      return copy_ffi_result(result, output, outputSize);
+   }
+   catch (...)
+   {
+      return LUAOSUTILS_FFI_ERROR;
+   }
+}
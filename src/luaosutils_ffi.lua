@@ -0,0 +1,119 @@
+--
+--  luaosutils_ffi.lua
+--  luaosutils
+--
+--  (Usage permitted by MIT License. See LICENSE file in this repository.)
+--
+--  LuaJIT FFI bindings for the luaosutils_ffi_ functions in luaosutils_export.h. Calls through these skip the
+--  Lua C API stack, so the JIT can compile them into the calling trace. They return the same values as the
+--  functions of the same names in the luaosutils namespaces.
+--
+--     local osutils_ffi = require('luaosutils_ffi')
+--     local escaped = osutils_ffi.url_escape("a b&c")
+--
+--  The functions are looked up in the host process first, for hosts that link luaosutils statically, and
+--  otherwise in the luaosutils library found on package.cpath. Call osutils_ffi.load(path) to use a specific
+--  library instead.
+--
+
+local ffi = require('ffi')
+
+ffi.cdef[[
+size_t luaosutils_ffi_url_escape(const char* input, size_t inputSize, char* output, size_t outputSize);
+size_t luaosutils_ffi_conv_bin_to_chars(const unsigned char* input, size_t inputSize, char* output, size_t outputSize);
+size_t luaosutils_ffi_conv_chars_to_bin(const char* input, size_t inputSize, unsigned char* output, size_t outputSize);
+size_t luaosutils_ffi_calc_randomized_data(unsigned char* output, size_t outputSize);
+size_t luaosutils_ffi_text_convert_encoding(const char* input, size_t inputSize, unsigned int fromCodepage,
+                                            unsigned int toCodepage, char* output, size_t outputSize);
+]]
+
+local FFI_ERROR = ffi.cast('size_t', -1)
+local UTF8_CODEPAGE = 65001
+
+local function find_library()
+   if pcall(function() return ffi.C.luaosutils_ffi_url_escape end) then
+      return ffi.C
+   end
+   local path = package.searchpath('luaosutils', package.cpath)
+   if not path then
+      error("luaosutils library not found on package.cpath", 3)
+   end
+   return ffi.load(path)
+end
+
+local lib = nil
+
+-- Output buffer shared by all calls. It only grows, so steady-state calls do not allocate it.
+local scratchSize = 256
+local scratch = ffi.new('uint8_t[?]', scratchSize)
+
+local function get_scratch(size)
+   if size > scratchSize then
+      scratchSize = math.max(size, 2 * scratchSize)
+      scratch = ffi.new('uint8_t[?]', scratchSize)
+   end
+   return scratch
+end
+
+local M = {}
+
+function M.load(path)
+   lib = path and ffi.load(path) or find_library()
+   return M
+end
+
+function M.url_escape(input)
+   local buffer = get_scratch(3 * #input)
+   local size = lib.luaosutils_ffi_url_escape(input, #input, buffer, scratchSize)
+   if size == FFI_ERROR then
+      return ""
+   end
+   if size > scratchSize then
+      buffer = get_scratch(tonumber(size))
+      size = lib.luaosutils_ffi_url_escape(input, #input, buffer, scratchSize)
+   end
+   return ffi.string(buffer, size)
+end
+
+function M.conv_bin_to_chars(input)
+   local size = 2 * #input
+   local buffer = get_scratch(size)
+   lib.luaosutils_ffi_conv_bin_to_chars(input, #input, buffer, scratchSize)
+   return ffi.string(buffer, size)
+end
+
+function M.conv_chars_to_bin(input)
+   local buffer = get_scratch(math.floor((#input + 1) / 2))
+   local size = lib.luaosutils_ffi_conv_chars_to_bin(input, #input, buffer, scratchSize)
+   return ffi.string(buffer, size)
+end
+
+function M.calc_randomized_data(size)
+   if not size or size <= 0 then
+      size = math.random(32, 96)
+   end
+   local buffer = get_scratch(size)
+   if lib.luaosutils_ffi_calc_randomized_data(buffer, size) == FFI_ERROR then
+      return nil
+   end
+   return ffi.string(buffer, size)
+end
+
+function M.convert_encoding(text, fromCodepage, toCodepage)
+   if #text == 0 then
+      return "" -- as text.convert_encoding, whatever the codepages
+   end
+   toCodepage = toCodepage or UTF8_CODEPAGE
+   local buffer = get_scratch(3 * #text + 16)
+   local size = lib.luaosutils_ffi_text_convert_encoding(text, #text, fromCodepage, toCodepage, buffer, scratchSize)
+   if size == FFI_ERROR then
+      return nil
+   end
+   if size > scratchSize then
+      buffer = get_scratch(tonumber(size))
+      size = lib.luaosutils_ffi_text_convert_encoding(text, #text, fromCodepage, toCodepage, buffer, scratchSize)
+   end
+   return ffi.string(buffer, size)
+end
+
+return M.load()
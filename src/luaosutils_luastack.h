@@ -15,9 +15,32 @@
 #ifndef __OBJC__
 
 #include <string>
+#include <string_view>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <variant>
 
 #include "lua.hpp"
 #include "crypto/luaosutils_crypto_utils.h"
+#include "luaosutils_buffer.h"
+#include "luaosutils_stats.h"
+
+/** \brief Returns the bytes of the string or buffer at \p index, or an empty view for any other value.
+ *
+ * As with lua_tolstring, a number is converted to a string in place.
+ */
+inline std::string_view lua_bytes_view(lua_State* L, int index)
+{
+   size_t len = 0;
+   const char* str = lua_tolstring(L, index, &len);
+   if (str)
+      return std::string_view(str, len);
+   if (const luaosutils::shared_buffer* buffer = luaosutils::to_buffer(L, index))
+      return buffer->string_view();
+   return std::string_view();
+}
 
 template<typename T>
 class LuaStack
@@ -39,7 +62,9 @@ public:
 private:
    lua_State* L;
    
-   template<typename U>
+   // The unused second parameter makes the specializations below partial ones. GCC rejects explicit
+   // specializations in class scope.
+   template<typename U, typename = void>
    struct get_helper {
       static U get(lua_State*, int) {
          // Default implementation throws an error
@@ -53,15 +78,15 @@ private:
       static_assert(sizeof(U) == 0, "No specialized implementation for this type");
    }
    
-   template<>
-   struct get_helper<bool> {
+   template<typename Unused>
+   struct get_helper<bool, Unused> {
       static bool get(lua_State* L, int index) {
          return lua_toboolean(L, index);
       }
    };
    
-   template<>
-   struct get_helper<int> {
+   template<typename Unused>
+   struct get_helper<int, Unused> {
       static int get(lua_State* L, int index) {
          if (lua_isfunction(L, index))
          {
@@ -72,44 +97,70 @@ private:
       }
    };
    
-   template<>
-   struct get_helper<unsigned int> {
+   template<typename Unused>
+   struct get_helper<unsigned int, Unused> {
       static unsigned int get(lua_State* L, int index) {
          return static_cast<unsigned int>(lua_tointeger(L, index));
       }
    };
 
-   template<>
-   struct get_helper<long> {
+   template<typename Unused>
+   struct get_helper<long, Unused> {
       static long get(lua_State* L, int index) {
          return static_cast<long>(lua_tointeger(L, index));
       }
    };
 
-   template<>
-   struct get_helper<double> {
+   template<typename Unused>
+   struct get_helper<long long, Unused> {
+      static long long get(lua_State* L, int index) {
+         return static_cast<long long>(lua_tointeger(L, index));
+      }
+   };
+
+   template<typename Unused>
+   struct get_helper<double, Unused> {
       static double get(lua_State* L, int index) {
          return lua_tonumber(L, index);
       }
    };
    
-   template<>
-   struct get_helper<std::string> {
+   template<typename Unused>
+   struct get_helper<std::string, Unused> {
       static std::string get(lua_State* L, int index) {
-         const char* str = lua_tolstring(L, index, nullptr);
-         if (str == nullptr) return "";
-         const size_t len = lua_rawlen(L, index);
-         return std::string(str, len);
+         return std::string(lua_bytes_view(L, index));
       }
    };
    
-   template<>
-   struct get_helper<luaosutils::encryptBuffer> {
+   // The views borrow the string or buffer that Lua owns, so they are only valid while the value stays on the
+   // stack. For a function argument, that is until the C function returns.
+   template<typename Unused>
+   struct get_helper<std::string_view, Unused> {
+      static std::string_view get(lua_State* L, int index) {
+         return lua_bytes_view(L, index);
+      }
+   };
+   
+   template<typename Unused>
+   struct get_helper<luaosutils::bufferView, Unused> {
+      static luaosutils::bufferView get(lua_State* L, int index) {
+         const std::string_view bytes = lua_bytes_view(L, index);
+         return luaosutils::bufferView(reinterpret_cast<const uint8_t*>(bytes.data()), bytes.size());
+      }
+   };
+   
+   template<typename Unused>
+   struct get_helper<luaosutils::bytes_argument, Unused> {
+      static luaosutils::bytes_argument get(lua_State* L, int index) {
+         return {get_helper<luaosutils::bufferView>::get(L, index), luaosutils::to_buffer(L, index) != nullptr};
+      }
+   };
+   
+   template<typename Unused>
+   struct get_helper<luaosutils::encryptBuffer, Unused> {
       static luaosutils::encryptBuffer get(lua_State* L, int index) {
-         const uint8_t* val = (const uint8_t*)lua_tolstring(L, index, nullptr);
-         if (val == nullptr) return luaosutils::encryptBuffer();
-         const size_t len = lua_rawlen(L, index);
-         return luaosutils::encryptBuffer(val, val + len);
+         const std::string_view bytes = lua_bytes_view(L, index);
+         return luaosutils::encryptBuffer(bytes.begin(), bytes.end());
       }
    };
 
@@ -129,6 +180,17 @@ private:
       lua_pushinteger(L, value);
    }
 
+   void push_impl(long long value) {
+      lua_pushinteger(L, static_cast<lua_Integer>(value));
+   }
+
+   void push_impl(const std::optional<long long>& value) {
+      if (value.has_value())
+         lua_pushinteger(L, static_cast<lua_Integer>(value.value()));
+      else
+         lua_pushnil(L);
+   }
+
    void push_impl(double value) {
       lua_pushnumber(L, value);
    }
@@ -137,9 +199,21 @@ private:
       lua_pushlstring(L, value.data(), value.size());
    }
    
+   void push_impl(std::string_view value) {
+      lua_pushlstring(L, value.data(), value.size());
+   }
+   
    void push_impl(const luaosutils::encryptBuffer& value) {
       lua_pushlstring(L, (const char*)value.data(), value.size());
    }
+
+   void push_impl(const luaosutils::shared_buffer& value) {
+      luaosutils::push_buffer(L, value);
+   }
+
+   void push_impl(const luaosutils::bytes_result& value) {
+      std::visit([this](const auto& bytes) { push_impl(bytes); }, value);
+   }
 };
 
 // Base case for the recursive call
@@ -155,6 +229,32 @@ int push_lua_args(lua_State* L, Arg arg, Args... args) {
    return 1 + push_lua_args(L, args...);
 }
 
+inline void lua_parameter_error(lua_State* L, int param_number, int expected_type, int actual_type, const char* metatableKey)
+{
+   const char* expected_type_name = metatableKey ? metatableKey : lua_typename(L, expected_type);
+   const char* actual_type_name = lua_typename(L, actual_type);
+   luaosutils::note_stats_error();
+   luaL_error(L, "param %d expected %s, got %s", param_number, expected_type_name, actual_type_name);
+}
+
+/** \brief Returns true if a value of Lua type \p type at \p param_number is acceptable where \p expected_type is expected.
+ * A buffer is accepted wherever a string is.
+ */
+inline bool is_lua_parameter_type(lua_State* L, int param_number, int type, int expected_type)
+{
+   if (type == expected_type)
+      return true;
+   return expected_type == LUA_TSTRING && type == LUA_TUSERDATA && luaosutils::to_buffer(L, param_number);
+}
+
+/** \brief Raises the same error as get_lua_parameter if the value at \p param_number is not of \p expected_type. */
+inline void check_lua_parameter_type(lua_State* L, int param_number, int expected_type)
+{
+   const int type = lua_type(L, param_number);
+   if (! is_lua_parameter_type(L, param_number, type, expected_type))
+      lua_parameter_error(L, param_number, expected_type, type, nullptr);
+}
+
 template<typename T>
 T get_lua_parameter(lua_State* L, int param_number, int expected_type, std::optional<T> default_value = std::nullopt, const char* metatableKey = nullptr)
 {
@@ -164,12 +264,8 @@ T get_lua_parameter(lua_State* L, int param_number, int expected_type, std::opti
       if (default_value.has_value())
          return default_value.value();
    }
-   if (type != expected_type)
-   {
-      const char* expected_type_name = metatableKey ? metatableKey : lua_typename(L, expected_type);
-      const char* actual_type_name = lua_typename(L, type);
-      luaL_error(L, "param %d expected %s, got %s", param_number, expected_type_name, actual_type_name);
-   }
+   if (! is_lua_parameter_type(L, param_number, type, expected_type))
+      lua_parameter_error(L, param_number, expected_type, type, metatableKey);
    if constexpr (std::is_convertible<T, void*>::value)
    {
       T ptr = (metatableKey)
@@ -197,5 +293,167 @@ void push_lua_return_value(lua_State* L, const T& retval)
       LuaStack<T>(L).push(retval);
 }
 
+/** \brief Gives a pointer to a full userdata its metatable key. Specialize it for each such type that
+ * a bound function takes, so that #lua_bind checks the metatable. Other pointers are light userdata.
+ */
+template<typename T>
+struct lua_metatable_key
+{
+   static constexpr const char* value = nullptr;
+};
+
+/** \brief Describes how #lua_bind reads a parameter of type T: its Lua type, whether it may be nil, and how to get it. */
+template<typename T>
+struct lua_parameter
+{
+   static constexpr bool optional = false;
+   static constexpr const char* metatableKey = std::is_pointer_v<T> ? lua_metatable_key<T>::value : nullptr;
+
+   static constexpr int type()
+   {
+      if constexpr (std::is_same_v<T, bool>)
+         return LUA_TBOOLEAN;
+      else if constexpr (std::is_arithmetic_v<T>)
+         return LUA_TNUMBER;
+      else if constexpr (std::is_pointer_v<T>)
+         return metatableKey ? LUA_TUSERDATA : LUA_TLIGHTUSERDATA;
+      else
+         return LUA_TSTRING;
+   }
+
+   static T get(lua_State* L, int index)
+   {
+      if constexpr (std::is_pointer_v<T>)
+      {
+         if constexpr (metatableKey != nullptr)
+            return reinterpret_cast<T>(luaL_checkudata(L, index, metatableKey));
+         else
+            return reinterpret_cast<T>(lua_touserdata(L, index));
+      }
+      else
+         return LuaStack<T>(L).get(index);
+   }
+};
+
+template<typename T>
+struct lua_parameter<std::optional<T>>
+{
+   static constexpr bool optional = true;
+   static constexpr const char* metatableKey = lua_parameter<T>::metatableKey;
+
+   static constexpr int type() { return lua_parameter<T>::type(); }
+
+   static std::optional<T> get(lua_State* L, int index)
+   {
+      if (lua_isnoneornil(L, index))
+         return std::nullopt;
+      return lua_parameter<T>::get(L, index);
+   }
+};
+
+/** \brief Checks the types of all the parameters of a bound function in one pass over a table built at compile time. */
+template<typename... Args>
+void check_lua_parameters(lua_State* L)
+{
+   if constexpr (sizeof...(Args) > 0)
+   {
+      static constexpr int types[] = { lua_parameter<Args>::type()... };
+      static constexpr bool optional[] = { lua_parameter<Args>::optional... };
+      static constexpr const char* metatableKeys[] = { lua_parameter<Args>::metatableKey... };
+      for (int x = 0; x < static_cast<int>(sizeof...(Args)); x++)
+      {
+         const int type = lua_type(L, x + 1);
+         if (! is_lua_parameter_type(L, x + 1, type, types[x]) && ! (optional[x] && (type == LUA_TNIL || type == LUA_TNONE)))
+            lua_parameter_error(L, x + 1, types[x], type, metatableKeys[x]);
+      }
+   }
+}
+
+template<typename T>
+struct is_std_tuple : std::false_type {};
+
+template<typename... Ts>
+struct is_std_tuple<std::tuple<Ts...>> : std::true_type {};
+
+template<typename T>
+struct is_std_optional : std::false_type {};
+
+template<typename T>
+struct is_std_optional<std::optional<T>> : std::true_type {};
+
+/** \brief Pushes the return value of a bound function: each element of a tuple, nil for an empty optional or
+ * for `nullptr`, or the value itself.
+ *
+ * \return the number of values pushed
+ */
+template<typename T>
+int push_lua_results(lua_State* L, const T& value)
+{
+   if constexpr (is_std_tuple<T>::value)
+   {
+      return std::apply([L](const auto&... values) -> int
+            {
+               int numPushed = 0;
+               ((numPushed += push_lua_results(L, values)), ...);
+               return numPushed;
+            }, value);
+   }
+   else if constexpr (std::is_null_pointer_v<T>)
+   {
+      lua_pushnil(L);
+      return 1;
+   }
+   else if constexpr (is_std_optional<T>::value)
+   {
+      if (! value.has_value())
+      {
+         lua_pushnil(L);
+         return 1;
+      }
+      return push_lua_results(L, value.value());
+   }
+   else
+   {
+      push_lua_return_value(L, value);
+      return 1;
+   }
+}
+
+template<auto Function, typename R, typename... Args, size_t... Is>
+int invoke_bound_function(lua_State* L, std::index_sequence<Is...>)
+{
+   check_lua_parameters<std::decay_t<Args>...>(L);
+   if constexpr (std::is_void_v<R>)
+   {
+      Function(lua_parameter<std::decay_t<Args>>::get(L, Is + 1)...);
+      return 0;
+   }
+   else
+      return push_lua_results(L, Function(lua_parameter<std::decay_t<Args>>::get(L, Is + 1)...));
+}
+
+template<auto Function, typename R, typename... Args>
+int call_bound_function(lua_State* L, R (*)(Args...))
+{
+   return invoke_bound_function<Function, R, Args...>(L, std::index_sequence_for<Args...>());
+}
+
+/** \brief Generates a lua_CFunction from a plain C++ function at compile time.
+ *
+ * The Lua arguments are checked against the parameter types of \p Function and converted to them. A
+ * `std::optional` parameter may be nil or omitted. The return value is pushed as described for
+ * #push_lua_results, and a void function returns nothing. For example:
+ *
+ *     static std::string url_escape(std::string_view input);
+ *     static const luaL_Reg funcs[] = { {"url_escape", lua_bind<url_escape>}, {NULL, NULL} };
+ *
+ * The error for a mismatched argument is the same as the one get_lua_parameter raises.
+ */
+template<auto Function>
+int lua_bind(lua_State* L)
+{
+   return call_bound_function<Function>(L, Function);
+}
+
 #endif // __OBJC__
 #endif // luaosutils_luastack_h
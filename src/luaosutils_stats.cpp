@@ -0,0 +1,168 @@
+//
+//  luaosutils_stats.cpp
+//  luaosutils
+//
+//  (Usage permitted by MIT License. See LICENSE file in this repository.)
+//
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "luaosutils_buffer.h"
+#include "luaosutils_stats.h"
+
+namespace luaosutils
+{
+
+/** \brief A registered function and the counter its calls are recorded in. */
+struct counted_function
+{
+   lua_CFunction function;
+   stats_counter* counter;
+};
+
+/** \brief Owns every counter and counted function. It is never destroyed, because background threads may still
+ * record into counters while the process exits.
+ */
+struct stats_registry
+{
+   std::mutex mutex;
+   std::map<std::string, std::unique_ptr<stats_counter>> counters;
+   std::map<const luaL_Reg*, std::vector<counted_function>> tables; // filled once per table, then never changed
+
+   static stats_registry& instance()
+   {
+      static stats_registry* registry = new stats_registry;
+      return *registry;
+   }
+};
+
+static thread_local stats_counter* t_currentCounter = nullptr;
+
+void stats_counter::add_latency(clock::duration elapsed)
+{
+   const auto nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+   const std::uint64_t value = nanoseconds > 0 ? static_cast<std::uint64_t>(nanoseconds) : 0;
+   add(totalNanoseconds, value);
+   size_t bucket = 0;
+   for (std::uint64_t microseconds = value / 1000; microseconds && bucket < kStatsLatencyBuckets - 1; microseconds >>= 1)
+      bucket++;
+   add(latency[bucket]);
+}
+
+stats_snapshot stats_counter::snapshot(bool reset)
+{
+   auto read = [reset](std::atomic<std::uint64_t>& value)
+   {
+      return reset ? value.exchange(0, std::memory_order_relaxed) : value.load(std::memory_order_relaxed);
+   };
+   stats_snapshot result;
+   result.calls = read(calls);
+   result.errors = read(errors);
+   result.bytesIn = read(bytesIn);
+   result.bytesOut = read(bytesOut);
+   result.totalNanoseconds = read(totalNanoseconds);
+   for (size_t x = 0; x < kStatsLatencyBuckets; x++)
+      result.latency[x] = read(latency[x]);
+   return result;
+}
+
+stats_counter& get_stats_counter(const std::string& name)
+{
+   stats_registry& registry = stats_registry::instance();
+   std::lock_guard<std::mutex> lock(registry.mutex);
+   auto& counter = registry.counters[name];
+   if (! counter)
+      counter = std::make_unique<stats_counter>();
+   return *counter;
+}
+
+void for_each_stats_counter(bool reset, const std::function<void(const std::string&, const stats_snapshot&)>& visitor)
+{
+   stats_registry& registry = stats_registry::instance();
+   std::lock_guard<std::mutex> lock(registry.mutex);
+   for (auto& [name, counter] : registry.counters)
+   {
+      const stats_snapshot snapshot = counter->snapshot(reset);
+      if (snapshot.calls)
+         visitor(name, snapshot);
+   }
+}
+
+void note_stats_error()
+{
+   if (t_currentCounter)
+      t_currentCounter->add(t_currentCounter->errors);
+}
+
+static std::uint64_t string_bytes(lua_State* L, int first, int last)
+{
+   std::uint64_t result = 0;
+   for (int x = first; x <= last; x++)
+   {
+      const int type = lua_type(L, x);
+      if (type == LUA_TSTRING)
+         result += lua_rawlen(L, x);
+      else if (type == LUA_TUSERDATA)
+      {
+         if (const shared_buffer* buffer = to_buffer(L, x))
+            result += buffer->size();
+      }
+   }
+   return result;
+}
+
+/* Calls that raise a Lua error or yield do not return here, so they record no latency and leave the current
+ * counter set until the next counted call on this thread replaces it. Errors are counted where they are raised,
+ * by note_stats_error. */
+static int call_counted_function(lua_State* L)
+{
+   const auto entry = static_cast<const counted_function*>(lua_touserdata(L, lua_upvalueindex(1)));
+   stats_counter& counter = *entry->counter;
+   counter.add(counter.calls);
+   counter.add(counter.bytesIn, string_bytes(L, 1, lua_gettop(L)));
+   stats_counter* previousCounter = t_currentCounter;
+   t_currentCounter = &counter;
+   const auto start = stats_counter::clock::now();
+   const int numResults = entry->function(L);
+   counter.add_latency(stats_counter::clock::now() - start);
+   t_currentCounter = previousCounter;
+   const int top = lua_gettop(L);
+   counter.add(counter.bytesOut, string_bytes(L, top - numResults + 1, top));
+   return numResults;
+}
+
+void set_counted_funcs(lua_State* L, const luaL_Reg* funcs, const char* prefix)
+{
+   stats_registry& registry = stats_registry::instance();
+   const std::vector<counted_function>* entries = nullptr;
+   {
+      // The entries for each registration table are built once and shared by every Lua state that opens the library.
+      std::lock_guard<std::mutex> lock(registry.mutex);
+      auto& tableEntries = registry.tables[funcs];
+      if (tableEntries.empty())
+      {
+         for (const luaL_Reg* reg = funcs; reg->name; reg++)
+         {
+            const std::string name = std::string(prefix) + "." + reg->name;
+            auto& counter = registry.counters[name];
+            if (! counter)
+               counter = std::make_unique<stats_counter>();
+            tableEntries.push_back({reg->func, counter.get()});
+         }
+      }
+      entries = &tableEntries;
+   }
+   const luaL_Reg* reg = funcs;
+   for (const counted_function& entry : *entries)
+   {
+      lua_pushlightuserdata(L, const_cast<counted_function*>(&entry));
+      lua_pushcclosure(L, call_counted_function, 1);
+      lua_setfield(L, -2, reg->name);
+      reg++;
+   }
+}
+
+}
@@ -0,0 +1,80 @@
+//
+//  luaosutils_stats.h
+//  luaosutils
+//
+//  (Usage permitted by MIT License. See LICENSE file in this repository.)
+//
+
+#ifndef luaosutils_stats_h
+#define luaosutils_stats_h
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#include "lua.hpp"
+
+namespace luaosutils
+{
+
+/** \brief The number of latency buckets. Bucket 0 counts calls under 1 microsecond, bucket n counts calls from
+ * 2^(n-1) up to 2^n microseconds, and the last bucket counts everything slower (about 4 seconds or more).
+ */
+constexpr size_t kStatsLatencyBuckets = 24;
+
+/** \brief A copy of the values in a stats_counter at one moment. */
+struct stats_snapshot
+{
+   std::uint64_t calls{};
+   std::uint64_t errors{};
+   std::uint64_t bytesIn{};
+   std::uint64_t bytesOut{};
+   std::uint64_t totalNanoseconds{};
+   std::uint64_t latency[kStatsLatencyBuckets] = {};
+};
+
+/** \brief The performance counters for one exported function or backend operation.
+ *
+ * Every update is a relaxed atomic add, so any thread may record into a counter without a lock. Counters
+ * are created on first use and never freed, so references to them may be cached.
+ */
+class stats_counter
+{
+public:
+   using clock = std::chrono::steady_clock;
+
+   std::atomic<std::uint64_t> calls{0};
+   std::atomic<std::uint64_t> errors{0};
+   std::atomic<std::uint64_t> bytesIn{0};
+   std::atomic<std::uint64_t> bytesOut{0};
+   std::atomic<std::uint64_t> totalNanoseconds{0};
+   std::atomic<std::uint64_t> latency[kStatsLatencyBuckets] = {};
+
+   void add(std::atomic<std::uint64_t>& value, std::uint64_t amount = 1)
+   { value.fetch_add(amount, std::memory_order_relaxed); }
+
+   void add_latency(clock::duration elapsed);
+
+   /** \brief Reads the counters, optionally setting them back to zero as they are read. */
+   stats_snapshot snapshot(bool reset);
+};
+
+/** \brief Returns the counter with the given name, creating it the first time. */
+stats_counter& get_stats_counter(const std::string& name);
+
+/** \brief Calls \p visitor with a snapshot of every counter that has recorded at least one call, in name order. */
+void for_each_stats_counter(bool reset, const std::function<void(const std::string&, const stats_snapshot&)>& visitor);
+
+/** \brief Counts an error against the exported function that is running on this thread, if any. */
+void note_stats_error();
+
+/** \brief Works like `luaL_setfuncs(L, funcs, 0)`, but each function is registered through a closure that
+ * counts its calls, string and buffer bytes in and out, and latency under the name `prefix.name`.
+ */
+void set_counted_funcs(lua_State* L, const luaL_Reg* funcs, const char* prefix);
+
+}
+
+#endif /* luaosutils_stats_h */
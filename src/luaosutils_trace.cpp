@@ -0,0 +1,119 @@
+//
+//  luaosutils_trace.cpp
+//  luaosutils
+//
+//  (Usage permitted by MIT License. See LICENSE file in this repository.)
+//
+
+#include "luaosutils_trace.h"
+
+#ifdef LUAOSUTILS_TRACE
+
+#include <atomic>
+#include <cinttypes>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+namespace luaosutils
+{
+
+constexpr size_t kTraceCapacity = 65536; // the oldest spans are overwritten once the buffer is full
+
+struct trace_record
+{
+   const char* name;
+   char phase;
+   std::uint32_t threadId;
+   std::uint64_t id;
+   std::chrono::steady_clock::time_point start;
+   std::chrono::steady_clock::duration duration;
+};
+
+/** \brief The ring buffer of spans. It is never destroyed, because background threads may record spans while the
+ * process exits.
+ */
+struct trace_buffer
+{
+   std::mutex mutex;
+   std::vector<trace_record> records = std::vector<trace_record>(kTraceCapacity);
+   size_t next{0};
+   size_t count{0};
+   const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+   static trace_buffer& instance()
+   {
+      static trace_buffer* buffer = new trace_buffer;
+      return *buffer;
+   }
+
+   void add(const trace_record& record)
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      records[next] = record;
+      next = (next + 1) % kTraceCapacity;
+      if (count < kTraceCapacity)
+         count++;
+   }
+};
+
+static std::uint32_t trace_thread_id()
+{
+   static std::atomic<std::uint32_t> nextThreadId{1};
+   static thread_local const std::uint32_t threadId = nextThreadId.fetch_add(1, std::memory_order_relaxed);
+   return threadId;
+}
+
+std::uint64_t trace_next_id()
+{
+   static std::atomic<std::uint64_t> nextId{1};
+   return nextId.fetch_add(1, std::memory_order_relaxed);
+}
+
+void trace_async(const char* name, char phase, std::uint64_t id)
+{
+   trace_buffer::instance().add({name, phase, trace_thread_id(), id, std::chrono::steady_clock::now(), {}});
+}
+
+void trace_complete(const char* name, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end)
+{
+   trace_buffer::instance().add({name, 'X', trace_thread_id(), 0, start, end - start});
+}
+
+std::string trace_to_json(bool clear)
+{
+   trace_buffer& buffer = trace_buffer::instance();
+   std::vector<trace_record> records;
+   {
+      std::lock_guard<std::mutex> lock(buffer.mutex);
+      records.reserve(buffer.count);
+      for (size_t x = 0; x < buffer.count; x++)
+         records.push_back(buffer.records[(buffer.next + kTraceCapacity - buffer.count + x) % kTraceCapacity]);
+      if (clear)
+         buffer.count = 0;
+   }
+   auto microseconds = [](std::chrono::steady_clock::duration duration)
+   {
+      return std::chrono::duration<double, std::micro>(duration).count();
+   };
+   std::string result = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+   char line[256];
+   for (size_t x = 0; x < records.size(); x++)
+   {
+      // Span names are string literals, so they need no escaping.
+      const trace_record& record = records[x];
+      int length = snprintf(line, sizeof(line), "%s\n{\"name\":\"%s\",\"cat\":\"luaosutils\",\"ph\":\"%c\",\"pid\":1,\"tid\":%" PRIu32 ",\"ts\":%.3f",
+                            x ? "," : "", record.name, record.phase, record.threadId, microseconds(record.start - buffer.epoch));
+      if (record.phase == 'X')
+         length += snprintf(line + length, sizeof(line) - length, ",\"dur\":%.3f}", microseconds(record.duration));
+      else
+         length += snprintf(line + length, sizeof(line) - length, ",\"id\":\"0x%" PRIx64 "\"}", record.id);
+      result.append(line, static_cast<size_t>(length));
+   }
+   result += "\n]}\n";
+   return result;
+}
+
+}
+
+#endif // LUAOSUTILS_TRACE
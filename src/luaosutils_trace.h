@@ -0,0 +1,78 @@
+//
+//  luaosutils_trace.h
+//  luaosutils
+//
+//  (Usage permitted by MIT License. See LICENSE file in this repository.)
+//
+//  Records spans in a ring buffer for export as Chrome trace-event JSON (chrome://tracing or Perfetto).
+//  Tracing is compiled in only when LUAOSUTILS_TRACE is defined. Otherwise every macro below expands to
+//  nothing, and no tracing code or data is built.
+
+#ifndef luaosutils_trace_h
+#define luaosutils_trace_h
+
+#ifdef LUAOSUTILS_TRACE
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace luaosutils
+{
+
+/** \brief Returns a new id for pairing the begin and end of an async span. */
+std::uint64_t trace_next_id();
+
+/** \brief Records the begin (\p phase `'b'`) or end (\p phase `'e'`) of an async span, which may cross threads. */
+void trace_async(const char* name, char phase, std::uint64_t id);
+
+/** \brief Records a complete span on the calling thread. */
+void trace_complete(const char* name, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end);
+
+/** \brief Returns the recorded spans as Chrome trace-event JSON, optionally clearing the buffer. */
+std::string trace_to_json(bool clear);
+
+/** \brief Records a complete span from construction until #end or destruction, whichever comes first. */
+class trace_scope
+{
+   const char* m_name;
+   std::chrono::steady_clock::time_point m_start;
+   bool m_ended{false};
+
+public:
+   explicit trace_scope(const char* name) : m_name(name), m_start(std::chrono::steady_clock::now()) {}
+   ~trace_scope() { end(); }
+
+   trace_scope(const trace_scope&) = delete;
+   trace_scope& operator=(const trace_scope&) = delete;
+
+   void end()
+   {
+      if (m_ended) return;
+      m_ended = true;
+      trace_complete(m_name, m_start, std::chrono::steady_clock::now());
+   }
+};
+
+}
+
+#define LUAOSUTILS_TRACE_CONCAT_(a, b) a##b
+#define LUAOSUTILS_TRACE_CONCAT(a, b) LUAOSUTILS_TRACE_CONCAT_(a, b)
+
+#define LUAOSUTILS_TRACE_SCOPE(name) luaosutils::trace_scope LUAOSUTILS_TRACE_CONCAT(traceScope_, __LINE__)(name)
+#define LUAOSUTILS_TRACE_SPAN(var, name) luaosutils::trace_scope var(name)
+#define LUAOSUTILS_TRACE_SPAN_END(var) var.end()
+#define LUAOSUTILS_TRACE_ASYNC_BEGIN(name, id) luaosutils::trace_async(name, 'b', id)
+#define LUAOSUTILS_TRACE_ASYNC_END(name, id) luaosutils::trace_async(name, 'e', id)
+
+#else // LUAOSUTILS_TRACE
+
+#define LUAOSUTILS_TRACE_SCOPE(name)
+#define LUAOSUTILS_TRACE_SPAN(var, name)
+#define LUAOSUTILS_TRACE_SPAN_END(var)
+#define LUAOSUTILS_TRACE_ASYNC_BEGIN(name, id)
+#define LUAOSUTILS_TRACE_ASYNC_END(name, id)
+
+#endif // LUAOSUTILS_TRACE
+
+#endif /* luaosutils_trace_h */
@@ -11,27 +11,25 @@
 #include "luaosutils.hpp"
 #include "menu/luaosutils_menu_os.h"
 
-static int luaosutils_menu_delete_submenu(lua_State *L)
+// The window is optional on macOS, where the menu bar belongs to the application rather than a window.
+#if OPERATING_SYSTEM == MAC_OS
+using window_parameter = std::optional<luaosutils::window_handle>;
+static luaosutils::window_handle get_window(const window_parameter& hWnd) { return hWnd.value_or(nullptr); }
+#else
+using window_parameter = luaosutils::window_handle;
+static luaosutils::window_handle get_window(window_parameter hWnd) { return hWnd; }
+#endif
+
+static bool luaosutils_menu_delete_submenu(std::optional<luaosutils::menu_handle> hMenu, window_parameter hWnd)
 {
-   auto hMenu = get_lua_parameter<luaosutils::menu_handle>(L, 1, LUA_TLIGHTUSERDATA, nullptr);
-   auto hWnd = get_lua_parameter<luaosutils::window_handle>(L, 2, LUA_TLIGHTUSERDATA MAC_PARM(nullptr));
-   
-   if (luaosutils::menu_get_item_count(hMenu) > 0)
-      push_lua_return_value(L, false);
-   else
-      push_lua_return_value(L, luaosutils::menu_delete_submenu(hMenu, hWnd));
-   return 1;
+   if (luaosutils::menu_get_item_count(hMenu.value_or(nullptr)) > 0)
+      return false;
+   return luaosutils::menu_delete_submenu(hMenu.value_or(nullptr), get_window(hWnd));
 }
 
-static int luaosutils_menu_execute_command_id(lua_State *L)
+static bool luaosutils_menu_execute_command_id(long cmd, window_parameter hWnd)
 {
-   auto cmd = get_lua_parameter<long>(L, 1, LUA_TNUMBER);
-   auto hWnd = get_lua_parameter<luaosutils::window_handle>(L, 2, LUA_TLIGHTUSERDATA MAC_PARM(nullptr));
-
-   bool retval = luaosutils::menu_execute_command_id(cmd, hWnd);
-   push_lua_return_value(L, retval);
-
-   return 1;
+   return luaosutils::menu_execute_command_id(cmd, get_window(hWnd));
 }
 
 static int luaosutils_menu_find_item(lua_State *L)
@@ -59,100 +57,48 @@ static int luaosutils_menu_find_item(lua_State *L)
    return 2;
 }
 
-static int luaosutils_menu_get_item_command_id(lua_State *L)
+static std::optional<long> luaosutils_menu_get_item_command_id(luaosutils::menu_handle hMenu, int index)
 {
-   auto hMenu = get_lua_parameter<luaosutils::menu_handle>(L, 1, LUA_TLIGHTUSERDATA);
-   auto index = get_lua_parameter<int>(L, 2, LUA_TNUMBER);
-
    if (index < 0 || !hMenu || index >= luaosutils::menu_get_item_count(hMenu))
-      lua_pushnil(L);
-   else
-   {
-      long retval = luaosutils::menu_get_item_command_id(hMenu, index);
-      if (retval > 0)
-         push_lua_return_value(L, retval);
-      else
-         lua_pushnil(L);
-   }
-   return 1;
-}
-
-static int luaosutils_menu_get_item_count(lua_State *L)
-{
-   auto hMenu = get_lua_parameter<luaosutils::menu_handle>(L, 1, LUA_TLIGHTUSERDATA);
-
-   push_lua_return_value(L, luaosutils::menu_get_item_count(hMenu));
-   return 1;
+      return std::nullopt;
+   long retval = luaosutils::menu_get_item_command_id(hMenu, index);
+   if (retval <= 0)
+      return std::nullopt;
+   return retval;
 }
 
-static int luaosutils_menu_get_item_submenu(lua_State *L)
+static luaosutils::menu_handle luaosutils_menu_get_item_submenu(luaosutils::menu_handle hMenu, int index)
 {
-   auto hMenu = get_lua_parameter<luaosutils::menu_handle>(L, 1, LUA_TLIGHTUSERDATA);
-   auto index = get_lua_parameter<int>(L, 2, LUA_TNUMBER);
-
    if (index < 0 || !hMenu || index >= luaosutils::menu_get_item_count(hMenu))
-      lua_pushnil(L);
-   else
-      push_lua_return_value(L, luaosutils::menu_get_item_submenu(hMenu, index));
-   return 1;
-}
-
-static int luaosutils_menu_get_item_text(lua_State *L)
-{
-   auto hMenu = get_lua_parameter<luaosutils::menu_handle>(L, 1, LUA_TLIGHTUSERDATA);
-   auto index = get_lua_parameter<int>(L, 2, LUA_TNUMBER);
-   
-   push_lua_return_value(L, luaosutils::menu_get_item_text(hMenu, index));
-   return 1;
+      return nullptr;
+   return luaosutils::menu_get_item_submenu(hMenu, index);
 }
 
-static int luaosutils_get_item_type(lua_State *L)
+static int luaosutils_get_item_type(luaosutils::menu_handle hMenu, int index)
 {
-   auto hMenu = get_lua_parameter<luaosutils::menu_handle>(L, 1, LUA_TLIGHTUSERDATA);
-   auto index = get_lua_parameter<int>(L, 2, LUA_TNUMBER);
-
    if (index < 0 || !hMenu || index >= luaosutils::menu_get_item_count(hMenu))
-      push_lua_return_value(L, static_cast<int>(luaosutils::MENUITEM_TYPES::ITEMTYPE_INVALID));
-   else
-      push_lua_return_value(L, static_cast<int>(luaosutils::menu_get_item_type(hMenu, index)));
-   return 1;
+      return static_cast<int>(luaosutils::MENUITEM_TYPES::ITEMTYPE_INVALID);
+   return static_cast<int>(luaosutils::menu_get_item_type(hMenu, index));
 }
 
-static int luaosutils_menu_get_title(lua_State *L)
+static std::string luaosutils_menu_get_title(luaosutils::menu_handle hMenu, window_parameter hWnd)
 {
-   auto hMenu = get_lua_parameter<luaosutils::menu_handle>(L, 1, LUA_TLIGHTUSERDATA);
-   auto hWnd = get_lua_parameter<luaosutils::window_handle>(L, 2, LUA_TLIGHTUSERDATA MAC_PARM(nullptr));
-
-   push_lua_return_value(L, luaosutils::menu_get_title(hMenu, hWnd));
-   return 1;
+   return luaosutils::menu_get_title(hMenu, get_window(hWnd));
 }
 
-static int luaosutils_menu_get_top_level_menu(lua_State *L)
+static luaosutils::menu_handle luaosutils_menu_get_top_level_menu(window_parameter hWnd)
 {
-   auto hWnd = get_lua_parameter<luaosutils::window_handle>(L, 1, LUA_TLIGHTUSERDATA MAC_PARM(nullptr));
-
-   push_lua_return_value(L, luaosutils::menu_get_top_level_menu(hWnd));
-   return 1;
+   return luaosutils::menu_get_top_level_menu(get_window(hWnd));
 }
 
-static int luaosutils_menu_insert_separator(lua_State *L)
+static std::optional<int> luaosutils_menu_insert_separator(luaosutils::menu_handle hMenu, std::optional<int> insertIndex)
 {
-   auto hMenu = get_lua_parameter<luaosutils::menu_handle>(L, 1, LUA_TLIGHTUSERDATA);
-   auto insertIndex = get_lua_parameter<int>(L, 2, LUA_TNUMBER, -1);
-   
    if (!hMenu)
-   {
-      lua_pushnil(L);
-      return 1;
-   }
-
-   int itemIndex = luaosutils::menu_insert_separator(hMenu, insertIndex);
-
+      return std::nullopt;
+   int itemIndex = luaosutils::menu_insert_separator(hMenu, insertIndex.value_or(-1));
    if (itemIndex < 0)
-      lua_pushnil(L);
-   else
-      push_lua_return_value(L, itemIndex);
-   return 1;
+      return std::nullopt;
+   return itemIndex;
 }
 
 static int luaosutils_menu_insert_submenu(lua_State *L)
@@ -203,38 +149,23 @@ static int luaosutils_menu_move_item(lua_State *L)
    return 2;
 }
 
-static int luaosutils_menu_redraw([[maybe_unused]]lua_State* L)
+static void luaosutils_menu_redraw(window_parameter hWnd)
 {
-   luaosutils::window_handle hWnd = get_lua_parameter<luaosutils::window_handle>(L, 1, LUA_TLIGHTUSERDATA MAC_PARM(nullptr));
-
-   luaosutils::menu_redraw(hWnd);
-   return 0;
+   luaosutils::menu_redraw(get_window(hWnd));
 }
 
-static int luaosutils_menu_set_item_text(lua_State *L)
+static bool luaosutils_menu_set_item_text(luaosutils::menu_handle hMenu, int index, const std::string& newText)
 {
-   auto hMenu = get_lua_parameter<luaosutils::menu_handle>(L, 1, LUA_TLIGHTUSERDATA);
-   auto index = get_lua_parameter<int>(L, 2, LUA_TNUMBER);
-   auto newText = get_lua_parameter<std::string>(L, 3, LUA_TSTRING);
-   
    if (newText.size() <= 0 || index < 0 || index >= luaosutils::menu_get_item_count(hMenu))
-      push_lua_return_value(L, false);
-   else
-      push_lua_return_value(L, luaosutils::menu_set_item_text(hMenu, index, newText));
-   return 1;
+      return false;
+   return luaosutils::menu_set_item_text(hMenu, index, newText);
 }
 
-static int luaosutils_menu_set_title(lua_State *L)
+static bool luaosutils_menu_set_title(luaosutils::menu_handle hMenu, window_parameter hWnd, const std::string& newText)
 {
-   auto hMenu = get_lua_parameter<luaosutils::menu_handle>(L, 1, LUA_TLIGHTUSERDATA);
-   auto hWnd = get_lua_parameter<luaosutils::window_handle>(L, 2, LUA_TLIGHTUSERDATA MAC_PARM(nullptr));
-   auto newText = get_lua_parameter<std::string>(L, 3, LUA_TSTRING);
-
    if (newText.size() <= 0)
-      push_lua_return_value(L, false);
-   else
-      push_lua_return_value(L, luaosutils::menu_set_title(hMenu, hWnd, newText));
-   return 1;
+      return false;
+   return luaosutils::menu_set_title(hMenu, get_window(hWnd), newText);
 }
 
 static const std::map<std::string, luaosutils::MENUITEM_TYPES> constants =
@@ -246,36 +177,36 @@ static const std::map<std::string, luaosutils::MENUITEM_TYPES> constants =
 };
 
 static const luaL_Reg menu_utils[] = {
-   {"delete_submenu",      luaosutils_menu_delete_submenu},
-   {"execute_command_id",  luaosutils_menu_execute_command_id},
+   {"delete_submenu",      lua_bind<luaosutils_menu_delete_submenu>},
+   {"execute_command_id",  lua_bind<luaosutils_menu_execute_command_id>},
    {"find_item",           luaosutils_menu_find_item},
-   {"get_item_command_id", luaosutils_menu_get_item_command_id},
-   {"get_item_count",      luaosutils_menu_get_item_count},
-   {"get_item_submenu",    luaosutils_menu_get_item_submenu},
-   {"get_item_text",       luaosutils_menu_get_item_text},
-   {"get_item_type",       luaosutils_get_item_type},
-   {"get_title",           luaosutils_menu_get_title},
-   {"get_top_level_menu",  luaosutils_menu_get_top_level_menu},
-   {"insert_separator",    luaosutils_menu_insert_separator},
+   {"get_item_command_id", lua_bind<luaosutils_menu_get_item_command_id>},
+   {"get_item_count",      lua_bind<luaosutils::menu_get_item_count>},
+   {"get_item_submenu",    lua_bind<luaosutils_menu_get_item_submenu>},
+   {"get_item_text",       lua_bind<luaosutils::menu_get_item_text>},
+   {"get_item_type",       lua_bind<luaosutils_get_item_type>},
+   {"get_title",           lua_bind<luaosutils_menu_get_title>},
+   {"get_top_level_menu",  lua_bind<luaosutils_menu_get_top_level_menu>},
+   {"insert_separator",    lua_bind<luaosutils_menu_insert_separator>},
    {"insert_submenu",      luaosutils_menu_insert_submenu},
    {"move_item",           luaosutils_menu_move_item},
-   {"redraw",              luaosutils_menu_redraw},
-   {"set_item_text",       luaosutils_menu_set_item_text},
-   {"set_title",           luaosutils_menu_set_title},
+   {"redraw",              lua_bind<luaosutils_menu_redraw>},
+   {"set_item_text",       lua_bind<luaosutils_menu_set_item_text>},
+   {"set_title",           lua_bind<luaosutils_menu_set_title>},
    {NULL, NULL} // sentinel
 };
 
 static const luaL_Reg menu_utils_restricted[] = {
    {"delete_submenu",      restricted_function},
-   {"execute_command_id",  luaosutils_menu_execute_command_id},
+   {"execute_command_id",  lua_bind<luaosutils_menu_execute_command_id>},
    {"find_item",           luaosutils_menu_find_item},
-   {"get_item_command_id", luaosutils_menu_get_item_command_id},
-   {"get_item_count",      luaosutils_menu_get_item_count},
-   {"get_item_submenu",    luaosutils_menu_get_item_submenu},
-   {"get_item_text",       luaosutils_menu_get_item_text},
-   {"get_item_type",       luaosutils_get_item_type},
-   {"get_title",           luaosutils_menu_get_title},
-   {"get_top_level_menu",  luaosutils_menu_get_top_level_menu},
+   {"get_item_command_id", lua_bind<luaosutils_menu_get_item_command_id>},
+   {"get_item_count",      lua_bind<luaosutils::menu_get_item_count>},
+   {"get_item_submenu",    lua_bind<luaosutils_menu_get_item_submenu>},
+   {"get_item_text",       lua_bind<luaosutils::menu_get_item_text>},
+   {"get_item_type",       lua_bind<luaosutils_get_item_type>},
+   {"get_title",           lua_bind<luaosutils_menu_get_title>},
+   {"get_top_level_menu",  lua_bind<luaosutils_menu_get_top_level_menu>},
    {"insert_separator",    restricted_function},
    {"insert_submenu",      restricted_function},
    {"move_item",           restricted_function},
@@ -289,11 +220,11 @@ void luaosutils_menu_create(lua_State *L, bool restricted)
 {
    lua_newtable(L);  // create nested table
    
-   for (auto constant : constants)
+   for (const auto& constant : constants)
       add_constant(L, constant.first.c_str(), static_cast<int>(constant.second), -3);
    
    const luaL_Reg* funcs = restricted ? menu_utils_restricted : menu_utils;
-   luaL_setfuncs(L, funcs, 0);      // add file methods to new metatable
+   luaosutils::set_counted_funcs(L, funcs, "menu"); // add file methods to new metatable
    lua_setfield(L, -2, "menu");     // add the nested table to the parent table with the name
 }
 
@@ -10,90 +10,58 @@
 #include "luaosutils.hpp"
 #include "process/luaosutils_process_os.h"
 
-static int luaosutils_process_execute(lua_State *L)
+static std::optional<luaosutils::bytes_result> luaosutils_process_execute(const std::string& cmd, std::optional<std::string> dir,
+                                                                        std::optional<bool> asBuffer)
 {
-   auto cmd = get_lua_parameter<std::string>(L, 1, LUA_TSTRING);
-   auto dir = get_lua_parameter<std::string>(L, 2, LUA_TSTRING, std::string());
-   
-   if (cmd.size())
-   {
-      std::string output;
-      const bool result = luaosutils::process_execute(cmd, dir, output);
-      if (result)
-         push_lua_return_value(L, output);
-      else
-         lua_pushnil(L);
-   }
-   else
-      lua_pushnil(L);
-
-   return 1;
+   if (cmd.empty())
+      return std::nullopt;
+   std::string output;
+   if (! luaosutils::process_execute(cmd, dir.value_or(std::string()), output))
+      return std::nullopt;
+   return luaosutils::make_bytes_result(std::move(output), asBuffer.value_or(false));
 }
 
-static int luaosutils_process_launch(lua_State *L)
+static bool luaosutils_process_launch(const std::string& cmd, std::optional<std::string> dir)
 {
-   auto cmd = get_lua_parameter<std::string>(L, 1, LUA_TSTRING);
-   auto dir = get_lua_parameter<std::string>(L, 2, LUA_TSTRING, std::string());
-
-   if (cmd.size())
-      push_lua_return_value(L, luaosutils::process_launch(cmd, dir));
-   else
-      push_lua_return_value(L, false);
-   return 1;
+   if (cmd.empty())
+      return false;
+   return luaosutils::process_launch(cmd, dir.value_or(std::string()));
 }
 
-static int luaosutils_process_make_dir(lua_State *L)
+static bool luaosutils_process_make_dir(const std::string& pathString, std::optional<std::string> dir)
 {
-   auto pathString = get_lua_parameter<std::string>(L, 1, LUA_TSTRING);
-   auto dir = get_lua_parameter<std::string>(L, 2, LUA_TSTRING, std::string());
-
-   const std::string mkdirString = std::string(WINCODE("cmd /c mkdir ") MACCODE("mkdir ")) + '"' + pathString + '"';
-   push_lua_return_value(L, luaosutils::process_launch(mkdirString, dir));
-   
-   return 1;
+   const std::string mkdirString = std::string(WINCODE("cmd /c mkdir ") MACCODE("mkdir ") LINUXCODE("mkdir ")) + '"' + pathString + '"';
+   return luaosutils::process_launch(mkdirString, dir.value_or(std::string()));
 }
 
-static int luaosutils_process_list_dir(lua_State *L)
+static std::optional<std::string> luaosutils_process_list_dir(const std::string& pathString, std::optional<std::string> options)
 {
-   auto pathString = get_lua_parameter<std::string>(L, 1, LUA_TSTRING);
-   auto options = get_lua_parameter<std::string>(L, 2, LUA_TSTRING, std::string());
-   if (options.size())
-      options = ' ' + options;
+   std::string optionsString = options.value_or(std::string());
+   if (optionsString.size())
+      optionsString = ' ' + optionsString;
 
-   const std::string lsdirString = std::string(WINCODE("cmd /c dir") MACCODE("ls")) + options;
+   const std::string lsdirString = std::string(WINCODE("cmd /c dir") MACCODE("ls") LINUXCODE("ls")) + optionsString;
    std::string output;
-   const bool result = luaosutils::process_execute(lsdirString, pathString, output);
-   if (result)
-      push_lua_return_value(L, output);
-   else
-      lua_pushnil(L);
-
-   return 1;
+   if (! luaosutils::process_execute(lsdirString, pathString, output))
+      return std::nullopt;
+   return output;
 }
 
-static int luaosutils_process_run_event_loop(lua_State *L)
-{
-   auto secondsTimeout = get_lua_parameter<double>(L, 1, LUA_TNUMBER);
-   luaosutils::run_event_loop(secondsTimeout);
-   return 0;
-}
-
-
 static const luaL_Reg process_utils[] = {
-   {"execute",             luaosutils_process_execute},
-   {"launch",              luaosutils_process_launch},
-   {"make_dir",            luaosutils_process_make_dir},
-   {"list_dir",            luaosutils_process_list_dir},
-   {"run_event_loop",      luaosutils_process_run_event_loop},
+   {"execute",             lua_bind<luaosutils_process_execute>},
+   {"launch",              lua_bind<luaosutils_process_launch>},
+   {"make_dir",            lua_bind<luaosutils_process_make_dir>},
+   {"list_dir",            lua_bind<luaosutils_process_list_dir>},
+   {"run_event_loop",      lua_bind<luaosutils::run_event_loop>},
    {NULL, NULL} // sentinel
 };
 
 static const luaL_Reg process_utils_restricted[] = {
    {"execute",             restricted_function},
    {"launch",              restricted_function},
-   {"make_dir",            luaosutils_process_make_dir},
-   {"list_dir",            luaosutils_process_list_dir},
-   {"run_event_loop",      luaosutils_process_run_event_loop},
+   {"make_dir",            lua_bind<luaosutils_process_make_dir>},
+   {"list_dir",            lua_bind<luaosutils_process_list_dir>},
+   {"run_event_loop",      lua_bind<luaosutils::run_event_loop>},
    {NULL, NULL} // sentinel
 };
 
@@ -102,6 +70,6 @@ void luaosutils_process_create(lua_State *L, bool restricted)
    lua_newtable(L);  // create nested table
    
    const luaL_Reg* funcs = restricted ? process_utils_restricted : process_utils;
-   luaL_setfuncs(L, funcs, 0);         // add file methods to new metatable
+   luaosutils::set_counted_funcs(L, funcs, "process"); // add file methods to new metatable
    lua_setfield(L, -2, "process");     // add the nested table to the parent table with the name
 }
@@ -0,0 +1,115 @@
+//
+//  luaosutils_process_os_linux.cpp
+//  luaosutils
+//
+//  (Usage permitted by MIT License. See LICENSE file in this repository.)
+//
+#include <string>
+#include <cerrno>
+
+#include <pwd.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "luaosutils.hpp"
+#include "process/luaosutils_process_os.h"
+#include "internet/luaosutils_internet_os.h"
+#include "luaosutils_trace.h"
+
+namespace luaosutils
+{
+
+// Call before fork(): getpwuid may take locks that another thread holds at the moment of the fork.
+static std::string GetUserShellPath()
+{
+   struct passwd *pw = getpwuid(getuid()); // Get the user information
+   if (pw && pw->pw_shell && *pw->pw_shell)
+      return pw->pw_shell;
+   return "/bin/sh";
+}
+
+// Runs in the forked child, so it only makes async-signal-safe calls with strings prepared before the fork.
+// Never returns.
+static void ExecShellCommand(const char* shell, const char* cmd, const char* dir)
+{
+   if (*dir && chdir(dir) != 0)
+      _exit(127);
+   execl(shell, shell, "-c", cmd, static_cast<char*>(nullptr));
+   _exit(127);
+}
+
+bool process_execute(const std::string& cmd, const std::string& dir, std::string& processOutput)
+{
+   LUAOSUTILS_TRACE_SPAN(spawnSpan, "process.spawn");
+   const std::string shell = GetUserShellPath();
+   int fds[2];
+   if (pipe2(fds, O_CLOEXEC) != 0) // a process started by another thread must not inherit the pipe
+      return false;
+   const pid_t pid = fork();
+   if (pid < 0)
+   {
+      close(fds[0]);
+      close(fds[1]);
+      return false;
+   }
+   if (pid == 0)
+   {
+      close(fds[0]);
+      dup2(fds[1], STDOUT_FILENO);
+      close(fds[1]);
+      ExecShellCommand(shell.c_str(), cmd.c_str(), dir.c_str());
+   }
+   LUAOSUTILS_TRACE_SPAN_END(spawnSpan);
+   LUAOSUTILS_TRACE_SCOPE("process.wait");
+   close(fds[1]);
+   processOutput.clear();
+   char buf[4096];
+   ssize_t numRead;
+   while ((numRead = read(fds[0], buf, sizeof(buf))) != 0)
+   {
+      if (numRead < 0)
+      {
+         if (errno == EINTR) continue;
+         break;
+      }
+      processOutput.append(buf, static_cast<size_t>(numRead));
+   }
+   close(fds[0]);
+   int status = 0;
+   while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+   return WIFEXITED(status) && WEXITSTATUS(status) != 127;
+}
+
+bool process_launch(const std::string& cmd, const std::string& dir)
+{
+   LUAOSUTILS_TRACE_SCOPE("process.spawn");
+   const std::string shell = GetUserShellPath();
+   // Double-fork so that the launched process is reparented and never becomes a zombie.
+   const pid_t pid = fork();
+   if (pid < 0)
+      return false;
+   if (pid == 0)
+   {
+      if (fork() != 0)
+         _exit(0);
+      const int devNull = open("/dev/null", O_RDWR);
+      if (devNull >= 0)
+      {
+         dup2(devNull, STDOUT_FILENO);
+         dup2(devNull, STDERR_FILENO);
+         close(devNull);
+      }
+      ExecShellCommand(shell.c_str(), cmd.c_str(), dir.c_str());
+   }
+   int status = 0;
+   while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+   return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+void run_event_loop(double timeoutSeconds)
+{
+   dispatch_completions(timeoutSeconds);
+}
+
+}
@@ -12,6 +12,7 @@
 #import <Cocoa/Cocoa.h>
 
 #include "process/luaosutils_process_os.h"
+#include "luaosutils_trace.h"
 
 namespace luaosutils
 {
@@ -26,6 +27,7 @@ static NSString* GetUserShellPath()
 
 bool process_execute(const std::string& cmd, const std::string& dir, std::string& processOutput)
 {
+   LUAOSUTILS_TRACE_SPAN(spawnSpan, "process.spawn");
    NSTask *task = nil;
    NSString *output = nil;
    @try {
@@ -51,6 +53,8 @@ bool process_execute(const std::string& cmd, const std::string& dir, std::string
          NSLog(@"Error returned from launchAndReturnError in process_execute: %@", error);
          return false;
       }
+      LUAOSUTILS_TRACE_SPAN_END(spawnSpan);
+      LUAOSUTILS_TRACE_SCOPE("process.wait");
       
       NSData *data = [file readDataToEndOfFile];
       output = [[NSString alloc] initWithData:data encoding:NSUTF8StringEncoding];
@@ -73,6 +77,7 @@ bool process_execute(const std::string& cmd, const std::string& dir, std::string
 
 bool process_launch(const std::string& cmd, const std::string& dir)
 {
+   LUAOSUTILS_TRACE_SCOPE("process.spawn");
    NSTask *task = nil;
    @try {
       NSString* nsCmd = [NSString stringWithUTF8String:cmd.c_str()];
@@ -12,6 +12,7 @@
 
 #include "process/luaosutils_process_os.h"
 #include "winutils/luaosutils_winutils.h"
+#include "luaosutils_trace.h"
 
 namespace luaosutils
 {
@@ -36,6 +37,7 @@ static bool getCmdExeFullPath(std::basic_string<WCHAR>& result)
 
 bool process_execute(const std::string& cmd, const std::string& dir, std::string& processOutput)
 {
+   LUAOSUTILS_TRACE_SPAN(spawnSpan, "process.spawn");
    SECURITY_ATTRIBUTES saAttr;
    HANDLE hRead, hWrite;
 
@@ -78,6 +80,8 @@ bool process_execute(const std::string& cmd, const std::string& dir, std::string
    }
 
    CloseHandle(hWrite);
+   LUAOSUTILS_TRACE_SPAN_END(spawnSpan);
+   LUAOSUTILS_TRACE_SCOPE("process.wait");
 
    DWORD bytesRead;
    const int bufferSize = 4096;
@@ -107,6 +111,7 @@ bool process_execute(const std::string& cmd, const std::string& dir, std::string
 
 bool process_launch(const std::string& cmd, const std::string& dir)
 {
+   LUAOSUTILS_TRACE_SCOPE("process.spawn");
    STARTUPINFOW si;
    PROCESS_INFORMATION pi;
 
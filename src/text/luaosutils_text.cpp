@@ -9,33 +9,20 @@
 #include "luaosutils.hpp"
 #include "text/luaosutils_text_os.h"
 
-static int luaosutils_text_convert_encoding(lua_State *L)
+static std::optional<std::string> luaosutils_text_convert_encoding(std::string_view text, unsigned int fromCodepage, std::optional<unsigned int> toCodepage)
 {
-   auto text = get_lua_parameter<std::string>(L, 1, LUA_TSTRING);
-   auto fromCodepage = get_lua_parameter<unsigned int>(L, 2, LUA_TNUMBER);
-   auto toCodepage = get_lua_parameter<unsigned int>(L, 3, LUA_TNUMBER, luaosutils::text_get_utf8_codepage());
-
-   if (!text.size())
-   {
-      push_lua_return_value(L, text);
-      return 1;
-   }
+   if (text.empty())
+      return std::string();
 
    // Encode even when fromCodepage == toCodepage
    // This allows a script to find out if fromCodepage is a valid encoding for the string.
-   if (fromCodepage && toCodepage)
-   {
-      std::string output;
-      const bool result = luaosutils::text_convert_encoding(text, fromCodepage, output, toCodepage);
-      if (result)
-         push_lua_return_value(L, output);
-      else
-         lua_pushnil(L);
-   }
-   else
-      lua_pushnil(L);
-
-   return 1;
+   const unsigned int toCodepageValue = toCodepage.value_or(luaosutils::text_get_utf8_codepage());
+   if (! fromCodepage || ! toCodepageValue)
+      return std::nullopt;
+   std::string output;
+   if (! luaosutils::text_convert_encoding(text, fromCodepage, output, toCodepageValue))
+      return std::nullopt;
+   return output;
 }
 
 int luaosutils_text_get_default_encoding(lua_State *L)
@@ -55,16 +42,10 @@ int luaosutils_text_get_default_encoding(lua_State *L)
    return numReturns;
 }
 
-int luaosutils_text_get_utf8_encoding(lua_State *L)
-{
-   push_lua_return_value(L, luaosutils::text_get_utf8_codepage());
-   return 1;
-}
-
 static const luaL_Reg text_utils[] = {
-   {"convert_encoding",       luaosutils_text_convert_encoding},
+   {"convert_encoding",       lua_bind<luaosutils_text_convert_encoding>},
    {"get_default_codepage",   luaosutils_text_get_default_encoding},
-   {"get_utf8_codepage",      luaosutils_text_get_utf8_encoding},
+   {"get_utf8_codepage",      lua_bind<luaosutils::text_get_utf8_codepage>},
    {NULL, NULL} // sentinel
 };
 
@@ -72,6 +53,6 @@ void luaosutils_text_create(lua_State *L)
 {
    lua_newtable(L);  // create nested table
    
-   luaL_setfuncs(L, text_utils, 0);   // add file methods to new metatable
+   luaosutils::set_counted_funcs(L, text_utils, "text"); // add file methods to new metatable
    lua_setfield(L, -2, "text");       // add the nested table to the parent table with the name
 }
@@ -10,10 +10,13 @@
 #ifndef luaosutils_text_os_h
 #define luaosutils_text_os_h
 
+#include <string>
+#include <string_view>
+
 namespace luaosutils
 {
 
-bool text_convert_encoding(const std::string& text, unsigned int fromCodepage, std::string& output, unsigned int toCodepage);
+bool text_convert_encoding(std::string_view text, unsigned int fromCodepage, std::string& output, unsigned int toCodepage);
 int text_get_default_codepage(std::string& errorMessage);
 int text_get_utf8_codepage();
 
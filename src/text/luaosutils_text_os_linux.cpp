@@ -0,0 +1,102 @@
+//
+//  luaosutils_text_os_linux.cpp
+//  luaosutils
+//
+//  (Usage permitted by MIT License. See LICENSE file in this repository.)
+//
+//  Linux has no codepage API, so the Windows codepage numbers that the text namespace uses are mapped to
+//  iconv encoding names.
+//
+#include <cerrno>
+#include <clocale>
+#include <cstdlib>
+#include <string>
+
+#include <iconv.h>
+#include <langinfo.h>
+
+#include "text/luaosutils_text_os.h"
+
+namespace luaosutils
+{
+
+constexpr unsigned int kUtf8Codepage = 65001;
+
+static std::string iconv_name_for_codepage(unsigned int codepage)
+{
+   switch (codepage)
+   {
+      case 1200: return "UTF-16LE";
+      case 1201: return "UTF-16BE";
+      case 12000: return "UTF-32LE";
+      case 12001: return "UTF-32BE";
+      case 10000: return "MACINTOSH";
+      case 20127: return "US-ASCII";
+      case 20866: return "KOI8-R";
+      case 21866: return "KOI8-U";
+      case 51932: return "EUC-JP";
+      case 51949: return "EUC-KR";
+      case 54936: return "GB18030";
+      case kUtf8Codepage: return "UTF-8";
+   }
+   if (codepage >= 28591 && codepage <= 28606)
+      return "ISO-8859-" + std::to_string(codepage - 28590);
+   return "CP" + std::to_string(codepage); // 437, 850, 874, 932, 936, 949, 950, 1250-1258, ...
+}
+
+bool text_convert_encoding(std::string_view text, unsigned int fromCodepage, std::string& output, unsigned int toCodepage)
+{
+   iconv_t converter = iconv_open(iconv_name_for_codepage(toCodepage).c_str(), iconv_name_for_codepage(fromCodepage).c_str());
+   if (converter == reinterpret_cast<iconv_t>(-1))
+      return false;
+   std::string result;
+   char* input = const_cast<char*>(text.data());
+   size_t inputLeft = text.size();
+   char block[4096];
+   bool success = true;
+   while (success)
+   {
+      char* next = block;
+      size_t blockLeft = sizeof(block);
+      const bool finished = (inputLeft == 0); // then flush any shift state the output encoding needs
+      const size_t converted = finished ? iconv(converter, nullptr, nullptr, &next, &blockLeft)
+                                        : iconv(converter, &input, &inputLeft, &next, &blockLeft);
+      result.append(block, next - block);
+      if (converted == static_cast<size_t>(-1))
+         success = (errno == E2BIG); // otherwise the input is not valid in fromCodepage or cannot be written in toCodepage
+      else if (finished)
+         break;
+   }
+   iconv_close(converter);
+   if (success)
+      output = std::move(result);
+   return success;
+}
+
+int text_get_utf8_codepage()
+{
+   return kUtf8Codepage;
+}
+
+int text_get_default_codepage(std::string& errorMessage)
+{
+   errorMessage = "";
+   // the host may never have called setlocale, so read the user's locale from the environment
+   locale_t userLocale = newlocale(LC_CTYPE_MASK, "", static_cast<locale_t>(0));
+   if (! userLocale)
+      return text_get_utf8_codepage();
+   const std::string codeset = nl_langinfo_l(CODESET, userLocale);
+   freelocale(userLocale);
+   if (codeset == "UTF-8")
+      return text_get_utf8_codepage();
+   if (codeset == "ANSI_X3.4-1968")
+      return 20127;
+   if (codeset.rfind("ISO-8859-", 0) == 0)
+      return 28590 + std::atoi(codeset.c_str() + 9);
+   if (codeset.rfind("CP", 0) == 0)
+      return std::atoi(codeset.c_str() + 2);
+   errorMessage = "unsupported locale codeset " + codeset;
+   return 0;
+}
+
+}
@@ -15,7 +15,7 @@
 namespace luaosutils
 {
 
-bool text_convert_encoding(const std::string& text, unsigned int fromCodepage, std::string& output, unsigned int toCodepage)
+bool text_convert_encoding(std::string_view text, unsigned int fromCodepage, std::string& output, unsigned int toCodepage)
 {
    @try {
       CFStringEncoding cfFromEncoding = CFStringConvertWindowsCodepageToEncoding(fromCodepage);
@@ -16,9 +16,10 @@
 namespace luaosutils
 {
 
-bool text_convert_encoding(const std::string& text, unsigned int fromCodepage, std::string& output, unsigned int toCodepage)
+bool text_convert_encoding(std::string_view text, unsigned int fromCodepage, std::string& output, unsigned int toCodepage)
 {
-	const int inpSize = MultiByteToWideChar(fromCodepage, MB_ERR_INVALID_CHARS, text.c_str(), -1, nullptr, 0) - 1; // remove null-terminator
+	const int textSize = static_cast<int>(text.size()); // an explicit length, since a view need not be null-terminated
+	const int inpSize = MultiByteToWideChar(fromCodepage, MB_ERR_INVALID_CHARS, text.data(), textSize, nullptr, 0);
 	if (inpSize <= 0)
 	{
 #ifdef _DEBUG
@@ -28,8 +29,8 @@ bool text_convert_encoding(const std::string& text, unsigned int fromCodepage, s
 	}
 	std::basic_string<WCHAR> wInp;
 	wInp.resize(inpSize);
-	MultiByteToWideChar(fromCodepage, 0, text.c_str(), -1, wInp.data(), inpSize);
-	const int outSize = WideCharToMultiByte(toCodepage, 0, wInp.c_str(), -1, nullptr, 0, NULL, NULL) - 1; // remove null-terminator
+	MultiByteToWideChar(fromCodepage, 0, text.data(), textSize, wInp.data(), inpSize);
+	const int outSize = WideCharToMultiByte(toCodepage, 0, wInp.c_str(), inpSize, nullptr, 0, NULL, NULL);
 	if (outSize <= 0)
 	{
 #ifdef _DEBUG
@@ -38,7 +39,7 @@ bool text_convert_encoding(const std::string& text, unsigned int fromCodepage, s
 		return false;
 	}
 	output.resize(outSize);
-	WideCharToMultiByte(toCodepage, 0, wInp.c_str(), -1, output.data(), outSize, NULL, NULL);
+	WideCharToMultiByte(toCodepage, 0, wInp.c_str(), inpSize, output.data(), outSize, NULL, NULL);
 	return true;
 }
 
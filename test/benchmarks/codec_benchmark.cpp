@@ -0,0 +1,112 @@
+//
+//  codec_benchmark.cpp
+//  luaosutils
+//
+//  (Usage permitted by MIT License. See LICENSE file in this repository.)
+//
+//  Measures the throughput of the hex and base64 codecs for digest-sized, key-sized and payload-sized data,
+//  and compares hex with the original std::stringstream and std::stoi implementation. Build it from the
+//  repository root, once as is and once with -DLUAOSUTILS_NO_SIMD to measure the scalar code alone:
+//
+//     c++ -std=c++17 -O2 -Isrc test/benchmarks/codec_benchmark.cpp src/crypto/luaosutils_crypto_codecs.cpp -o /tmp/codec_benchmark
+//     /tmp/codec_benchmark [seconds per measurement]
+//
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iomanip>
+#include <random>
+#include <sstream>
+#include <string>
+
+#include "crypto/luaosutils_crypto_utils.h"
+
+using luaosutils::encryptBuffer;
+
+static std::string original_buffer2HexString(const uint8_t* buffer, const size_t size)
+{
+   std::stringstream ss;
+   ss << std::hex << std::setfill('0');
+   for (size_t i = 0; i < size; i++)
+      ss << std::setw(2) << static_cast<int>(buffer[i]);
+   return ss.str();
+}
+
+static encryptBuffer original_hexString2Buffer(const std::string& hexString)
+{
+   encryptBuffer buffer;
+   for (size_t i = 0; i < hexString.size(); i += 2)
+   {
+      try
+      {
+         buffer.push_back(static_cast<uint8_t>(std::stoi(hexString.substr(i, 2), nullptr, 16)));
+      }
+      catch (...) {}
+   }
+   return buffer;
+}
+
+static volatile size_t g_sink; // keeps the compiler from discarding the results
+
+/** \brief Runs \p function repeatedly for about \p seconds and prints the input consumed per second. */
+template<typename Function>
+static void run(const char* name, size_t inputSize, double seconds, Function function)
+{
+   size_t iterations = 0;
+   const auto start = std::chrono::steady_clock::now();
+   double elapsed = 0;
+   do
+   {
+      for (int x = 0; x < 64; x++)
+         g_sink = g_sink + function();
+      iterations += 64;
+      elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+   } while (elapsed < seconds);
+   printf("   %-26s %10.1f MB/s\n", name, inputSize * static_cast<double>(iterations) / elapsed / 1e6);
+}
+
+int main(int argc, char* argv[])
+{
+   const double seconds = argc > 1 ? std::atof(argv[1]) : 0.5;
+#ifdef LUAOSUTILS_NO_SIMD
+   printf("scalar build\n");
+#else
+   printf("default build\n");
+#endif
+   std::mt19937 random(12345);
+   for (size_t size : {32, 64, 4096, 1024 * 1024})
+   {
+      encryptBuffer data(size);
+      for (auto& byte : data)
+         byte = static_cast<uint8_t>(random());
+      const std::string hex = luaosutils::buffer2HexString(data);
+      const std::string base64 = luaosutils::buffer2Base64String(data);
+      const double scale = size >= 4096 ? seconds : seconds / 2;
+      printf("%zu bytes\n", size);
+      run("hex encode (original)", size, scale, [&]() { return original_buffer2HexString(data.data(), data.size()).size(); });
+      run("hex encode", size, scale, [&]() { return luaosutils::buffer2HexString(data).size(); });
+      run("hex decode (original)", hex.size(), scale, [&]() { return original_hexString2Buffer(hex).size(); });
+      run("hex decode", hex.size(), scale, [&]() { return luaosutils::hexString2Buffer(hex).size(); });
+      run("hex decode (strict)", hex.size(), scale, [&]()
+            {
+               encryptBuffer result;
+               luaosutils::hexString2Buffer(hex, result, luaosutils::decode_mode::strict);
+               return result.size();
+            });
+      run("base64 encode", size, scale, [&]() { return luaosutils::buffer2Base64String(data).size(); });
+      run("base64 decode", base64.size(), scale, [&]()
+            {
+               encryptBuffer result;
+               luaosutils::base64String2Buffer(base64, result, luaosutils::decode_mode::lenient);
+               return result.size();
+            });
+      run("base64 decode (strict)", base64.size(), scale, [&]()
+            {
+               encryptBuffer result;
+               luaosutils::base64String2Buffer(base64, result, luaosutils::decode_mode::strict);
+               return result.size();
+            });
+   }
+   return 0;
+}
@@ -0,0 +1,67 @@
+--
+--  ffi_benchmark.lua
+--  luaosutils
+--
+--  (Usage permitted by MIT License. See LICENSE file in this repository.)
+--
+--  Compares calling the pure utility functions through the Lua C API with calling them through LuaJIT FFI
+--  (require('luaosutils_ffi')), both in the same LuaJIT runtime. luaosutils itself needs Lua 5.4, so under LuaJIT
+--  the C API path is ffi_benchmark_capi, a C API module that binds the same exported functions. Build it as
+--  described in ffi_benchmark_capi.cpp, and run with it, luaosutils and src/luaosutils_ffi.lua on the package paths:
+--
+--     luajit test/benchmarks/ffi_benchmark.lua [iterations]
+--
+--  Under Lua 5.4 it times the luaosutils C API functions alone. Those times include the Lua 5.4 interpreter, so
+--  compare them only with other Lua 5.4 runs.
+--
+
+local iterations = tonumber(arg and arg[1]) or 1000000
+
+local paths = {}
+if jit then
+   local ok, capi = pcall(require, 'ffi_benchmark_capi')
+   if not ok then
+      error("cannot load ffi_benchmark_capi, see ffi_benchmark_capi.cpp: " .. tostring(capi))
+   end
+   capi.name = "C API"
+   paths[#paths + 1] = capi
+   local osutils_ffi = require('luaosutils_ffi')
+   paths[#paths + 1] = {
+      name = "FFI",
+      url_escape = osutils_ffi.url_escape,
+      conv_bin_to_chars = osutils_ffi.conv_bin_to_chars,
+      conv_chars_to_bin = osutils_ffi.conv_chars_to_bin,
+      calc_randomized_data = osutils_ffi.calc_randomized_data,
+   }
+else
+   local osutils = require('luaosutils')
+   paths[#paths + 1] = {
+      name = "C API",
+      url_escape = osutils.internet.url_escape,
+      conv_bin_to_chars = osutils.crypto.conv_bin_to_chars,
+      conv_chars_to_bin = osutils.crypto.conv_chars_to_bin,
+      calc_randomized_data = osutils.crypto.calc_randomized_data,
+   }
+end
+
+local cases = {
+   {"url_escape", "name=a b&c"},
+   {"conv_bin_to_chars", "\0\1\2\3\4\5\6\7\8\9\10\11\12\13\14\15"},
+   {"conv_chars_to_bin", "000102030405060708090a0b0c0d0e0f"},
+   {"calc_randomized_data", 16},
+}
+
+print(string.format("%s, %d iterations", jit and jit.version or _VERSION, iterations))
+for _, case in ipairs(cases) do
+   local name, input = case[1], case[2]
+   for _, path in ipairs(paths) do
+      local func = path[name]
+      local total = 0
+      local start = os.clock()
+      for _ = 1, iterations do
+         total = total + #func(input)
+      end
+      local elapsed = os.clock() - start
+      print(string.format("%-22s %-6s %8.1f ns/call  (%d)", name, path.name, elapsed * 1e9 / iterations, total % 10))
+   end
+end
@@ -0,0 +1,100 @@
+//
+//  ffi_benchmark_capi.cpp
+//  luaosutils
+//
+//  (Usage permitted by MIT License. See LICENSE file in this repository.)
+//
+//  A Lua C API module for LuaJIT that binds the same luaosutils_ffi_ functions as luaosutils_ffi.lua, so that
+//  ffi_benchmark.lua can time both calling conventions in the same runtime. luaosutils itself needs Lua 5.4 and
+//  cannot be loaded by LuaJIT. Build it from the repository root against LuaJIT's headers and a Linux build of
+//  luaosutils (see CMakeLists.txt):
+//
+//     c++ -std=c++17 -O2 -shared -fPIC -I/usr/include/luajit-2.1 -Isrc -o build/ffi_benchmark_capi.so
+//         test/benchmarks/ffi_benchmark_capi.cpp -Lbuild -l:luaosutils.so -Wl,-rpath,$PWD/build
+//
+
+#include "luaosutils_export.h"
+
+constexpr size_t kStackBufferSize = 256;
+
+/** \brief Calls an ffi function that writes to an output buffer and pushes its result, retrying with a buffer
+ * from Lua when the stack buffer is too small. Pushes \p failure if the function fails.
+ */
+template<typename Function>
+static int push_ffi_result(lua_State* L, Function function, const char* failure)
+{
+   char stackBuffer[kStackBufferSize];
+   char* output = stackBuffer;
+   size_t size = function(output, sizeof(stackBuffer));
+   if (size == LUAOSUTILS_FFI_ERROR)
+   {
+      if (failure)
+         lua_pushstring(L, failure);
+      else
+         lua_pushnil(L);
+      return 1;
+   }
+   if (size > sizeof(stackBuffer))
+   {
+      output = static_cast<char*>(lua_newuserdata(L, size));
+      size = function(output, size);
+   }
+   lua_pushlstring(L, output, size);
+   return 1;
+}
+
+static int capi_url_escape(lua_State* L)
+{
+   size_t inputSize = 0;
+   const char* input = luaL_checklstring(L, 1, &inputSize);
+   return push_ffi_result(L, [input, inputSize](char* output, size_t outputSize)
+         {
+            return luaosutils_ffi_url_escape(input, inputSize, output, outputSize);
+         }, "");
+}
+
+static int capi_conv_bin_to_chars(lua_State* L)
+{
+   size_t inputSize = 0;
+   const char* input = luaL_checklstring(L, 1, &inputSize);
+   return push_ffi_result(L, [input, inputSize](char* output, size_t outputSize)
+         {
+            return luaosutils_ffi_conv_bin_to_chars(reinterpret_cast<const unsigned char*>(input), inputSize, output, outputSize);
+         }, "");
+}
+
+static int capi_conv_chars_to_bin(lua_State* L)
+{
+   size_t inputSize = 0;
+   const char* input = luaL_checklstring(L, 1, &inputSize);
+   return push_ffi_result(L, [input, inputSize](char* output, size_t outputSize)
+         {
+            return luaosutils_ffi_conv_chars_to_bin(input, inputSize, reinterpret_cast<unsigned char*>(output), outputSize);
+         }, "");
+}
+
+static int capi_calc_randomized_data(lua_State* L)
+{
+   const size_t size = static_cast<size_t>(luaL_checkinteger(L, 1));
+   return push_ffi_result(L, [size](char* output, size_t outputSize)
+         {
+            if (size > outputSize)
+               return size;
+            return luaosutils_ffi_calc_randomized_data(reinterpret_cast<unsigned char*>(output), size);
+         }, nullptr);
+}
+
+static const luaL_Reg capi_functions[] = {
+   {"url_escape",             capi_url_escape},
+   {"conv_bin_to_chars",      capi_conv_bin_to_chars},
+   {"conv_chars_to_bin",      capi_conv_chars_to_bin},
+   {"calc_randomized_data",   capi_calc_randomized_data},
+   {NULL, NULL} // sentinel
+};
+
+extern "C" LUAOSUTILS_EXPORT int luaopen_ffi_benchmark_capi(lua_State* L)
+{
+   lua_newtable(L);
+   luaL_register(L, NULL, capi_functions);
+   return 1;
+}
@@ -0,0 +1,52 @@
+//
+//  luaosutils_open_benchmark.cpp
+//  luaosutils
+//
+//  (Usage permitted by MIT License. See LICENSE file in this repository.)
+//
+//  Measures what it costs a new Lua state to open luaosutils, as every short-lived script does when it calls
+//  require. Namespaces are built on first access, so it also measures opening the library and touching one
+//  namespace, and opening it and touching all of them, which is the work every open used to do. Build it from
+//  the repository root against a luaosutils library and Lua 5.4:
+//
+//     c++ -std=c++17 -O2 -Isrc -I<lua include folder> test/benchmarks/luaosutils_open_benchmark.cpp <luaosutils library> <lua library> -o /tmp/luaosutils_open_benchmark
+//     /tmp/luaosutils_open_benchmark [states]
+//
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <initializer_list>
+
+#include "luaosutils_export.h"
+
+static void run(const char* name, size_t numStates, std::initializer_list<const char*> namespaces)
+{
+   double openSeconds = 0;
+   const auto start = std::chrono::steady_clock::now();
+   for (size_t x = 0; x < numStates; x++)
+   {
+      lua_State* L = luaL_newstate();
+      const auto openStart = std::chrono::steady_clock::now();
+      luaopen_luaosutils(L);
+      for (const char* space : namespaces)
+      {
+         lua_getfield(L, -1, space);
+         lua_pop(L, 1);
+      }
+      openSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - openStart).count();
+      lua_close(L);
+   }
+   const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+   printf("%-28s %8.2f us/open  %8.2f us/state (including new and close)\n", name,
+          openSeconds * 1e6 / numStates, elapsed.count() * 1e6 / numStates);
+}
+
+int main(int argc, char* argv[])
+{
+   const size_t numStates = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 10000;
+   run("open only", numStates, {});
+   run("open + internet", numStates, {"internet"});
+   run("open + all namespaces", numStates, {"crypto", "internet", "menu", "process", "text"});
+   return 0;
+}
@@ -0,0 +1,76 @@
+//
+//  luastack_view_benchmark.cpp
+//  luaosutils
+//
+//  (Usage permitted by MIT License. See LICENSE file in this repository.)
+//
+//  Compares reading Lua string arguments with get_lua_parameter as copies (std::string, encryptBuffer)
+//  and as views that borrow the Lua-owned memory (std::string_view, bufferView). It counts the heap
+//  allocations made per call as well as the time. Build it against Lua 5.4 from the repository root:
+//
+//     c++ -std=c++17 -O2 -Isrc -I<lua include folder> test/benchmarks/luastack_view_benchmark.cpp src/luaosutils_stats.cpp <lua library> -o /tmp/luastack_view_benchmark
+//     /tmp/luastack_view_benchmark [iterations]
+//
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "luaosutils_luastack.h"
+
+static std::atomic<unsigned long long> g_allocations{0};
+
+void* operator new(size_t size)
+{
+   g_allocations.fetch_add(1, std::memory_order_relaxed);
+   if (void* p = std::malloc(size ? size : 1))
+      return p;
+   throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+template<typename T>
+static void run(lua_State* L, const char* name, size_t iterations)
+{
+   const size_t bytes = lua_rawlen(L, 1);
+   unsigned long long checksum = 0;
+   const unsigned long long allocationsBefore = g_allocations.load();
+   const auto start = std::chrono::steady_clock::now();
+   for (size_t x = 0; x < iterations; x++)
+   {
+      auto value = get_lua_parameter<T>(L, 1, LUA_TSTRING);
+      checksum += static_cast<unsigned char>(value.data()[value.size() / 2]);
+   }
+   const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+   const double allocationsPerCall = double(g_allocations.load() - allocationsBefore) / iterations;
+   printf("%10zu bytes  %-26s %12.1f ns/call  %5.2f allocs/call  (%llu)\n", bytes, name,
+          elapsed.count() * 1e9 / iterations, allocationsPerCall, checksum % 10);
+}
+
+int main(int argc, char* argv[])
+{
+   const size_t baseIterations = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+   lua_State* L = luaL_newstate();
+   for (size_t bytes : {size_t(16), size_t(1024), size_t(64 * 1024), size_t(4 * 1024 * 1024)})
+   {
+      const std::string value(bytes, 'x');
+      lua_settop(L, 0);
+      lua_pushlstring(L, value.data(), value.size());
+      // Keep the total number of bytes copied roughly level across sizes.
+      const size_t iterations = (std::max)(size_t(10), baseIterations / (std::max)(size_t(1), bytes / 1024));
+      run<std::string>(L, "std::string", iterations);
+      run<std::string_view>(L, "std::string_view", iterations);
+      run<luaosutils::encryptBuffer>(L, "encryptBuffer", iterations);
+      run<luaosutils::bufferView>(L, "bufferView", iterations);
+   }
+   lua_close(L);
+   return 0;
+}
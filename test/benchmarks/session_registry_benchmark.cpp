@@ -0,0 +1,123 @@
+//
+//  session_registry_benchmark.cpp
+//  luaosutils
+//
+//  (Usage permitted by MIT License. See LICENSE file in this repository.)
+//
+//  Compares session lookups in slot_registry with the std::map and mutex it replaced, while one
+//  thread keeps creating and destroying sessions, as the main thread does, and the others look them
+//  up, as completion paths do. Build and run it from the repository root:
+//
+//     c++ -std=c++17 -O2 -pthread -Isrc test/benchmarks/session_registry_benchmark.cpp -o /tmp/session_registry_benchmark
+//     /tmp/session_registry_benchmark [sessions] [seconds]
+//
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "internet/luaosutils_session_registry.h"
+
+struct session
+{
+   std::uint64_t id{};
+};
+
+/** \brief The registry that callback_session used before: a map of ids behind one mutex. */
+class map_registry
+{
+   std::map<std::uint64_t, session*> m_sessions;
+   std::mutex m_mutex;
+   std::uint64_t m_nextId{};
+
+public:
+   std::uint64_t reserve() { std::lock_guard<std::mutex> lock(m_mutex); return ++m_nextId; }
+   void bind(std::uint64_t id, session* s) { std::lock_guard<std::mutex> lock(m_mutex); m_sessions.emplace(id, s); }
+   void release(std::uint64_t id) { std::lock_guard<std::mutex> lock(m_mutex); m_sessions.erase(id); }
+   session* find(std::uint64_t id)
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      auto it = m_sessions.find(id);
+      return it == m_sessions.end() ? nullptr : it->second;
+   }
+};
+
+template<typename Registry>
+static void run(const char* name, Registry& registry, size_t numSessions, size_t numReaders, double seconds)
+{
+   std::vector<session> sessions(numSessions);
+   std::vector<std::atomic<std::uint64_t>> ids(numSessions);
+   for (size_t x = 0; x < numSessions; x++)
+   {
+      sessions[x].id = registry.reserve();
+      registry.bind(sessions[x].id, &sessions[x]);
+      ids[x] = sessions[x].id;
+   }
+
+   std::atomic<bool> stop{false};
+   std::atomic<unsigned long long> lookups{0};
+   std::atomic<unsigned long long> churns{0};
+   std::vector<std::thread> threads;
+   for (size_t t = 0; t < numReaders; t++)
+   {
+      threads.emplace_back([&, t]()
+            {
+               std::minstd_rand random(static_cast<unsigned>(t + 1));
+               unsigned long long count = 0;
+               while (! stop.load(std::memory_order_relaxed))
+               {
+                  for (int x = 0; x < 1024; x++)
+                     registry.find(ids[random() % numSessions].load(std::memory_order_relaxed));
+                  count += 1024;
+               }
+               lookups += count;
+            });
+   }
+   threads.emplace_back([&]()
+         {
+            std::minstd_rand random(12345);
+            unsigned long long count = 0;
+            while (! stop.load(std::memory_order_relaxed))
+            {
+               const size_t x = random() % numSessions;
+               registry.release(sessions[x].id);
+               sessions[x].id = registry.reserve();
+               registry.bind(sessions[x].id, &sessions[x]);
+               ids[x].store(sessions[x].id, std::memory_order_relaxed);
+               count++;
+            }
+            churns += count;
+         });
+
+   std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+   stop = true;
+   for (auto& thread : threads)
+      thread.join();
+   for (auto& s : sessions)
+      registry.release(s.id);
+   printf("%-14s %2zu readers: %8.1f M lookups/s, %7.2f M create/destroy/s\n", name, numReaders,
+          lookups / seconds / 1e6, churns / seconds / 1e6);
+}
+
+int main(int argc, char* argv[])
+{
+   const size_t numSessions = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 10000;
+   const double seconds = argc > 2 ? std::atof(argv[2]) : 1.0;
+   const size_t maxReaders = (std::max)(1u, std::thread::hardware_concurrency());
+   printf("%zu sessions\n", numSessions);
+   for (size_t numReaders = 1; numReaders <= maxReaders; numReaders *= 2)
+   {
+      map_registry mapRegistry;
+      run("map + mutex", mapRegistry, numSessions, numReaders, seconds);
+      luaosutils::slot_registry<session> slotRegistry;
+      run("slot_registry", slotRegistry, numSessions, numReaders, seconds);
+   }
+   return 0;
+}
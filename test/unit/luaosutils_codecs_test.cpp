@@ -0,0 +1,224 @@
+//
+//  luaosutils_codecs_test.cpp
+//  luaosutils
+//
+//  (Usage permitted by MIT License. See LICENSE file in this repository.)
+//
+//  Tests the hex and base64 codecs against known vectors, simple reference implementations and malformed
+//  input, in strict and lenient mode. Lengths run past several 12, 16 and 32 byte blocks, so that both the SSE2
+//  blocks and the scalar tail are covered. CMake builds it twice, once with LUAOSUTILS_NO_SIMD.
+//
+
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <string>
+
+#include "crypto/luaosutils_crypto_utils.h"
+#include "luaosutils_test.h"
+
+using luaosutils::decode_mode;
+using luaosutils::encryptBuffer;
+
+static constexpr size_t kMaxLength = 200;
+
+static encryptBuffer bytes_of(std::string_view text)
+{
+   return encryptBuffer(text.begin(), text.end());
+}
+
+static encryptBuffer random_bytes(std::mt19937& random, size_t size)
+{
+   encryptBuffer result(size);
+   for (auto& byte : result)
+      byte = static_cast<uint8_t>(random());
+   return result;
+}
+
+static std::string reference_hex(const encryptBuffer& buffer)
+{
+   static const char digits[] = "0123456789abcdef";
+   std::string result;
+   for (uint8_t byte : buffer)
+   {
+      result += digits[byte >> 4];
+      result += digits[byte & 0x0f];
+   }
+   return result;
+}
+
+// The original hexString2Buffer, which lenient decoding must still match.
+static encryptBuffer reference_hex_decode(const std::string& hexString)
+{
+   encryptBuffer buffer;
+   for (size_t i = 0; i < hexString.size(); i += 2)
+   {
+      try
+      {
+         buffer.push_back(static_cast<uint8_t>(std::stoi(hexString.substr(i, 2), nullptr, 16)));
+      }
+      catch (...) {}
+   }
+   return buffer;
+}
+
+static std::string reference_base64(const encryptBuffer& buffer)
+{
+   static const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+   std::string result;
+   for (size_t i = 0; i < buffer.size(); i += 3)
+   {
+      const size_t count = (std::min)(size_t(3), buffer.size() - i);
+      uint32_t word = buffer[i] << 16;
+      if (count > 1) word |= buffer[i + 1] << 8;
+      if (count > 2) word |= buffer[i + 2];
+      result += digits[word >> 18];
+      result += digits[(word >> 12) & 0x3f];
+      result += count > 1 ? digits[(word >> 6) & 0x3f] : '=';
+      result += count > 2 ? digits[word & 0x3f] : '=';
+   }
+   return result;
+}
+
+static bool decodes_to(std::string_view base64, decode_mode mode, std::string_view expected)
+{
+   encryptBuffer buffer;
+   return luaosutils::base64String2Buffer(base64, buffer, mode) && buffer == bytes_of(expected);
+}
+
+static bool rejects(std::string_view base64, decode_mode mode)
+{
+   encryptBuffer buffer{1, 2, 3};
+   return ! luaosutils::base64String2Buffer(base64, buffer, mode) && buffer.empty();
+}
+
+static void test_hex_vectors()
+{
+   const encryptBuffer bytes{0x00, 0x01, 0x7f, 0x80, 0xab, 0xff};
+   CHECK(luaosutils::buffer2HexString(bytes) == "00017f80abff");
+   CHECK(luaosutils::buffer2HexString(encryptBuffer()) == "");
+   CHECK(luaosutils::hexString2Buffer("00017F80ABff") == bytes);
+   encryptBuffer buffer;
+   CHECK(luaosutils::hexString2Buffer("00017F80ABff", buffer, decode_mode::strict) && buffer == bytes);
+   CHECK(luaosutils::hexString2Buffer("", buffer, decode_mode::strict) && buffer.empty());
+}
+
+static void test_hex_round_trips()
+{
+   std::mt19937 random(1);
+   for (size_t size = 0; size <= kMaxLength; size++)
+   {
+      const encryptBuffer bytes = random_bytes(random, size);
+      const std::string hex = luaosutils::buffer2HexString(bytes);
+      if (! CHECK(hex == reference_hex(bytes)))
+         break;
+      encryptBuffer buffer;
+      CHECK(luaosutils::hexString2Buffer(hex, buffer, decode_mode::strict) && buffer == bytes);
+      CHECK(luaosutils::hexString2Buffer(hex) == bytes);
+      encryptBuffer output((hex.size() + 1) / 2);
+      CHECK(luaosutils::hexChars2Buffer(hex, output.data()) == bytes.size() && output == bytes);
+   }
+}
+
+static void test_hex_malformed()
+{
+   encryptBuffer buffer{1};
+   CHECK(! luaosutils::hexString2Buffer("abc", buffer, decode_mode::strict) && buffer.empty());
+   // a bad digit in the first and the second 32-digit block, and in the tail
+   const std::string valid(70, 'a');
+   for (size_t position : {0, 5, 31, 32, 45, 63, 64, 69})
+   {
+      for (char bad : {'g', ' ', '-', '\x80'})
+      {
+         std::string hex = valid;
+         hex[position] = bad;
+         buffer = {1};
+         CHECK(! luaosutils::hexString2Buffer(hex, buffer, decode_mode::strict) && buffer.empty());
+         CHECK(luaosutils::hexString2Buffer(hex) == reference_hex_decode(hex));
+         encryptBuffer output((hex.size() + 1) / 2);
+         output.resize(luaosutils::hexChars2Buffer(hex, output.data()));
+         CHECK(output == reference_hex_decode(hex));
+      }
+   }
+   for (const char* hex : {"zz01", " 1", "1z", "-1", "+f", "0", "abc", "0x12"})
+      CHECK(luaosutils::hexString2Buffer(hex) == reference_hex_decode(hex));
+}
+
+static void test_base64_vectors()
+{
+   // RFC 4648, section 10
+   const char* const vectors[][2] = {
+      {"", ""}, {"f", "Zg=="}, {"fo", "Zm8="}, {"foo", "Zm9v"}, {"foob", "Zm9vYg=="}, {"fooba", "Zm9vYmE="}, {"foobar", "Zm9vYmFy"}
+   };
+   for (const auto& vector : vectors)
+   {
+      CHECK(luaosutils::buffer2Base64String(bytes_of(vector[0])) == vector[1]);
+      CHECK(decodes_to(vector[1], decode_mode::strict, vector[0]));
+      CHECK(decodes_to(vector[1], decode_mode::lenient, vector[0]));
+   }
+}
+
+static void test_base64_round_trips()
+{
+   std::mt19937 random(2);
+   for (size_t size = 0; size <= kMaxLength; size++)
+   {
+      const encryptBuffer bytes = random_bytes(random, size);
+      const std::string base64 = luaosutils::buffer2Base64String(bytes);
+      if (! CHECK(base64 == reference_base64(bytes)))
+         break;
+      encryptBuffer buffer;
+      CHECK(luaosutils::base64String2Buffer(base64, buffer, decode_mode::strict) && buffer == bytes);
+      CHECK(luaosutils::base64String2Buffer(base64, buffer, decode_mode::lenient) && buffer == bytes);
+   }
+}
+
+static void test_base64_malformed()
+{
+   CHECK(rejects("Zg", decode_mode::strict));                    // no padding
+   CHECK(decodes_to("Zg", decode_mode::lenient, "f"));
+   CHECK(rejects("Zh==", decode_mode::strict));                  // unused bits set
+   CHECK(rejects("Z===", decode_mode::strict));
+   CHECK(rejects("Z", decode_mode::lenient));                    // one digit is not a byte
+   CHECK(rejects("Zg==Zg==", decode_mode::lenient));             // data after padding
+   CHECK(rejects("Zg=x", decode_mode::lenient));
+   CHECK(rejects("Zm9v!mFy", decode_mode::lenient));
+   CHECK(rejects("-_-_", decode_mode::strict));
+   CHECK(decodes_to("-_-_", decode_mode::lenient, "\xfb\xff\xbf"));
+   CHECK(decodes_to("Zm9v\r\nYmFy\n", decode_mode::lenient, "foobar"));
+   CHECK(rejects("Zm9v YmFy", decode_mode::strict));
+   CHECK(decodes_to("Zg== \n", decode_mode::lenient, "f"));
+
+   // whitespace, a bad character and URL-safe characters in and after the first 16-digit block
+   std::mt19937 random(3);
+   const encryptBuffer bytes = random_bytes(random, 60);
+   const std::string base64 = luaosutils::buffer2Base64String(bytes);
+   for (size_t position : {0, 7, 15, 16, 30, 47, 79})
+   {
+      std::string spaced = base64;
+      spaced.insert(position, "\n");
+      encryptBuffer buffer;
+      CHECK(luaosutils::base64String2Buffer(spaced, buffer, decode_mode::lenient) && buffer == bytes);
+      CHECK(rejects(spaced, decode_mode::strict));
+      std::string bad = base64;
+      bad[position] = '*';
+      CHECK(rejects(bad, decode_mode::lenient));
+      CHECK(rejects(bad, decode_mode::strict));
+   }
+   std::string urlSafe = base64;
+   for (char& c : urlSafe)
+      c = (c == '+') ? '-' : (c == '/') ? '_' : c;
+   encryptBuffer buffer;
+   CHECK(luaosutils::base64String2Buffer(urlSafe, buffer, decode_mode::lenient) && buffer == bytes);
+}
+
+int main()
+{
+   test_hex_vectors();
+   test_hex_round_trips();
+   test_hex_malformed();
+   test_base64_vectors();
+   test_base64_round_trips();
+   test_base64_malformed();
+   return test_result();
+}
@@ -0,0 +1,153 @@
+//
+//  luaosutils_hash_test.cpp
+//  luaosutils
+//
+//  (Usage permitted by MIT License. See LICENSE file in this repository.)
+//
+//  Tests the portable SHA-256, SHA-512 and BLAKE3 hashers against the NIST (FIPS 180-4 examples) and BLAKE3
+//  known answers, hashing each message whole and in pieces that straddle the 64 and 128 byte blocks and the
+//  1024 byte BLAKE3 chunks. On a processor with the SHA extensions, SHA-256 runs the SHA-NI kernel; CMake also
+//  builds the test with LUAOSUTILS_NO_SIMD, which runs the portable kernels everywhere.
+//
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "crypto/luaosutils_crypto_hash.h"
+#include "luaosutils_test.h"
+
+using luaosutils::bufferView;
+using luaosutils::encryptBuffer;
+using luaosutils::hasher;
+
+static const size_t kPieceSizes[] = {1, 7, 63, 64, 65, 127, 128, 129, 1000, 1023, 1024, 1025, 4096};
+
+struct known_answer
+{
+   encryptBuffer message;
+   const char* sha256;
+   const char* sha512;
+};
+
+static encryptBuffer bytes_of(std::string_view text)
+{
+   return encryptBuffer(text.begin(), text.end());
+}
+
+// The input of the official BLAKE3 test vectors.
+static encryptBuffer blake3_input(size_t size)
+{
+   encryptBuffer result(size);
+   for (size_t i = 0; i < size; i++)
+      result[i] = static_cast<uint8_t>(i % 251);
+   return result;
+}
+
+static std::string hash_whole(std::unique_ptr<hasher> (*create)(), const encryptBuffer& message)
+{
+   auto hash = create();
+   hash->update(bufferView(message.data(), message.size()));
+   return luaosutils::buffer2HexString(hash->finish());
+}
+
+// Feeds the message in pieces of pieceSize bytes, with an empty update before each one.
+static std::string hash_in_pieces(std::unique_ptr<hasher> (*create)(), const encryptBuffer& message, size_t pieceSize)
+{
+   auto hash = create();
+   for (size_t offset = 0; offset < message.size(); offset += pieceSize)
+   {
+      hash->update(bufferView());
+      hash->update(bufferView(message.data() + offset, (std::min)(pieceSize, message.size() - offset)));
+   }
+   hash->update(bufferView());
+   return luaosutils::buffer2HexString(hash->finish());
+}
+
+static void check_hasher(std::unique_ptr<hasher> (*create)(), const encryptBuffer& message, const std::string& expected)
+{
+   CHECK(hash_whole(create, message) == expected);
+   for (size_t pieceSize : kPieceSizes)
+   {
+      if (! CHECK(hash_in_pieces(create, message, pieceSize) == expected))
+         break;
+   }
+   // a clone continues from the same state as the original
+   auto hash = create();
+   const size_t half = message.size() / 2;
+   hash->update(bufferView(message.data(), half));
+   if (auto copy = hash->clone())
+   {
+      copy->update(bufferView(message.data() + half, message.size() - half));
+      CHECK(luaosutils::buffer2HexString(copy->finish()) == expected);
+   }
+   hash->update(bufferView(message.data() + half, message.size() - half));
+   CHECK(luaosutils::buffer2HexString(hash->finish()) == expected);
+}
+
+static void test_sha2()
+{
+   const known_answer answers[] = {
+      {bytes_of(""),
+         "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855",
+         "cf83e1357eefb8bdf1542850d66d8007d620e4050b5715dc83f4a921d36ce9ce47d0d13c5d85f2b0ff8318d2877eec2f63b931bd47417a81a538327af927da3e"},
+      {bytes_of("abc"),
+         "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad",
+         "ddaf35a193617abacc417349ae20413112e6fa4e89a97ea20a9eeee64b55d39a2192992a274fc1a836ba3c23a3feebbd454d4423643ce80e2a9ac94fa54ca49f"},
+      {bytes_of("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq"),
+         "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1",
+         "204a8fc6dda82f0a0ced7beb8e08a41657c16ef468b228a8279be331a703c33596fd15c13b1b07f9aa1d3bea57789ca031ad85c7a71dd70354ec631238ca3445"},
+      {bytes_of("abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmnhijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu"),
+         "cf5b16a778af8380036ce59e7b0492370b249b11e8f07a51afac45037afee9d1",
+         "8e959b75dae313da8cf4f72814fc143f8f7779c6eb9f7fa17299aeadb6889018501d289e4900f7e4331b99dec4b5433ac7d329eeb6dd26545e96e55b874be909"},
+      {encryptBuffer(1000000, 'a'),
+         "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0",
+         "e718483d0ce769644e2e42c7bc15b4638e1f98b13b2044285632a803afa973ebde0ff244877ea60a4cb0432ce577c31beb009c5c2c49aa2e4eadb217ad8cc09b"},
+   };
+   for (const auto& answer : answers)
+   {
+      check_hasher(luaosutils::create_sha256_hasher, answer.message, answer.sha256);
+      check_hasher(luaosutils::create_sha512_hasher, answer.message, answer.sha512);
+   }
+}
+
+static void test_blake3()
+{
+   const std::pair<size_t, const char*> answers[] = {
+      {0, "af1349b9f5f9a1a6a0404dea36dcc9499bcb25c9adc112b7cc9a93cae41f3262"},
+      {1, "2d3adedff11b61f14c886e35afa036736dcd87a74d27b5c1510225d0f592e213"},
+      {63, "e9bc37a594daad83be9470df7f7b3798297c3d834ce80ba85d6e207627b7db7b"},
+      {64, "4eed7141ea4a5cd4b788606bd23f46e212af9cacebacdc7d1f4c6dc7f2511b98"},
+      {65, "de1e5fa0be70df6d2be8fffd0e99ceaa8eb6e8c93a63f2d8d1c30ecb6b263dee"},
+      {1023, "10108970eeda3eb932baac1428c7a2163b0e924c9a9e25b35bba72b28f70bd11"},
+      {1024, "42214739f095a406f3fc83deb889744ac00df831c10daa55189b5d121c855af7"},
+      {1025, "d00278ae47eb27b34faecf67b4fe263f82d5412916c1ffd97c8cb7fb814b8444"},
+      {2048, "e776b6028c7cd22a4d0ba182a8bf62205d2ef576467e838ed6f2529b85fba24a"},
+      {2049, "5f4d72f40d7a5f82b15ca2b2e44b1de3c2ef86c426c95c1af0b6879522563030"},
+      {3072, "b98cb0ff3623be03326b373de6b9095218513e64f1ee2edd2525c7ad1e5cffd2"},
+      {3073, "7124b49501012f81cc7f11ca069ec9226cecb8a2c850cfe644e327d22d3e1cd3"},
+      {4096, "015094013f57a5277b59d8475c0501042c0b642e531b0a1c8f58d2163229e969"},
+      {4097, "9b4052b38f1c5fc8b1f9ff7ac7b27cd242487b3d890d15c96a1c25b8aa0fb995"},
+      {5120, "9cadc15fed8b5d854562b26a9536d9707cadeda9b143978f319ab34230535833"},
+      {5121, "628bd2cb2004694adaab7bbd778a25df25c47b9d4155a55f8fbd79f2fe154cff"},
+      {6144, "3e2e5b74e048f3add6d21faab3f83aa44d3b2278afb83b80b3c35164ebeca205"},
+      {6145, "f1323a8631446cc50536a9f705ee5cb619424d46887f3c376c695b70e0f0507f"},
+      {7168, "61da957ec2499a95d6b8023e2b0e604ec7f6b50e80a9678b89d2628e99ada77a"},
+      {7169, "a003fc7a51754a9b3c7fae0367ab3d782dccf28855a03d435f8cfe74605e7817"},
+      {8192, "aae792484c8efe4f19e2ca7d371d8c467ffb10748d8a5a1ae579948f718a2a63"},
+      {8193, "bab6c09cb8ce8cf459261398d2e7aef35700bf488116ceb94a36d0f5f1b7bc3b"},
+      {16384, "f875d6646de28985646f34ee13be9a576fd515f76b5b0a26bb324735041ddde4"},
+      {31744, "62b6960e1a44bcc1eb1a611a8d6235b6b4b78f32e7abc4fb4c6cdcce94895c47"},
+      {102400, "bc3e3d41a1146b069abffad3c0d44860cf664390afce4d9661f7902e7943e085"},
+   };
+   for (const auto& answer : answers)
+      check_hasher(luaosutils::create_blake3_hasher, blake3_input(answer.first), answer.second);
+}
+
+int main()
+{
+   test_sha2();
+   test_blake3();
+   return test_result();
+}
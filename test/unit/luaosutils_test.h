@@ -0,0 +1,41 @@
+//
+//  luaosutils_test.h
+//  luaosutils
+//
+//  (Usage permitted by MIT License. See LICENSE file in this repository.)
+//
+//  The checks the unit tests use. Each test is a plain executable run by ctest: a failed check prints its
+//  file, line and expression, and main returns test_result(), which fails the test if any check failed.
+//
+
+#ifndef luaosutils_test_h
+#define luaosutils_test_h
+
+#include <cstdio>
+
+inline int& test_failures()
+{
+   static int failures = 0;
+   return failures;
+}
+
+inline bool test_check(bool passed, const char* expression, const char* file, int line)
+{
+   if (! passed)
+   {
+      std::fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expression);
+      test_failures()++;
+   }
+   return passed;
+}
+
+inline int test_result()
+{
+   if (test_failures())
+      std::fprintf(stderr, "%d check(s) failed\n", test_failures());
+   return test_failures() ? 1 : 0;
+}
+
+#define CHECK(expression) test_check(static_cast<bool>(expression), #expression, __FILE__, __LINE__)
+
+#endif /* luaosutils_test_h */